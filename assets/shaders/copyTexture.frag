@@ -0,0 +1,11 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D source;
+uniform float targetSize;
+uniform float lod;      // log2 of the downscale, keeps the copy from aliasing
+
+void main()
+{
+    FragColor = textureLod(source, gl_FragCoord.xy / targetSize, lod);
+}
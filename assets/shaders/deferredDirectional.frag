@@ -0,0 +1,90 @@
+#version 330 core
+out vec4 FragColor;
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform sampler2D gAlbedoMetal;
+uniform sampler2D gNormalRoughness;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+uniform mat4 view;
+
+uniform DirLight dirLight;
+
+// directional light shadow cascades, layer i of the array is cascade i
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeViewProjection[4];
+uniform vec4 cascadeSplits;         // far view depth of each cascade
+uniform vec4 cascadeTexelSizes;     // world units per shadow texel
+uniform int cascadeCount;           // 0 with shadows off
+
+vec3 OctDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Fraction of the directional light reaching fragPos
+float CalcShadow(vec3 fragPos, vec3 normal, float viewDepth)
+{
+    if (cascadeCount == 0 || viewDepth > cascadeSplits[cascadeCount - 1])
+        return 1.0;
+
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    // Normal offset scaled to the cascade's texel size against acne
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec4 lightPos = cascadeViewProjection[cascade] * vec4(offsetPos, 1.0);
+    vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+
+    // 3x3 taps of the hardware 2x2 comparison filter
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(cascade), min(coords.z, 1.0)));
+    return lit / 9.0;
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    vec4 albedoMetal = texture(gAlbedoMetal, uv);
+    vec4 normalRoughness = texture(gNormalRoughness, uv);
+
+    vec4 worldPos = inverseViewProjection * vec4(vec3(uv, texture(gDepth, uv).r) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+
+    vec3 normal = OctDecode(normalRoughness.xy);
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 albedo = albedoMetal.rgb;
+    float metallic = albedoMetal.a;
+    float roughness = max(normalRoughness.z, 0.05);
+    float shininess = 2.0 / (roughness * roughness) - 2.0;
+
+    vec3 lightDir = normalize(-dirLight.direction);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    vec3 specularColor = mix(vec3(1.0), albedo, metallic) * normalRoughness.w;
+    vec3 ambient  = dirLight.ambient * albedo;
+    vec3 diffuse  = dirLight.diffuse * diff * albedo * (1.0 - metallic);
+    vec3 specular = dirLight.specular * spec * specularColor;
+    float shadow = CalcShadow(fragPos, normal, -(view * vec4(fragPos, 1.0)).z);
+    FragColor = vec4(ambient + shadow * (diffuse + specular), 1.0);
+}
@@ -0,0 +1,119 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D gAlbedoMetal;
+uniform sampler2D gNormalRoughness;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 screenSize;
+uniform vec3 viewPos;
+
+// point light cube shadows, faces packed 3x2 into a shared atlas
+uniform sampler2DShadow pointShadowAtlas;
+uniform samplerBuffer pointShadowTiles;  // per shadow: (atlas offset.xy, face size, near plane)
+
+flat in vec4 LightPositionRadius;
+flat in vec3 LightColor;
+flat in int LightShadow;
+
+vec3 OctDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Cube face orientation, must match PointShadowFaces in point_shadows.h
+const vec3 FACE_FORWARD[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+                                     vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 FACE_UP[6] = vec3[6](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0),
+                                vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+
+// Fraction of a point light reaching fragPos, shadow is the light's shadow index + 1
+float CalcPointShadow(vec3 fragPos, vec3 normal, vec3 lightPos, float radius, int shadow)
+{
+    if (shadow == 0)
+        return 1.0;
+
+    vec4 tile = texelFetch(pointShadowTiles, shadow - 1);
+    float faceSize = tile.z;
+    float near = tile.w;
+
+    // Normal offset of about one and a half face texels at this distance
+    vec3 toFrag = fragPos - lightPos;
+    vec3 d = toFrag + normal * (3.0 * length(toFrag) / faceSize);
+
+    vec3 a = abs(d);
+    int face = a.x >= a.y && a.x >= a.z ? (d.x > 0.0 ? 0 : 1)
+             : a.y >= a.z ? (d.y > 0.0 ? 2 : 3)
+             : (d.z > 0.0 ? 4 : 5);
+    vec3 forward = FACE_FORWARD[face];
+    vec3 up = FACE_UP[face];
+    float ma = dot(d, forward);
+
+    // Same projection as the face's 90 degree perspective matrix
+    vec2 ndc = vec2(dot(d, cross(forward, up)), dot(d, up)) / ma;
+    float depth = ((radius + near) / (radius - near) - 2.0 * radius * near / ((radius - near) * ma)) * 0.5 + 0.5;
+
+    vec2 origin = tile.xy + vec2(face % 3, face / 3) * faceSize;
+    vec2 texel = (ndc * 0.5 + 0.5) * faceSize;
+    vec2 atlasSize = vec2(textureSize(pointShadowAtlas, 0));
+
+    // 2x2 taps of the hardware comparison filter, kept inside the face
+    float lit = 0.0;
+    for (int x = 0; x < 2; x++)
+        for (int y = 0; y < 2; y++)
+        {
+            vec2 tap = clamp(texel + vec2(x, y) - 0.5, vec2(1.0), vec2(faceSize - 1.0));
+            lit += texture(pointShadowAtlas, vec3((origin + tap) / atlasSize, min(depth, 1.0)));
+        }
+    return lit * 0.25;
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    float depth = texture(gDepth, uv).r;
+    if (depth >= 1.0)
+        discard;
+
+    vec4 worldPos = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+
+    vec3 lightPos = LightPositionRadius.xyz;
+    float radius = LightPositionRadius.w;
+    float distance = length(lightPos - fragPos);
+    if (distance >= radius)
+        discard;
+
+    vec4 albedoMetal = texture(gAlbedoMetal, uv);
+    vec4 normalRoughness = texture(gNormalRoughness, uv);
+
+    vec3 normal = OctDecode(normalRoughness.xy);
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 albedo = albedoMetal.rgb;
+    float metallic = albedoMetal.a;
+    float roughness = max(normalRoughness.z, 0.05);
+    float shininess = 2.0 / (roughness * roughness) - 2.0;
+
+    vec3 lightDir = (lightPos - fragPos) / distance;
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+
+    // same falloff as the forward path
+    float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+    float window = clamp(1.0 - pow(distance / radius, 4.0), 0.0, 1.0);
+    attenuation *= window * window;
+    // The G-buffer has no receive flag, every opaque surface receives
+    float shadow = CalcPointShadow(fragPos, normal, lightPos, radius, LightShadow);
+
+    vec3 specularColor = mix(vec3(1.0), albedo, metallic) * normalRoughness.w;
+    vec3 ambient  = 0.1 * LightColor * albedo;
+    vec3 diffuse  = LightColor * diff * albedo * (1.0 - metallic) * shadow;
+    vec3 specular = LightColor * spec * specularColor * shadow;
+    FragColor = vec4((ambient + diffuse + specular) * attenuation, 1.0);
+}
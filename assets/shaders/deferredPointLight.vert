@@ -0,0 +1,20 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aLightPositionRadius;   // per instance
+layout (location = 2) in vec4 aLightColor;            // per instance
+
+uniform mat4 viewProjection;
+
+flat out vec4 LightPositionRadius;
+flat out vec3 LightColor;
+flat out int LightShadow;     // point shadow index + 1, 0 without one
+
+void main()
+{
+    LightPositionRadius = aLightPositionRadius;
+    LightColor = aLightColor.rgb;
+    LightShadow = int(aLightColor.w);
+
+    vec3 worldPos = aLightPositionRadius.xyz + aPos * aLightPositionRadius.w;
+    gl_Position = viewProjection * vec4(worldPos, 1.0);
+}
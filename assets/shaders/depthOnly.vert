@@ -0,0 +1,32 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+#ifdef MERGED_DRAWS
+// merged draws from the geometry pool, the model matrix is fetched by draw
+// ID the same way as modelShader.vert's MATERIAL_TABLE path
+layout (location = 3) in uint aDrawID;
+uniform samplerBuffer drawTransforms;   // 7 texels per draw: model matrix, normal matrix
+#else
+uniform mat4 model;
+#endif
+
+// Must match modelShader.vert exactly so the color pass can test with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+#ifdef MERGED_DRAWS
+    int base = int(aDrawID) * 7;
+    mat4 model = mat4(texelFetch(drawTransforms, base),
+                      texelFetch(drawTransforms, base + 1),
+                      texelFetch(drawTransforms, base + 2),
+                      texelFetch(drawTransforms, base + 3));
+#endif
+
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    vec4 viewPos = view * vec4(FragPos, 1.0);
+    gl_Position = projection * viewPos;
+}
@@ -0,0 +1,9 @@
+#version 330 core
+
+// Full screen triangle from gl_VertexID, placed on the far plane so a
+// GL_GREATER depth test keeps only pixels covered by geometry
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 1.0, 1.0);
+}
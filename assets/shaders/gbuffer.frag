@@ -0,0 +1,35 @@
+#version 330 core
+layout (location = 0) out vec4 gAlbedoMetal;
+layout (location = 1) out vec4 gNormalRoughness;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;    // white without a map
+    vec3 diffuse;                   // used without a diffuse map
+    bool hasDiffuseMap;
+    float roughness;
+    float metallic;
+};
+
+uniform Material material;
+
+in vec3 Normal;
+in vec2 TexCoords;
+
+// Octahedral mapping of a unit vector to [0,1]^2
+vec2 OctEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signs;
+    return e * 0.5 + 0.5;
+}
+
+void main()
+{
+    vec3 albedo = material.hasDiffuseMap ? texture(material.texture_diffuse1, TexCoords).rgb : material.diffuse;
+    float specular = texture(material.texture_specular1, TexCoords).r;
+
+    gAlbedoMetal = vec4(albedo, material.metallic);
+    gNormalRoughness = vec4(OctEncode(normalize(Normal)), material.roughness, specular);
+}
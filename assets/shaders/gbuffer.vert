@@ -0,0 +1,31 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;    // octahedral in .xy for quantized meshes
+layout (location = 2) in vec2 aTexCoords;
+
+uniform mat4 model;     // includes the position decode of quantized meshes
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 normalMatrix;
+uniform bool octNormals;
+
+out vec3 Normal;
+out vec2 TexCoords;
+
+// Inverse of the octahedral mapping GPUResourceManager::OctEncode
+vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
+void main()
+{
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = mat3(normalMatrix) * (octNormals ? OctDecode(aNormal.xy) : aNormal);
+    TexCoords = aTexCoords;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -1,10 +1,20 @@
-#version 330 core
-out vec4 FragColor;
+#version 410 core
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float Revealage;  // weighted blended pass only
 
+// HAS_DIFFUSE_MAP, HAS_SPECULAR_MAP and HAS_NORMAL_MAP select which
+// textures are sampled, POINT_LIGHT_LIMIT bounds the cluster loop and is
+// left undefined when no cluster has a light, see ShaderFeatures
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
-    float shininess;
+    sampler2D texture_normal1;
+    vec3 diffuse;       // used without a diffuse map
+    float roughness;
+    float opacity;
 };
 
 struct DirLight {
@@ -17,14 +27,9 @@ struct DirLight {
 
 struct PointLight {    
     vec3 position;
-    
-    float constant;
-    float linear;
-    float quadratic;  
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
+    float radius;
+    vec3 color;
+    int shadow;     // point shadow index + 1, 0 without one
 }; 
 
 struct SpotLight {
@@ -42,39 +47,262 @@ struct SpotLight {
     vec3 specular;       
 };
   
+#ifdef MATERIAL_TABLE
+// merged draws: 2 texels per MaterialID, (diffuse ref, specular ref) and
+// (normal ref, unorm8 color and opacity, unorm16 roughness << 16 | feature bits), see MaterialTable
+uniform usamplerBuffer materialTable;
+#ifndef BINDLESS_TEXTURES
+uniform sampler2DArray materialArrays[3];   // layers of 512, 1024 and 2048 texels
+#endif
+flat in uint MaterialIndex;
+flat in uint ReceiveShadows;
+#else
 uniform Material material;
+uniform bool receiveShadows;
+#endif
 uniform vec3 viewPos;
 // lights uniforms
 uniform DirLight dirLight;
-#define NR_POINT_LIGHTS 4  
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLight;
+
+// clustered point lights: two texels per light, (position, radius) and (color, shadow index + 1)
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterGrid;          // (offset, count) per cluster
+uniform usamplerBuffer clusterLightIndices;
+uniform uvec3 clusterDims;
+uniform vec2 clusterTileSize;
+uniform float clusterZScale;
+uniform float clusterZBias;
+
+// directional light shadow cascades, layer i of the array is cascade i
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeViewProjection[4];
+uniform vec4 cascadeSplits;         // far view depth of each cascade
+uniform vec4 cascadeTexelSizes;     // world units per shadow texel
+uniform int cascadeCount;           // 0 with shadows off
+uniform bool weightedBlended;       // transparent pass, accumulate instead of writing color
+
+// point light cube shadows, faces packed 3x2 into a shared atlas
+uniform sampler2DShadow pointShadowAtlas;
+uniform samplerBuffer pointShadowTiles;  // per shadow: (atlas offset.xy, face size, near plane)
+
 //funcs prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
 in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
+in float ViewDepth;
+
+// surface inputs of the lighting functions, sampled once in main
+vec3 Albedo;
+vec3 SpecularColor;
+float Shininess;
+bool ReceivesShadows;
+
+// Tangent frame from screen space derivatives, meshes carry no tangents.
+// Normal maps are two channel (BC5), z is rebuilt from the unit length.
+vec3 PerturbNormal(vec3 normal, vec2 mapNormal)
+{
+    vec3 dp1 = dFdx(FragPos);
+    vec3 dp2 = dFdy(FragPos);
+    vec2 duv1 = dFdx(TexCoords);
+    vec2 duv2 = dFdy(TexCoords);
+
+    vec3 dp2perp = cross(dp2, normal);
+    vec3 dp1perp = cross(normal, dp1);
+    vec3 tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+    vec3 bitangent = dp2perp * duv1.y + dp1perp * duv2.y;
+    float invmax = inversesqrt(max(max(dot(tangent, tangent), dot(bitangent, bitangent)), 1e-20));
+    vec2 xy = mapNormal * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+    return normalize(mat3(tangent * invmax, bitangent * invmax, normal) * tangentNormal);
+}
+
+#ifdef MATERIAL_TABLE
+// ref is a bindless handle or (array, layer), gradients come from outside
+// the branches so every array samples with the same footprint
+vec4 SampleMaterialTexture(uvec2 ref, vec2 dx, vec2 dy)
+{
+#ifdef BINDLESS_TEXTURES
+    return textureGrad(sampler2D(ref), TexCoords, dx, dy);
+#else
+    vec3 coords = vec3(TexCoords, float(ref.y));
+    if (ref.x == 0u)
+        return textureGrad(materialArrays[0], coords, dx, dy);
+    if (ref.x == 1u)
+        return textureGrad(materialArrays[1], coords, dx, dy);
+    return textureGrad(materialArrays[2], coords, dx, dy);
+#endif
+}
+#endif
+
+PointLight FetchPointLight(uint index)
+{
+    vec4 positionRadius = texelFetch(lightData, int(index) * 2);
+    vec4 color = texelFetch(lightData, int(index) * 2 + 1);
+
+    PointLight light;
+    light.position = positionRadius.xyz;
+    light.radius = positionRadius.w;
+    light.color = color.rgb;
+    light.shadow = int(color.w);
+    return light;
+}
+
+// Fraction of the directional light reaching fragPos
+float CalcShadow(vec3 fragPos, vec3 normal, float viewDepth)
+{
+    if (cascadeCount == 0 || viewDepth > cascadeSplits[cascadeCount - 1])
+        return 1.0;
+
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    // Normal offset scaled to the cascade's texel size against acne
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec4 lightPos = cascadeViewProjection[cascade] * vec4(offsetPos, 1.0);
+    vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+
+    // 3x3 taps of the hardware 2x2 comparison filter
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(cascade), min(coords.z, 1.0)));
+    return lit / 9.0;
+}
+
+// Cube face orientation, must match PointShadowFaces in point_shadows.h
+const vec3 FACE_FORWARD[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+                                     vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 FACE_UP[6] = vec3[6](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0),
+                                vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+
+// Fraction of a point light reaching fragPos, shadow is the light's shadow index + 1
+float CalcPointShadow(vec3 fragPos, vec3 normal, vec3 lightPos, float radius, int shadow)
+{
+    if (shadow == 0)
+        return 1.0;
+
+    vec4 tile = texelFetch(pointShadowTiles, shadow - 1);
+    float faceSize = tile.z;
+    float near = tile.w;
+
+    // Normal offset of about one and a half face texels at this distance
+    vec3 toFrag = fragPos - lightPos;
+    vec3 d = toFrag + normal * (3.0 * length(toFrag) / faceSize);
+
+    vec3 a = abs(d);
+    int face = a.x >= a.y && a.x >= a.z ? (d.x > 0.0 ? 0 : 1)
+             : a.y >= a.z ? (d.y > 0.0 ? 2 : 3)
+             : (d.z > 0.0 ? 4 : 5);
+    vec3 forward = FACE_FORWARD[face];
+    vec3 up = FACE_UP[face];
+    float ma = dot(d, forward);
+
+    // Same projection as the face's 90 degree perspective matrix
+    vec2 ndc = vec2(dot(d, cross(forward, up)), dot(d, up)) / ma;
+    float depth = ((radius + near) / (radius - near) - 2.0 * radius * near / ((radius - near) * ma)) * 0.5 + 0.5;
+
+    vec2 origin = tile.xy + vec2(face % 3, face / 3) * faceSize;
+    vec2 texel = (ndc * 0.5 + 0.5) * faceSize;
+    vec2 atlasSize = vec2(textureSize(pointShadowAtlas, 0));
+
+    // 2x2 taps of the hardware comparison filter, kept inside the face
+    float lit = 0.0;
+    for (int x = 0; x < 2; x++)
+        for (int y = 0; y < 2; y++)
+        {
+            vec2 tap = clamp(texel + vec2(x, y) - 0.5, vec2(1.0), vec2(faceSize - 1.0));
+            lit += texture(pointShadowAtlas, vec3((origin + tap) / atlasSize, min(depth, 1.0)));
+        }
+    return lit * 0.25;
+}
+
+uint ClusterIndex()
+{
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterTileSize), clusterDims.xy - 1u);
+    float slice = log(max(ViewDepth, 1e-4)) * clusterZScale - clusterZBias;
+    uint z = uint(clamp(slice, 0.0, float(clusterDims.z - 1u)));
+    return (z * clusterDims.y + tile.y) * clusterDims.x + tile.x;
+}
 
 void main()
 {   
+    vec4 albedo;
+    float opacity;
+    float roughness;
     vec3 norm = normalize(Normal);
+#ifdef MATERIAL_TABLE
+    // one shader for every material, the feature bits branch per draw
+    uvec4 refs = texelFetch(materialTable, int(MaterialIndex) * 2);
+    uvec4 params = texelFetch(materialTable, int(MaterialIndex) * 2 + 1);
+    uint features = params.w & 0xFFFFu;
+    vec4 color = unpackUnorm4x8(params.z);
+    vec2 dx = dFdx(TexCoords);
+    vec2 dy = dFdy(TexCoords);
+    albedo = (features & 1u) != 0u ? SampleMaterialTexture(refs.xy, dx, dy) : vec4(color.rgb, 1.0);
+    SpecularColor = SampleMaterialTexture(refs.zw, dx, dy).rgb;     // white without a map
+    if ((features & 4u) != 0u)
+        norm = PerturbNormal(norm, SampleMaterialTexture(params.xy, dx, dy).rg);
+    roughness = float(params.w >> 16) / 65535.0;
+    opacity = color.a;
+    ReceivesShadows = ReceiveShadows != 0u;
+#else
+#ifdef HAS_DIFFUSE_MAP
+    albedo = texture(material.texture_diffuse1, TexCoords);
+#else
+    albedo = vec4(material.diffuse, 1.0);
+#endif
+#ifdef HAS_SPECULAR_MAP
+    SpecularColor = texture(material.texture_specular1, TexCoords).rgb;
+#else
+    SpecularColor = vec3(1.0);
+#endif
+#ifdef HAS_NORMAL_MAP
+    norm = PerturbNormal(norm, texture(material.texture_normal1, TexCoords).rg);
+#endif
+    roughness = material.roughness;
+    opacity = material.opacity;
+    ReceivesShadows = receiveShadows;
+#endif
+    Albedo = albedo.rgb;
+    // same roughness to exponent mapping as the deferred lighting
+    roughness = max(roughness, 0.05);
+    Shininess = 2.0 / (roughness * roughness) - 2.0;
+
     vec3 viewDir = normalize(viewPos - FragPos);
 
     // phase 1: Directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
-    // phase 2: Point lights
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
+    float shadow = ReceivesShadows ? CalcShadow(FragPos, norm, ViewDepth) : 1.0;
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, shadow);
+#ifdef POINT_LIGHT_LIMIT
+    // phase 2: Point lights of this fragment's cluster
+    uvec2 cluster = texelFetch(clusterGrid, int(ClusterIndex())).xy;
+    uint lightCount = min(cluster.y, POINT_LIGHT_LIMIT);
+    for(uint i = 0u; i < lightCount; i++)
+        result += CalcPointLight(FetchPointLight(texelFetch(clusterLightIndices, int(cluster.x + i)).r), norm, FragPos, viewDir);    
+#endif
     // phase 3: Spot light
     //result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
     
-    FragColor = vec4(result, 1.0);
+    if (weightedBlended)
+    {
+        // Depth weight from McGuire and Bavoil, closer surfaces dominate the average
+        float alpha = albedo.a * opacity;
+        float weight = clamp(10.0 / (1e-5 + pow(ViewDepth / 5.0, 2.0) + pow(ViewDepth / 200.0, 6.0)), 1e-2, 3e3);
+        FragColor = vec4(result * alpha, alpha) * alpha * weight;
+        Revealage = alpha;
+    }
+    else
+        FragColor = vec4(result, 1.0);
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     
     vec3 lightDir = normalize(-light.direction);
@@ -82,12 +310,12 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), Shininess);
     // combine results
-    vec3 ambient  = light.ambient  * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 ambient  = light.ambient  * Albedo;
+    vec3 diffuse  = light.diffuse  * diff * Albedo;
+    vec3 specular = light.specular * spec * SpecularColor;
+    return (ambient + shadow * (diffuse + specular));
 }
 
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
@@ -97,18 +325,20 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    // attenuation
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), Shininess);
+    // attenuation, windowed to reach zero at the light radius
     float distance    = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + 
-  			     light.quadratic * (distance * distance));    
+    float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+    float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+    attenuation *= window * window;
+    float shadow = ReceivesShadows ? CalcPointShadow(fragPos, normal, light.position, light.radius, light.shadow) : 1.0;
     // combine results
-    vec3 ambient  = light.ambient  * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+    vec3 ambient  = 0.1 * light.color * Albedo;
+    vec3 diffuse  = light.color * diff * Albedo;
+    vec3 specular = light.color * spec * SpecularColor;
     ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
+    diffuse  *= attenuation * shadow;
+    specular *= attenuation * shadow;
     return (ambient + diffuse + specular);
 }
 
@@ -120,7 +350,7 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), Shininess);
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
@@ -129,9 +359,9 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
+    vec3 ambient = light.ambient * Albedo;
+    vec3 diffuse = light.diffuse * diff * Albedo;
+    vec3 specular = light.specular * spec * SpecularColor;
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
@@ -1,28 +1,71 @@
-#version 330 core
+#version 410 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec3 aNormal;    // octahedral in .xy for quantized meshes
 layout (location = 2) in vec2 aTexCoords;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+
+#ifdef MATERIAL_TABLE
+// merged draws: per draw data is fetched by draw ID, an instanced attribute
+// under multi-draw indirect or a constant attribute value otherwise
+layout (location = 3) in uint aDrawID;
+uniform samplerBuffer drawTransforms;   // 7 texels per draw: model matrix, normal matrix
+uniform usamplerBuffer drawInfos;       // MaterialID, receiveShadows
+
+flat out uint MaterialIndex;
+flat out uint ReceiveShadows;
+#else
+uniform mat4 model;        // includes the position decode of quantized meshes
 uniform mat4 normalMatrix;  // For proper normal transformation
+uniform bool octNormals;
+#endif
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
+out float ViewDepth;    // Positive view space depth, selects the light cluster slice
+
+// Must match depthOnly.vert exactly for the GL_EQUAL depth test after a pre-pass
+invariant gl_Position;
+
+// Inverse of the octahedral mapping GPUResourceManager::OctEncode
+vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 void main()
 {
-    //FragPos = vec3(model * vec4(aPos, 1.0));       
-    //Normal = mat3(transpose(inverse(model))) * aNormal;
-    //TexCoords = aTexCoords;
-    
-    //gl_Position = projection * view * vec4(FragPos, 1.0);
+#ifdef MATERIAL_TABLE
+    int base = int(aDrawID) * 7;
+    mat4 model = mat4(texelFetch(drawTransforms, base),
+                      texelFetch(drawTransforms, base + 1),
+                      texelFetch(drawTransforms, base + 2),
+                      texelFetch(drawTransforms, base + 3));
+    mat3 normalMatrix = mat3(texelFetch(drawTransforms, base + 4).xyz,
+                             texelFetch(drawTransforms, base + 5).xyz,
+                             texelFetch(drawTransforms, base + 6).xyz);
+
+    uvec4 info = texelFetch(drawInfos, int(aDrawID));
+    MaterialIndex = info.x;
+    ReceiveShadows = info.y;
+#endif
 
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(normalMatrix) * aNormal;  // Transform normals properly
+#ifdef MATERIAL_TABLE
+    vec3 normal = aNormal;      // the geometry pool stores float vertices
+#else
+    vec3 normal = octNormals ? OctDecode(aNormal.xy) : aNormal;
+#endif
+    Normal = mat3(normalMatrix) * normal;  // Transform normals properly
     TexCoords = aTexCoords;
+
+    vec4 viewPos = view * vec4(FragPos, 1.0);
+    ViewDepth = -viewPos.z;
     
-    gl_Position = projection * view * vec4(FragPos, 1.0);
-} 
\ No newline at end of file
+    gl_Position = projection * viewPos;
+}
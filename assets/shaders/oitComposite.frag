@@ -0,0 +1,17 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D accumulation;   // sum of weighted premultiplied color, weighted alpha
+uniform sampler2D revealage;      // product of (1 - alpha)
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float reveal = texelFetch(revealage, texel, 0).r;
+    if (reveal >= 1.0)
+        discard;    // no transparent surface here
+
+    vec4 accum = texelFetch(accumulation, texel, 0);
+    vec3 average = accum.rgb / clamp(accum.a, 1e-4, 5e4);
+    FragColor = vec4(average, reveal);
+}
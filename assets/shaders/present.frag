@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D sceneColor;
+
+void main()
+{
+    FragColor = vec4(texelFetch(sceneColor, ivec2(gl_FragCoord.xy), 0).rgb, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+layout (location = 0) out uint Visibility;
+
+uniform uint drawID;
+
+// Must match VisibilityRenderer::TRIANGLE_ID_BITS
+const uint TRIANGLE_ID_BITS = 19u;
+
+void main()
+{
+    // drawID + 1 so that 0 marks pixels without geometry
+    Visibility = ((drawID + 1u) << TRIANGLE_ID_BITS) | uint(gl_PrimitiveID);
+}
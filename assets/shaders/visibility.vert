@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 viewProjection;
+uniform samplerBuffer drawTransforms;   // 7 texels per draw: model matrix, normal matrix
+uniform uint drawID;
+
+void main()
+{
+    int base = int(drawID) * 7;
+    mat4 model = mat4(texelFetch(drawTransforms, base),
+                      texelFetch(drawTransforms, base + 1),
+                      texelFetch(drawTransforms, base + 2),
+                      texelFetch(drawTransforms, base + 3));
+
+    gl_Position = viewProjection * (model * vec4(aPos, 1.0));
+}
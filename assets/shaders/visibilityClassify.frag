@@ -0,0 +1,19 @@
+#version 330 core
+
+uniform usampler2D visibilityBuffer;
+uniform usamplerBuffer drawInfos;   // firstIndex, baseVertex, materialSlot, unused
+uniform float materialSlotScale;
+
+const uint TRIANGLE_ID_BITS = 19u;
+
+// Writes the pixel's material slot as depth for the per-material resolve
+void main()
+{
+    uint visibility = texelFetch(visibilityBuffer, ivec2(gl_FragCoord.xy), 0).r;
+    if (visibility == 0u)
+        discard;
+
+    uint drawID = (visibility >> TRIANGLE_ID_BITS) - 1u;
+    uint materialSlot = texelFetch(drawInfos, int(drawID)).z;
+    gl_FragDepth = float(materialSlot) * materialSlotScale;
+}
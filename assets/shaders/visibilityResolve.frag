@@ -0,0 +1,277 @@
+#version 330 core
+out vec4 FragColor;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;    // white without a map
+    vec3 diffuse;                   // used without a diffuse map
+    bool hasDiffuseMap;
+    float roughness;
+};
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    float radius;
+    vec3 color;
+    int shadow;     // point shadow index + 1, 0 without one
+};
+
+uniform Material material;
+uniform DirLight dirLight;
+uniform vec3 viewPos;
+uniform mat4 view;
+uniform mat4 viewProjection;
+uniform vec2 screenSize;
+
+// visibility buffer and programmable vertex fetch
+uniform usampler2D visibilityBuffer;
+uniform samplerBuffer vertexData;       // 2 texels per vertex: (position, normal.x), (normal.yz, uv)
+uniform usamplerBuffer indexData;
+uniform samplerBuffer drawTransforms;   // 7 texels per draw: model matrix, normal matrix
+uniform usamplerBuffer drawInfos;       // firstIndex, baseVertex, materialSlot, receiveShadows
+
+// clustered point lights, see modelShader.frag
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+uniform uvec3 clusterDims;
+uniform vec2 clusterTileSize;
+uniform float clusterZScale;
+uniform float clusterZBias;
+
+// directional light shadow cascades, layer i of the array is cascade i
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeViewProjection[4];
+uniform vec4 cascadeSplits;         // far view depth of each cascade
+uniform vec4 cascadeTexelSizes;     // world units per shadow texel
+uniform int cascadeCount;           // 0 with shadows off
+
+// point light cube shadows, faces packed 3x2 into a shared atlas
+uniform sampler2DShadow pointShadowAtlas;
+uniform samplerBuffer pointShadowTiles;  // per shadow: (atlas offset.xy, face size, near plane)
+
+const uint TRIANGLE_ID_BITS = 19u;
+
+struct Barycentrics {
+    vec3 lambda;
+    vec3 ddx;
+    vec3 ddy;
+};
+
+// Perspective correct barycentrics of a pixel and their screen space
+// derivatives from the clip space corners of its triangle
+Barycentrics ComputeBarycentrics(vec4 p0, vec4 p1, vec4 p2, vec2 pixelNdc)
+{
+    Barycentrics result;
+
+    vec3 invW = 1.0 / vec3(p0.w, p1.w, p2.w);
+    vec2 ndc0 = p0.xy * invW.x;
+    vec2 ndc1 = p1.xy * invW.y;
+    vec2 ndc2 = p2.xy * invW.z;
+
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float ddxSum = dot(ddx, vec3(1.0));
+    float ddySum = dot(ddy, vec3(1.0));
+
+    vec2 delta = pixelNdc - ndc0;
+    float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+    float interpW = 1.0 / interpInvW;
+
+    result.lambda = interpW * (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy);
+
+    // One pixel steps in NDC
+    ddx *= 2.0 / screenSize.x;
+    ddy *= 2.0 / screenSize.y;
+    ddxSum *= 2.0 / screenSize.x;
+    ddySum *= 2.0 / screenSize.y;
+
+    float interpWdx = 1.0 / (interpInvW + ddxSum);
+    float interpWdy = 1.0 / (interpInvW + ddySum);
+    result.ddx = interpWdx * (result.lambda * interpInvW + ddx) - result.lambda;
+    result.ddy = interpWdy * (result.lambda * interpInvW + ddy) - result.lambda;
+    return result;
+}
+
+PointLight FetchPointLight(uint index)
+{
+    vec4 positionRadius = texelFetch(lightData, int(index) * 2);
+    vec4 color = texelFetch(lightData, int(index) * 2 + 1);
+
+    PointLight light;
+    light.position = positionRadius.xyz;
+    light.radius = positionRadius.w;
+    light.color = color.rgb;
+    light.shadow = int(color.w);
+    return light;
+}
+
+// Fraction of the directional light reaching fragPos
+float CalcShadow(vec3 fragPos, vec3 normal, float viewDepth)
+{
+    if (cascadeCount == 0 || viewDepth > cascadeSplits[cascadeCount - 1])
+        return 1.0;
+
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    // Normal offset scaled to the cascade's texel size against acne
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec4 lightPos = cascadeViewProjection[cascade] * vec4(offsetPos, 1.0);
+    vec3 coords = lightPos.xyz / lightPos.w * 0.5 + 0.5;
+
+    // 3x3 taps of the hardware 2x2 comparison filter
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(cascade), min(coords.z, 1.0)));
+    return lit / 9.0;
+}
+
+// Cube face orientation, must match PointShadowFaces in point_shadows.h
+const vec3 FACE_FORWARD[6] = vec3[6](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+                                     vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 FACE_UP[6] = vec3[6](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0),
+                                vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+
+// Fraction of a point light reaching fragPos, shadow is the light's shadow index + 1
+float CalcPointShadow(vec3 fragPos, vec3 normal, vec3 lightPos, float radius, int shadow)
+{
+    if (shadow == 0)
+        return 1.0;
+
+    vec4 tile = texelFetch(pointShadowTiles, shadow - 1);
+    float faceSize = tile.z;
+    float near = tile.w;
+
+    // Normal offset of about one and a half face texels at this distance
+    vec3 toFrag = fragPos - lightPos;
+    vec3 d = toFrag + normal * (3.0 * length(toFrag) / faceSize);
+
+    vec3 a = abs(d);
+    int face = a.x >= a.y && a.x >= a.z ? (d.x > 0.0 ? 0 : 1)
+             : a.y >= a.z ? (d.y > 0.0 ? 2 : 3)
+             : (d.z > 0.0 ? 4 : 5);
+    vec3 forward = FACE_FORWARD[face];
+    vec3 up = FACE_UP[face];
+    float ma = dot(d, forward);
+
+    // Same projection as the face's 90 degree perspective matrix
+    vec2 ndc = vec2(dot(d, cross(forward, up)), dot(d, up)) / ma;
+    float depth = ((radius + near) / (radius - near) - 2.0 * radius * near / ((radius - near) * ma)) * 0.5 + 0.5;
+
+    vec2 origin = tile.xy + vec2(face % 3, face / 3) * faceSize;
+    vec2 texel = (ndc * 0.5 + 0.5) * faceSize;
+    vec2 atlasSize = vec2(textureSize(pointShadowAtlas, 0));
+
+    // 2x2 taps of the hardware comparison filter, kept inside the face
+    float lit = 0.0;
+    for (int x = 0; x < 2; x++)
+        for (int y = 0; y < 2; y++)
+        {
+            vec2 tap = clamp(texel + vec2(x, y) - 0.5, vec2(1.0), vec2(faceSize - 1.0));
+            lit += texture(pointShadowAtlas, vec3((origin + tap) / atlasSize, min(depth, 1.0)));
+        }
+    return lit * 0.25;
+}
+
+uint ClusterIndex(float viewDepth)
+{
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterTileSize), clusterDims.xy - 1u);
+    float slice = log(max(viewDepth, 1e-4)) * clusterZScale - clusterZBias;
+    uint z = uint(clamp(slice, 0.0, float(clusterDims.z - 1u)));
+    return (z * clusterDims.y + tile.y) * clusterDims.x + tile.x;
+}
+
+void main()
+{
+    uint visibility = texelFetch(visibilityBuffer, ivec2(gl_FragCoord.xy), 0).r;
+    uint drawID = (visibility >> TRIANGLE_ID_BITS) - 1u;
+    uint triangleID = visibility & ((1u << TRIANGLE_ID_BITS) - 1u);
+
+    uvec4 drawInfo = texelFetch(drawInfos, int(drawID));
+    int base = int(drawID) * 7;
+    mat4 model = mat4(texelFetch(drawTransforms, base),
+                      texelFetch(drawTransforms, base + 1),
+                      texelFetch(drawTransforms, base + 2),
+                      texelFetch(drawTransforms, base + 3));
+    mat3 normalMatrix = mat3(texelFetch(drawTransforms, base + 4).xyz,
+                             texelFetch(drawTransforms, base + 5).xyz,
+                             texelFetch(drawTransforms, base + 6).xyz);
+
+    // Fetch and transform the triangle
+    vec3 worldPos[3];
+    vec4 clipPos[3];
+    vec3 normals[3];
+    vec2 uvs[3];
+    for (int i = 0; i < 3; i++)
+    {
+        uint index = texelFetch(indexData, int(drawInfo.x + triangleID * 3u) + i).r + drawInfo.y;
+        vec4 texel0 = texelFetch(vertexData, int(index) * 2);
+        vec4 texel1 = texelFetch(vertexData, int(index) * 2 + 1);
+
+        worldPos[i] = vec3(model * vec4(texel0.xyz, 1.0));
+        clipPos[i] = viewProjection * vec4(worldPos[i], 1.0);
+        normals[i] = vec3(texel0.w, texel1.xy);
+        uvs[i] = texel1.zw;
+    }
+
+    vec2 pixelNdc = gl_FragCoord.xy / screenSize * 2.0 - 1.0;
+    Barycentrics bary = ComputeBarycentrics(clipPos[0], clipPos[1], clipPos[2], pixelNdc);
+
+    vec3 FragPos = bary.lambda.x * worldPos[0] + bary.lambda.y * worldPos[1] + bary.lambda.z * worldPos[2];
+    vec3 norm = normalize(normalMatrix * (bary.lambda.x * normals[0] + bary.lambda.y * normals[1] + bary.lambda.z * normals[2]));
+
+    vec2 TexCoords = bary.lambda.x * uvs[0] + bary.lambda.y * uvs[1] + bary.lambda.z * uvs[2];
+    vec2 uvDx = bary.ddx.x * uvs[0] + bary.ddx.y * uvs[1] + bary.ddx.z * uvs[2];
+    vec2 uvDy = bary.ddy.x * uvs[0] + bary.ddy.y * uvs[1] + bary.ddy.z * uvs[2];
+
+    vec3 albedo = material.hasDiffuseMap ? textureGrad(material.texture_diffuse1, TexCoords, uvDx, uvDy).rgb : material.diffuse;
+    vec3 specularMap = textureGrad(material.texture_specular1, TexCoords, uvDx, uvDy).rgb;
+
+    // same roughness to exponent mapping as the forward and deferred lighting
+    float roughness = max(material.roughness, 0.05);
+    float shininess = 2.0 / (roughness * roughness) - 2.0;
+    vec3 viewDir = normalize(viewPos - FragPos);
+
+    // Directional light
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    float shadow = drawInfo.w != 0u ? CalcShadow(FragPos, norm, viewDepth) : 1.0;
+    vec3 lightDir = normalize(-dirLight.direction);
+    float diff = max(dot(norm, lightDir), 0.0);
+    float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), shininess);
+    vec3 result = dirLight.ambient * albedo + shadow * (dirLight.diffuse * diff * albedo + dirLight.specular * spec * specularMap);
+
+    // Point lights of this pixel's cluster
+    uvec2 cluster = texelFetch(clusterGrid, int(ClusterIndex(viewDepth))).xy;
+    for (uint i = 0u; i < cluster.y; i++)
+    {
+        PointLight light = FetchPointLight(texelFetch(clusterLightIndices, int(cluster.x + i)).r);
+
+        vec3 toLight = light.position - FragPos;
+        float distance = length(toLight);
+        lightDir = toLight / distance;
+        diff = max(dot(norm, lightDir), 0.0);
+        spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), shininess);
+
+        float attenuation = 1.0 / (1.0 + 0.09 * distance + 0.032 * (distance * distance));
+        float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+        attenuation *= window * window;
+        float pointShadow = drawInfo.w != 0u ? CalcPointShadow(FragPos, norm, light.position, light.radius, light.shadow) : 1.0;
+
+        result += (0.1 * light.color * albedo + pointShadow * (light.color * diff * albedo + light.color * spec * specularMap)) * attenuation;
+    }
+
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+
+uniform uint materialSlot;
+uniform float materialSlotScale;
+
+// Full screen triangle at the material slot depth, GL_EQUAL keeps the
+// pixels classified to this material
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    float depth = float(materialSlot) * materialSlotScale;
+    gl_Position = vec4(position * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+}
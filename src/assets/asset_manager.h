@@ -3,6 +3,10 @@
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
 
 //#define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -12,6 +16,12 @@
 #include <assimp/postprocess.h>
 
 #include "defines.h"
+#include "job_system.h"
+#include "assets/mesh_simplifier.h"
+#include "assets/mesh_optimizer.h"
+#include "assets/meshlet_builder.h"
+#include "assets/block_compression.h"
+#include "assets/ktx2.h"
 
 struct Vertex {
     glm::vec3 Position;
@@ -46,17 +56,25 @@ struct MeshData{
     glm::vec3 boundsMax{0.0f};
     glm::vec3 boundsCenter{0.0f};
     f32 boundsRadius = 0.0f;
+
+    // Geometric error against the imported mesh, 0 for source meshes
+    f32 lodError = 0.0f;
+
+    // Clusters covering indices in order, empty for meshes drawn whole
+    std::vector<Meshlet> meshlets;
 };
 
 struct TextureData{
     std::string path;
     std::string type;
 
-    // Image data (before GPU upload)
-    unsigned char* data = nullptr;
+    // Full mip chain, level 0 first, rows tightly packed. Kept after
+    // upload, the renderer streams levels in and out of VRAM from here.
+    std::vector<std::vector<u8>> mips;
+    TextureFormat format = TextureFormat::RGBA8;
     int width = 0;
     int height = 0;
-    int channels = 0;
+    int channels = 0;   // stored by the format
 
     // GPU resource ID (set by renderer)
     u32 glTextureID = 0;
@@ -72,6 +90,11 @@ struct Material{
     f32 roughness = 0.5f;
     f32 ao = 1.0f;
 
+    // Blended with weighted blended OIT instead of written opaque, the
+    // diffuse texture alpha is multiplied in
+    f32 opacity = 1.0f;
+    bool alphaBlend = false;
+
     // Texture references
     TextureID albedoTexture = INVALID_TEXTURE;
     TextureID normalTexture = INVALID_TEXTURE;
@@ -84,20 +107,54 @@ struct Material{
     TextureID specularTexture = INVALID_TEXTURE;
 };
 
+// Lower detail version of a model
+struct ModelLOD{
+    std::vector<MeshID> meshes;
+
+    // Used once the bounding sphere covers less than this fraction of the
+    // screen height (hand authored LODs)
+    f32 screenSize = 0.0f;
+
+    // Geometric error in model units, when > 0 the threshold is derived from
+    // the allowed on-screen error instead of screenSize
+    f32 error = 0.0f;
+};
+
 struct ModelAsset{
     std::string path;
     std::string name;
     std::vector<MeshID> meshes;
     std::vector<MaterialID> materials;
 
+    // Lower detail levels, lods[0] is LOD 1. LOD 0 is always meshes.
+    std::vector<ModelLOD> lods;
+
     // Model-wide bounding info
     glm::vec3 boundsMin{0.0f};
     glm::vec3 boundsMax{0.0f};
     glm::vec3 boundsCenter{0.0f};
     f32 boundsRadius = 0.0f;
+
+    // UV units per model unit, area weighted over the meshes, picks the
+    // texture mip levels to stream. 0 without texture coordinates.
+    f32 uvDensity = 0.0f;
+
+    u32 GetLODCount() const { return 1 + static_cast<u32>(lods.size()); }
+
+    const std::vector<MeshID>& GetLODMeshes(u32 lod) const {
+        if(lod == 0 || lods.empty()) return meshes;
+        return lods[std::min<size_t>(lod, lods.size()) - 1].meshes;
+    }
 };
 
 // Asset loading stats
+// Vertex cache efficiency of one imported mesh around the optimization stage
+struct MeshOptimizeReport{
+    std::string name;
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
 struct AssetStats{
     u32 texturesLoaded = 0;
     u32 materialsCreated = 0;
@@ -105,11 +162,46 @@ struct AssetStats{
     u32 modelsLoaded = 0;
     u32 totalVertices = 0;
     u32 totalTriangles = 0;
+    u32 lodMeshesGenerated = 0;
+    u32 lodTriangles = 0;
+    u32 meshletsBuilt = 0;
+    u32 texturesCompressed = 0;    // block compressed, cooked now or earlier
+    u32 texturesFromCache = 0;     // cooked KTX2 reused
     size_t memoryUsed = 0; // Bytes
+
+    // One entry per imported mesh, LOD meshes are optimized but not reported
+    std::vector<MeshOptimizeReport> meshOptimization;
+};
+
+// Options applied to every model and texture loaded after they are set
+struct ModelImportSettings{
+    // Simplified LOD chain generated per mesh, as fractions of the source triangle count
+    bool generateLODs = true;
+    std::vector<f32> lodTriangleRatios{0.5f, 0.25f, 0.125f, 0.0625f};
+
+    // Meshes below this are left alone, and a LOD level that removes less than
+    // minLODReduction of the previous level's triangles is dropped
+    u32 minLODSourceTriangles = 256;
+    f32 minLODReduction = 0.1f;
+
+    SimplifySettings simplify;
+
+    // Triangle and vertex reordering of every imported and LOD mesh
+    MeshOptimizeSettings optimize;
+
+    // Cluster culling data, built after the reordering of each mesh
+    MeshletSettings meshlets;
+
+    // Block compression of every texture not loaded from a KTX2 file
+    TextureCompressionSettings textures;
 };
 
 class AssetManager{
 private:
+    static constexpr const char* TEXTURE_CACHE_DIRECTORY = "texture_cache/";
+    // Part of every cooked texture's key, bump when the encoder's output changes
+    static constexpr u32 TEXTURE_COOK_VERSION = 1;
+
     // Asset storage
     std::vector<TextureData> m_textures;
     std::vector<Material> m_materials;
@@ -130,11 +222,16 @@ private:
     // Loading statistics
     AssetStats m_stats;
 
+    ModelImportSettings m_importSettings;
+
+    // Optional, spreads import work such as LOD generation over workers
+    JobSystem* m_jobSystem;
+
     // Assimp importer (reused for efficiency)
     Assimp::Importer m_importer;
 
 public:
-    AssetManager(){
+    AssetManager(JobSystem* jobSystem = nullptr): m_jobSystem(jobSystem){
         // Reserve space for common asset counts
         m_textures.reserve(1024);
         m_materials.reserve(256);
@@ -142,13 +239,6 @@ public:
         m_models.reserve(128);
     }
 
-    ~AssetManager(){
-        // Free texture data
-        for(auto& texture: m_textures){
-            if(texture.data) stbi_image_free(texture.data);
-        }
-    }
-
     // Model Loading
     ModelAssetID LoadModel(const std::string& path){
         // Check if already loaded
@@ -190,6 +280,8 @@ public:
         // Calculate model bound
         CalculateModelBounds(model);
         //printf("MODEL BOUNDS CALCULATED \n");
+        // Build simplified LODs
+        GenerateLODs(modelID);
         // Cache the loaded model
         m_modelPathMap[path] = modelID;
         m_stats.modelsLoaded++;
@@ -197,6 +289,38 @@ public:
         return modelID;
     }
 
+    // Attach a lower detail model file as the next LOD of an already loaded
+    // model. Only the geometry is used, the entity keeps its material.
+    bool LoadModelLOD(ModelAssetID modelID, const std::string& path, f32 screenSize){
+        if(modelID == INVALID_MODEL || modelID >= m_models.size()) return false;
+
+        const aiScene* scene = m_importer.ReadFile(path,
+            aiProcess_Triangulate | aiProcess_FlipUVs | 
+            aiProcess_CalcTangentSpace| aiProcess_GenNormals 
+        );
+
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode){
+            return false;
+        }
+
+        ModelAsset lodModel;
+        ProcessNode(scene->mRootNode, scene, lodModel);
+        if(lodModel.meshes.empty()) return false;
+
+        ModelLOD lod;
+        lod.meshes = std::move(lodModel.meshes);
+        lod.screenSize = screenSize;
+
+        // Keep LODs ordered from most to least detailed
+        ModelAsset& model = m_models[modelID];
+        model.lods.push_back(std::move(lod));
+        std::sort(model.lods.begin(), model.lods.end(), [](const ModelLOD& a, const ModelLOD& b){
+            return a.screenSize > b.screenSize;
+        });
+
+        return true;
+    }
+
     // Texture loading
     TextureID LoadTexture(const std::string& path, const std::string& type = "diffuse"){
         auto it = m_texturePathMap.find(path);
@@ -211,17 +335,21 @@ public:
         texture.path = path;
         texture.type = type;
 
-        // Load Image data (CPU side)
-        texture.data = stbi_load(path.c_str(), &texture.width, &texture.height, &texture.channels, 0);
-        if(!texture.data){
+        // KTX2 files are taken as they are, anything else is decoded and cooked
+        bool loaded = path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0
+            ? KTX2::Read(path, texture.format, texture.width, texture.height, texture.mips)
+            : CookTexture(path, texture);
+        if(!loaded){
             // Log error, return invalid
             return INVALID_TEXTURE;
         }
+        texture.channels = static_cast<int>(BlockCompressor::GetChannels(texture.format));
 
         // Cache and update stats
         m_texturePathMap[path] = textureID;
         m_stats.texturesLoaded++;
-        m_stats.memoryUsed += texture.width * texture.height * texture.channels;
+        if(BlockCompressor::IsCompressed(texture.format)) m_stats.texturesCompressed++;
+        for(const std::vector<u8>& mip: texture.mips) m_stats.memoryUsed += mip.size();
 
         return textureID;
     }
@@ -256,6 +384,13 @@ public:
     const Material* GetMaterial(MaterialID id) const {
         return (id > 0 && id < m_materials.size()) ? &m_materials[id] : nullptr;
     }
+
+    Material* GetMaterial(MaterialID id) {
+        return (id > 0 && id < m_materials.size()) ? &m_materials[id] : nullptr;
+    }
+
+    // Material IDs are dense, valid ones are 1 to GetMaterialCount() - 1
+    u32 GetMaterialCount() const { return static_cast<u32>(m_materials.size()); }
     
     const TextureData* GetTexture(TextureID id) const {
         return (id > 0 && id < m_textures.size()) ? &m_textures[id] : nullptr;
@@ -269,6 +404,9 @@ public:
     // Statistics
     const AssetStats& GetStats() const { return m_stats; }
 
+    // Import configuration
+    ModelImportSettings& GetImportSettings() { return m_importSettings; }
+
     // Resource management
     void UnloadModel(ModelAssetID id) {
         // Implementation: Mark as unused, cleanup if no references
@@ -298,6 +436,12 @@ private:
             if (aiMat->Get(AI_MATKEY_SHININESS, shininess) == AI_SUCCESS) {
                 material.roughness = 1.0f - (shininess / 128.0f);  // Convert to roughness
             }
+
+            float opacity;
+            if (aiMat->Get(AI_MATKEY_OPACITY, opacity) == AI_SUCCESS) {
+                material.opacity = opacity;
+                material.alphaBlend = opacity < 1.0f;
+            }
             
             // Load textures
             material.diffuseTexture = LoadMaterialTextures(aiMat, aiTextureType_DIFFUSE, directory);
@@ -372,6 +516,9 @@ private:
             }
         }
 
+        // Source order rarely suits the vertex cache
+        OptimizeMesh(mesh);
+
         // Calculate mesh bounds
         CalculateMeshBounds(mesh);
         
@@ -381,10 +528,167 @@ private:
         m_stats.totalTriangles += static_cast<u32>(mesh.indices.size() / 3);
         m_stats.memoryUsed += mesh.vertices.size() * sizeof(Vertex);
         m_stats.memoryUsed += mesh.indices.size() * sizeof(uint32_t);
+        m_stats.memoryUsed += mesh.meshlets.size() * sizeof(Meshlet);
         
         return meshID;
     }
 
+    // Reorders the mesh and records the cache stats before and after
+    void OptimizeMesh(MeshData& mesh){
+        const MeshOptimizeSettings& settings = m_importSettings.optimize;
+
+        MeshOptimizeReport report;
+        report.name = mesh.name;
+        report.before = MeshOptimizer::AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), settings.cacheSize);
+
+        ReorderMesh(mesh);
+
+        report.after = MeshOptimizer::AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), settings.cacheSize);
+        m_stats.meshOptimization.push_back(std::move(report));
+        m_stats.meshletsBuilt += static_cast<u32>(mesh.meshlets.size());
+    }
+
+    // Triangles for the vertex cache and overdraw, then grouped into meshlets,
+    // then vertices for fetch locality, which leaves the meshlet ranges valid
+    void ReorderMesh(MeshData& mesh) const {
+        const MeshOptimizeSettings& optimize = m_importSettings.optimize;
+        const MeshletSettings& meshlets = m_importSettings.meshlets;
+        const f32* positions = reinterpret_cast<const f32*>(mesh.vertices.data());
+        const u32 strideFloats = sizeof(Vertex) / sizeof(f32);
+
+        MeshOptimizer::OptimizeTriangles(mesh.indices, positions, mesh.vertices.size(), strideFloats, optimize);
+        if(meshlets.enabled && mesh.indices.size() / 3 >= meshlets.minTriangles){
+            mesh.meshlets = MeshletBuilder::Build(mesh.indices, positions, mesh.vertices.size(), strideFloats, meshlets);
+        }
+        if(optimize.vertexFetch) MeshOptimizer::OptimizeVertexFetch(mesh.vertices, mesh.indices);
+    }
+
+    // Builds a simplified LOD chain for every mesh of the model, one job per mesh
+    void GenerateLODs(ModelAssetID modelID){
+        const ModelImportSettings& settings = m_importSettings;
+        if(!settings.generateLODs || settings.lodTriangleRatios.empty()) return;
+
+        const std::vector<MeshID> sourceMeshes = m_models[modelID].meshes;
+        std::vector<std::vector<MeshData>> chains(sourceMeshes.size());
+
+        // Workers only read m_meshes, new meshes are stored once all are done
+        auto buildChain = [this, &sourceMeshes, &chains](size_t meshIndex){
+            chains[meshIndex] = BuildLODChain(m_meshes[sourceMeshes[meshIndex]]);
+        };
+
+        if(m_jobSystem){
+            JobCounter counter;
+            for(size_t i = 0; i < sourceMeshes.size(); i++){
+                m_jobSystem->Submit([&buildChain, i](){ buildChain(i); }, &counter);
+            }
+            m_jobSystem->Wait(counter);
+        } else {
+            for(size_t i = 0; i < sourceMeshes.size(); i++){
+                buildChain(i);
+            }
+        }
+
+        // Assemble model LODs, meshes that could not be reduced further reuse
+        // the previous level
+        std::vector<MeshID> previousMeshes = sourceMeshes;
+        u32 previousTriangles = 0;
+        for(MeshID meshID: sourceMeshes){
+            previousTriangles += static_cast<u32>(m_meshes[meshID].indices.size() / 3);
+        }
+
+        for(size_t level = 0; level < settings.lodTriangleRatios.size(); level++){
+            ModelLOD lod;
+            u32 triangles = 0;
+
+            for(size_t i = 0; i < sourceMeshes.size(); i++){
+                MeshID meshID = previousMeshes[i];
+                if(level < chains[i].size() && !chains[i][level].indices.empty()){
+                    meshID = StoreLODMesh(std::move(chains[i][level]));
+                }
+
+                lod.meshes.push_back(meshID);
+                lod.error = std::max(lod.error, m_meshes[meshID].lodError);
+                triangles += static_cast<u32>(m_meshes[meshID].indices.size() / 3);
+            }
+
+            if(triangles > previousTriangles * (1.0f - settings.minLODReduction)) break;
+
+            // A lossless level still has to be selectable
+            lod.error = std::max(lod.error, 1e-6f * m_models[modelID].boundsRadius);
+
+            previousMeshes = lod.meshes;
+            previousTriangles = triangles;
+            m_models[modelID].lods.push_back(std::move(lod));
+        }
+    }
+
+    // Simplifies each level from the previous one. Levels that did not get
+    // smaller are left empty.
+    std::vector<MeshData> BuildLODChain(const MeshData& source) const {
+        const ModelImportSettings& settings = m_importSettings;
+        std::vector<MeshData> chain(settings.lodTriangleRatios.size());
+
+        size_t sourceIndexCount = source.indices.size();
+        if(sourceIndexCount / 3 < settings.minLODSourceTriangles) return chain;
+
+        const MeshData* previous = &source;
+        for(size_t level = 0; level < chain.size(); level++){
+            size_t targetIndexCount = static_cast<size_t>(sourceIndexCount * settings.lodTriangleRatios[level]) / 3 * 3;
+
+            SimplifyResult simplified = MeshSimplifier::Simplify(
+                reinterpret_cast<const f32*>(previous->vertices.data()), previous->vertices.size(),
+                MeshSimplifier::VertexLayout{}, previous->indices, targetIndexCount, settings.simplify);
+
+            if(simplified.indices.empty() || simplified.indices.size() >= previous->indices.size()) break;
+
+            // Keep only referenced vertices, in first use order
+            MeshData& lodMesh = chain[level];
+            lodMesh.name = source.name + "_LOD" + std::to_string(level + 1);
+            lodMesh.lodError = previous->lodError + simplified.error;
+
+            std::vector<u32> vertexRemap(previous->vertices.size(), ~0u);
+            lodMesh.indices.reserve(simplified.indices.size());
+            for(u32 index: simplified.indices){
+                if(vertexRemap[index] == ~0u){
+                    vertexRemap[index] = static_cast<u32>(lodMesh.vertices.size());
+                    lodMesh.vertices.push_back(previous->vertices[index]);
+                }
+                lodMesh.indices.push_back(vertexRemap[index]);
+            }
+
+            // Collapses scatter the source order, reorder like an imported mesh
+            ReorderMesh(lodMesh);
+
+            lodMesh.boundsMin = source.boundsMin;
+            lodMesh.boundsMax = source.boundsMax;
+            lodMesh.boundsCenter = source.boundsCenter;
+            lodMesh.boundsRadius = source.boundsRadius;
+
+            previous = &lodMesh;
+        }
+
+        return chain;
+    }
+
+    MeshID StoreLODMesh(MeshData&& lodMesh){
+        MeshID meshID = m_nextMeshID++;
+        if (meshID >= m_meshes.size()) {
+            m_meshes.resize(meshID + 1);
+        }
+
+        MeshData& mesh = m_meshes[meshID];
+        mesh = std::move(lodMesh);
+
+        m_stats.lodMeshesGenerated++;
+        m_stats.lodTriangles += static_cast<u32>(mesh.indices.size() / 3);
+        m_stats.meshletsBuilt += static_cast<u32>(mesh.meshlets.size());
+        m_stats.memoryUsed += mesh.vertices.size() * sizeof(Vertex);
+        m_stats.memoryUsed += mesh.indices.size() * sizeof(uint32_t);
+        m_stats.memoryUsed += mesh.meshlets.size() * sizeof(Meshlet);
+
+        return meshID;
+    }
+
     TextureID LoadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& directory) {
         if (mat->GetTextureCount(type) == 0) {
             return INVALID_TEXTURE;
@@ -444,6 +748,157 @@ private:
         
         model.boundsCenter = (model.boundsMin + model.boundsMax) * 0.5f;
         model.boundsRadius = glm::distance(model.boundsCenter, model.boundsMax);
+
+        // Both areas doubled, the ratio is what counts
+        f32 uvArea = 0.0f;
+        f32 area = 0.0f;
+        for (MeshID meshID : model.meshes) {
+            const MeshData& mesh = m_meshes[meshID];
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                const Vertex& v0 = mesh.vertices[mesh.indices[i]];
+                const Vertex& v1 = mesh.vertices[mesh.indices[i + 1]];
+                const Vertex& v2 = mesh.vertices[mesh.indices[i + 2]];
+                glm::vec2 uv1 = v1.TexCoords - v0.TexCoords;
+                glm::vec2 uv2 = v2.TexCoords - v0.TexCoords;
+                uvArea += std::abs(uv1.x * uv2.y - uv1.y * uv2.x);
+                area += glm::length(glm::cross(v1.Position - v0.Position, v2.Position - v0.Position));
+            }
+        }
+        model.uvDensity = area > 0.0f ? std::sqrt(uvArea / area) : 0.0f;
+    }
+
+    // Decodes the image, builds its mip chain and block compresses every
+    // level. The result is kept as KTX2 under a key of the source's path,
+    // size and modification time, so later runs skip all of it.
+    bool CookTexture(const std::string& path, TextureData& texture){
+        const TextureCompressionSettings& settings = m_importSettings.textures;
+        std::string cachePath = settings.enabled && settings.cache ? GetCookedTexturePath(path, texture.type) : "";
+        if(!cachePath.empty() && KTX2::Read(cachePath, texture.format, texture.width, texture.height, texture.mips)){
+            m_stats.texturesFromCache++;
+            return true;
+        }
+
+        // Gray and alpha has no GL format of its own, it's expanded to RGBA
+        int channels = 0;
+        if(!stbi_info(path.c_str(), &texture.width, &texture.height, &channels)) return false;
+        int requested = channels == 2 ? 4 : 0;
+        unsigned char* pixels = stbi_load(path.c_str(), &texture.width, &texture.height, &texture.channels, requested);
+        if(!pixels) return false;
+        if(requested) texture.channels = requested;
+        BuildMipChain(pixels, texture);
+        stbi_image_free(pixels);
+
+        if(!settings.enabled || !SelectCompressedFormat(texture, settings, texture.format)){
+            return BlockCompressor::GetUncompressedFormat(texture.channels, texture.format);
+        }
+
+        for(size_t level = 0; level < texture.mips.size(); level++){
+            texture.mips[level] = BlockCompressor::Compress(texture.mips[level].data(),
+                                                            std::max(texture.width >> level, 1),
+                                                            std::max(texture.height >> level, 1),
+                                                            texture.channels, texture.format, m_jobSystem);
+        }
+
+        if(!cachePath.empty()){
+            std::error_code error;
+            std::filesystem::create_directories(TEXTURE_CACHE_DIRECTORY, error);
+            KTX2::Write(cachePath, texture.format, texture.width, texture.height, texture.mips);
+        }
+        return true;
+    }
+
+    // Normal maps keep x and y in BC5 and rebuild z in the shader, single
+    // channels go to BC4. Color takes BC1 unless its alpha is used, then
+    // BC7, or BC3 without BPTC. False when the driver has no fitting format.
+    static bool SelectCompressedFormat(const TextureData& texture, const TextureCompressionSettings& settings,
+                                       TextureFormat& format){
+        if(texture.type == "normal" && texture.channels >= 3){
+            format = TextureFormat::BC5;
+            return true;
+        }
+        if(texture.channels == 1){
+            format = TextureFormat::BC4;
+            return true;
+        }
+
+        bool alpha = false;
+        if(texture.channels == 4){
+            const std::vector<u8>& pixels = texture.mips[0];
+            for(size_t i = 3; i < pixels.size() && !alpha; i += 4) alpha = pixels[i] != 255;
+        }
+
+        if(!alpha && settings.s3tc){
+            format = TextureFormat::BC1;
+        } else if(settings.bptc){
+            format = TextureFormat::BC7;
+        } else if(settings.s3tc){
+            format = TextureFormat::BC3;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Empty when the source can't be stat'ed, the texture is then cooked every time
+    std::string GetCookedTexturePath(const std::string& path, const std::string& type) const {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if(error) return "";
+        auto modified = std::filesystem::last_write_time(path, error);
+        if(error) return "";
+
+        const TextureCompressionSettings& settings = m_importSettings.textures;
+        std::string key = path + '\x1f' + type + '\x1f' + std::to_string(size) + '\x1f' +
+                          std::to_string(modified.time_since_epoch().count()) + '\x1f' +
+                          std::to_string(settings.s3tc) + std::to_string(settings.bptc) +
+                          std::to_string(TEXTURE_COOK_VERSION);
+
+        // FNV-1a, 64 bit
+        u64 hash = 14695981039346656037ull;
+        for(unsigned char c: key){
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.ktx2", static_cast<unsigned long long>(hash));
+        return std::string(TEXTURE_CACHE_DIRECTORY) + name;
+    }
+
+    // 2x2 box filtered levels down to 1x1, odd edges clamp like glGenerateMipmap's
+    static void BuildMipChain(const unsigned char* pixels, TextureData& texture) {
+        const int channels = texture.channels;
+        texture.mips.clear();
+        texture.mips.emplace_back(pixels, pixels + static_cast<size_t>(texture.width) * texture.height * channels);
+
+        int width = texture.width;
+        int height = texture.height;
+        while (width > 1 || height > 1) {
+            int nextWidth = std::max(width / 2, 1);
+            int nextHeight = std::max(height / 2, 1);
+            const std::vector<u8>& source = texture.mips.back();
+            std::vector<u8> level(static_cast<size_t>(nextWidth) * nextHeight * channels);
+
+            for (int y = 0; y < nextHeight; y++) {
+                int y0 = std::min(y * 2, height - 1);
+                int y1 = std::min(y * 2 + 1, height - 1);
+                for (int x = 0; x < nextWidth; x++) {
+                    int x0 = std::min(x * 2, width - 1);
+                    int x1 = std::min(x * 2 + 1, width - 1);
+                    for (int c = 0; c < channels; c++) {
+                        u32 sum = source[(static_cast<size_t>(y0) * width + x0) * channels + c] +
+                                  source[(static_cast<size_t>(y0) * width + x1) * channels + c] +
+                                  source[(static_cast<size_t>(y1) * width + x0) * channels + c] +
+                                  source[(static_cast<size_t>(y1) * width + x1) * channels + c];
+                        level[(static_cast<size_t>(y) * nextWidth + x) * channels + c] = static_cast<u8>((sum + 2) / 4);
+                    }
+                }
+            }
+
+            texture.mips.push_back(std::move(level));
+            width = nextWidth;
+            height = nextHeight;
+        }
     }
 
     std::string ExtractFileName(const std::string& path){
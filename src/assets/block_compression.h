@@ -0,0 +1,449 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "defines.h"
+#include "job_system.h"
+
+// Layout of a texture's levels, in RAM, on disk and in VRAM alike
+enum class TextureFormat : u32{
+    R8,
+    RGB8,
+    RGBA8,
+    BC1,    // RGB, 4 bits per texel
+    BC3,    // RGBA, BC4 style alpha next to BC1 color, 8 bits per texel
+    BC4,    // R, 4 bits per texel
+    BC5,    // RG as two BC4 blocks, 8 bits per texel
+    BC7,    // RGBA, 8 bits per texel
+};
+
+struct TextureCompressionSettings{
+    // Off keeps the decoded texels as they are
+    bool enabled = true;
+
+    // Formats the driver can sample, set once the context exists. BC4 and
+    // BC5 (RGTC) are core since GL 3.0 and always allowed.
+    bool s3tc = false;      // BC1, BC3
+    bool bptc = false;      // BC7
+
+    // Cooked textures are written as KTX2 and loaded from there while the source is unchanged
+    bool cache = true;
+};
+
+// CPU block compression of 4x4 texel blocks. Endpoints start on the
+// principal axis of the block's colors and get one least squares refit on
+// the chosen indices, kept if it lowers the error. BC7 uses mode 6 only:
+// a single RGBA line with 16 steps, which covers everything this renderer
+// loads at a fraction of a full mode search's cost. Blocks past the edge
+// of a level repeat its last row and column.
+class BlockCompressor{
+private:
+    // BC7 4-bit index interpolation weights, out of 64
+    static constexpr u32 BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    // Writes fields into a zeroed block, least significant bit first
+    struct BitWriter{
+        u8* out;
+        u32 position = 0;
+
+        void Write(u32 value, u32 count){
+            for(u32 i = 0; i < count; i++, position++){
+                if((value >> i) & 1) out[position >> 3] |= static_cast<u8>(1u << (position & 7));
+            }
+        }
+    };
+
+public:
+    static bool IsCompressed(TextureFormat format){
+        return format != TextureFormat::R8 && format != TextureFormat::RGB8 && format != TextureFormat::RGBA8;
+    }
+
+    // Bytes per block, or per texel for the uncompressed formats
+    static u32 BlockBytes(TextureFormat format){
+        switch(format){
+        case TextureFormat::R8: return 1;
+        case TextureFormat::RGB8: return 3;
+        case TextureFormat::RGBA8: return 4;
+        case TextureFormat::BC1:
+        case TextureFormat::BC4: return 8;
+        default: return 16;
+        }
+    }
+
+    static u32 GetChannels(TextureFormat format){
+        switch(format){
+        case TextureFormat::R8:
+        case TextureFormat::BC4: return 1;
+        case TextureFormat::BC5: return 2;
+        case TextureFormat::RGB8:
+        case TextureFormat::BC1: return 3;
+        default: return 4;
+        }
+    }
+
+    // Uncompressed format holding channels, false for two channels which stb
+    // means as gray and alpha
+    static bool GetUncompressedFormat(i32 channels, TextureFormat& format){
+        switch(channels){
+        case 1: format = TextureFormat::R8; return true;
+        case 3: format = TextureFormat::RGB8; return true;
+        case 4: format = TextureFormat::RGBA8; return true;
+        default: return false;
+        }
+    }
+
+    static size_t LevelBytes(TextureFormat format, i32 width, i32 height){
+        if(!IsCompressed(format)) return static_cast<size_t>(width) * height * BlockBytes(format);
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+    }
+
+    // Encodes one level of tightly packed 8-bit texels with 1 to 4 channels.
+    // Rows of blocks are spread over the job system's workers when there is one.
+    static std::vector<u8> Compress(const u8* pixels, i32 width, i32 height, i32 channels, TextureFormat format,
+                                    JobSystem* jobSystem){
+        u32 blocksX = static_cast<u32>((width + 3) / 4);
+        u32 blocksY = static_cast<u32>((height + 3) / 4);
+        u32 blockBytes = BlockBytes(format);
+        std::vector<u8> blocks(static_cast<size_t>(blocksX) * blocksY * blockBytes, 0);
+
+        auto encodeRows = [&](u32 begin, u32 end, u32){
+            glm::vec4 texels[16];
+            for(u32 blockY = begin; blockY < end; blockY++){
+                for(u32 blockX = 0; blockX < blocksX; blockX++){
+                    LoadBlock(pixels, width, height, channels, blockX * 4, blockY * 4, texels);
+                    EncodeBlock(format, texels, &blocks[(static_cast<size_t>(blockY) * blocksX + blockX) * blockBytes]);
+                }
+            }
+        };
+
+        if(jobSystem){
+            jobSystem->ParallelFor(blocksY, 4, encodeRows);
+        } else {
+            encodeRows(0, blocksY, 0);
+        }
+        return blocks;
+    }
+
+private:
+    // Gray and gray-alpha sources are spread to RGB like GL's luminance formats
+    static void LoadBlock(const u8* pixels, i32 width, i32 height, i32 channels, u32 x0, u32 y0, glm::vec4* texels){
+        for(u32 i = 0; i < 16; i++){
+            i32 x = std::min(static_cast<i32>(x0 + i % 4), width - 1);
+            i32 y = std::min(static_cast<i32>(y0 + i / 4), height - 1);
+            const u8* texel = pixels + (static_cast<size_t>(y) * width + x) * channels;
+            switch(channels){
+            case 1: texels[i] = glm::vec4(texel[0], texel[0], texel[0], 255.0f); break;
+            case 2: texels[i] = glm::vec4(texel[0], texel[0], texel[0], texel[1]); break;
+            case 3: texels[i] = glm::vec4(texel[0], texel[1], texel[2], 255.0f); break;
+            default: texels[i] = glm::vec4(texel[0], texel[1], texel[2], texel[3]); break;
+            }
+        }
+    }
+
+    static void EncodeBlock(TextureFormat format, const glm::vec4* texels, u8* out){
+        switch(format){
+        case TextureFormat::BC1:
+            EncodeBC1(texels, out);
+            break;
+        case TextureFormat::BC3:
+            EncodeBC4(texels, 3, out);
+            EncodeBC1(texels, out + 8);
+            break;
+        case TextureFormat::BC4:
+            EncodeBC4(texels, 0, out);
+            break;
+        case TextureFormat::BC5:
+            EncodeBC4(texels, 0, out);
+            EncodeBC4(texels, 1, out + 8);
+            break;
+        case TextureFormat::BC7:
+            EncodeBC7(texels, out);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Endpoints at the ends of the texels' spread along their principal
+    // axis, channelMask zeroes the channels that don't count
+    static void PrincipalEndpoints(const glm::vec4* texels, const glm::vec4& channelMask, glm::vec4& first, glm::vec4& last){
+        glm::vec4 mean(0.0f);
+        glm::vec4 low(255.0f), high(0.0f);
+        for(u32 i = 0; i < 16; i++){
+            mean += texels[i];
+            low = glm::min(low, texels[i]);
+            high = glm::max(high, texels[i]);
+        }
+        mean *= channelMask / 16.0f;
+
+        glm::mat4 covariance(0.0f);
+        for(u32 i = 0; i < 16; i++){
+            glm::vec4 offset = texels[i] * channelMask - mean;
+            covariance += glm::outerProduct(offset, offset);
+        }
+
+        // Power iteration from the bounding box diagonal
+        glm::vec4 axis = (high - low) * channelMask;
+        for(u32 iteration = 0; iteration < 8; iteration++){
+            glm::vec4 next = covariance * axis;
+            f32 length = glm::length(next);
+            if(length < 1e-6f) break;
+            axis = next / length;
+        }
+        f32 axisLength = glm::length(axis);
+        if(axisLength < 1e-6f){
+            first = last = mean;
+            return;
+        }
+        axis /= axisLength;
+
+        f32 minT = 0.0f, maxT = 0.0f;
+        for(u32 i = 0; i < 16; i++){
+            f32 t = glm::dot(texels[i] * channelMask - mean, axis);
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        first = glm::clamp(mean + axis * maxT, 0.0f, 255.0f);
+        last = glm::clamp(mean + axis * minT, 0.0f, 255.0f);
+    }
+
+    // Least squares endpoints for fixed interpolation weights, false when
+    // every texel uses the same weight and the fit is undetermined
+    static bool FitEndpoints(const glm::vec4* texels, const f32* weights, glm::vec4& first, glm::vec4& last){
+        f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        glm::vec4 ax(0.0f), bx(0.0f);
+        for(u32 i = 0; i < 16; i++){
+            f32 a = 1.0f - weights[i];
+            f32 b = weights[i];
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            ax += texels[i] * a;
+            bx += texels[i] * b;
+        }
+        f32 determinant = aa * bb - ab * ab;
+        if(std::abs(determinant) < 1e-6f) return false;
+
+        first = glm::clamp((ax * bb - bx * ab) / determinant, 0.0f, 255.0f);
+        last = glm::clamp((bx * aa - ax * ab) / determinant, 0.0f, 255.0f);
+        return true;
+    }
+
+    static f32 Distance(const glm::vec4& a, const glm::vec4& b, const glm::vec4& channelMask){
+        glm::vec4 difference = (a - b) * channelMask;
+        return glm::dot(difference, difference);
+    }
+
+    // BC1: two RGB565 endpoints and 2-bit indices, always the four color mode
+    static void EncodeBC1(const glm::vec4* texels, u8* out){
+        const glm::vec4 rgb(1.0f, 1.0f, 1.0f, 0.0f);
+        glm::vec4 first, last;
+        PrincipalEndpoints(texels, rgb, first, last);
+
+        u16 endpoints[2];
+        u32 indices;
+        f32 error = QuantizeBC1(texels, first, last, endpoints, indices);
+
+        // Refit to the indices, index 2 and 3 sit at a third and two thirds
+        static constexpr f32 weightOf[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+        f32 weights[16];
+        for(u32 i = 0; i < 16; i++) weights[i] = weightOf[(indices >> (i * 2)) & 3];
+        if(FitEndpoints(texels, weights, first, last)){
+            u16 refitEndpoints[2];
+            u32 refitIndices;
+            if(QuantizeBC1(texels, first, last, refitEndpoints, refitIndices) < error){
+                endpoints[0] = refitEndpoints[0];
+                endpoints[1] = refitEndpoints[1];
+                indices = refitIndices;
+            }
+        }
+
+        out[0] = static_cast<u8>(endpoints[0]);
+        out[1] = static_cast<u8>(endpoints[0] >> 8);
+        out[2] = static_cast<u8>(endpoints[1]);
+        out[3] = static_cast<u8>(endpoints[1] >> 8);
+        for(u32 i = 0; i < 4; i++) out[4 + i] = static_cast<u8>(indices >> (i * 8));
+    }
+
+    // Endpoints in the order that selects the four color mode, equal ones
+    // decode the same in either mode
+    static f32 QuantizeBC1(const glm::vec4* texels, const glm::vec4& first, const glm::vec4& last,
+                           u16* endpoints, u32& indices){
+        endpoints[0] = To565(first);
+        endpoints[1] = To565(last);
+        if(endpoints[0] < endpoints[1]) std::swap(endpoints[0], endpoints[1]);
+
+        glm::vec4 palette[4];
+        palette[0] = From565(endpoints[0]);
+        palette[1] = From565(endpoints[1]);
+        palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+        u32 paletteSize = endpoints[0] == endpoints[1] ? 1 : 4;
+
+        const glm::vec4 rgb(1.0f, 1.0f, 1.0f, 0.0f);
+        f32 error = 0.0f;
+        indices = 0;
+        for(u32 i = 0; i < 16; i++){
+            u32 best = 0;
+            f32 bestDistance = Distance(texels[i], palette[0], rgb);
+            for(u32 p = 1; p < paletteSize; p++){
+                f32 distance = Distance(texels[i], palette[p], rgb);
+                if(distance < bestDistance){
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices |= best << (i * 2);
+            error += bestDistance;
+        }
+        return error;
+    }
+
+    static u16 To565(const glm::vec4& color){
+        u32 r = static_cast<u32>(std::lround(color.r * 31.0f / 255.0f));
+        u32 g = static_cast<u32>(std::lround(color.g * 63.0f / 255.0f));
+        u32 b = static_cast<u32>(std::lround(color.b * 31.0f / 255.0f));
+        return static_cast<u16>((r << 11) | (g << 5) | b);
+    }
+
+    static glm::vec4 From565(u16 color){
+        u32 r = (color >> 11) & 31;
+        u32 g = (color >> 5) & 63;
+        u32 b = color & 31;
+        return glm::vec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 0.0f);
+    }
+
+    // BC4: two 8-bit endpoints and 3-bit indices in the eight value mode,
+    // used for the single channel formats and BC3's alpha
+    static void EncodeBC4(const glm::vec4* texels, u32 channel, u8* out){
+        f32 low = 255.0f, high = 0.0f;
+        for(u32 i = 0; i < 16; i++){
+            low = std::min(low, texels[i][channel]);
+            high = std::max(high, texels[i][channel]);
+        }
+        u32 first = static_cast<u32>(std::lround(high));
+        u32 last = static_cast<u32>(std::lround(low));
+
+        // Index 0 and 1 are the endpoints, 2 to 7 step from the first to the last
+        f32 palette[8] = {static_cast<f32>(first), static_cast<f32>(last)};
+        for(u32 step = 1; step < 7; step++){
+            palette[step + 1] = static_cast<f32>(((7 - step) * first + step * last) / 7);
+        }
+
+        out[0] = static_cast<u8>(first);
+        out[1] = static_cast<u8>(last);
+        BitWriter writer{out + 2};
+        for(u32 i = 0; i < 16; i++){
+            u32 best = 0;
+            if(first != last){
+                f32 bestDistance = std::abs(texels[i][channel] - palette[0]);
+                for(u32 p = 1; p < 8; p++){
+                    f32 distance = std::abs(texels[i][channel] - palette[p]);
+                    if(distance < bestDistance){
+                        best = p;
+                        bestDistance = distance;
+                    }
+                }
+            }
+            writer.Write(best, 3);
+        }
+    }
+
+    // BC7 mode 6: RGBA endpoints of 7 bits plus a shared low bit each, and 4-bit indices
+    static void EncodeBC7(const glm::vec4* texels, u8* out){
+        const glm::vec4 rgba(1.0f);
+        glm::vec4 first, last;
+        PrincipalEndpoints(texels, rgba, first, last);
+
+        glm::uvec4 endpoints[2];
+        u32 pBits[2];
+        u8 indices[16];
+        f32 error = QuantizeBC7(texels, first, last, endpoints, pBits, indices);
+
+        f32 weights[16];
+        for(u32 i = 0; i < 16; i++) weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+        if(FitEndpoints(texels, weights, first, last)){
+            glm::uvec4 refitEndpoints[2];
+            u32 refitPBits[2];
+            u8 refitIndices[16];
+            if(QuantizeBC7(texels, first, last, refitEndpoints, refitPBits, refitIndices) < error){
+                std::copy(refitEndpoints, refitEndpoints + 2, endpoints);
+                std::copy(refitPBits, refitPBits + 2, pBits);
+                std::copy(refitIndices, refitIndices + 16, indices);
+            }
+        }
+
+        // The first texel's index has an implied zero top bit, mirror the line if it's set
+        if(indices[0] & 8){
+            std::swap(endpoints[0], endpoints[1]);
+            std::swap(pBits[0], pBits[1]);
+            for(u8& index: indices) index = static_cast<u8>(15 - index);
+        }
+
+        std::fill(out, out + 16, u8(0));
+        BitWriter writer{out};
+        writer.Write(1u << 6, 7);
+        for(u32 channel = 0; channel < 4; channel++){
+            writer.Write(endpoints[0][channel], 7);
+            writer.Write(endpoints[1][channel], 7);
+        }
+        writer.Write(pBits[0], 1);
+        writer.Write(pBits[1], 1);
+        writer.Write(indices[0], 3);
+        for(u32 i = 1; i < 16; i++) writer.Write(indices[i], 4);
+    }
+
+    static f32 QuantizeBC7(const glm::vec4* texels, const glm::vec4& first, const glm::vec4& last,
+                           glm::uvec4* endpoints, u32* pBits, u8* indices){
+        glm::uvec4 expanded[2];
+        QuantizeBC7Endpoint(first, endpoints[0], pBits[0], expanded[0]);
+        QuantizeBC7Endpoint(last, endpoints[1], pBits[1], expanded[1]);
+
+        glm::vec4 palette[16];
+        for(u32 p = 0; p < 16; p++){
+            glm::uvec4 color = ((64u - BC7_WEIGHTS[p]) * expanded[0] + BC7_WEIGHTS[p] * expanded[1] + 32u) >> 6u;
+            palette[p] = glm::vec4(color);
+        }
+
+        const glm::vec4 rgba(1.0f);
+        f32 error = 0.0f;
+        for(u32 i = 0; i < 16; i++){
+            u32 best = 0;
+            f32 bestDistance = Distance(texels[i], palette[0], rgba);
+            for(u32 p = 1; p < 16; p++){
+                f32 distance = Distance(texels[i], palette[p], rgba);
+                if(distance < bestDistance){
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices[i] = static_cast<u8>(best);
+            error += bestDistance;
+        }
+        return error;
+    }
+
+    // 7 bits per channel and the low bit shared by all four, whichever low bit lands closer
+    static void QuantizeBC7Endpoint(const glm::vec4& color, glm::uvec4& endpoint, u32& pBit, glm::uvec4& expanded){
+        f32 bestError = -1.0f;
+        for(u32 p = 0; p < 2; p++){
+            glm::uvec4 quantized;
+            f32 error = 0.0f;
+            for(u32 channel = 0; channel < 4; channel++){
+                f32 value = std::round((color[channel] - p) / 2.0f);
+                quantized[channel] = static_cast<u32>(std::clamp(value, 0.0f, 127.0f));
+                f32 difference = static_cast<f32>(quantized[channel] * 2 + p) - color[channel];
+                error += difference * difference;
+            }
+            if(bestError < 0.0f || error < bestError){
+                bestError = error;
+                endpoint = quantized;
+                pBit = p;
+            }
+        }
+        expanded = endpoint * 2u + glm::uvec4(pBit);
+    }
+};
@@ -0,0 +1,214 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+#include "assets/block_compression.h"
+#include "defines.h"
+
+// Reader and writer of the KTX2 container for 2D textures with a mip chain,
+// no supercompression. Only the formats of TextureFormat are accepted,
+// identified by their Vulkan format. Levels keep this renderer's row order,
+// bottom row first as GL uploads them, which the written files state in
+// their KTXorientation key.
+class KTX2{
+private:
+    static constexpr u8 IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+    struct Header{
+        u8 identifier[12];
+        u32 vkFormat;
+        u32 typeSize;
+        u32 pixelWidth;
+        u32 pixelHeight;
+        u32 pixelDepth;
+        u32 layerCount;
+        u32 faceCount;
+        u32 levelCount;
+        u32 supercompressionScheme;
+
+        u32 dfdByteOffset;
+        u32 dfdByteLength;
+        u32 kvdByteOffset;
+        u32 kvdByteLength;
+        u64 sgdByteOffset;
+        u64 sgdByteLength;
+    };
+
+    struct LevelIndex{
+        u64 byteOffset;
+        u64 byteLength;
+        u64 uncompressedByteLength;
+    };
+
+public:
+    static bool Read(const std::string& path, TextureFormat& format, i32& width, i32& height,
+                     std::vector<std::vector<u8>>& mips){
+        std::ifstream file(path, std::ios::binary);
+        if(!file) return false;
+        std::vector<u8> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        Header header;
+        if(bytes.size() < sizeof(Header)) return false;
+        std::memcpy(&header, bytes.data(), sizeof(Header));
+        if(std::memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0 ||
+           !FromVkFormat(header.vkFormat, format) || header.supercompressionScheme != 0 ||
+           header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 ||
+           header.layerCount > 1 || header.faceCount != 1) return false;
+
+        // Level count 0 asks the loader to generate mips, this one only takes what's stored
+        u32 levelCount = std::max(header.levelCount, 1u);
+        if(bytes.size() < sizeof(Header) + levelCount * sizeof(LevelIndex)) return false;
+
+        width = static_cast<i32>(header.pixelWidth);
+        height = static_cast<i32>(header.pixelHeight);
+        mips.assign(levelCount, {});
+        for(u32 level = 0; level < levelCount; level++){
+            LevelIndex index;
+            std::memcpy(&index, bytes.data() + sizeof(Header) + level * sizeof(LevelIndex), sizeof(LevelIndex));
+
+            size_t expected = BlockCompressor::LevelBytes(format, std::max(width >> level, 1), std::max(height >> level, 1));
+            if(index.byteLength != expected || index.byteOffset > bytes.size() ||
+               bytes.size() - index.byteOffset < index.byteLength) return false;
+            mips[level].assign(bytes.begin() + index.byteOffset, bytes.begin() + index.byteOffset + index.byteLength);
+        }
+        return true;
+    }
+
+    // mips holds level 0 first, each tightly packed
+    static bool Write(const std::string& path, TextureFormat format, i32 width, i32 height,
+                      const std::vector<std::vector<u8>>& mips){
+        if(mips.empty()) return false;
+
+        std::vector<u32> dfd = BuildDFD(format);
+        std::vector<u8> kvd;
+        AddKeyValue(kvd, "KTXorientation", "ru");
+        AddKeyValue(kvd, "KTXwriter", "simple-renderer");
+
+        Header header{};
+        std::memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+        ToVkFormat(format, header.vkFormat);
+        header.typeSize = 1;
+        header.pixelWidth = static_cast<u32>(width);
+        header.pixelHeight = static_cast<u32>(height);
+        header.faceCount = 1;
+        header.levelCount = static_cast<u32>(mips.size());
+
+        size_t offset = sizeof(Header) + mips.size() * sizeof(LevelIndex);
+        header.dfdByteOffset = static_cast<u32>(offset);
+        header.dfdByteLength = static_cast<u32>(dfd.size() * sizeof(u32));
+        offset += header.dfdByteLength;
+        header.kvdByteOffset = static_cast<u32>(offset);
+        header.kvdByteLength = static_cast<u32>(kvd.size());
+        offset += kvd.size();
+
+        // Smallest level first, each aligned to a whole block and to 4 bytes
+        u32 alignment = BlockBytes(format);
+        std::vector<LevelIndex> levels(mips.size());
+        for(size_t level = mips.size(); level-- > 0;){
+            offset = (offset + alignment - 1) / alignment * alignment;
+            levels[level] = {offset, mips[level].size(), mips[level].size()};
+            offset += mips[level].size();
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if(!file) return false;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(LevelIndex));
+        file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size() * sizeof(u32));
+        file.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+
+        size_t position = header.kvdByteOffset + kvd.size();
+        const char padding[16] = {};
+        for(size_t level = mips.size(); level-- > 0;){
+            file.write(padding, levels[level].byteOffset - position);
+            file.write(reinterpret_cast<const char*>(mips[level].data()), mips[level].size());
+            position = levels[level].byteOffset + mips[level].size();
+        }
+        return static_cast<bool>(file);
+    }
+
+private:
+    // Least common multiple of the block or texel size and 4
+    static u32 BlockBytes(TextureFormat format){
+        u32 bytes = BlockCompressor::BlockBytes(format);
+        return bytes % 4 == 0 ? bytes : bytes % 2 == 0 ? bytes * 2 : bytes * 4;
+    }
+
+    static bool ToVkFormat(TextureFormat format, u32& vkFormat){
+        switch(format){
+        case TextureFormat::R8: vkFormat = 9; return true;         // VK_FORMAT_R8_UNORM
+        case TextureFormat::RGB8: vkFormat = 23; return true;      // VK_FORMAT_R8G8B8_UNORM
+        case TextureFormat::RGBA8: vkFormat = 37; return true;     // VK_FORMAT_R8G8B8A8_UNORM
+        case TextureFormat::BC1: vkFormat = 131; return true;      // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+        case TextureFormat::BC3: vkFormat = 137; return true;      // VK_FORMAT_BC3_UNORM_BLOCK
+        case TextureFormat::BC4: vkFormat = 139; return true;      // VK_FORMAT_BC4_UNORM_BLOCK
+        case TextureFormat::BC5: vkFormat = 141; return true;      // VK_FORMAT_BC5_UNORM_BLOCK
+        case TextureFormat::BC7: vkFormat = 145; return true;      // VK_FORMAT_BC7_UNORM_BLOCK
+        }
+        return false;
+    }
+
+    static bool FromVkFormat(u32 vkFormat, TextureFormat& format){
+        for(TextureFormat candidate: {TextureFormat::R8, TextureFormat::RGB8, TextureFormat::RGBA8, TextureFormat::BC1,
+                                      TextureFormat::BC3, TextureFormat::BC4, TextureFormat::BC5, TextureFormat::BC7}){
+            u32 candidateVkFormat = 0;
+            if(ToVkFormat(candidate, candidateVkFormat) && candidateVkFormat == vkFormat){
+                format = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Basic data format descriptor: one block of the Khronos Data Format
+    // spec, with one sample per channel or per BC sub-block
+    static std::vector<u32> BuildDFD(TextureFormat format){
+        struct Sample{ u32 bitOffset, bitLength, channel; };
+        u32 colorModel = 1;     // KHR_DF_MODEL_RGBSDA
+        std::vector<Sample> samples;
+        switch(format){
+        case TextureFormat::BC1: colorModel = 128; samples = {{0, 64, 0}}; break;
+        case TextureFormat::BC3: colorModel = 130; samples = {{0, 64, 15}, {64, 64, 0}}; break;
+        case TextureFormat::BC4: colorModel = 131; samples = {{0, 64, 0}}; break;
+        case TextureFormat::BC5: colorModel = 132; samples = {{0, 64, 0}, {64, 64, 1}}; break;
+        case TextureFormat::BC7: colorModel = 134; samples = {{0, 128, 0}}; break;
+        default:
+            for(u32 channel = 0; channel < BlockCompressor::GetChannels(format); channel++){
+                samples.push_back({channel * 8, 8, channel == 3 ? 15u : channel});
+            }
+            break;
+        }
+        bool compressed = BlockCompressor::IsCompressed(format);
+        u32 upper = compressed ? 0xFFFFFFFFu : 0xFFu;
+
+        u32 blockSize = 24 + 16 * static_cast<u32>(samples.size());
+        std::vector<u32> dfd;
+        dfd.push_back(4 + blockSize);                   // dfdTotalSize
+        dfd.push_back(0);                               // vendor Khronos, basic descriptor
+        dfd.push_back(2 | (blockSize << 16));           // version 1.3
+        dfd.push_back(colorModel | (1 << 8) | (1 << 16));   // BT.709 primaries, linear transfer
+        dfd.push_back(compressed ? 0x0303u : 0u);       // texel block dimensions minus one
+        dfd.push_back(BlockCompressor::BlockBytes(format));     // bytes in plane 0
+        dfd.push_back(0);
+        for(const Sample& sample: samples){
+            dfd.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+            dfd.push_back(0);       // sample position
+            dfd.push_back(0);
+            dfd.push_back(upper);
+        }
+        return dfd;
+    }
+
+    // Key and value null terminated, the pair padded to 4 bytes
+    static void AddKeyValue(std::vector<u8>& kvd, const char* key, const char* value){
+        u32 length = static_cast<u32>(std::strlen(key) + std::strlen(value) + 2);
+        const u8* lengthBytes = reinterpret_cast<const u8*>(&length);
+        kvd.insert(kvd.end(), lengthBytes, lengthBytes + sizeof(length));
+        kvd.insert(kvd.end(), key, key + std::strlen(key) + 1);
+        kvd.insert(kvd.end(), value, value + std::strlen(value) + 1);
+        kvd.resize((kvd.size() + 3) / 4 * 4, 0);
+    }
+};
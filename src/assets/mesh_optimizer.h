@@ -0,0 +1,305 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+#include <glm/glm.hpp>
+
+#include "defines.h"
+
+// Post-transform cache efficiency of an index buffer on a simulated FIFO cache
+struct VertexCacheStats{
+    f32 acmr = 0.0f;    // vertices transformed per triangle, 0.5 is the ideal for a large grid
+    f32 atvr = 0.0f;    // vertices transformed per vertex, 1.0 is the ideal
+};
+
+struct MeshOptimizeSettings{
+    bool vertexCache = true;
+    bool overdraw = true;
+    bool vertexFetch = true;
+
+    // Simulated cache size, 16 is a conservative figure for current hardware
+    u32 cacheSize = 16;
+    // Clusters may end wherever their ACMR is within this factor of the
+    // whole mesh's, more and smaller clusters give overdraw ordering more freedom
+    f32 overdrawThreshold = 1.05f;
+};
+
+// Import time triangle and vertex reordering on an indexed triangle list:
+//   1. Tipsify (Sander, Nehab and Barczak 2007) orders triangles for the
+//      post-transform vertex cache and reports the cluster boundaries
+//   2. clusters are sorted so outward facing ones on the hull come first,
+//      which occlude the rest and cut overdraw without hurting the cache
+//   3. vertices are renumbered in first use order for linear fetches
+//
+// Positions are read from interleaved floats with position at offset 0, so
+// the Vertex array can be passed directly like MeshSimplifier does.
+class MeshOptimizer{
+public:
+    static VertexCacheStats AnalyzeVertexCache(const std::vector<u32>& indices, size_t vertexCount, u32 cacheSize = 16){
+        VertexCacheStats stats;
+        if(indices.size() < 3 || vertexCount == 0) return stats;
+
+        // FIFO: a vertex is in the cache if it was pushed less than cacheSize misses ago
+        std::vector<u32> pushedAt(vertexCount, 0);
+        u32 misses = 0;
+        for(u32 index: indices){
+            if(pushedAt[index] == 0 || misses - pushedAt[index] + 1 > cacheSize){
+                misses++;
+                pushedAt[index] = misses;
+            }
+        }
+
+        stats.acmr = static_cast<f32>(misses) / static_cast<f32>(indices.size() / 3);
+        stats.atvr = static_cast<f32>(misses) / static_cast<f32>(vertexCount);
+        return stats;
+    }
+
+    // Reorders triangles in place, vertexData is only read for the overdraw step
+    static void OptimizeTriangles(std::vector<u32>& indices, const f32* vertexData, size_t vertexCount,
+                                  u32 strideFloats, const MeshOptimizeSettings& settings){
+        if(indices.size() < 3 || indices.size() % 3 != 0 || vertexCount == 0) return;
+
+        std::vector<u32> clusters;
+        if(settings.vertexCache){
+            indices = Tipsify(indices, vertexCount, settings.cacheSize, clusters);
+        } else {
+            clusters.push_back(0);
+        }
+
+        if(settings.overdraw){
+            SplitClusters(indices, vertexCount, settings.cacheSize, settings.overdrawThreshold, clusters);
+            SortClusters(indices, vertexData, strideFloats, clusters);
+        }
+    }
+
+    // Renumbers vertices by first use and drops unreferenced ones
+    template<typename VertexType>
+    static void OptimizeVertexFetch(std::vector<VertexType>& vertices, std::vector<u32>& indices){
+        std::vector<u32> remap(vertices.size(), ~0u);
+        std::vector<VertexType> reordered;
+        reordered.reserve(vertices.size());
+
+        for(u32& index: indices){
+            if(remap[index] == ~0u){
+                remap[index] = static_cast<u32>(reordered.size());
+                reordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(reordered);
+    }
+
+    // Triangles of every vertex, CSR layout, also used by MeshletBuilder
+    static void BuildAdjacency(const std::vector<u32>& indices, size_t vertexCount,
+                               std::vector<u32>& offsets, std::vector<u32>& triangles){
+        offsets.assign(vertexCount + 1, 0);
+        for(u32 index: indices) offsets[index + 1]++;
+        for(size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+        triangles.resize(indices.size());
+        std::vector<u32> fill(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < indices.size(); i++){
+            triangles[fill[indices[i]]++] = static_cast<u32>(i / 3);
+        }
+    }
+
+private:
+    // Fans around one vertex at a time, picking the next fanning vertex among
+    // the ones just emitted that will still be in the cache once its
+    // remaining triangles are drawn. clusters gets the first triangle after
+    // every dead end, where the walk had to jump.
+    static std::vector<u32> Tipsify(const std::vector<u32>& indices, size_t vertexCount, u32 cacheSize,
+                                    std::vector<u32>& clusters){
+        std::vector<u32> offsets, adjacency;
+        BuildAdjacency(indices, vertexCount, offsets, adjacency);
+
+        std::vector<u32> liveTriangles(vertexCount);
+        for(size_t v = 0; v < vertexCount; v++) liveTriangles[v] = offsets[v + 1] - offsets[v];
+
+        std::vector<u32> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(indices.size() / 3, false);
+        std::vector<u32> deadEnd;
+        std::vector<u32> candidates;
+        std::vector<u32> result;
+        result.reserve(indices.size());
+
+        u32 time = cacheSize + 1;
+        u32 cursor = 0;
+        i64 fanning = 0;
+        clusters.clear();
+        clusters.push_back(0);
+
+        while(fanning >= 0){
+            candidates.clear();
+            u32 v = static_cast<u32>(fanning);
+
+            for(u32 a = offsets[v]; a < offsets[v + 1]; a++){
+                u32 triangle = adjacency[a];
+                if(emitted[triangle]) continue;
+
+                for(u32 k = 0; k < 3; k++){
+                    u32 corner = indices[triangle * 3 + k];
+                    result.push_back(corner);
+                    deadEnd.push_back(corner);
+                    candidates.push_back(corner);
+                    liveTriangles[corner]--;
+                    if(time - cacheTime[corner] > cacheSize){
+                        cacheTime[corner] = time++;
+                    }
+                }
+                emitted[triangle] = true;
+            }
+
+            // Best candidate still in the cache after its fan, else the freshest
+            i64 best = -1;
+            i64 bestPriority = -1;
+            for(u32 candidate: candidates){
+                if(liveTriangles[candidate] == 0) continue;
+
+                i64 priority = 0;
+                if(time - cacheTime[candidate] + 2 * liveTriangles[candidate] <= cacheSize){
+                    priority = time - cacheTime[candidate];
+                }
+                if(priority > bestPriority){
+                    bestPriority = priority;
+                    best = candidate;
+                }
+            }
+
+            if(best < 0){
+                best = SkipDeadEnd(deadEnd, liveTriangles, cursor);
+                if(best >= 0 && result.size() / 3 > clusters.back()){
+                    clusters.push_back(static_cast<u32>(result.size() / 3));
+                }
+            }
+            fanning = best;
+        }
+
+        return result;
+    }
+
+    static i64 SkipDeadEnd(std::vector<u32>& deadEnd, const std::vector<u32>& liveTriangles, u32& cursor){
+        while(!deadEnd.empty()){
+            u32 v = deadEnd.back();
+            deadEnd.pop_back();
+            if(liveTriangles[v] > 0) return v;
+        }
+        while(cursor < liveTriangles.size()){
+            if(liveTriangles[cursor] > 0) return cursor;
+            cursor++;
+        }
+        return -1;
+    }
+
+    // Adds soft boundaries inside the Tipsify clusters: a cluster may end
+    // wherever its own ACMR with a cold cache is already within threshold of
+    // the whole mesh's, so splitting there costs the cache little
+    static void SplitClusters(const std::vector<u32>& indices, size_t vertexCount, u32 cacheSize, f32 threshold,
+                              std::vector<u32>& clusters){
+        u32 triangleCount = static_cast<u32>(indices.size() / 3);
+        f32 meshACMR = AnalyzeVertexCache(indices, vertexCount, cacheSize).acmr;
+
+        // A vertex counts as cached only if it was pushed during the current
+        // cluster, so each cluster starts with a cold cache
+        std::vector<u32> split;
+        std::vector<u32> pushedAt(vertexCount, 0);
+        u32 misses = 0;
+        u32 clusterBase = 0;    // misses before the current cluster
+        u32 clusterStart = 0;
+        size_t nextHard = 1;
+
+        for(u32 triangle = 0; triangle < triangleCount; triangle++){
+            bool hard = nextHard < clusters.size() && clusters[nextHard] == triangle;
+            if(hard) nextHard++;
+
+            if(triangle == 0 || hard){
+                split.push_back(triangle);
+                clusterStart = triangle;
+                clusterBase = misses;
+            }
+
+            for(u32 k = 0; k < 3; k++){
+                u32 index = indices[triangle * 3 + k];
+                if(pushedAt[index] <= clusterBase || misses - pushedAt[index] + 1 > cacheSize){
+                    pushedAt[index] = ++misses;
+                }
+            }
+
+            // Soft boundary after this triangle unless a hard one follows anyway
+            u32 clusterTriangles = triangle + 1 - clusterStart;
+            bool hardNext = nextHard < clusters.size() && clusters[nextHard] == triangle + 1;
+            if(triangle + 1 < triangleCount && !hardNext && clusterTriangles >= cacheSize &&
+               static_cast<f32>(misses - clusterBase) / clusterTriangles <= meshACMR * threshold){
+                split.push_back(triangle + 1);
+                clusterStart = triangle + 1;
+                clusterBase = misses;
+            }
+        }
+
+        clusters.swap(split);
+    }
+
+    // Orders clusters by how far out they sit along their own average normal,
+    // an approximation of the view independent occlusion order from the same paper
+    static void SortClusters(std::vector<u32>& indices, const f32* vertexData, u32 strideFloats,
+                             const std::vector<u32>& clusters){
+        u32 triangleCount = static_cast<u32>(indices.size() / 3);
+        auto position = [vertexData, strideFloats](u32 index){
+            const f32* p = vertexData + static_cast<size_t>(index) * strideFloats;
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+
+        // Area weighted mesh centroid
+        glm::vec3 meshCentroid(0.0f);
+        f32 meshArea = 0.0f;
+        for(u32 triangle = 0; triangle < triangleCount; triangle++){
+            glm::vec3 p0 = position(indices[triangle * 3]);
+            glm::vec3 p1 = position(indices[triangle * 3 + 1]);
+            glm::vec3 p2 = position(indices[triangle * 3 + 2]);
+            f32 area = glm::length(glm::cross(p1 - p0, p2 - p0));
+            meshCentroid += (p0 + p1 + p2) * (area / 3.0f);
+            meshArea += area;
+        }
+        if(meshArea > 0.0f) meshCentroid /= meshArea;
+
+        std::vector<f32> sortKeys(clusters.size());
+        for(size_t c = 0; c < clusters.size(); c++){
+            u32 begin = clusters[c];
+            u32 end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+            glm::vec3 centroid(0.0f);
+            glm::vec3 normal(0.0f);     // area weighted, cross products are twice the area
+            f32 area = 0.0f;
+            for(u32 triangle = begin; triangle < end; triangle++){
+                glm::vec3 p0 = position(indices[triangle * 3]);
+                glm::vec3 p1 = position(indices[triangle * 3 + 1]);
+                glm::vec3 p2 = position(indices[triangle * 3 + 2]);
+                glm::vec3 cross = glm::cross(p1 - p0, p2 - p0);
+                f32 triangleArea = glm::length(cross);
+
+                centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+                normal += cross;
+                area += triangleArea;
+            }
+            if(area > 0.0f) centroid /= area;
+            f32 normalLength = glm::length(normal);
+            if(normalLength > 0.0f) normal /= normalLength;
+
+            sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+        }
+
+        std::vector<u32> order(clusters.size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&sortKeys](u32 a, u32 b){ return sortKeys[a] > sortKeys[b]; });
+
+        std::vector<u32> sorted;
+        sorted.reserve(indices.size());
+        for(u32 c: order){
+            u32 begin = clusters[c];
+            u32 end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            sorted.insert(sorted.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+        }
+        indices.swap(sorted);
+    }
+};
@@ -0,0 +1,511 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "defines.h"
+
+struct SimplifySettings{
+    // Weights of the attribute error relative to the squared position error,
+    // attribute error is scaled by the mesh extent so weights are unitless
+    f32 normalWeight = 0.5f;
+    f32 uvWeight = 1.0f;
+
+    // Keep open borders and attribute seams (UV/normal splits) in place
+    bool lockBorders = true;
+
+    // Stop once a collapse would cost more than this (relative to the mesh extent)
+    f32 maxRelativeError = 0.05f;
+};
+
+struct SimplifyResult{
+    std::vector<u32> indices;
+    f32 error = 0.0f; // geometric error in mesh units
+};
+
+// Quadric error metric edge collapse simplifier (Garland-Heckbert) working on
+// an indexed triangle list. Vertices are only ever collapsed onto an existing
+// neighbour (half-edge collapse) so the vertex buffer can be reused and
+// attributes stay exact; normal/uv attribute quadrics are added to the
+// position quadric error.
+//
+// Vertex data is passed as interleaved floats: position at floatOffset 0 and
+// normal/uv at the given offsets, which lets callers pass their Vertex array
+// directly.
+class MeshSimplifier{
+public:
+    struct VertexLayout{
+        u32 strideFloats = 8;
+        u32 normalOffset = 3;
+        u32 uvOffset = 6;
+    };
+
+private:
+    // Symmetric 4x4 plane quadric, stored as the 10 unique terms plus the
+    // accumulated weight so the error is a weighted mean squared distance
+    struct Quadric{
+        f64 a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        f64 a11 = 0, a12 = 0, a13 = 0;
+        f64 a22 = 0, a23 = 0;
+        f64 a33 = 0;
+        f64 w = 0;
+
+        static Quadric FromPlane(f64 a, f64 b, f64 c, f64 d, f64 weight){
+            Quadric q;
+            q.a00 = a * a * weight; q.a01 = a * b * weight; q.a02 = a * c * weight; q.a03 = a * d * weight;
+            q.a11 = b * b * weight; q.a12 = b * c * weight; q.a13 = b * d * weight;
+            q.a22 = c * c * weight; q.a23 = c * d * weight;
+            q.a33 = d * d * weight;
+            q.w = weight;
+            return q;
+        }
+
+        void Add(const Quadric& o){
+            a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+            a11 += o.a11; a12 += o.a12; a13 += o.a13;
+            a22 += o.a22; a23 += o.a23;
+            a33 += o.a33;
+            w += o.w;
+        }
+
+        f64 Evaluate(const glm::vec3& p) const {
+            f64 x = p.x, y = p.y, z = p.z;
+            f64 error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                      + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                      + a22 * z * z + 2 * a23 * z
+                      + a33;
+            return error > 0 && w > 0 ? error / w : 0;
+        }
+    };
+
+    // Attribute quadric (Hoppe 1999): every triangle defines a linear field
+    // a(p) = g.p + d for each attribute component, and the error of placing
+    // attribute value a at position p is the squared distance to that field.
+    // Smoothly varying attributes therefore collapse for free, while real
+    // discontinuities cost. Stored per component: G = sum(w g g^T) (6 terms),
+    // b = sum(w g d), c = sum(w d^2), e = sum(w g), f = sum(w d).
+    static constexpr u32 ATTRIBUTE_COUNT = 5; // normal xyz, uv
+    static constexpr f64 BORDER_WEIGHT = 10.0;    // constraint planes of open edges, per squared edge length
+    static constexpr u32 ATTRIBUTE_TERMS = 14;
+
+    struct AttributeQuadric{
+        f64 terms[ATTRIBUTE_COUNT][ATTRIBUTE_TERMS] = {};
+        f64 w = 0;
+
+        void Add(const AttributeQuadric& o){
+            for(u32 k = 0; k < ATTRIBUTE_COUNT; k++){
+                for(u32 t = 0; t < ATTRIBUTE_TERMS; t++){
+                    terms[k][t] += o.terms[k][t];
+                }
+            }
+            w += o.w;
+        }
+
+        void AddField(u32 k, const glm::dvec3& g, f64 d, f64 weight){
+            f64* q = terms[k];
+            q[0] += weight * g.x * g.x; q[1] += weight * g.x * g.y; q[2] += weight * g.x * g.z;
+            q[3] += weight * g.y * g.y; q[4] += weight * g.y * g.z; q[5] += weight * g.z * g.z;
+            q[6] += weight * g.x * d; q[7] += weight * g.y * d; q[8] += weight * g.z * d;
+            q[9] += weight * d * d;
+            q[10] += weight * g.x; q[11] += weight * g.y; q[12] += weight * g.z;
+            q[13] += weight * d;
+        }
+
+        // Weighted sum over components of mean squared attribute error
+        f64 Evaluate(const glm::vec3& p, const f32* attributes, const f32* componentWeights) const {
+            if(w <= 0) return 0;
+
+            f64 x = p.x, y = p.y, z = p.z;
+            f64 error = 0;
+            for(u32 k = 0; k < ATTRIBUTE_COUNT; k++){
+                const f64* q = terms[k];
+                f64 a = attributes[k];
+                f64 pGp = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + q[3] * y * y + 2 * q[4] * y * z + q[5] * z * z;
+                f64 e = pGp + 2 * (q[6] * x + q[7] * y + q[8] * z) + q[9]
+                      - 2 * a * (q[10] * x + q[11] * y + q[12] * z + q[13])
+                      + a * a * w;
+                error += componentWeights[k] * (e > 0 ? e : 0);
+            }
+            return error / w;
+        }
+    };
+
+    struct Collapse{
+        u32 from;
+        u32 to;
+        f64 cost;
+    };
+
+public:
+    static SimplifyResult Simplify(const f32* vertexData, size_t vertexCount, const VertexLayout& layout,
+                                   const std::vector<u32>& sourceIndices, size_t targetIndexCount,
+                                   const SimplifySettings& settings){
+        SimplifyResult result;
+        result.indices = sourceIndices;
+
+        if(vertexCount == 0 || sourceIndices.size() < 3 || targetIndexCount >= sourceIndices.size()){
+            return result;
+        }
+
+        auto position = [&](u32 v){ return glm::make_vec3(vertexData + v * layout.strideFloats); };
+        auto Attributes = [&](u32 v, f32* out){
+            const f32* vertex = vertexData + v * layout.strideFloats;
+            out[0] = vertex[layout.normalOffset];
+            out[1] = vertex[layout.normalOffset + 1];
+            out[2] = vertex[layout.normalOffset + 2];
+            out[3] = vertex[layout.uvOffset];
+            out[4] = vertex[layout.uvOffset + 1];
+        };
+        const f32 componentWeights[ATTRIBUTE_COUNT] = {
+            settings.normalWeight, settings.normalWeight, settings.normalWeight,
+            settings.uvWeight, settings.uvWeight
+        };
+
+        // Importers without vertex joining emit a vertex per corner, merge exact
+        // duplicates first so the mesh is connected
+        std::vector<u32> wedgeRemap = BuildRemap(vertexData, vertexCount, layout.strideFloats, layout.strideFloats);
+        for(u32& index: result.indices){
+            index = wedgeRemap[index];
+        }
+
+        // Vertices sharing a position but not attributes are wedges of one
+        // position, topology is tracked per position
+        std::vector<u32> positionRemap = BuildRemap(vertexData, vertexCount, layout.strideFloats, 3);
+
+        glm::vec3 boundsMin = position(0), boundsMax = position(0);
+        for(u32 v = 1; v < vertexCount; v++){
+            boundsMin = glm::min(boundsMin, position(v));
+            boundsMax = glm::max(boundsMax, position(v));
+        }
+        f32 extent = glm::max(glm::length(boundsMax - boundsMin), 1e-6f);
+        f64 extentSquared = static_cast<f64>(extent) * extent;
+        f64 maxCost = static_cast<f64>(settings.maxRelativeError) * settings.maxRelativeError * extentSquared;
+
+        std::vector<bool> locked(vertexCount, false);
+        if(settings.lockBorders){
+            LockBordersAndSeams(result.indices, wedgeRemap, positionRemap, vertexCount, locked);
+        }
+
+        // Area weighted plane quadrics accumulated per position, attribute
+        // quadrics per wedge. Unlocked open edges also get a plane through the
+        // edge perpendicular to the face, so the outline keeps its shape.
+        std::vector<Quadric> quadrics(vertexCount);
+        std::vector<AttributeQuadric> attributeQuadrics(vertexCount);
+        std::unordered_map<u64, u32> edgeUse;
+        if(!settings.lockBorders){
+            edgeUse = CountEdgeUse(result.indices, positionRemap);
+        }
+        for(size_t i = 0; i + 2 < result.indices.size(); i += 3){
+            glm::vec3 p0 = position(result.indices[i]);
+            glm::vec3 p1 = position(result.indices[i + 1]);
+            glm::vec3 p2 = position(result.indices[i + 2]);
+
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            f32 doubleArea = glm::length(n);
+            if(doubleArea <= 0.0f) continue;
+            n /= doubleArea;
+
+            Quadric q = Quadric::FromPlane(n.x, n.y, n.z, -glm::dot(n, p0), doubleArea * 0.5f);
+            AttributeQuadric qa = BuildAttributeQuadric(p0, p1, p2, n, doubleArea * 0.5f,
+                result.indices[i], result.indices[i + 1], result.indices[i + 2], Attributes);
+            for(u32 k = 0; k < 3; k++){
+                quadrics[positionRemap[result.indices[i + k]]].Add(q);
+                attributeQuadrics[result.indices[i + k]].Add(qa);
+            }
+
+            for(u32 e = 0; e < 3 && !edgeUse.empty(); e++){
+                u32 a = result.indices[i + e];
+                u32 b = result.indices[i + (e + 1) % 3];
+                if(edgeUse[EdgeKey(positionRemap[a], positionRemap[b])] != 1) continue;
+
+                glm::vec3 edge = position(b) - position(a);
+                glm::vec3 normal = glm::cross(edge, n);
+                f32 length = glm::length(normal);
+                if(length <= 0.0f) continue;
+                normal /= length;
+
+                Quadric border = Quadric::FromPlane(normal.x, normal.y, normal.z, -glm::dot(normal, position(a)),
+                                                    BORDER_WEIGHT * glm::dot(edge, edge));
+                quadrics[positionRemap[a]].Add(border);
+                quadrics[positionRemap[b]].Add(border);
+            }
+        }
+
+        std::vector<u32> collapseRemap(vertexCount);
+        std::vector<u32> adjacencyOffsets, adjacency;
+        std::vector<Collapse> collapses;
+        std::unordered_set<u64> visitedEdges;
+        std::vector<bool> touched(vertexCount);
+        f64 maxAppliedCost = 0.0;
+
+        size_t indexCount = result.indices.size();
+        while(indexCount > targetIndexCount){
+            BuildAdjacency(result.indices, indexCount, vertexCount, adjacencyOffsets, adjacency);
+
+            // Cheapest direction of every collapsible edge
+            collapses.clear();
+            visitedEdges.clear();
+            for(size_t i = 0; i < indexCount; i += 3){
+                for(u32 e = 0; e < 3; e++){
+                    u32 a = result.indices[i + e];
+                    u32 b = result.indices[i + (e + 1) % 3];
+                    // Each edge once, open edges only appear in one orientation
+                    if(!visitedEdges.insert(EdgeKey(a, b)).second) continue;
+
+                    Collapse best{0, 0, -1.0};
+                    for(u32 dir = 0; dir < 2; dir++){
+                        u32 from = dir == 0 ? a : b;
+                        u32 to = dir == 0 ? b : a;
+                        if(locked[from]) continue;
+
+                        Quadric q = quadrics[positionRemap[from]];
+                        q.Add(quadrics[positionRemap[to]]);
+                        f64 cost = q.Evaluate(position(to));
+
+                        AttributeQuadric qa = attributeQuadrics[from];
+                        qa.Add(attributeQuadrics[to]);
+                        f32 targetAttributes[ATTRIBUTE_COUNT];
+                        Attributes(to, targetAttributes);
+                        cost += qa.Evaluate(position(to), targetAttributes, componentWeights) * extentSquared;
+
+                        if(best.cost < 0.0 || cost < best.cost){
+                            best = {from, to, cost};
+                        }
+                    }
+
+                    if(best.cost >= 0.0 && best.cost <= maxCost){
+                        collapses.push_back(best);
+                    }
+                }
+            }
+
+            if(collapses.empty()) break;
+
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y){
+                return x.cost < y.cost;
+            });
+
+            // Apply independent collapses, a vertex is used by at most one per pass
+            for(u32 v = 0; v < vertexCount; v++) collapseRemap[v] = v;
+            std::fill(touched.begin(), touched.end(), false);
+
+            size_t trianglesToRemove = (indexCount - targetIndexCount) / 3;
+            size_t trianglesRemoved = 0;
+            size_t applied = 0;
+
+            for(const Collapse& collapse: collapses){
+                if(trianglesRemoved >= trianglesToRemove) break;
+                if(touched[collapse.from] || touched[collapse.to]) continue;
+                if(!IsCollapseValid(result.indices, adjacencyOffsets, adjacency, collapse, vertexData, layout.strideFloats, touched)) continue;
+
+                // Triangles around the edge disappear
+                u32 removed = 0;
+                for(u32 k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1]; k++){
+                    u32 triangle = adjacency[k];
+                    for(u32 c = 0; c < 3; c++){
+                        if(result.indices[triangle * 3 + c] == collapse.to) removed++;
+                    }
+                }
+
+                collapseRemap[collapse.from] = collapse.to;
+                quadrics[positionRemap[collapse.to]].Add(quadrics[positionRemap[collapse.from]]);
+                attributeQuadrics[collapse.to].Add(attributeQuadrics[collapse.from]);
+
+                // Lock the one-ring so later collapses this pass see fresh geometry
+                for(u32 k = adjacencyOffsets[collapse.from]; k < adjacencyOffsets[collapse.from + 1]; k++){
+                    u32 triangle = adjacency[k];
+                    for(u32 c = 0; c < 3; c++){
+                        touched[result.indices[triangle * 3 + c]] = true;
+                    }
+                }
+
+                maxAppliedCost = std::max(maxAppliedCost, collapse.cost);
+                trianglesRemoved += removed;
+                applied++;
+            }
+
+            if(applied == 0) break;
+
+            // Rewrite indices and drop degenerate triangles
+            size_t writeIndex = 0;
+            for(size_t i = 0; i < indexCount; i += 3){
+                u32 a = collapseRemap[result.indices[i]];
+                u32 b = collapseRemap[result.indices[i + 1]];
+                u32 c = collapseRemap[result.indices[i + 2]];
+                if(a == b || b == c || a == c) continue;
+
+                result.indices[writeIndex++] = a;
+                result.indices[writeIndex++] = b;
+                result.indices[writeIndex++] = c;
+            }
+            indexCount = writeIndex;
+        }
+
+        result.indices.resize(indexCount);
+        result.error = static_cast<f32>(std::sqrt(maxAppliedCost));
+        return result;
+    }
+
+private:
+    // Linear attribute fields over one triangle: solve g.(p1-p0) = a1-a0,
+    // g.(p2-p0) = a2-a0, g.n = 0 for every component
+    template<typename AttributeFn>
+    static AttributeQuadric BuildAttributeQuadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+                                                  const glm::vec3& n, f32 area, u32 v0, u32 v1, u32 v2, AttributeFn&& attributes){
+        AttributeQuadric qa;
+        qa.w = area;
+
+        // Edges and normal are the rows of the system, glm is column major
+        glm::dvec3 e1 = glm::dvec3(p1 - p0), e2 = glm::dvec3(p2 - p0), dn = glm::dvec3(n);
+        glm::dmat3 system = glm::transpose(glm::dmat3(e1, e2, dn));
+        if(std::abs(glm::determinant(system)) < 1e-30) return qa;
+        glm::dmat3 inverse = glm::inverse(system);
+
+        f32 a0[ATTRIBUTE_COUNT], a1[ATTRIBUTE_COUNT], a2[ATTRIBUTE_COUNT];
+        attributes(v0, a0);
+        attributes(v1, a1);
+        attributes(v2, a2);
+
+        for(u32 k = 0; k < ATTRIBUTE_COUNT; k++){
+            glm::dvec3 g = inverse * glm::dvec3(a1[k] - a0[k], a2[k] - a0[k], 0.0);
+            f64 d = a0[k] - glm::dot(g, glm::dvec3(p0));
+            qa.AddField(k, g, d, area);
+        }
+        return qa;
+    }
+
+    // Maps every vertex to the first vertex with identical leading floats
+    static std::vector<u32> BuildRemap(const f32* vertexData, size_t vertexCount, u32 strideFloats, u32 compareFloats){
+        struct Key{
+            const f32* data;
+            u32 count;
+            bool operator==(const Key& o) const { return std::memcmp(data, o.data, count * sizeof(f32)) == 0; }
+        };
+        struct KeyHash{
+            size_t operator()(const Key& key) const {
+                // FNV-1a over the raw bytes
+                u64 hash = 14695981039346656037ull;
+                const u8* bytes = reinterpret_cast<const u8*>(key.data);
+                for(size_t i = 0; i < key.count * sizeof(f32); i++){
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+                }
+                return static_cast<size_t>(hash);
+            }
+        };
+
+        std::vector<u32> remap(vertexCount);
+        std::unordered_map<Key, u32, KeyHash> firstVertex;
+        firstVertex.reserve(vertexCount);
+
+        for(u32 v = 0; v < vertexCount; v++){
+            auto [it, inserted] = firstVertex.try_emplace(Key{vertexData + v * strideFloats, compareFloats}, v);
+            remap[v] = it->second;
+        }
+        return remap;
+    }
+
+    // Same key for both orientations of an edge
+    static u64 EdgeKey(u32 a, u32 b){
+        if(a > b) std::swap(a, b);
+        return (static_cast<u64>(a) << 32) | b;
+    }
+
+    // Triangles using each edge, counted per position so wedges don't split edges
+    static std::unordered_map<u64, u32> CountEdgeUse(const std::vector<u32>& indices, const std::vector<u32>& positionRemap){
+        std::unordered_map<u64, u32> edgeUse;
+        edgeUse.reserve(indices.size());
+        for(size_t i = 0; i + 2 < indices.size(); i += 3){
+            for(u32 e = 0; e < 3; e++){
+                edgeUse[EdgeKey(positionRemap[indices[i + e]], positionRemap[indices[i + (e + 1) % 3]])]++;
+            }
+        }
+        return edgeUse;
+    }
+
+    // Locks vertices on open edges (counted per position) and any position
+    // that is split into several wedges
+    static void LockBordersAndSeams(const std::vector<u32>& indices, const std::vector<u32>& wedgeRemap,
+                                    const std::vector<u32>& positionRemap, size_t vertexCount, std::vector<bool>& locked){
+        std::unordered_map<u64, u32> edgeUse = CountEdgeUse(indices, positionRemap);
+
+        std::vector<bool> borderPosition(vertexCount, false);
+        for(const auto& [key, count]: edgeUse){
+            if(count == 1){
+                borderPosition[static_cast<u32>(key >> 32)] = true;
+                borderPosition[static_cast<u32>(key & 0xFFFFFFFF)] = true;
+            }
+        }
+
+        // Count distinct wedges per position
+        std::vector<u32> wedgeOfPosition(vertexCount, ~0u);
+        std::vector<bool> seamPosition(vertexCount, false);
+        for(u32 v = 0; v < vertexCount; v++){
+            if(wedgeRemap[v] != v) continue;
+            u32& wedge = wedgeOfPosition[positionRemap[v]];
+            if(wedge == ~0u) wedge = v;
+            else if(wedge != v) seamPosition[positionRemap[v]] = true;
+        }
+
+        for(u32 v = 0; v < vertexCount; v++){
+            u32 p = positionRemap[v];
+            locked[v] = borderPosition[p] || seamPosition[p];
+        }
+    }
+
+    static void BuildAdjacency(const std::vector<u32>& indices, size_t indexCount, size_t vertexCount,
+                               std::vector<u32>& offsets, std::vector<u32>& adjacency){
+        offsets.assign(vertexCount + 1, 0);
+        for(size_t i = 0; i < indexCount; i++){
+            offsets[indices[i] + 1]++;
+        }
+        for(size_t v = 0; v < vertexCount; v++){
+            offsets[v + 1] += offsets[v];
+        }
+
+        adjacency.resize(indexCount);
+        std::vector<u32> fill(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < indexCount; i++){
+            adjacency[fill[indices[i]]++] = static_cast<u32>(i / 3);
+        }
+    }
+
+    // Rejects collapses that flip a triangle or touch geometry already
+    // modified in this pass
+    static bool IsCollapseValid(const std::vector<u32>& indices, const std::vector<u32>& offsets, const std::vector<u32>& adjacency,
+                                const Collapse& collapse, const f32* vertexData, u32 strideFloats, const std::vector<bool>& touched){
+        glm::vec3 target = glm::make_vec3(vertexData + collapse.to * strideFloats);
+
+        for(u32 k = offsets[collapse.from]; k < offsets[collapse.from + 1]; k++){
+            u32 triangle = adjacency[k];
+            u32 corners[3] = {indices[triangle * 3], indices[triangle * 3 + 1], indices[triangle * 3 + 2]};
+
+            bool hasTarget = false;
+            for(u32 c = 0; c < 3; c++){
+                if(corners[c] == collapse.to) hasTarget = true;
+                if(touched[corners[c]]) return false;
+            }
+            if(hasTarget) continue;
+
+            glm::vec3 p[3], q[3];
+            for(u32 c = 0; c < 3; c++){
+                p[c] = glm::make_vec3(vertexData + corners[c] * strideFloats);
+                q[c] = corners[c] == collapse.from ? target : p[c];
+            }
+
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+
+            // Flipped or collapsed to a sliver
+            if(glm::dot(before, after) <= 0.0f) return false;
+            f32 afterLength = glm::length(after);
+            if(afterLength < 1e-12f || glm::dot(before, after) < 0.2f * glm::length(before) * afterLength) return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,243 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "assets/mesh_optimizer.h"
+#include "defines.h"
+
+// Small cluster of a mesh's triangles, a contiguous range of its index
+// buffer so the visible ones can be drawn straight from the shared indices
+struct Meshlet{
+    u32 firstIndex = 0;     // relative to the mesh
+    u32 indexCount = 0;
+    u32 vertexCount = 0;    // unique vertices referenced
+
+    // Object space bounding sphere
+    glm::vec3 center{0.0f};
+    f32 radius = 0.0f;
+
+    // Normal cone: every triangle faces away from a camera at p when
+    // dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius.
+    // coneCutoff is 1 when the normals spread too far to ever cull.
+    glm::vec3 coneAxis{0.0f, 0.0f, 1.0f};
+    f32 coneCutoff = 1.0f;
+};
+
+struct MeshletSettings{
+    bool enabled = true;
+    u32 maxVertices = 64;
+    u32 maxTriangles = 124;
+
+    // Below this a mesh is drawn whole, per cluster draws would cost more than they cull
+    u32 minTriangles = 512;
+
+    // How much growing a cluster prefers triangles facing like it, tighter
+    // cones cull more back faces at the price of a few more vertices
+    f32 coneWeight = 0.25f;
+};
+
+// Greedy meshlet construction: a meshlet grows by the adjacent triangle
+// adding the fewest new vertices, ties going to the one whose normal
+// matches the meshlet's best, and is closed when it is full or runs out of
+// neighbours it can take. Triangles keep their relative order inside each
+// meshlet, so the vertex cache order of MeshOptimizer survives mostly
+// intact.
+class MeshletBuilder{
+private:
+    // Unemitted triangles looked at after the cursor when a meshlet runs out of
+    // neighbours, UV seams split the index adjacency of otherwise connected surfaces
+    static constexpr u32 SEED_WINDOW = 128;
+
+public:
+    // Reorders indices so every meshlet is one contiguous range, in order
+    static std::vector<Meshlet> Build(std::vector<u32>& indices, const f32* vertexData, size_t vertexCount,
+                                      u32 strideFloats, const MeshletSettings& settings){
+        std::vector<Meshlet> meshlets;
+        u32 triangleCount = static_cast<u32>(indices.size() / 3);
+        if(triangleCount == 0 || vertexCount == 0) return meshlets;
+
+        auto position = [vertexData, strideFloats](u32 index){
+            const f32* p = vertexData + static_cast<size_t>(index) * strideFloats;
+            return glm::vec3(p[0], p[1], p[2]);
+        };
+
+        // Per triangle centroid and unit normal, zero for degenerate ones
+        std::vector<glm::vec3> centroids(triangleCount);
+        std::vector<glm::vec3> normals(triangleCount);
+        for(u32 triangle = 0; triangle < triangleCount; triangle++){
+            glm::vec3 p0 = position(indices[triangle * 3]);
+            glm::vec3 p1 = position(indices[triangle * 3 + 1]);
+            glm::vec3 p2 = position(indices[triangle * 3 + 2]);
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            f32 length = glm::length(normal);
+
+            centroids[triangle] = (p0 + p1 + p2) / 3.0f;
+            normals[triangle] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+        }
+
+        std::vector<u32> offsets, adjacency;
+        MeshOptimizer::BuildAdjacency(indices, vertexCount, offsets, adjacency);
+
+        std::vector<u32> liveTriangles(vertexCount);
+        for(size_t v = 0; v < vertexCount; v++) liveTriangles[v] = offsets[v + 1] - offsets[v];
+
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<u32> meshletOf(vertexCount, 0);    // meshlet number + 1 of the vertex's latest meshlet
+        std::vector<u32> meshletVertices;
+        std::vector<u32> meshletTriangles;
+        std::vector<u32> reordered;
+        reordered.reserve(indices.size());
+
+        glm::vec3 normalSum(0.0f);
+        glm::vec3 centroidSum(0.0f);
+        u32 cursor = 0;
+        u32 stamp = 1;
+
+        auto newVertices = [&](u32 triangle){
+            u32 count = 0;
+            for(u32 k = 0; k < 3; k++){
+                if(meshletOf[indices[triangle * 3 + k]] != stamp) count++;
+            }
+            return count;
+        };
+
+        auto addTriangle = [&](u32 triangle){
+            for(u32 k = 0; k < 3; k++){
+                u32 index = indices[triangle * 3 + k];
+                if(meshletOf[index] != stamp){
+                    meshletOf[index] = stamp;
+                    meshletVertices.push_back(index);
+                }
+                liveTriangles[index]--;
+            }
+            emitted[triangle] = true;
+            meshletTriangles.push_back(triangle);
+            normalSum += normals[triangle];
+            centroidSum += centroids[triangle];
+        };
+
+        auto closeMeshlet = [&](){
+            meshlets.push_back(Finish(meshletTriangles, meshletVertices, normals, position,
+                                      static_cast<u32>(reordered.size())));
+            for(u32 triangle: meshletTriangles){
+                reordered.insert(reordered.end(), indices.begin() + triangle * 3, indices.begin() + triangle * 3 + 3);
+            }
+            meshletVertices.clear();
+            meshletTriangles.clear();
+            normalSum = glm::vec3(0.0f);
+            centroidSum = glm::vec3(0.0f);
+            stamp++;
+        };
+
+        while(true){
+            while(cursor < triangleCount && emitted[cursor]) cursor++;
+            if(cursor == triangleCount) break;
+
+            if(meshletTriangles.empty()){
+                addTriangle(cursor);
+                continue;
+            }
+
+            u32 vertexRoom = settings.maxVertices - static_cast<u32>(meshletVertices.size());
+            f32 normalLength = glm::length(normalSum);
+            glm::vec3 axis = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f);
+
+            // Best neighbour: fewest new vertices, then facing, then the one
+            // finishing the most vertices so no islands are left behind
+            i64 best = -1;
+            f32 bestScore = 0.0f;
+            u32 bestLive = 0;
+            for(u32 vertex: meshletVertices){
+                for(u32 a = offsets[vertex]; a < offsets[vertex + 1]; a++){
+                    u32 triangle = adjacency[a];
+                    if(emitted[triangle]) continue;
+
+                    u32 added = newVertices(triangle);
+                    if(added > vertexRoom) continue;
+
+                    u32 live = liveTriangles[indices[triangle * 3]] + liveTriangles[indices[triangle * 3 + 1]] +
+                               liveTriangles[indices[triangle * 3 + 2]];
+                    f32 score = added + settings.coneWeight * (1.0f - glm::dot(normals[triangle], axis));
+                    if(best < 0 || score < bestScore || (score == bestScore && live < bestLive)){
+                        best = triangle;
+                        bestScore = score;
+                        bestLive = live;
+                    }
+                }
+            }
+
+            // No neighbour fits, jump to the nearest upcoming triangle that does
+            if(best < 0){
+                glm::vec3 center = centroidSum / static_cast<f32>(meshletTriangles.size());
+                f32 bestDistance = 0.0f;
+                u32 end = std::min(triangleCount, cursor + SEED_WINDOW);
+                for(u32 triangle = cursor; triangle < end; triangle++){
+                    if(emitted[triangle] || newVertices(triangle) > vertexRoom) continue;
+
+                    glm::vec3 offset = centroids[triangle] - center;
+                    f32 distance = glm::dot(offset, offset);
+                    if(best < 0 || distance < bestDistance){
+                        best = triangle;
+                        bestDistance = distance;
+                    }
+                }
+            }
+
+            if(best < 0){
+                closeMeshlet();
+                continue;
+            }
+
+            addTriangle(static_cast<u32>(best));
+            if(meshletTriangles.size() >= settings.maxTriangles) closeMeshlet();
+        }
+        if(!meshletTriangles.empty()) closeMeshlet();
+
+        indices.swap(reordered);
+        return meshlets;
+    }
+
+private:
+    // Bounds of a finished meshlet, whose triangles are sorted back into source order
+    template<typename PositionFn>
+    static Meshlet Finish(std::vector<u32>& triangles, const std::vector<u32>& vertices,
+                          const std::vector<glm::vec3>& normals, const PositionFn& position, u32 firstIndex){
+        std::sort(triangles.begin(), triangles.end());
+
+        Meshlet meshlet;
+        meshlet.firstIndex = firstIndex;
+        meshlet.indexCount = static_cast<u32>(triangles.size() * 3);
+        meshlet.vertexCount = static_cast<u32>(vertices.size());
+
+        // Sphere around the box center, loose but cheap and stable
+        glm::vec3 boundsMin(position(vertices[0]));
+        glm::vec3 boundsMax = boundsMin;
+        for(u32 vertex: vertices){
+            boundsMin = glm::min(boundsMin, position(vertex));
+            boundsMax = glm::max(boundsMax, position(vertex));
+        }
+        meshlet.center = (boundsMin + boundsMax) * 0.5f;
+        for(u32 vertex: vertices){
+            meshlet.radius = std::max(meshlet.radius, glm::length(position(vertex) - meshlet.center));
+        }
+
+        // Cone around the average normal. A spread close to 90 degrees gives
+        // a cutoff too near 1 to be worth the precision risk, leave it uncullable.
+        glm::vec3 axis(0.0f);
+        for(u32 triangle: triangles) axis += normals[triangle];
+        f32 axisLength = glm::length(axis);
+        if(axisLength <= 0.0f) return meshlet;
+        axis /= axisLength;
+
+        f32 minDot = 1.0f;
+        for(u32 triangle: triangles){
+            if(normals[triangle] != glm::vec3(0.0f)) minDot = std::min(minDot, glm::dot(normals[triangle], axis));
+        }
+        meshlet.coneAxis = axis;
+        meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+        return meshlet;
+    }
+};
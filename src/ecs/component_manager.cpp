@@ -10,6 +10,7 @@ EntityID ComponentManager::CreateEntity()
         m_transforms.resize(id + 1);
         m_renderComponents.resize(id + 1);
         m_hierarchies.resize(id + 1);
+        m_lights.resize(id + 1);
         m_componentMasks.resize(id + 1);
         m_activeEntities.resize(id + 1);
     }
@@ -59,6 +60,14 @@ void ComponentManager::AddHierarchy(EntityID entity, const HierarchyComponent &h
     m_componentMasks[entity] |= HIERARCHY;
 }
 
+void ComponentManager::AddLight(EntityID entity, const LightComponent &light)
+{
+    if (entity >= m_lights.size())
+        return;
+    m_lights[entity] = light;
+    m_componentMasks[entity] |= LIGHT;
+}
+
 TransformComponent *ComponentManager::GetTransform(EntityID entity)
 {
     if (entity >= m_transforms.size() || !(m_componentMasks[entity] & TRANSFORM))
@@ -86,6 +95,15 @@ HierarchyComponent *ComponentManager::GetHierarchy(EntityID entity)
     return &m_hierarchies[entity];
 }
 
+LightComponent *ComponentManager::GetLight(EntityID entity)
+{
+    if (entity >= m_lights.size() || !(m_componentMasks[entity] & LIGHT))
+    {
+        return nullptr;
+    }
+    return &m_lights[entity];
+}
+
 std::vector<EntityID> ComponentManager::GetEntitiesWith(u32 componentMask) const
 {
     std::vector<EntityID> result;
@@ -130,24 +148,136 @@ void TransformSystem::UpdateWorldMatrix(TransformComponent &transform)
 
 void RenderSystem::Update(ComponentManager &componentManager, f32 deltaTime)
 {
-    // This would typically collect render data and submit to renderer
+    // Entities per job, small enough to balance, large enough to amortize the submit
+    constexpr u32 ENTITIES_PER_JOB = 1024;
+
     auto entities = componentManager.GetEntitiesWith(
         ComponentManager::TRANSFORM | ComponentManager::RENDER);
 
+    const std::vector<TransformComponent>& transforms = componentManager.GetTransforms();
+    std::vector<RenderComponent>& renders = componentManager.GetRenderComponents();
+    const AssetManager* assetManager = m_renderer->GetAssetManager();
+    const Frustum& frustum = m_renderer->GetFrustum();
+    const CameraData& camera = m_renderer->GetCamera();
+    const LODSettings& lodSettings = m_renderer->GetLODSettings();
+    const ShadowCascadeData& shadowCascades = m_renderer->GetShadowCascades();
+    const std::vector<PointShadowData>& pointShadows = m_renderer->GetPointShadows();
+    const f32 viewportHeight = static_cast<f32>(m_renderer->GetViewportSize().y);
+
+    m_entitiesCulled.store(0, std::memory_order_relaxed);
+
+    m_jobSystem->ParallelFor(static_cast<u32>(entities.size()), ENTITIES_PER_JOB,
+        [&](u32 begin, u32 end, u32 /*threadIndex*/)
+    {
+        u32 culled = 0;
+
+        for (u32 i = begin; i < end; i++)
+        {
+            EntityID entity = entities[i];
+            const TransformComponent &transform = transforms[entity];
+            RenderComponent &render = renders[entity];
+
+            if (!render.isVisible) continue;
+
+            // Frustum cull the model bounding sphere in world space
+            const ModelAsset *model = assetManager->GetModel(render.modelID);
+            if (!model) continue;
+
+            glm::vec3 worldCenter = glm::vec3(transform.worldMatrix * glm::vec4(model->boundsCenter, 1.0f));
+            f32 maxScale = glm::max(glm::length(glm::vec3(transform.worldMatrix[0])),
+                           glm::max(glm::length(glm::vec3(transform.worldMatrix[1])),
+                                    glm::length(glm::vec3(transform.worldMatrix[2]))));
+
+            f32 worldRadius = model->boundsRadius * maxScale;
+
+            // Off screen casters can still throw shadows into a cascade
+            u32 cascadeMask = render.castShadows
+                ? ShadowCascadeBuilder::CascadeMask(shadowCascades, worldCenter, worldRadius) : 0;
+            u32 pointShadowMask = render.castShadows
+                ? PointShadowAllocator::LightMask(pointShadows, worldCenter, worldRadius) : 0;
+            bool castsShadow = (cascadeMask | pointShadowMask) != 0;
+
+            if (!frustum.IntersectsSphere(worldCenter, worldRadius))
+            {
+                culled++;
+                if (castsShadow) SubmitShadowCaster(transform, render, cascadeMask, pointShadowMask, worldCenter, worldRadius, entity);
+                continue;
+            }
+
+            f32 distanceToCamera = glm::distance(camera.position, glm::vec3(transform.worldMatrix[3]));
+
+            // Pick the LOD, each entity is only touched by one worker so the
+            // hysteresis state can be updated in place
+            LODQuery lodQuery;
+            lodQuery.distanceToCamera = distanceToCamera;
+            lodQuery.worldRadius = worldRadius;
+            lodQuery.worldScale = maxScale;
+            lodQuery.projectionScale = camera.projection[1][1];
+            lodQuery.viewportHeight = viewportHeight;
+            lodQuery.lodDistance = render.lodDistance;
+            render.currentLOD = LODSelector::Select(*model, lodQuery, render.currentLOD, lodSettings);
+
+            // World distance one pixel spans at the nearest point of the
+            // bounds, scaled into the model's UV space
+            f32 nearestDistance = glm::max(glm::distance(camera.position, worldCenter) - worldRadius, 1e-3f);
+            f32 worldPerPixel = 2.0f * nearestDistance / (camera.projection[1][1] * viewportHeight);
+
+            RenderCommand command;
+            command.distanceToCamera = distanceToCamera;
+            command.uvPerPixel = worldPerPixel * model->uvDensity / glm::max(maxScale, 1e-6f);
+            command.lodLevel = render.currentLOD;
+            command.worldMatrix = transform.worldMatrix;
+            command.normalMatrix = glm::transpose(glm::inverse(transform.worldMatrix));
+            command.modelID = render.modelID;
+            command.materialID = render.materialID;
+            command.castShadows = render.castShadows;
+            command.entityID = entity;
+
+            m_renderer->SubmitRenderCommand(command);
+            if (castsShadow) SubmitShadowCaster(transform, render, cascadeMask, pointShadowMask, worldCenter, worldRadius, entity);
+        }
+
+        m_entitiesCulled.fetch_add(culled, std::memory_order_relaxed);
+    });
+}
+
+// Uses the LOD the entity was last drawn with, fresh when it is on screen
+void RenderSystem::SubmitShadowCaster(const TransformComponent &transform, const RenderComponent &render, u32 cascadeMask,
+                                      u32 pointShadowMask, const glm::vec3 &worldCenter, f32 worldRadius, EntityID entity)
+{
+    ShadowCaster caster;
+    caster.worldMatrix = transform.worldMatrix;
+    caster.modelID = render.modelID;
+    caster.lodLevel = render.currentLOD;
+    caster.boundsCenter = worldCenter;
+    caster.boundsRadius = worldRadius;
+    caster.cascadeMask = cascadeMask;
+    caster.pointShadowMask = pointShadowMask;
+    caster.entityID = entity;
+
+    m_renderer->SubmitShadowCaster(caster);
+}
+
+void LightSystem::Update(ComponentManager &componentManager, f32 deltaTime)
+{
+    auto entities = componentManager.GetEntitiesWith(
+        ComponentManager::TRANSFORM | ComponentManager::LIGHT);
+
     for (EntityID entity : entities)
     {
         TransformComponent *transform = componentManager.GetTransform(entity);
-        RenderComponent *render = componentManager.GetRender(entity);
-
-        if (!render->isVisible) continue;
+        LightComponent *light = componentManager.GetLight(entity);
 
-        RenderCommand command;
-        command.worldMatrix = transform->worldMatrix;
-        command.normalMatrix = glm::transpose(glm::inverse(transform->worldMatrix));
-        command.modelID = render->modelID;
-        command.materialID = render->materialID;
-        command.entityID = entity;
+        PointLightData data;
+        data.position = glm::vec3(transform->worldMatrix[3]);
+        data.radius = light->radius;
+        data.color = light->color;
+        data.intensity = light->intensity;
+        data.castShadows = light->castShadows;
 
-        m_renderer->SubmitRenderCommand(command);
+        m_renderer->SubmitPointLight(data);
     }
-}
+
+    // Casters are culled against the lights that got a shadow map
+    m_renderer->AllocatePointShadows();
+}
\ No newline at end of file
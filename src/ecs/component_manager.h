@@ -6,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "defines.h"
+#include "job_system.h"
 #include "rendering/renderer.h"
 
 // Entity ID type
@@ -26,7 +27,17 @@ struct RenderComponent{
     u32 modelID = 0; // Index into model array
     u32 materialID = 0; // index into material array
     bool isVisible = true;
-    float lodDistance = 0.0f;
+    float lodDistance = 0.0f; // > 0 switches LOD every lodDistance units instead of by screen size
+    bool castShadows = true;
+
+    // LOD drawn last frame, used for hysteresis
+    u32 currentLOD = 0;
+};
+
+struct LightComponent{
+    glm::vec3 color{1.0f};
+    float intensity = 1.0f;
+    float radius = 10.0f; // influence range, light falls off to zero here
     bool castShadows = true;
 };
 
@@ -47,6 +58,7 @@ private:
     std::vector<TransformComponent> m_transforms;
     std::vector<RenderComponent> m_renderComponents;
     std::vector<HierarchyComponent> m_hierarchies;
+    std::vector<LightComponent> m_lights;
 
     // Components masks - which components each entity has
     std::vector<u32> m_componentMasks;
@@ -55,7 +67,8 @@ public:
     enum ComponentType: u32{
         TRANSFORM = 1 << 0,
         RENDER = 1 << 1,
-        HIERARCHY = 1 << 2
+        HIERARCHY = 1 << 2,
+        LIGHT = 1 << 3
     };
 
     // Entity creation/destruction
@@ -72,6 +85,9 @@ public:
     // Component addition/removal
     void AddHierarchy(EntityID entity, const HierarchyComponent& hierarchy = {});
 
+    // Component addition/removal
+    void AddLight(EntityID entity, const LightComponent& light = {});
+
     // Component access
     TransformComponent* GetTransform(EntityID entity);
 
@@ -79,6 +95,8 @@ public:
 
     HierarchyComponent *GetHierarchy(EntityID entity);
 
+    LightComponent *GetLight(EntityID entity);
+
     // Component queries - get all entities with specific components
     std::vector<EntityID> GetEntitiesWith(u32 componentMask) const;
 
@@ -86,6 +104,7 @@ public:
     const std::vector<EntityID>& GetAllEntities() const { return m_entities; }
     std::vector<TransformComponent>& GetTransforms() { return m_transforms; }
     std::vector<RenderComponent>& GetRenderComponents() { return m_renderComponents; }
+    std::vector<LightComponent>& GetLights() { return m_lights; }
     const std::vector<uint32_t>& GetComponentMasks() const { return m_componentMasks; }
     const std::vector<bool>& GetActiveEntities() const { return m_activeEntities; }
 };
@@ -105,11 +124,32 @@ private:
     void UpdateWorldMatrix(TransformComponent& transform);
 };
 
-// Render system - processes renderable entities
+// Render system - culls renderable entities and records render commands
+// on the job system, each worker covering a contiguous range of entities
 class RenderSystem: public System{
+private:
+    Renderer* m_renderer;
+    JobSystem* m_jobSystem;
+
+    // Statistics
+    std::atomic<u32> m_entitiesCulled{0};
+public:
+    RenderSystem(Renderer* renderer, JobSystem* jobSystem): m_renderer(renderer), m_jobSystem(jobSystem){}
+    void Update(ComponentManager& componentManager, f32 deltaTime) override;
+
+    u32 GetEntitiesCulled() const { return m_entitiesCulled.load(std::memory_order_relaxed); }
+
+private:
+    void SubmitShadowCaster(const TransformComponent& transform, const RenderComponent& render, u32 cascadeMask,
+                            u32 pointShadowMask, const glm::vec3& worldCenter, f32 worldRadius, EntityID entity);
+};
+
+// Light system - gathers light entities for the renderer and picks the ones
+// casting shadows, so it must run before the render system
+class LightSystem: public System{
 private:
     Renderer* m_renderer;
 public:
-    RenderSystem(Renderer* renderer): m_renderer(renderer){}
+    LightSystem(Renderer* renderer): m_renderer(renderer){}
     void Update(ComponentManager& componentManager, f32 deltaTime) override;
 };
\ No newline at end of file
@@ -0,0 +1,168 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+#include "defines.h"
+
+// Counts outstanding jobs so a caller can wait on a group of them
+struct JobCounter{
+    std::atomic<u32> pending{0};
+
+    bool IsDone() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+// Small fixed-size worker pool. Thread index 0 is always the thread that
+// created the pool (the main/context thread), workers are 1..N.
+class JobSystem{
+private:
+    struct Job{
+        std::function<void()> function;
+        JobCounter* counter = nullptr;
+    };
+
+    std::vector<std::thread> m_workers;
+    std::deque<Job> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_jobAvailable;
+    bool m_shutdown = false;
+
+    static u32& ThreadIndexStorage(){
+        static thread_local u32 threadIndex = 0;
+        return threadIndex;
+    }
+
+public:
+    // workerCount == 0 picks one worker per hardware thread minus the caller
+    explicit JobSystem(u32 workerCount = 0){
+        if(workerCount == 0){
+            u32 hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+
+        m_workers.reserve(workerCount);
+        for(u32 i = 0; i < workerCount; i++){
+            m_workers.emplace_back([this, i](){ WorkerLoop(i + 1); });
+        }
+    }
+
+    ~JobSystem(){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_jobAvailable.notify_all();
+
+        for(auto& worker: m_workers){
+            worker.join();
+        }
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Workers plus the calling thread
+    u32 GetThreadCount() const { return static_cast<u32>(m_workers.size()) + 1; }
+
+    // Index of the current thread in [0, GetThreadCount())
+    static u32 GetThreadIndex() { return ThreadIndexStorage(); }
+
+    // Queue a job, counter (optional) is decremented when it finishes
+    void Submit(std::function<void()> function, JobCounter* counter = nullptr){
+        if(counter){
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back({std::move(function), counter});
+        }
+        m_jobAvailable.notify_one();
+    }
+
+    // Block until the counter reaches zero, running queued jobs meanwhile
+    // so waiting from inside a job can't deadlock the pool
+    void Wait(JobCounter& counter){
+        while(!counter.IsDone()){
+            if(!RunPendingJob()){
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Split [0, count) into contiguous ranges of at least minBatchSize and
+    // run fn(begin, end, threadIndex) on them. The caller takes part and the
+    // call returns once every range is done.
+    template<typename Fn>
+    void ParallelFor(u32 count, u32 minBatchSize, Fn&& fn){
+        if(count == 0) return;
+
+        minBatchSize = std::max(minBatchSize, 1u);
+        u32 batchCount = std::min(GetThreadCount(), (count + minBatchSize - 1) / minBatchSize);
+
+        if(batchCount <= 1){
+            fn(0u, count, GetThreadIndex());
+            return;
+        }
+
+        u32 batchSize = (count + batchCount - 1) / batchCount;
+        JobCounter counter;
+
+        for(u32 batch = 1; batch < batchCount; batch++){
+            u32 begin = batch * batchSize;
+            u32 end = std::min(begin + batchSize, count);
+            if(begin >= end) break;
+
+            Submit([&fn, begin, end](){ fn(begin, end, GetThreadIndex()); }, &counter);
+        }
+
+        fn(0u, std::min(batchSize, count), GetThreadIndex());
+        Wait(counter);
+    }
+
+private:
+    void WorkerLoop(u32 threadIndex){
+        ThreadIndexStorage() = threadIndex;
+
+        while(true){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_jobAvailable.wait(lock, [this](){ return m_shutdown || !m_jobs.empty(); });
+
+                if(m_shutdown && m_jobs.empty()) return;
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            Execute(job);
+        }
+    }
+
+    bool RunPendingJob(){
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_jobs.empty()) return false;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        Execute(job);
+        return true;
+    }
+
+    void Execute(Job& job){
+        job.function();
+        if(job.counter){
+            job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+};
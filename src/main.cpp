@@ -14,7 +14,10 @@
 #include "ecs/component_manager.h"
 #include "assets/asset_manager.h"
 #include "rendering/gpu_resource_manager.h"
+#include "rendering/render_thread.h"
+#include "rendering/gl_extensions.h"
 #include "ecs/scene.h"
+#include "job_system.h"
 #include "shader.h"
 #include "camera.h"
 
@@ -36,9 +39,10 @@ void error_callback_glfw(int error, const char* description) {
   fprintf( stderr, "GLFW ERROR: code %i msg: %s.\n", error, description );
 }
 
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+void framebuffer_size_callback(GLFWwindow* window, int /*width*/, int /*height*/)
 {
-    glViewport(0, 0, width, height);
+    // The viewport is set by the renderer from the frame packet, the context
+    // may be bound to the render thread
 }
 
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
@@ -176,6 +180,10 @@ int main( void ) {
   printf( "Renderer: %s.\n", glGetString( GL_RENDERER ) );
   printf( "OpenGL version supported %s.\n", glGetString( GL_VERSION ) );
 
+  // Create the ImGui font texture and shaders while the context is still
+  // current here, the simulation thread never calls into GL afterwards
+  ImGui_ImplOpenGL3_CreateDeviceObjects();
+
   double prev_s = glfwGetTime();  // Set the initial 'previous time'.
   double title_countdown_s = 0.2;
 
@@ -191,34 +199,6 @@ int main( void ) {
   //glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
   //glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
-  u32 framebuffer;
-  glGenFramebuffers(1, &framebuffer);
-  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-
-  // generate texture
-  u32 textureColorbuffer;
-  glGenTextures(1, &textureColorbuffer);
-  glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, win_w, win_h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glBindTexture(GL_TEXTURE_2D, 0);
-
-  // attach it to currently bound framebuffer object
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureColorbuffer, 0);
-
-  u32 rbo;
-  glGenRenderbuffers(1, &rbo);
-  glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, win_w, win_h);
-  glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
-
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
   //Shader lightingShader("lighting.vert", "lighting.frag");
   Shader lightCubeShader("lightCube.vert", "lightCube.frag");
 
@@ -226,13 +206,35 @@ int main( void ) {
   //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   
   // CREATE CORE SYSTEMS
-  AssetManager assetManager;
+  JobSystem jobSystem;
+  AssetManager assetManager(&jobSystem);
   GPUResourceManager gpuManager(&assetManager);
-  Renderer renderer(&assetManager, &gpuManager);
+  Renderer renderer(&assetManager, &gpuManager, &jobSystem);
+
+  // Textures are cooked only into formats this driver samples
+  TextureCompressionSettings& textureCompression = assetManager.GetImportSettings().textures;
+  textureCompression.s3tc = S3TCFormats::IsSupported();
+  textureCompression.bptc = GLAD_GL_VERSION_4_2 || HasGLExtension("GL_ARB_texture_compression_bptc");
+
+  // Hidden window whose context shares objects with the main one, same context hints
+  if (useLoaderThread)
+  {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* loaderContext = glfwCreateWindow(1, 1, "Loader", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (loaderContext)
+      gpuManager.StartLoaderThread(loaderContext);
+    else
+      fprintf(stderr, "WARNING: no shared context, uploads stay on the render thread.\n");
+  }
 
   // CREATE SCENE WITH ECS
   Scene scene;
-  scene.AddSystem(std::make_unique<RenderSystem>(&renderer));
+  // Lights first, the render system culls shadow casters against them
+  scene.AddSystem(std::make_unique<LightSystem>(&renderer));
+  auto renderSystem = std::make_unique<RenderSystem>(&renderer, &jobSystem);
+  RenderSystem* renderSystemPtr = renderSystem.get();
+  scene.AddSystem(std::move(renderSystem));
   //scene.AddSystem(std::make_unique<TransformSystem>());
 
   // Load a model
@@ -280,6 +282,30 @@ int main( void ) {
         pointLightPositions[3]  // Position in world
   );
 
+  // The cubes double as point lights
+  EntityID lightCubes[] = {e_lightCube1, e_lightCube2, e_lightCube3, e_lightCube4};
+  for (int i = 0; i < 4; i++)
+  {
+        LightComponent light;
+        light.color = pointLightColors[i];
+        light.radius = pointLightRadius;
+        scene.GetComponentManager().AddLight(lightCubes[i], light);
+  }
+
+  // Foliage drawn through the weighted blended transparency pass
+  MaterialID grassMaterial = assetManager.CreateMaterial("grass");
+  if (Material* grass = assetManager.GetMaterial(grassMaterial))
+  {
+        grass->diffuseTexture = assetManager.LoadTexture("../assets/textures/grass.png");
+        grass->specularTexture = grass->diffuseTexture;
+        grass->alphaBlend = true;
+  }
+  for (int i = 0; i < 3; i++)
+  {
+        scene.CreateRenderableObject("grass" + std::to_string(i), cubeModel, grassMaterial,
+                                     glm::vec3(-1.5f + 1.5f * i, -0.5f, 1.5f));
+  }
+
   printf("backpack entity: %d", scene.GetEntityByName("backpack"));
   // Create a basic material
   //MaterialID defaultMaterial = assetManager.CreateMaterial("default");
@@ -288,6 +314,20 @@ int main( void ) {
 
   std::optional<int> selectedEntityId;
 
+  // Hand the context to the render thread, otherwise render inline
+  std::unique_ptr<RenderThread> renderThread;
+  FramePacket immediatePacket;
+  if (renderFrameLatency > 0)
+  {
+    renderThread = std::make_unique<RenderThread>(window, &renderer, renderFrameLatency);
+    renderThread->Start();
+  }
+  int frameLatencySetting = static_cast<int>(renderFrameLatency);
+  u64 frameIndex = 0;
+  // Cold start cost, glfwGetTime counts from glfwInit
+  double firstFrameTime = -1.0;
+  bool startupReported = false;
+
   while ( !glfwWindowShouldClose( window ) ) 
   {
     glfwPollEvents(); // Update window events.
@@ -299,6 +339,9 @@ int main( void ) {
       continue;
     }
 
+    // Blocks while the render thread is frameLatency frames behind
+    FramePacket* packet = renderThread ? renderThread->AcquirePacket() : &immediatePacket;
+
     float currentFrame = static_cast<float>(glfwGetTime());
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;  
@@ -306,7 +349,8 @@ int main( void ) {
     // ===============
     // Dear ImGui START
     // ===============
-    ImGui_ImplOpenGL3_NewFrame();
+    if (!renderThread)
+      ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
@@ -314,9 +358,148 @@ int main( void ) {
       ImGui::Begin("Statistics");
     
       ImGui::Text("Loaded: %d models, %d vertices", assetManager.GetStats().modelsLoaded, assetManager.GetStats().totalVertices);
+      ImGui::Text("LOD meshes: %d, %d triangles", assetManager.GetStats().lodMeshesGenerated, assetManager.GetStats().lodTriangles);
+      ImGui::Text("Meshlets: %d", assetManager.GetStats().meshletsBuilt);
+      if (ImGui::TreeNode("Vertex cache (ACMR / ATVR)"))
+      {
+        for (const MeshOptimizeReport& report : assetManager.GetStats().meshOptimization)
+          ImGui::Text("%s: %.3f / %.3f -> %.3f / %.3f", report.name.c_str(), report.before.acmr, report.before.atvr,
+                      report.after.acmr, report.after.atvr);
+        ImGui::TreePop();
+      }
+      ImGui::Text("GPU meshes: %d, %d quantized, %.1f MB", gpuManager.GetMeshesUploaded(), gpuManager.GetMeshesQuantized(),
+                  gpuManager.GetGPUMemoryUsed() / (1024.0 * 1024.0));
+
+      const TextureStreamer& textureStreamer = gpuManager.GetTextureStreamer();
+      ResidencySettings& residencySettings = renderer.GetResidencySettings();
+      int vramBudget = static_cast<int>(residencySettings.budgetMB);
+      if (ImGui::SliderInt("VRAM budget (MB)", &vramBudget, 32, 4096))
+        residencySettings.budgetMB = static_cast<u32>(vramBudget);
+      int meshShare = static_cast<int>(residencySettings.meshPercent);
+      if (ImGui::SliderInt("Mesh share (%)", &meshShare, 0, 100))
+        residencySettings.meshPercent = static_cast<u32>(meshShare);
+      ImGui::Text("Meshes resident: %d, %.1f / %.1f MB, %d evicted", gpuManager.GetMeshesResident(),
+                  gpuManager.GetMeshBytesResident() / (1024.0 * 1024.0), residencySettings.GetMeshBudget() / (1024.0 * 1024.0),
+                  gpuManager.GetMeshesEvicted());
+      ImGui::Text("Textures resident: %.1f / %.1f MB, %d evicted", textureStreamer.GetResidentBytes() / (1024.0 * 1024.0),
+                  residencySettings.GetTextureBudget() / (1024.0 * 1024.0), textureStreamer.GetTexturesEvicted());
+      ImGui::Text("Geometry pool: %.1f MB, outside the budget", gpuManager.GetGeometryPoolBytes() / (1024.0 * 1024.0));
+      ImGui::Text("Material texture arrays: %.1f MB, layers in use count in the texture budget", renderer.GetMaterialArrayMemory() / (1024.0 * 1024.0));
+
+      TextureStreamingSettings& streamingSettings = renderer.GetTextureStreamingSettings();
+      ImGui::Checkbox("Texture streaming", &streamingSettings.enabled);
+      ImGui::SliderFloat("Texture mip bias", &streamingSettings.mipBias, -1.0f, 4.0f);
+      ImGui::Text("Textures: %d, %.1f MB resident, %.1f MB wanted, %d levels pending", textureStreamer.GetTextureCount(),
+                  textureStreamer.GetResidentBytes() / (1024.0 * 1024.0), textureStreamer.GetWantedBytes() / (1024.0 * 1024.0),
+                  textureStreamer.GetPendingLevels());
+      ImGui::Text("Texture levels: %d streamed, %d evicted, %.1f KB uploaded last frame", textureStreamer.GetLevelsStreamed(),
+                  textureStreamer.GetLevelsEvicted(), textureStreamer.GetUploadedBytes() / 1024.0);
+      ImGui::Text("Block compressed textures: %d, %d from the cook cache", assetManager.GetStats().texturesCompressed,
+                  assetManager.GetStats().texturesFromCache);
+
+      const UploadQueue& uploadQueue = gpuManager.GetUploadQueue();
+      UploadSettings& uploadSettings = renderer.GetUploadSettings();
+      int meshUploadBudget = static_cast<int>(uploadSettings.meshKBPerFrame);
+      if (ImGui::SliderInt("Mesh uploads (KB/frame)", &meshUploadBudget, 256, 65536))
+        uploadSettings.meshKBPerFrame = static_cast<u32>(meshUploadBudget);
+      ImGui::Text("Uploads: %.1f KB staged last frame, %d meshes waiting, %d frames in flight, %d direct",
+                  uploadQueue.GetStagedBytes() / 1024.0, gpuManager.GetPendingMeshes(), uploadQueue.GetSegmentsInFlight(),
+                  uploadQueue.GetDirectUploads());
+      if (const GLLoaderThread* loader = gpuManager.GetLoaderThread())
+        ImGui::Text("Loader thread: %d jobs in flight, %d done", loader->GetJobsQueued(), loader->GetJobsCompleted());
+      else
+        ImGui::Text("Loader thread: off, uploads staged on the render thread");
       ImGui::Text("Draw calls: %d, triangles: %d", renderer.GetDrawCalls(), renderer.GetTrianglesRendered());
+      ImGui::Text("Commands: %d, culled: %d (%d threads)", renderer.GetCommandsSubmitted(), renderSystemPtr->GetEntitiesCulled(), jobSystem.GetThreadCount());
+      ImGui::Text("Point lights: %d, max per cluster: %d", renderer.GetPointLightCount(), renderer.GetMaxLightsPerCluster());
+      ImGui::Text("Model shader permutations: %d, %d compiling, %d batches on fallback", renderer.GetShaderPermutations(),
+                  renderer.GetShaderPermutationsPending(), renderer.GetShaderFallbackBatches());
 
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+
+      ViewSettings& viewSettings = renderer.GetViewSettings();
+      const char* renderPaths[] = {"Forward", "Deferred", "Visibility buffer"};
+      int renderPath = static_cast<int>(viewSettings.renderPath);
+      if (ImGui::Combo("Render path", &renderPath, renderPaths, IM_ARRAYSIZE(renderPaths)))
+        viewSettings.renderPath = static_cast<RenderPath>(renderPath);
+      if (viewSettings.renderPath == RenderPath::VisibilityBuffer)
+        ImGui::Text("Material passes: %d", renderer.GetMaterialsResolved());
+      ImGui::Text("Render passes: %d, culled: %d", renderer.GetRenderPasses(), renderer.GetRenderPassesCulled());
+      ImGui::Text("Render targets: %.1f MB, %.1f MB without aliasing",
+                  renderer.GetPhysicalTargetMemory() / (1024.0f * 1024.0f), renderer.GetTransientTargetMemory() / (1024.0f * 1024.0f));
+
+      ShadowSettings& shadowSettings = renderer.GetShadowSettings();
+      ImGui::Checkbox("Shadows", &shadowSettings.enabled);
+      ImGui::SliderFloat("Shadow distance", &shadowSettings.shadowDistance, 10.0f, 100.0f);
+      ImGui::Text("Shadow cascades: %d rendered, %d cached, %d casters, %d draw calls",
+                  renderer.GetShadowCascadesRendered(), renderer.GetShadowCascadesCached(),
+                  renderer.GetShadowCasters(), renderer.GetShadowDrawCalls());
+
+      PointShadowSettings& pointShadowSettings = renderer.GetPointShadowSettings();
+      ImGui::Checkbox("Point light shadows", &pointShadowSettings.enabled);
+      ImGui::SliderFloat("Point shadow resolution", &pointShadowSettings.resolutionScale, 0.125f, 2.0f);
+      ImGui::Text("Point shadows: %d lights, %.0f%% of atlas, %d draw calls",
+                  renderer.GetPointShadowLights(), renderer.GetPointShadowAtlasUsage() * 100.0f, renderer.GetPointShadowDrawCalls());
+      ImGui::Text("Point shadow faces: %d drawn, %d culled",
+                  renderer.GetPointShadowFacesRendered(), renderer.GetPointShadowFacesCulled());
+
+      ImGui::Checkbox("Depth pre-pass", &viewSettings.depthPrePass);
+      ImGui::Checkbox("Merge material draws", &viewSettings.mergeMaterials);
+      if (viewSettings.mergeMaterials)
+        ImGui::Text("Material textures: %s, %s", renderer.UsesBindlessTextures() ? "bindless" : "texture arrays",
+                    renderer.UsesMultiDrawIndirect() ? "multi-draw indirect" : "one draw per mesh");
+      if (viewSettings.mergeMaterials)
+      {
+        ImGui::Checkbox("Meshlet culling", &viewSettings.meshletCulling);
+        ImGui::Text("Meshlets: %d tested, %d off-screen, %d back-facing", renderer.GetMeshletsTested(),
+                    renderer.GetMeshletsFrustumCulled(), renderer.GetMeshletsBackfaceCulled());
+        if (renderer.SupportsGPUCulling())
+          ImGui::Checkbox("GPU culling", &viewSettings.gpuCulling);
+        else
+          ImGui::Text("GPU culling: needs GL 4.3");
+        if (renderer.IsGPUCulled())
+        {
+          ImGui::Text("GPU culling (%s): %d instances, %d drawn, %d revealed", renderer.UsesIndirectDrawCount() ? "draw count" : "fixed count",
+                      renderer.GetGPUCullInstances(), renderer.GetGPUCullDrawnFirstPhase(), renderer.GetGPUCullDrawnSecondPhase());
+          ImGui::Text("GPU culled: %d off-screen, %d occluded", renderer.GetGPUCullFrustumCulled(), renderer.GetGPUCullOcclusionCulled());
+        }
+      }
+      ImGui::Text("Pre-pass draw calls: %d", renderer.GetDepthPrePassDrawCalls());
+
+      // Last measurement of each mode, so toggling shows the fragment shading saved
+      u64 shadedWithout = renderer.GetShadedFragments(false);
+      u64 shadedWith = renderer.GetShadedFragments(true);
+      ImGui::Text("Shaded fragments (%s): %llu off, %llu on", renderer.UsesPipelineStatistics() ? "FS invocations" : "samples passed",
+                  (unsigned long long)shadedWithout, (unsigned long long)shadedWith);
+      if (shadedWithout > 0 && shadedWith > 0)
+        ImGui::Text("Fragment shading saved: %.1f%%", 100.0 * (1.0 - (double)shadedWith / (double)shadedWithout));
+
+      LODSettings& lodSettings = renderer.GetLODSettings();
+      ImGui::SliderFloat("LOD bias", &lodSettings.bias, 0.05f, 2.0f);
+      ImGui::SliderFloat("LOD hysteresis", &lodSettings.hysteresis, 0.0f, 0.5f);
+
+      if (renderThread)
+      {
+        ImGui::Text("Render thread: %.3f ms, simulation waited %.3f ms", renderThread->GetRenderTimeMs(), renderThread->GetWaitTimeMs());
+        if (ImGui::SliderInt("Frame latency", &frameLatencySetting, 1, RenderThread::MAX_FRAME_LATENCY))
+          renderThread->SetFrameLatency(static_cast<u32>(frameLatencySetting));
+      }
+
+      const ProgramCacheStats& programCache = ProgramBinaryCache::GetStats();
+      double startupTime = renderThread ? renderThread->GetFirstFrameTime() : firstFrameTime;
+      if (startupTime >= 0.0)
+        ImGui::Text("Startup: %.0f ms to first frame", startupTime * 1000.0);
+      ImGui::Text("Programs: %d from binary cache (%.1f ms), %d compiled (%.1f ms), %d rejected",
+                  programCache.programsLoaded.load(), programCache.loadMs.load(),
+                  programCache.programsCompiled.load(), programCache.compileMs.load(),
+                  programCache.binariesRejected.load());
+      if (startupTime >= 0.0 && !startupReported)
+      {
+        printf("Startup: %.0f ms to first frame, %d programs from cache, %d compiled (%.1f ms)\n",
+               startupTime * 1000.0, programCache.programsLoaded.load(), programCache.programsCompiled.load(),
+               programCache.compileMs.load());
+        startupReported = true;
+      }
       
       ImGui::End();
     }
@@ -377,31 +560,41 @@ int main( void ) {
     // Dear ImGui END
     // ==============
 
-    // RENDER
-    // ------
-    glEnable(GL_DEPTH_TEST);
-
-    glClearColor( 0.1f, 0.1f, 0.1f, 1.0f);
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT /*| GL_STENCIL_BUFFER_BIT*/ );
-
-    glm::mat4 model = glm::mat4(1.0f);
+    // SIMULATE
+    // --------
     glm::mat4 view = camera.GetViewMatrix();
     glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 
+    glfwGetFramebufferSize(window, &packet->framebufferSize.x, &packet->framebufferSize.y);
     renderer.SetCamera(view, projection, camera.Position);
+    renderer.SetViewportSize(packet->framebufferSize.x, packet->framebufferSize.y);
 
     scene.Update(deltaTime);
 
-    renderer.RenderFrame();
+    packet->frameIndex = frameIndex++;
+    renderer.BuildFramePacket(*packet);
 
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-    // Put the stuff we've been drawing onto the visible area.
-    glfwSwapBuffers( window );
-    
+    // RENDER
+    // ------
+    if (renderThread)
+    {
+      packet->imgui.Capture(ImGui::GetDrawData());
+      renderThread->SubmitPacket(packet);
+    }
+    else
+    {
+      renderer.RenderFrame(*packet);
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      // Put the stuff we've been drawing onto the visible area.
+      glfwSwapBuffers( window );
+      if (firstFrameTime < 0.0)
+        firstFrameTime = glfwGetTime();
+    }
   }
 
-  glDeleteRenderbuffers(1, &rbo);
-  glDeleteFramebuffers(1, &framebuffer);
+  // Finish queued frames and take the context back
+  renderThread.reset();
+  gpuManager.StopLoaderThread();
 
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
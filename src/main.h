@@ -23,6 +23,13 @@ extern glm::vec3 lightPos;
 extern unsigned int numVerticesLoaded;
 extern unsigned int numTrianglesLoaded;
 
+// Frames the simulation may run ahead of the render thread, 0 renders on the main thread
+const u32 renderFrameLatency = 1;
+
+// Create and fill textures and buffers on a thread with its own shared
+// context, the render thread stages them itself when sharing fails
+const bool useLoaderThread = true;
+
 const glm::vec3 dirLightDirection(-0.2f, -1.0f, -0.3f);
 const glm::vec3 dirLightAmbient(0.05f, 0.05f, 0.05f);
 const glm::vec3 dirLightDiffuse(0.4f, 0.4f, 0.4f);
@@ -39,3 +46,5 @@ const glm::vec3 pointLightColors[] = {
     glm::vec3(1.0f, 0.0f, 0.0f),
     glm::vec3(1.0f, 1.0, 0.0),
     glm::vec3(0.2f, 0.2f, 1.0f)};
+
+const float pointLightRadius = 20.0f;
@@ -0,0 +1,146 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+
+#include <glad/gl.h>
+
+#include "defines.h"
+
+// Counters of the program cache, read by the UI
+struct ProgramCacheStats{
+    std::atomic<u32> programsLoaded{0};     // linked straight from a cached binary
+    std::atomic<u32> programsCompiled{0};   // compiled and linked from source
+    std::atomic<u32> binariesRejected{0};   // found on disk but refused by the driver
+    std::atomic<f32> loadMs{0.0f};
+    std::atomic<f32> compileMs{0.0f};        // calling thread only, driver compile threads excluded
+};
+
+// Linked program binaries on disk, one file per program. The key hashes
+// the final sources (defines included) with the driver's vendor, renderer
+// and version strings, so an edited shader or a driver update misses
+// instead of loading a stale binary. A driver may still refuse a binary it
+// wrote, the caller then compiles from source and stores the new one.
+class ProgramBinaryCache{
+private:
+    static constexpr u32 MAGIC = 0x43425053;    // "SPBC"
+    static constexpr const char* CACHE_DIRECTORY = "shader_cache/";
+
+    struct FileHeader{
+        u32 magic;
+        u32 binaryFormat;
+        u64 key;
+    };
+
+public:
+    static u64 Key(const std::string* sources, u32 count){
+        u64 hash = Hash(GetDriverString(), 14695981039346656037ull);
+        for(u32 i = 0; i < count; i++){
+            hash = Hash(sources[i], hash);
+            hash = Hash("\x1f", hash);   // stage separator
+        }
+        return hash;
+    }
+
+    // Links program from the cached binary, false when there is none or the
+    // driver rejects it and the program has to be built from source
+    static bool Load(u32 program, u64 key){
+        if(!IsSupported()) return false;
+
+        std::ifstream file(GetPath(key), std::ios::binary);
+        if(!file) return false;
+
+        FileHeader header;
+        if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+           header.magic != MAGIC || header.key != key) return false;
+
+        std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if(binary.empty()) return false;
+
+        glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if(linked != GL_TRUE){
+            GetStats().binariesRejected++;
+            return false;
+        }
+        GetStats().programsLoaded++;
+        return true;
+    }
+
+    // Call before linking so the driver keeps a retrievable binary
+    static void PrepareForStore(u32 program){
+        if(IsSupported()) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Writes a linked program's binary under key
+    static void Store(u32 program, u64 key){
+        if(!IsSupported()) return;
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(length <= 0) return;
+
+        std::vector<char> binary(length);
+        FileHeader header{MAGIC, 0, key};
+        glGetProgramBinary(program, length, nullptr, &header.binaryFormat, binary.data());
+
+        std::error_code error;
+        std::filesystem::create_directories(CACHE_DIRECTORY, error);
+        std::ofstream file(GetPath(key), std::ios::binary | std::ios::trunc);
+        if(!file) return;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), binary.size());
+    }
+
+    static ProgramCacheStats& GetStats(){
+        static ProgramCacheStats stats;
+        return stats;
+    }
+
+private:
+    // FNV-1a, 64 bit
+    static u64 Hash(const std::string& data, u64 hash){
+        for(unsigned char c: data){
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static std::string GetPath(u64 key){
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+        return std::string(CACHE_DIRECTORY) + name;
+    }
+
+    // A driver may expose no binary formats at all, the cache is off then
+    static bool IsSupported(){
+        static std::once_flag once;
+        static bool supported = false;
+        std::call_once(once, [](){
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            supported = formats > 0;
+        });
+        return supported;
+    }
+
+    static const std::string& GetDriverString(){
+        static std::once_flag once;
+        static std::string driver;
+        std::call_once(once, [](){
+            for(GLenum name: {GL_VENDOR, GL_RENDERER, GL_VERSION}){
+                const char* value = reinterpret_cast<const char*>(glGetString(name));
+                driver += value ? value : "";
+                driver += '\n';
+            }
+        });
+        return driver;
+    }
+};
@@ -0,0 +1,333 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <iostream>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/gpu_resource_manager.h"
+#include "rendering/frame_packet.h"
+#include "rendering/render_graph.h"
+#include "rendering/shadows.h"
+#include "rendering/point_shadows.h"
+#include "shader.h"
+#include "defines.h"
+
+struct DeferredStats{
+    u32 drawCalls = 0;
+    u32 trianglesRendered = 0;
+    u32 lightVolumes = 0;
+};
+
+// Deferred backend for opaque geometry. Fills the G-buffer, applies the
+// directional light with a full screen pass, then draws every point light as
+// one instanced batch of sphere volumes with additive blending. Volumes are
+// rendered back faces only with GL_GEQUAL, so shading is limited to pixels in
+// front of the back of the sphere and works with the camera inside it.
+// The G-buffer, 12 bytes per pixel plus the scene depth, is transient:
+//   RT0 RGBA8   albedo.rgb, metallic
+//   RT1 RGBA16  octahedral normal.xy, roughness, specular intensity
+//   depth       scene depth, world position is rebuilt from it
+class DeferredRenderer{
+private:
+    AssetManager* m_assetManager;
+    GPUResourceManager* m_gpuResourceManager;
+
+    std::unique_ptr<Shader> m_geometryShader;
+    std::unique_ptr<Shader> m_directionalShader;
+    std::unique_ptr<Shader> m_pointLightShader;
+
+    // Light volume geometry
+    u32 m_sphereVAO = 0;
+    u32 m_sphereVBO = 0;
+    u32 m_sphereEBO = 0;
+    u32 m_sphereIndexCount = 0;
+    u32 m_lightInstanceVBO = 0;
+    std::vector<glm::vec4> m_lightInstances;
+
+    // Attribute-less full screen triangle
+    u32 m_emptyVAO = 0;
+
+    DeferredStats m_stats;
+
+public:
+    DeferredRenderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager){
+        m_geometryShader = std::make_unique<Shader>("gbuffer.vert", "gbuffer.frag");
+        m_directionalShader = std::make_unique<Shader>("fullscreen.vert", "deferredDirectional.frag");
+        m_pointLightShader = std::make_unique<Shader>("deferredPointLight.vert", "deferredPointLight.frag");
+
+        CreateLightVolume();
+        glGenVertexArrays(1, &m_emptyVAO);
+    }
+
+    ~DeferredRenderer(){
+        glDeleteVertexArrays(1, &m_sphereVAO);
+        glDeleteVertexArrays(1, &m_emptyVAO);
+        glDeleteBuffers(1, &m_sphereVBO);
+        glDeleteBuffers(1, &m_sphereEBO);
+        glDeleteBuffers(1, &m_lightInstanceVBO);
+    }
+
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    // Adds the passes drawing the opaque batches into the scene targets.
+    // Packet and batches must stay alive until the graph has executed.
+    void AddPasses(RenderGraph& graph, const FramePacket& packet, const std::vector<RenderBatch>& batches,
+                   ShadowRenderer& shadows, PointShadowRenderer& pointShadows, const SceneTargets& targets){
+        m_stats = {};
+        glm::ivec2 size = graph.GetDesc(targets.color).size;
+
+        RGHandle albedoMetal = graph.CreateTexture("GBufferAlbedoMetal", {size, GL_RGBA8});
+        RGHandle normalRoughness = graph.CreateTexture("GBufferNormalRoughness", {size, GL_RGBA16});
+
+        graph.AddPass("GBuffer",
+            [&](RenderGraphBuilder& builder){
+                builder.WriteColor(albedoMetal, RGLoadOp::Clear);
+                builder.WriteColor(normalRoughness, RGLoadOp::Clear);
+                builder.WriteDepth(targets.depth, RGLoadOp::Clear);
+            },
+            [this, &packet, &batches](const RenderPassContext&){
+                GeometryPass(packet, batches);
+            });
+
+        // Depth is sampled and tested against at the same time, never written
+        graph.AddPass("DeferredLighting",
+            [&](RenderGraphBuilder& builder){
+                builder.Read(albedoMetal);
+                builder.Read(normalRoughness);
+                builder.Read(targets.depth);
+                if(targets.shadowMap != RG_INVALID_HANDLE) builder.Read(targets.shadowMap);
+                if(targets.pointShadowAtlas != RG_INVALID_HANDLE) builder.Read(targets.pointShadowAtlas);
+                builder.WriteColor(targets.color, RGLoadOp::Clear, SCENE_CLEAR_COLOR);
+                builder.WriteDepth(targets.depth);
+            },
+            [this, &packet, &shadows, &pointShadows, albedoMetal, normalRoughness, targets](const RenderPassContext& context){
+                GBufferTextures gBuffer;
+                gBuffer.albedoMetal = context.GetTexture(albedoMetal);
+                gBuffer.normalRoughness = context.GetTexture(normalRoughness);
+                gBuffer.depth = context.GetTexture(targets.depth);
+                gBuffer.size = context.GetSize(targets.depth);
+                LightingPass(packet, gBuffer, shadows, pointShadows);
+            });
+    }
+
+    const DeferredStats& GetStats() const { return m_stats; }
+
+private:
+    struct GBufferTextures{
+        u32 albedoMetal = 0;
+        u32 normalRoughness = 0;
+        u32 depth = 0;
+        glm::ivec2 size{0};
+    };
+
+    void GeometryPass(const FramePacket& packet, const std::vector<RenderBatch>& batches){
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+
+        m_geometryShader->use();
+        m_geometryShader->setMat4("view", packet.camera.view);
+        m_geometryShader->setMat4("projection", packet.camera.projection);
+        m_geometryShader->setInt("material.texture_diffuse1", 0);
+        m_geometryShader->setInt("material.texture_specular1", 1);
+
+        for(const RenderBatch& batch: batches){
+            if(batch.isTransparent) continue;
+
+            BindMaterial(batch.materialID);
+            for(const RenderCommand* command: batch.commands){
+                DrawCommand(*command);
+            }
+        }
+
+        glBindVertexArray(0);
+    }
+
+    void BindMaterial(MaterialID materialID){
+        const Material* material = m_assetManager->GetMaterial(materialID);
+        if(!material) return;
+
+        m_geometryShader->setVec3("material.diffuse", material->diffuse);
+        m_geometryShader->setBool("material.hasDiffuseMap", material->diffuseTexture != INVALID_TEXTURE);
+        m_geometryShader->setFloat("material.roughness", material->roughness);
+        m_geometryShader->setFloat("material.metallic", material->metallic);
+
+        BindTexture(GL_TEXTURE0, material->diffuseTexture);
+        BindTexture(GL_TEXTURE1, material->specularTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // White when the material has no such texture
+    void BindTexture(GLenum unit, TextureID textureID){
+        GPUTexture* texture = m_gpuResourceManager->GetGPUTexture(textureID);
+        if(!texture) texture = m_gpuResourceManager->GetFallbackTexture();
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D, texture->textureID);
+    }
+
+    void DrawCommand(const RenderCommand& command){
+        const ModelAsset* model = m_assetManager->GetModel(command.modelID);
+        if(!model) return;
+
+        m_geometryShader->setMat4("normalMatrix", command.normalMatrix);
+
+        for(MeshID meshID: model->GetLODMeshes(command.lodLevel)){
+            GPUMesh* gpuMesh = m_gpuResourceManager->GetGPUMesh(meshID);
+            if(!gpuMesh) continue;
+
+            m_geometryShader->setMat4("model", command.worldMatrix * gpuMesh->positionDecode);
+            m_geometryShader->setBool("octNormals", gpuMesh->octNormals);
+            glBindVertexArray(gpuMesh->VAO);
+            glDrawElements(GL_TRIANGLES, gpuMesh->indexCount, gpuMesh->indexType, 0);
+
+            m_stats.drawCalls++;
+            m_stats.trianglesRendered += gpuMesh->indexCount / 3;
+        }
+    }
+
+    void BindGBuffer(Shader& shader, const FramePacket& packet, const GBufferTextures& gBuffer){
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.albedoMetal);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.normalRoughness);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, gBuffer.depth);
+
+        shader.setInt("gAlbedoMetal", 0);
+        shader.setInt("gNormalRoughness", 1);
+        shader.setInt("gDepth", 2);
+        shader.setMat4("inverseViewProjection", glm::inverse(packet.camera.projection * packet.camera.view));
+        shader.setVec2("screenSize", glm::vec2(gBuffer.size));
+        shader.setVec3("viewPos", packet.camera.position);
+    }
+
+    void LightingPass(const FramePacket& packet, const GBufferTextures& gBuffer, ShadowRenderer& shadows,
+                      PointShadowRenderer& pointShadows){
+        glDepthMask(GL_FALSE);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+
+        // Directional light, only where geometry was written
+        glDisable(GL_CULL_FACE);
+        glDepthFunc(GL_GREATER);
+
+        m_directionalShader->use();
+        BindGBuffer(*m_directionalShader, packet, gBuffer);
+        m_directionalShader->setVec3("dirLight.direction", packet.dirLight.direction);
+        m_directionalShader->setVec3("dirLight.ambient", packet.dirLight.ambient);
+        m_directionalShader->setVec3("dirLight.diffuse", packet.dirLight.diffuse);
+        m_directionalShader->setVec3("dirLight.specular", packet.dirLight.specular);
+        // The G-buffer has no receive flag, every opaque surface receives
+        m_directionalShader->setMat4("view", packet.camera.view);
+        shadows.Bind(*m_directionalShader, packet);
+
+        glBindVertexArray(m_emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        m_stats.drawCalls++;
+
+        // Point light volumes, one instanced draw
+        if(!packet.pointLights.empty()){
+            m_lightInstances.clear();
+            for(const PointLightData& light: packet.pointLights){
+                m_lightInstances.emplace_back(light.position, light.radius);
+                m_lightInstances.emplace_back(light.color * light.intensity, static_cast<f32>(light.shadowIndex + 1));
+            }
+
+            glBindBuffer(GL_ARRAY_BUFFER, m_lightInstanceVBO);
+            glBufferData(GL_ARRAY_BUFFER, m_lightInstances.size() * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, m_lightInstances.size() * sizeof(glm::vec4), m_lightInstances.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_FRONT);
+            glDepthFunc(GL_GEQUAL);
+
+            m_pointLightShader->use();
+            BindGBuffer(*m_pointLightShader, packet, gBuffer);
+            m_pointLightShader->setMat4("viewProjection", packet.camera.projection * packet.camera.view);
+            pointShadows.Bind(*m_pointLightShader);
+
+            u32 lightCount = static_cast<u32>(packet.pointLights.size());
+            glBindVertexArray(m_sphereVAO);
+            glDrawElementsInstanced(GL_TRIANGLES, m_sphereIndexCount, GL_UNSIGNED_INT, 0, lightCount);
+
+            m_stats.drawCalls++;
+            m_stats.lightVolumes = lightCount;
+        }
+
+        glBindVertexArray(0);
+        glDisable(GL_BLEND);
+        glCullFace(GL_BACK);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Low poly UV sphere, pushed out so its faces enclose the unit sphere
+    void CreateLightVolume(){
+        const u32 segments = 16;
+        const u32 rings = 8;
+        const f32 scale = 1.0f / (std::cos(glm::pi<f32>() / segments) * std::cos(glm::pi<f32>() / (2 * rings)));
+
+        std::vector<glm::vec3> positions;
+        for(u32 ring = 0; ring <= rings; ring++){
+            f32 theta = glm::pi<f32>() * ring / rings;
+            for(u32 segment = 0; segment <= segments; segment++){
+                f32 phi = glm::two_pi<f32>() * segment / segments;
+                positions.emplace_back(std::sin(theta) * std::cos(phi) * scale,
+                                       std::cos(theta) * scale,
+                                       std::sin(theta) * std::sin(phi) * scale);
+            }
+        }
+
+        // Counter-clockwise seen from outside
+        std::vector<u32> indices;
+        for(u32 ring = 0; ring < rings; ring++){
+            for(u32 segment = 0; segment < segments; segment++){
+                u32 a = ring * (segments + 1) + segment;
+                u32 b = a + segments + 1;
+                indices.insert(indices.end(), {a, a + 1, b, b, a + 1, b + 1});
+            }
+        }
+        m_sphereIndexCount = static_cast<u32>(indices.size());
+
+        glGenVertexArrays(1, &m_sphereVAO);
+        glGenBuffers(1, &m_sphereVBO);
+        glGenBuffers(1, &m_sphereEBO);
+        glGenBuffers(1, &m_lightInstanceVBO);
+
+        glBindVertexArray(m_sphereVAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, m_sphereVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_sphereEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(u32), indices.data(), GL_STATIC_DRAW);
+
+        // Per light: (position, radius), (color, unused)
+        glBindBuffer(GL_ARRAY_BUFFER, m_lightInstanceVBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (void*)sizeof(glm::vec4));
+        glVertexAttribDivisor(2, 1);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
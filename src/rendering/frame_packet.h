@@ -0,0 +1,187 @@
+#pragma once
+#include <vector>
+
+#include <imgui.h>
+#include <glm/glm.hpp>
+
+#include "rendering/gpu_resource_manager.h"
+#include "defines.h"
+
+struct CameraData{
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    glm::vec3 position{0.0f};
+    glm::vec3 front{0.0f, 0.0f, -1.0f};
+};
+
+enum class RenderPath{
+    Forward,
+    Deferred,
+    VisibilityBuffer
+};
+
+// Per view render options
+struct ViewSettings{
+    RenderPath renderPath = RenderPath::Forward;
+    bool depthPrePass = false;  // forward only: lay down opaque depth first, then shade with GL_EQUAL
+    bool mergeMaterials = false;    // forward only: one multi-draw over all opaque materials
+    bool meshletCulling = true;     // merged draws only: skip off-screen and back-facing meshlets
+    bool gpuCulling = false;        // merged draws only: frustum and occlusion cull in compute, needs GL 4.3
+};
+
+struct DirectionalLightData{
+    glm::vec3 direction{0.0f, -1.0f, 0.0f};
+    glm::vec3 ambient{0.0f};
+    glm::vec3 diffuse{0.0f};
+    glm::vec3 specular{0.0f};
+};
+
+// Point light, attenuation is windowed to reach zero at radius so the light
+// can be binned into clusters
+struct PointLightData{
+    glm::vec3 position{0.0f};
+    f32 radius = 10.0f;
+    glm::vec3 color{1.0f};
+    f32 intensity = 1.0f;
+    bool castShadows = true;
+    i32 shadowIndex = -1;   // into FramePacket::pointShadows, -1 if it got no shadow map
+};
+
+// Cube shadow map of one point light. The six faces are tiles of a 3x2
+// block in the shared atlas, face i at (i % 3, i / 3) * faceSize.
+struct PointShadowData{
+    u32 lightIndex = 0;
+    glm::vec3 position{0.0f};
+    f32 radius = 0.0f;          // far plane of the faces
+    f32 nearPlane = 0.05f;
+    glm::uvec2 atlasOffset{0};  // texels
+    u32 faceSize = 0;           // texels per face side
+};
+
+// Clustered light lists, see LightClusterBuilder
+struct LightClusterData{
+    glm::uvec3 dimensions{0};
+    f32 zScale = 0.0f;
+    f32 zBias = 0.0f;
+
+    std::vector<u32> grid;          // (offset, count) per cluster
+    std::vector<u32> lightIndices;  // indices into FramePacket::pointLights
+    u32 maxLightsPerCluster = 0;
+};
+
+// One cascade of the directional light's shadow map. The light space
+// projection is orthographic and centered on a bounding sphere of the view
+// frustum slice, snapped to whole texels so the map does not shimmer.
+struct ShadowCascade{
+    glm::mat4 view{1.0f};
+    glm::mat4 projection{1.0f};
+    glm::mat4 viewProjection{1.0f};
+    f32 splitFar = 0.0f;    // view depth where the next cascade takes over
+    f32 extent = 0.0f;      // half size of the ortho box
+    f32 texelSize = 0.0f;   // world units per shadow map texel
+    bool cached = false;    // only re-rendered when its matrix or casters change
+};
+
+struct ShadowCascadeData{
+    static constexpr u32 MAX_CASCADES = 4;
+
+    u32 cascadeCount = 0;   // 0 when shadows are off
+    u32 resolution = 0;
+    ShadowCascade cascades[MAX_CASCADES];
+};
+
+// Shadow caster, culled against each cascade separately since it may be
+// outside the camera frustum and still cast into it
+struct ShadowCaster{
+    glm::mat4 worldMatrix{1.0f};
+    ModelAssetID modelID = INVALID_MODEL;
+    u32 lodLevel = 0;
+    glm::vec3 boundsCenter{0.0f};   // world space bounding sphere
+    f32 boundsRadius = 0.0f;
+    u32 cascadeMask = 0;        // bit i set if it touches cascade i
+    u32 pointShadowMask = 0;    // bit i set if it is inside the radius of point shadow i
+    u32 entityID = 0;
+};
+
+struct SpotLightData{
+    glm::vec3 position{0.0f};
+    glm::vec3 direction{0.0f, 0.0f, -1.0f};
+    glm::vec3 ambient{0.0f};
+    glm::vec3 diffuse{0.0f};
+    glm::vec3 specular{0.0f};
+    f32 constant = 1.0f;
+    f32 linear = 0.09f;
+    f32 quadratic = 0.032f;
+    f32 cutOff = 1.0f;
+    f32 outerCutOff = 1.0f;
+};
+
+// Deep copy of ImGui draw data. The lists returned by ImGui::GetDrawData()
+// are owned by the ImGui context and rebuilt on the next NewFrame(), so the
+// render thread gets its own copy.
+struct ImGuiDrawSnapshot{
+    ImDrawData drawData;
+
+    ImGuiDrawSnapshot() = default;
+    ImGuiDrawSnapshot(const ImGuiDrawSnapshot&) = delete;
+    ImGuiDrawSnapshot& operator=(const ImGuiDrawSnapshot&) = delete;
+
+    ~ImGuiDrawSnapshot(){
+        Clear();
+    }
+
+    void Capture(const ImDrawData* source){
+        Clear();
+        if(!source || !source->Valid) return;
+
+        drawData.Valid = true;
+        drawData.DisplayPos = source->DisplayPos;
+        drawData.DisplaySize = source->DisplaySize;
+        drawData.FramebufferScale = source->FramebufferScale;
+
+        // Clones only carry the output buffers, so they are appended directly
+        // instead of through AddDrawList() which validates builder state
+        for(ImDrawList* drawList: source->CmdLists){
+            drawData.CmdLists.push_back(drawList->CloneOutput());
+        }
+        drawData.CmdListsCount = drawData.CmdLists.Size;
+        drawData.TotalVtxCount = source->TotalVtxCount;
+        drawData.TotalIdxCount = source->TotalIdxCount;
+    }
+
+    void Clear(){
+        for(ImDrawList* drawList: drawData.CmdLists){
+            IM_DELETE(drawList);
+        }
+        drawData.Clear();
+    }
+};
+
+// Everything the render thread needs to draw one frame. Built by the
+// simulation thread and treated as immutable once submitted.
+struct FramePacket{
+    u64 frameIndex = 0;
+    glm::ivec2 framebufferSize{0};
+
+    CameraData camera;
+    ViewSettings viewSettings;
+    TextureStreamingSettings textureStreaming;
+    UploadSettings uploads;
+    ResidencySettings residency;
+
+    DirectionalLightData dirLight;
+    std::vector<PointLightData> pointLights;
+    LightClusterData lightClusters;
+    SpotLightData spotLight;
+
+    ShadowCascadeData shadowCascades;
+    std::vector<PointShadowData> pointShadows;
+    u32 pointShadowAtlasSize = 0;
+    std::vector<ShadowCaster> shadowCasters;
+
+    // Draw packets in sort key order
+    std::vector<RenderCommand> commands;
+    std::vector<u64> sortKeys;
+
+    ImGuiDrawSnapshot imgui;
+};
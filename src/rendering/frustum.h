@@ -0,0 +1,47 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "defines.h"
+
+// View frustum as six inward facing planes (xyz = normal, w = distance)
+struct Frustum{
+    enum Plane: u32{
+        PLANE_LEFT = 0,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+        PLANE_COUNT
+    };
+
+    glm::vec4 planes[PLANE_COUNT];
+
+    // Gribb/Hartmann plane extraction from a combined projection * view matrix
+    void Extract(const glm::mat4& viewProjection){
+        glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+        glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+        glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+        planes[PLANE_LEFT] = row3 + row0;
+        planes[PLANE_RIGHT] = row3 - row0;
+        planes[PLANE_BOTTOM] = row3 + row1;
+        planes[PLANE_TOP] = row3 - row1;
+        planes[PLANE_NEAR] = row3 + row2;
+        planes[PLANE_FAR] = row3 - row2;
+
+        for(auto& plane: planes){
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+
+    bool IntersectsSphere(const glm::vec3& center, f32 radius) const {
+        for(const auto& plane: planes){
+            if(glm::dot(glm::vec3(plane), center) + plane.w < -radius){
+                return false;
+            }
+        }
+        return true;
+    }
+};
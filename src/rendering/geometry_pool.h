@@ -0,0 +1,204 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/upload_queue.h"
+#include "defines.h"
+
+// Location of a mesh inside the geometry pool
+struct GeometryAllocation{
+    u32 baseVertex = 0;
+    u32 vertexCount = 0;
+    u32 firstIndex = 0;
+    u32 indexCount = 0;
+};
+
+// Mega-buffer holding the vertices and indices of many meshes, so they can be
+// drawn from one VAO with base vertex offsets and fetched by index from
+// shaders. Indices stay local to their mesh; add baseVertex when fetching.
+// The same storage is exposed as texture buffers for programmable vertex
+// fetch: two RGBA32F texels per vertex, (position.xyz, normal.x) and
+// (normal.yz, uv.xy), and one R32UI texel per index.
+class GeometryPool{
+private:
+    UploadQueue* m_uploadQueue;
+
+    u32 m_VAO = 0;
+    u32 m_VBO = 0;
+    u32 m_EBO = 0;
+    u32 m_vertexTexture = 0;
+    u32 m_indexTexture = 0;
+
+    // 0, 1, 2, ... as an instanced attribute at location 3. Multi-draw
+    // indirect passes the draw index as base instance, which gives shaders a
+    // draw ID without gl_DrawID.
+    u32 m_drawIDBuffer = 0;
+    u32 m_drawIDCapacity = 0;
+
+    u32 m_vertexCapacity = 0;
+    u32 m_indexCapacity = 0;
+    u32 m_vertexCount = 0;
+    u32 m_indexCount = 0;
+
+    std::unordered_map<MeshID, GeometryAllocation> m_allocations;
+
+public:
+    explicit GeometryPool(UploadQueue* uploadQueue, u32 initialVertexCapacity = 1 << 16, u32 initialIndexCapacity = 1 << 18)
+    : m_uploadQueue(uploadQueue){
+        glGenVertexArrays(1, &m_VAO);
+        glGenTextures(1, &m_vertexTexture);
+        glGenTextures(1, &m_indexTexture);
+        Reallocate(initialVertexCapacity, initialIndexCapacity);
+    }
+
+    ~GeometryPool(){
+        glDeleteVertexArrays(1, &m_VAO);
+        glDeleteBuffers(1, &m_VBO);
+        glDeleteBuffers(1, &m_EBO);
+        glDeleteBuffers(1, &m_drawIDBuffer);
+        glDeleteTextures(1, &m_vertexTexture);
+        glDeleteTextures(1, &m_indexTexture);
+    }
+
+    GeometryPool(const GeometryPool&) = delete;
+    GeometryPool& operator=(const GeometryPool&) = delete;
+
+    // Existing allocation of the mesh, or appends it to the pool
+    const GeometryAllocation& Allocate(MeshID meshID, const MeshData& meshData){
+        auto it = m_allocations.find(meshID);
+        if(it != m_allocations.end()){
+            return it->second;
+        }
+
+        u32 vertexCount = static_cast<u32>(meshData.vertices.size());
+        u32 indexCount = static_cast<u32>(meshData.indices.size());
+
+        // Grow geometrically, copying the existing contents on the GPU
+        if(m_vertexCount + vertexCount > m_vertexCapacity || m_indexCount + indexCount > m_indexCapacity){
+            Reallocate(std::max(m_vertexCapacity * 2, m_vertexCount + vertexCount),
+                       std::max(m_indexCapacity * 2, m_indexCount + indexCount));
+        }
+
+        GeometryAllocation allocation;
+        allocation.baseVertex = m_vertexCount;
+        allocation.vertexCount = vertexCount;
+        allocation.firstIndex = m_indexCount;
+        allocation.indexCount = indexCount;
+
+        // Staged in one upload. The copies come before any draw that uses
+        // them in command order, so the allocation is usable right away.
+        size_t vertexBytes = vertexCount * sizeof(Vertex);
+        size_t indexBytes = indexCount * sizeof(u32);
+        m_uploadQueue->Upload(vertexBytes + indexBytes, [&](u8* staging){
+            std::memcpy(staging, meshData.vertices.data(), vertexBytes);
+            std::memcpy(staging + vertexBytes, meshData.indices.data(), indexBytes);
+        }, [&](const UploadSource& source){
+            // EBO binding is VAO state, upload through the copy target instead
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_VBO);
+            source.CopyToBuffer(allocation.baseVertex * sizeof(Vertex), 0, vertexBytes);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_EBO);
+            source.CopyToBuffer(allocation.firstIndex * sizeof(u32), vertexBytes, indexBytes);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        });
+
+        m_vertexCount += vertexCount;
+        m_indexCount += indexCount;
+
+        return m_allocations[meshID] = allocation;
+    }
+
+    const GeometryAllocation* GetAllocation(MeshID meshID) const {
+        auto it = m_allocations.find(meshID);
+        return it != m_allocations.end() ? &it->second : nullptr;
+    }
+
+    // Enables the draw ID attribute, covering at least drawCount draws
+    void ReserveDrawIDs(u32 drawCount){
+        if(drawCount <= m_drawIDCapacity) return;
+
+        m_drawIDCapacity = std::max(m_drawIDCapacity * 2, std::max(drawCount, 1024u));
+        std::vector<u32> drawIDs(m_drawIDCapacity);
+        for(u32 i = 0; i < m_drawIDCapacity; i++){
+            drawIDs[i] = i;
+        }
+
+        if(!m_drawIDBuffer) glGenBuffers(1, &m_drawIDBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_drawIDBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawIDs.size() * sizeof(u32), drawIDs.data(), GL_STATIC_DRAW);
+
+        glBindVertexArray(m_VAO);
+        glEnableVertexAttribArray(3);
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    u32 GetVAO() const { return m_VAO; }
+    u32 GetVertexBuffer() const { return m_VBO; }
+    u32 GetIndexBuffer() const { return m_EBO; }
+    u32 GetVertexTexture() const { return m_vertexTexture; }
+    u32 GetIndexTexture() const { return m_indexTexture; }
+
+    u32 GetVertexCount() const { return m_vertexCount; }
+    u32 GetIndexCount() const { return m_indexCount; }
+    size_t GetMemoryUsed() const {
+        return static_cast<size_t>(m_vertexCapacity) * sizeof(Vertex) + static_cast<size_t>(m_indexCapacity) * sizeof(u32);
+    }
+
+private:
+    void Reallocate(u32 vertexCapacity, u32 indexCapacity){
+        u32 newVBO, newEBO;
+        glGenBuffers(1, &newVBO);
+        glGenBuffers(1, &newEBO);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newVBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(vertexCapacity) * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+        if(m_VBO){
+            glBindBuffer(GL_COPY_READ_BUFFER, m_VBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_vertexCount * sizeof(Vertex));
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newEBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, static_cast<size_t>(indexCapacity) * sizeof(u32), nullptr, GL_STATIC_DRAW);
+        if(m_EBO){
+            glBindBuffer(GL_COPY_READ_BUFFER, m_EBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_indexCount * sizeof(u32));
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &m_VBO);
+        glDeleteBuffers(1, &m_EBO);
+
+        m_VBO = newVBO;
+        m_EBO = newEBO;
+        m_vertexCapacity = vertexCapacity;
+        m_indexCapacity = indexCapacity;
+
+        // Same vertex layout as GPUMesh
+        glBindVertexArray(m_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindTexture(GL_TEXTURE_BUFFER, m_vertexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_VBO);
+        glBindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_EBO);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+};
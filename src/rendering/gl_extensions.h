@@ -0,0 +1,93 @@
+#pragma once
+#include <cstring>
+
+#include <glad/gl.h>
+#include <glfw/glfw3.h>
+
+#include "defines.h"
+
+// Extension check against the context's extension list, GL 3.0+ style
+inline bool HasGLExtension(const char* name){
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for(GLint i = 0; i < extensionCount; i++){
+        const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if(extension && std::strcmp(extension, name) == 0) return true;
+    }
+    return false;
+}
+
+// EXT_texture_compression_s3tc formats (BC1 to BC3). Never made core but
+// exposed by every desktop driver, the generated loader leaves them out.
+struct S3TCFormats{
+    static constexpr GLenum RGB_DXT1 = 0x83F0;
+    static constexpr GLenum RGBA_DXT5 = 0x83F3;
+
+    static bool IsSupported(){ return HasGLExtension("GL_EXT_texture_compression_s3tc"); }
+};
+
+// ARB_bindless_texture entry points. The generated loader only covers core
+// GL, so they are fetched by hand when the driver exposes the extension.
+struct BindlessTextureAPI{
+    typedef GLuint64 (GLAD_API_PTR *GetTextureHandleFn)(GLuint texture);
+    typedef void (GLAD_API_PTR *MakeTextureHandleResidentFn)(GLuint64 handle);
+    typedef void (GLAD_API_PTR *MakeTextureHandleNonResidentFn)(GLuint64 handle);
+
+    GetTextureHandleFn GetTextureHandle = nullptr;
+    MakeTextureHandleResidentFn MakeTextureHandleResident = nullptr;
+    MakeTextureHandleNonResidentFn MakeTextureHandleNonResident = nullptr;
+
+    // False if the extension or any entry point is missing
+    bool Load(){
+        if(!HasGLExtension("GL_ARB_bindless_texture")) return false;
+
+        GetTextureHandle = reinterpret_cast<GetTextureHandleFn>(glfwGetProcAddress("glGetTextureHandleARB"));
+        MakeTextureHandleResident = reinterpret_cast<MakeTextureHandleResidentFn>(glfwGetProcAddress("glMakeTextureHandleResidentARB"));
+        MakeTextureHandleNonResident = reinterpret_cast<MakeTextureHandleNonResidentFn>(glfwGetProcAddress("glMakeTextureHandleNonResidentARB"));
+        return GetTextureHandle && MakeTextureHandleResident && MakeTextureHandleNonResident;
+    }
+};
+
+// KHR/ARB_parallel_shader_compile: compiles and links run on driver threads
+// and their completion can be polled without blocking
+struct ParallelShaderCompileAPI{
+    static constexpr GLenum MAX_SHADER_COMPILER_THREADS = 0x91B0;
+    static constexpr GLenum COMPLETION_STATUS = 0x91B1;
+
+    typedef void (GLAD_API_PTR *MaxShaderCompilerThreadsFn)(GLuint count);
+
+    MaxShaderCompilerThreadsFn MaxShaderCompilerThreads = nullptr;
+
+    // False without either extension, every status query then blocks
+    bool Load(){
+        if(HasGLExtension("GL_KHR_parallel_shader_compile")){
+            MaxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsFn>(glfwGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+        } else if(HasGLExtension("GL_ARB_parallel_shader_compile")){
+            MaxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsFn>(glfwGetProcAddress("glMaxShaderCompilerThreadsARB"));
+        }
+        return MaxShaderCompilerThreads != nullptr;
+    }
+};
+
+// glMultiDrawElementsIndirectCount, core in GL 4.6 and ARB_indirect_parameters
+// before that: the draw count is read from a GPU buffer, so draws generated
+// on the GPU need no readback
+struct IndirectParametersAPI{
+    static constexpr GLenum PARAMETER_BUFFER = 0x80EE;
+
+    typedef void (GLAD_API_PTR *MultiDrawElementsIndirectCountFn)(GLenum mode, GLenum type, const void* indirect,
+                                                                  GLintptr drawCount, GLsizei maxDrawCount, GLsizei stride);
+
+    MultiDrawElementsIndirectCountFn MultiDrawElementsIndirectCount = nullptr;
+
+    // False without GL 4.6 or the extension
+    bool Load(){
+        if(GLAD_GL_VERSION_4_6 && glad_glMultiDrawElementsIndirectCount){
+            MultiDrawElementsIndirectCount = glad_glMultiDrawElementsIndirectCount;
+        } else if(HasGLExtension("GL_ARB_indirect_parameters")){
+            MultiDrawElementsIndirectCount = reinterpret_cast<MultiDrawElementsIndirectCountFn>(
+                glfwGetProcAddress("glMultiDrawElementsIndirectCountARB"));
+        }
+        return MultiDrawElementsIndirectCount != nullptr;
+    }
+};
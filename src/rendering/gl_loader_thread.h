@@ -0,0 +1,138 @@
+#pragma once
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#include <glad/gl.h>
+#include <glfw/glfw3.h>
+
+#include "defines.h"
+
+// Thread owning a second GL context in the render context's share group.
+// Jobs create and fill textures and buffers there, so the driver's copies
+// and allocations stay off the render thread. Each job is followed by a
+// fence; the render thread polls them and may use a job's objects once its
+// ticket completes. Container objects such as VAOs aren't shared and have
+// to be made on the render thread. Submit, Poll and IsComplete are render
+// thread only, stats may be read from any thread.
+class GLLoaderThread{
+private:
+    struct Job{
+        u64 ticket;
+        std::function<void()> work;
+    };
+
+    struct Finished{
+        u64 ticket;
+        GLsync fence;
+    };
+
+    GLFWwindow* m_context;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobReady;
+    std::deque<Job> m_jobs;
+    std::deque<Finished> m_finished;
+    bool m_shutdown = false;
+
+    u64 m_nextTicket = 1;
+    u64 m_completedTicket = 0;
+
+    // Read by the UI
+    std::atomic<u32> m_jobsQueued{0};
+    std::atomic<u32> m_jobsCompleted{0};
+
+public:
+    // Takes ownership of context, a hidden window sharing objects with the
+    // render context. Must be called on the main thread, as GLFW requires
+    // for windows.
+    explicit GLLoaderThread(GLFWwindow* context) : m_context(context){
+        m_thread = std::thread([this](){ ThreadLoop(); });
+    }
+
+    // Jobs not started yet are dropped. Needs a current context of the
+    // share group to delete the fences, and the main thread for the window.
+    ~GLLoaderThread(){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_jobReady.notify_all();
+        m_thread.join();
+
+        for(Finished& finished: m_finished){
+            glDeleteSync(finished.fence);
+        }
+        glfwDestroyWindow(m_context);
+    }
+
+    GLLoaderThread(const GLLoaderThread&) = delete;
+    GLLoaderThread& operator=(const GLLoaderThread&) = delete;
+
+    // Runs work on the loader thread with its context current
+    u64 Submit(std::function<void()> work){
+        u64 ticket = m_nextTicket++;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back({ticket, std::move(work)});
+        }
+        m_jobsQueued++;
+        m_jobReady.notify_one();
+        return ticket;
+    }
+
+    // Start of every frame: retires the jobs whose fences have passed
+    void Poll(){
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Jobs run in order on one context, so do their fences
+        while(!m_finished.empty()){
+            Finished& finished = m_finished.front();
+            GLenum status = glClientWaitSync(finished.fence, 0, 0);
+            if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+            glDeleteSync(finished.fence);
+            m_completedTicket = finished.ticket;
+            m_finished.pop_front();
+            m_jobsQueued--;
+            m_jobsCompleted++;
+        }
+    }
+
+    bool IsComplete(u64 ticket) const { return ticket != 0 && ticket <= m_completedTicket; }
+
+    u32 GetJobsQueued() const { return m_jobsQueued; }
+    u32 GetJobsCompleted() const { return m_jobsCompleted; }
+
+private:
+    void ThreadLoop(){
+        glfwMakeContextCurrent(m_context);
+
+        while(true){
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_jobReady.wait(lock, [this](){ return m_shutdown || !m_jobs.empty(); });
+                if(m_shutdown) break;
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            job.work();
+
+            // Flushed so the render context can wait on it
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.push_back({job.ticket, fence});
+        }
+
+        glfwMakeContextCurrent(NULL);
+    }
+};
@@ -0,0 +1,289 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "rendering/frustum.h"
+#include "rendering/gl_extensions.h"
+#include "shader.h"
+#include "defines.h"
+
+// World space bounds and geometry pool range of one drawn mesh, laid out
+// like Instance in gpuCull.comp
+struct GPUCullInstance{
+    glm::vec4 sphere{0.0f};
+    glm::uvec4 range{0u};   // index count, first index, base vertex, draw ID
+};
+
+// Results of a frame a few frames back, counters are read without stalling
+struct GPUCullStats{
+    u32 instances = 0;
+    u32 drawnFirstPhase = 0;    // passed against last frame's depth
+    u32 drawnSecondPhase = 0;   // hidden last frame, revealed by the retest
+    u32 frustumCulled = 0;
+    u32 occlusionCulled = 0;
+    u32 trianglesRendered = 0;
+};
+
+// Frustum and two-phase Hi-Z occlusion culling in compute, writing compacted
+// indirect commands. Phase 0 tests every instance against the max depth
+// pyramid of the previous frame and draws the ones that pass; the pyramid
+// is then rebuilt from that depth and phase 1 retests only the instances
+// phase 0 called hidden, so anything revealed since last frame is still
+// drawn the same frame. A final rebuild after phase 1 is next frame's history.
+//
+// Draw counts stay on the GPU with glMultiDrawElementsIndirectCount. Without
+// it every command slot is cleared first and the full range is drawn, empty
+// commands draw nothing. Needs GL 4.3 for compute and storage buffers.
+class GPUCuller{
+public:
+    static constexpr u32 HIZ_UNIT = 16;     // past every unit the model shaders use
+    static constexpr u32 COMMAND_SIZE = 5 * sizeof(u32);
+
+private:
+    static constexpr u32 READBACK_FRAMES = 3;
+    static constexpr u32 COUNTER_COUNT = 5;     // draw counts of both phases, frustum, occlusion, triangles
+
+    struct Readback{
+        u32 buffer = 0;
+        GLsync fence = nullptr;
+        u32 instances = 0;
+    };
+
+    std::unique_ptr<Shader> m_cullShader;
+    std::unique_ptr<Shader> m_hiZFromDepthShader;
+    std::unique_ptr<Shader> m_hiZShader;
+
+    IndirectParametersAPI m_indirectParameters;
+    bool m_drawCount = false;
+
+    u32 m_instanceBuffer = 0;
+    u32 m_stateBuffer = 0;
+    u32 m_commandBuffer = 0;
+    u32 m_counterBuffer = 0;
+    u32 m_capacity = 0;
+    u32 m_instanceCount = 0;
+
+    // Max depth pyramid, level 0 at half the depth buffer's resolution
+    u32 m_hiZ = 0;
+    glm::ivec2 m_depthSize{0};
+    glm::ivec2 m_hiZSize{0};
+    i32 m_hiZLevels = 0;
+    glm::mat4 m_hiZViewProjection{1.0f};
+    bool m_hasHistory = false;
+
+    Readback m_readbacks[READBACK_FRAMES];
+    u32 m_readbackIndex = 0;
+    GPUCullStats m_stats;
+
+public:
+    static bool IsSupported(){
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    GPUCuller(){
+        m_cullShader = std::make_unique<Shader>(ComputeSource{"gpuCull.comp"});
+        m_hiZFromDepthShader = std::make_unique<Shader>(ComputeSource{"hiZBuild.comp"}, "#define FROM_DEPTH\n");
+        m_hiZShader = std::make_unique<Shader>(ComputeSource{"hiZBuild.comp"});
+        m_drawCount = m_indirectParameters.Load();
+
+        glGenBuffers(1, &m_instanceBuffer);
+        glGenBuffers(1, &m_stateBuffer);
+        glGenBuffers(1, &m_commandBuffer);
+        glGenBuffers(1, &m_counterBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counterBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, COUNTER_COUNT * sizeof(u32), nullptr, GL_DYNAMIC_DRAW);
+
+        for(Readback& readback: m_readbacks){
+            glGenBuffers(1, &readback.buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, COUNTER_COUNT * sizeof(u32), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    ~GPUCuller(){
+        for(Readback& readback: m_readbacks){
+            if(readback.fence) glDeleteSync(readback.fence);
+            glDeleteBuffers(1, &readback.buffer);
+        }
+        glDeleteBuffers(1, &m_instanceBuffer);
+        glDeleteBuffers(1, &m_stateBuffer);
+        glDeleteBuffers(1, &m_commandBuffer);
+        glDeleteBuffers(1, &m_counterBuffer);
+        glDeleteTextures(1, &m_hiZ);
+    }
+
+    GPUCuller(const GPUCuller&) = delete;
+    GPUCuller& operator=(const GPUCuller&) = delete;
+
+    // Streams this frame's instances and resets the counters
+    void Upload(const std::vector<GPUCullInstance>& instances){
+        m_instanceCount = static_cast<u32>(instances.size());
+        if(m_instanceCount > m_capacity){
+            m_capacity = std::max(m_instanceCount, m_capacity * 2);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_stateBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity * sizeof(u32), nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * m_capacity * COMMAND_SIZE, nullptr, GL_DYNAMIC_COPY);
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instanceBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(GPUCullInstance), instances.data(), GL_STREAM_DRAW);
+
+        // Zero fills with null data
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counterBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        if(!m_drawCount){
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+            glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, 2 * m_instanceCount * COMMAND_SIZE,
+                                 GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Phase 0 can only test occlusion once a pyramid exists, phase 1 only
+    // has work after a phase 0 that did
+    bool HasHistory() const { return m_hasHistory; }
+
+    void Cull(u32 phase, const glm::mat4& viewProjection){
+        if(m_instanceCount == 0) return;
+
+        Frustum frustum;
+        frustum.Extract(viewProjection);
+
+        m_cullShader->use();
+        m_cullShader->setUInt("instanceCount", m_instanceCount);
+        m_cullShader->setUInt("phase", phase);
+        for(u32 i = 0; i < Frustum::PLANE_COUNT; i++){
+            m_cullShader->setVec4("frustumPlanes[" + std::to_string(i) + "]", frustum.planes[i]);
+        }
+
+        m_cullShader->setBool("occlusionTest", m_hasHistory);
+        m_cullShader->setMat4("occlusionViewProjection", m_hiZViewProjection);
+        m_cullShader->setVec2("depthSize", glm::vec2(m_depthSize));
+        m_cullShader->setInt("hiZLevels", m_hiZLevels);
+        m_cullShader->setInt("hiZ", HIZ_UNIT);
+        glActiveTexture(GL_TEXTURE0 + HIZ_UNIT);
+        glBindTexture(GL_TEXTURE_2D, m_hiZ);
+        glActiveTexture(GL_TEXTURE0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_instanceBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_stateBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_counterBuffer);
+
+        glDispatchCompute((m_instanceCount + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    // Issues a phase's commands, the caller binds the VAO and draw shader
+    void Draw(u32 phase){
+        if(m_instanceCount == 0) return;
+
+        const void* offset = reinterpret_cast<const void*>(static_cast<size_t>(phase) * m_instanceCount * COMMAND_SIZE);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+        if(m_drawCount){
+            glBindBuffer(IndirectParametersAPI::PARAMETER_BUFFER, m_counterBuffer);
+            m_indirectParameters.MultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, offset,
+                                                                phase * sizeof(u32), m_instanceCount, 0);
+            glBindBuffer(IndirectParametersAPI::PARAMETER_BUFFER, 0);
+        } else {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, m_instanceCount, 0);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // Rebuilds the pyramid from a depth buffer drawn with viewProjection
+    void BuildHiZ(u32 depthTexture, glm::ivec2 depthSize, const glm::mat4& viewProjection){
+        if(depthSize != m_depthSize) Resize(depthSize);
+
+        m_hiZFromDepthShader->use();
+        m_hiZFromDepthShader->setInt("depthBuffer", HIZ_UNIT);
+        glActiveTexture(GL_TEXTURE0 + HIZ_UNIT);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindImageTexture(0, m_hiZ, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((m_hiZSize.x + 7) / 8, (m_hiZSize.y + 7) / 8, 1);
+
+        m_hiZShader->use();
+        glm::ivec2 levelSize = m_hiZSize;
+        for(i32 level = 1; level < m_hiZLevels; level++){
+            levelSize = glm::max((levelSize + 1) / 2, glm::ivec2(1));
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            glBindImageTexture(1, m_hiZ, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(0, m_hiZ, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((levelSize.x + 7) / 8, (levelSize.y + 7) / 8, 1);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        m_hiZViewProjection = viewProjection;
+        m_hasHistory = true;
+    }
+
+    // Queues this frame's counters for readback and picks up finished ones
+    void EndFrame(){
+        Readback& current = m_readbacks[m_readbackIndex];
+        if(current.fence) glDeleteSync(current.fence);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, current.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, COUNTER_COUNT * sizeof(u32));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        current.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current.instances = m_instanceCount;
+        m_readbackIndex = (m_readbackIndex + 1) % READBACK_FRAMES;
+
+        // Oldest first, stop at the first one still in flight
+        for(u32 i = 0; i < READBACK_FRAMES; i++){
+            Readback& readback = m_readbacks[(m_readbackIndex + i) % READBACK_FRAMES];
+            if(!readback.fence) continue;
+
+            GLenum status = glClientWaitSync(readback.fence, 0, 0);
+            if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+            u32 counters[COUNTER_COUNT];
+            glBindBuffer(GL_COPY_READ_BUFFER, readback.buffer);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counters), counters);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+
+            m_stats.instances = readback.instances;
+            m_stats.drawnFirstPhase = counters[0];
+            m_stats.drawnSecondPhase = counters[1];
+            m_stats.frustumCulled = counters[2];
+            m_stats.occlusionCulled = counters[3];
+            m_stats.trianglesRendered = counters[4];
+        }
+    }
+
+    const GPUCullStats& GetStats() const { return m_stats; }
+    bool UsesDrawCount() const { return m_drawCount; }
+
+private:
+    void Resize(glm::ivec2 depthSize){
+        m_depthSize = depthSize;
+        m_hiZSize = glm::max((depthSize + 1) / 2, glm::ivec2(1));
+        m_hiZLevels = static_cast<i32>(std::floor(std::log2(static_cast<f32>(std::max(m_hiZSize.x, m_hiZSize.y))))) + 1;
+
+        // Immutable storage, so a new texture per size
+        glDeleteTextures(1, &m_hiZ);
+        glGenTextures(1, &m_hiZ);
+        glBindTexture(GL_TEXTURE_2D, m_hiZ);
+        glTexStorage2D(GL_TEXTURE_2D, m_hiZLevels, GL_R32F, m_hiZSize.x, m_hiZSize.y);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // The old pyramid was for another size
+        m_hasHistory = false;
+    }
+};
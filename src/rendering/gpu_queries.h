@@ -0,0 +1,83 @@
+#pragma once
+#include <glad/gl.h>
+
+#include "rendering/gl_extensions.h"
+#include "defines.h"
+
+// Counts fragment shader invocations of a range of draws. Uses
+// GL_FRAGMENT_SHADER_INVOCATIONS (GL 4.6 / ARB_pipeline_statistics_query)
+// when available, otherwise GL_SAMPLES_PASSED, which matches the shaded
+// fragment count as long as early depth testing is active.
+// Queries are read back a few frames late so the CPU never waits on the GPU.
+class FragmentStatsQuery{
+public:
+    static constexpr u32 QUERY_COUNT = 4;
+
+private:
+    struct Slot{
+        u32 query = 0;
+        u32 tag = 0;
+        bool pending = false;
+    };
+
+    Slot m_slots[QUERY_COUNT];
+    u32 m_current = 0;
+    GLenum m_target = GL_SAMPLES_PASSED;
+    bool m_pipelineStatistics = false;
+
+public:
+    FragmentStatsQuery(){
+        m_pipelineStatistics = GLAD_GL_VERSION_4_6 || HasGLExtension("GL_ARB_pipeline_statistics_query");
+        m_target = m_pipelineStatistics ? GL_FRAGMENT_SHADER_INVOCATIONS : GL_SAMPLES_PASSED;
+
+        for(Slot& slot: m_slots){
+            glGenQueries(1, &slot.query);
+        }
+    }
+
+    ~FragmentStatsQuery(){
+        for(Slot& slot: m_slots){
+            glDeleteQueries(1, &slot.query);
+        }
+    }
+
+    FragmentStatsQuery(const FragmentStatsQuery&) = delete;
+    FragmentStatsQuery& operator=(const FragmentStatsQuery&) = delete;
+
+    // The tag is handed back with the result, e.g. the render settings used
+    void Begin(u32 tag){
+        Slot& slot = m_slots[m_current];
+        slot.tag = tag;
+        glBeginQuery(m_target, slot.query);
+    }
+
+    void End(){
+        glEndQuery(m_target);
+        m_slots[m_current].pending = true;
+        m_current = (m_current + 1) % QUERY_COUNT;
+    }
+
+    // Oldest finished result, returns false if none is ready yet
+    bool Poll(u64& result, u32& tag){
+        bool found = false;
+        for(u32 i = 0; i < QUERY_COUNT; i++){
+            Slot& slot = m_slots[(m_current + i) % QUERY_COUNT];
+            if(!slot.pending) continue;
+
+            GLint available = 0;
+            glGetQueryObjectiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available) break;
+
+            GLuint64 value = 0;
+            glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &value);
+            slot.pending = false;
+
+            result = value;
+            tag = slot.tag;
+            found = true;
+        }
+        return found;
+    }
+
+    bool UsesPipelineStatistics() const { return m_pipelineStatistics; }
+};
@@ -1,46 +1,90 @@
 #pragma once
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <algorithm>
 #include <memory>
+#include <limits>
+#include <atomic>
+#include <cstring>
+#include <cmath>
 
 #include <glad/gl.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include "ecs/component_manager.h"
 #include "assets/asset_manager.h"  
+#include "rendering/geometry_pool.h"
+#include "rendering/texture_streaming.h"
+#include "rendering/upload_queue.h"
+#include "rendering/gl_loader_thread.h"
 #include "shader.h"
 #include "defines.h"
 
+// Vertex layouts a GPUMesh can be uploaded with
+enum class VertexFormat{
+    Float,      // Vertex as is, 32 bytes
+    Quantized   // QuantizedVertex, 16 bytes
+};
+
+// Position as unorm16 inside the mesh bounds, octahedral snorm16 normal and
+// half float UVs. The depth stream keeps only the position, 8 bytes.
+struct QuantizedVertex{
+    u16 position[4];    // w is padding
+    i16 normal[2];
+    u16 texCoords[2];
+};
+
 // GPU resource handles
 struct GPUMesh{
     u32 VAO = 0;
     u32 VBO = 0;
     u32 EBO = 0;
     u32 indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT;     // GL_UNSIGNED_SHORT below 65536 vertices
+
+    // Set once the staged copies into the buffers have completed, the mesh
+    // isn't drawn before
     bool isUploaded = false;
+    u64 uploadTicket = 0;
 
+    // Residency: buffer bytes and the last frame the mesh was asked for
+    size_t bytes = 0;
+    u64 lastUsedFrame = 0;
+
+    // Stored position to mesh space, multiply into the model matrix. Identity
+    // for float vertices, octNormals tells the shaders to decode normals.
+    VertexFormat format = VertexFormat::Float;
+    glm::mat4 positionDecode{1.0f};
+    bool octNormals = false;
+
+    // Tightly packed positions for depth-only passes, shares the EBO
+    u32 depthVAO = 0;
+    u32 positionVBO = 0;
+
+    // Zero names are ignored, a mesh may be dropped with only its buffers made
     ~GPUMesh(){
-        if(isUploaded){
-            glDeleteVertexArrays(1, &VAO);
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-        }
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &depthVAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &positionVBO);
+        glDeleteBuffers(1, &EBO);
     }
 };
 
-struct GPUTexture{
-    u32 textureID = 0;
-    GLenum target = GL_TEXTURE_2D;
-    bool isUploaded = false;
+// VRAM budget for meshes and textures together, split between the two.
+// Least recently used meshes not drawn last frame are freed when theirs is
+// exceeded, textures follow TextureStreamer's order. Either comes back on
+// its next use. The geometry pool is not part of it.
+struct ResidencySettings{
+    u32 budgetMB = 512;
+    u32 meshPercent = 50;
 
-    ~GPUTexture(){
-        if(isUploaded){
-            glDeleteTextures(1, &textureID);
-        }
-    }
+    size_t GetMeshBudget() const { return (static_cast<size_t>(budgetMB) << 20) / 100 * meshPercent; }
+    size_t GetTextureBudget() const { return (static_cast<size_t>(budgetMB) << 20) - GetMeshBudget(); }
 };
 
 // Render Command - what to draw this frame
@@ -52,9 +96,13 @@ struct RenderCommand{
     // Asset reference
     ModelAssetID modelID = INVALID_MODEL;
     MaterialID materialID = INVALID_MATERIAL;
+    u32 lodLevel = 0;
 
     // Renrering properties
     float distanceToCamera = 0.0f; // For sorting
+    // UV distance one pixel spans at the nearest point of the bounds, picks
+    // the texture levels to stream. 0 asks for full resolution.
+    float uvPerPixel = 0.0f;
     bool castShadows = true;
     bool receiveShadows = true;
 
@@ -65,7 +113,7 @@ struct RenderCommand{
 // Render batch - multiple objects with same material
 struct RenderBatch{
     MaterialID materialID;
-    std::vector<RenderCommand*> commands;
+    std::vector<const RenderCommand*> commands;
 
     // Sorting for transparency
     bool isTransparent = false;
@@ -75,68 +123,203 @@ class GPUResourceManager{
 private:
     AssetManager* m_assetManager;
 
+    // Staging ring every upload goes through, declared first so it outlives its users
+    UploadQueue m_uploadQueue;
+
     // GPU resource caches
     std::unordered_map<MeshID, std::unique_ptr<GPUMesh>> m_gpuMeshes;
     std::unordered_map<TextureID, std::unique_ptr<GPUTexture>> m_gpuTextures;
 
-    // Statistics
-    u32 m_meshesUploaded = 0;
-    u32 m_texturesUploaded = 0;
-    size_t m_gpuMemoryUsed = 0;
+    // Meshes asked for and not uploaded yet, and uploaded ones waiting for
+    // their ticket, of the upload queue or of the loader thread
+    std::deque<MeshID> m_pendingMeshes;
+    std::vector<MeshID> m_uploadingMeshes;
+    std::vector<MeshID> m_loadingMeshes;
+
+    // Frames counted by ProcessUploads, for the mesh LRU
+    u64 m_frame = 0;
+    ResidencySettings m_residencySettings;
+    std::vector<MeshID> m_evictionOrder;
+
+    // 1x1 stand-ins drawn until a texture's first levels have arrived:
+    // white, and a flat normal for normal maps
+    std::unique_ptr<GPUTexture> m_placeholders[2];
+
+    // Shared mega-buffer, meshes are only copied in when a backend asks for them
+    std::unique_ptr<GeometryPool> m_geometryPool;
+
+    // Mip residency of every texture, levels past the up-front ones on demand
+    TextureStreamer m_textureStreamer;
+    TextureStreamingSettings m_textureStreamingSettings;
+
+    // Format for meshes uploaded from now on
+    bool m_quantizeVertices = true;
+
+    // Statistics, read by the UI
+    std::atomic<u32> m_meshesUploaded{0};
+    std::atomic<u32> m_meshesQuantized{0};
+    std::atomic<u32> m_texturesUploaded{0};
+    std::atomic<u32> m_pendingMeshCount{0};
+    std::atomic<u32> m_meshesResident{0};
+    std::atomic<size_t> m_meshBytesResident{0};
+    std::atomic<u32> m_meshesEvicted{0};
+    std::atomic<size_t> m_geometryPoolBytes{0};     // published after every pool allocation
+
+    // Optional, declared last so it stops before the resources its jobs fill go away
+    std::unique_ptr<GLLoaderThread> m_loader;
 
 public:
-    GPUResourceManager(AssetManager* assetManager): m_assetManager(assetManager){}
+    GPUResourceManager(AssetManager* assetManager)
+    : m_assetManager(assetManager), m_textureStreamer(assetManager, &m_uploadQueue){}
 
-    // Get or create GPU mesh
+    // Get the GPU mesh, null until its upload has completed. The first
+    // request, or the first after an eviction, queues the upload for
+    // ProcessUploads.
     GPUMesh* GetGPUMesh(MeshID meshID){
         auto it = m_gpuMeshes.find(meshID);
         if(it != m_gpuMeshes.end()){
-            return it->second.get();
+            it->second->lastUsedFrame = m_frame;
+            return it->second->isUploaded ? it->second.get() : nullptr;
         }
 
-        // Upload mesh to GPU
         const MeshData* meshData = m_assetManager->GetMesh(meshID);
         if(!meshData){
             return nullptr;
         }
 
         auto gpuMesh = std::make_unique<GPUMesh>();
-        if(UploadMesh(*meshData, *gpuMesh)){
-            GPUMesh* result = gpuMesh.get();
-            m_gpuMeshes[meshID] = std::move(gpuMesh);
-            return result;
+        gpuMesh->lastUsedFrame = m_frame;
+        m_gpuMeshes[meshID] = std::move(gpuMesh);
+        m_pendingMeshes.push_back(meshID);
+        m_pendingMeshCount = static_cast<u32>(m_pendingMeshes.size());
+        return nullptr;
+    }
+
+    // Start of every frame on the render thread: fences last frame's
+    // uploads, marks the resources whose uploads have completed, frees
+    // meshes over the budget and stages queued meshes within the per-frame
+    // upload budget, oldest request first
+    void ProcessUploads(const UploadSettings& settings, const ResidencySettings& residency){
+        m_frame++;
+        m_residencySettings = residency;
+        m_uploadQueue.BeginFrame();
+        if(m_loader) m_loader->Poll();
+
+        m_uploadingMeshes.erase(std::remove_if(m_uploadingMeshes.begin(), m_uploadingMeshes.end(), [this](MeshID meshID){
+            GPUMesh& gpuMesh = *m_gpuMeshes[meshID];
+            if(!m_uploadQueue.IsComplete(gpuMesh.uploadTicket)) return false;
+            gpuMesh.isUploaded = true;
+            return true;
+        }), m_uploadingMeshes.end());
+
+        // Vertex arrays aren't shared between contexts, they're made here once the buffers are filled
+        if(m_loader){
+            m_loadingMeshes.erase(std::remove_if(m_loadingMeshes.begin(), m_loadingMeshes.end(), [this](MeshID meshID){
+                GPUMesh& gpuMesh = *m_gpuMeshes[meshID];
+                if(!m_loader->IsComplete(gpuMesh.uploadTicket)) return false;
+                CreateVertexArrays(gpuMesh);
+                gpuMesh.isUploaded = true;
+                return true;
+            }), m_loadingMeshes.end());
         }
 
-        return nullptr;
+        EvictMeshes(residency.GetMeshBudget());
+
+        size_t budget = static_cast<size_t>(settings.meshKBPerFrame) << 10;
+        size_t staged = 0;
+        while(!m_pendingMeshes.empty()){
+            MeshID meshID = m_pendingMeshes.front();
+            const MeshData* meshData = m_assetManager->GetMesh(meshID);
+
+            // A mesh larger than the whole budget still goes alone
+            size_t bytes = meshData ? GetMeshUploadBytes(*meshData) : 0;
+            if(staged > 0 && staged + bytes > budget) break;
+
+            m_pendingMeshes.pop_front();
+            if(!meshData) continue;
+            UploadMesh(meshID, *meshData, *m_gpuMeshes[meshID]);
+            (m_loader ? m_loadingMeshes : m_uploadingMeshes).push_back(meshID);
+            staged += bytes;
+        }
+        m_pendingMeshCount = static_cast<u32>(m_pendingMeshes.size());
+        m_meshesResident = static_cast<u32>(m_gpuMeshes.size() - m_pendingMeshes.size());
     }
 
-    // Get or create GPU texture
-    GPUTexture* GetGPUTexture(TextureID textureID){
-        if(textureID == INVALID_TEXTURE){
+    // Moves mesh and texture uploads to a thread with its own context in the
+    // render context's share group, a hidden window. Call on the main thread
+    // before anything is uploaded; without it uploads stage through the
+    // upload queue on the render thread.
+    void StartLoaderThread(GLFWwindow* sharedContext){
+        m_loader = std::make_unique<GLLoaderThread>(sharedContext);
+        m_textureStreamer.SetLoader(m_loader.get());
+    }
+
+    // Joins the loader thread, needs the render context current and must
+    // come before glfwTerminate. Loads still in flight are dropped.
+    void StopLoaderThread(){
+        m_textureStreamer.SetLoader(nullptr);
+        m_loader.reset();
+    }
+
+    const GLLoaderThread* GetLoaderThread() const { return m_loader.get(); }
+
+    // Get or add the mesh to the geometry pool
+    const GeometryAllocation* GetPoolAllocation(MeshID meshID){
+        if(const GeometryAllocation* allocation = GetGeometryPool().GetAllocation(meshID)){
+            return allocation;
+        }
+
+        const MeshData* meshData = m_assetManager->GetMesh(meshID);
+        if(!meshData){
             return nullptr;
         }
+        const GeometryAllocation& allocation = m_geometryPool->Allocate(meshID, *meshData);
+        m_geometryPoolBytes = m_geometryPool->GetMemoryUsed();
+        return &allocation;
+    }
 
-        auto it = m_gpuTextures.find(textureID);
-        if(it != m_gpuTextures.end()){
-            return it->second.get();
+    GeometryPool& GetGeometryPool(){
+        if(!m_geometryPool){
+            m_geometryPool = std::make_unique<GeometryPool>(&m_uploadQueue);
         }
+        return *m_geometryPool;
+    }
 
-        // Upload texture to GPU
-        TextureData* textureData = m_assetManager->GetTexture(textureID);
-        if(!textureData || !textureData->data){
-            return nullptr;
+    // Get the GPU texture, or a placeholder until its first levels have
+    // been uploaded. Registers the texture with the streamer on first use.
+    GPUTexture* GetGPUTexture(TextureID textureID){
+        GPUTexture* gpuTexture = GetStreamedTexture(textureID);
+        if(!gpuTexture || gpuTexture->isUploaded){
+            return gpuTexture;
         }
+        return GetPlaceholder(m_assetManager->GetTexture(textureID)->type == "normal");
+    }
 
-        auto gpuTexture = std::make_unique<GPUTexture>();
-        if(UploadTexture(*textureData, *gpuTexture)){
-            GPUTexture* result = gpuTexture.get();
-            m_gpuTextures[textureID] = std::move(gpuTexture);
-            return result;
+    // 1x1 white, bound in place of a material texture that doesn't exist so
+    // nothing samples what the previous material left bound
+    GPUTexture* GetFallbackTexture(){ return GetPlaceholder(false); }
+
+    bool IsPlaceholder(const GPUTexture* gpuTexture) const {
+        return gpuTexture && (gpuTexture == m_placeholders[0].get() || gpuTexture == m_placeholders[1].get());
+    }
+
+    // Texture streaming, render thread. Every texture drawn this frame is
+    // requested with its command's uvPerPixel, then Update streams once.
+    void RequestTextureMips(TextureID textureID, f32 uvPerPixel){
+        if(GetStreamedTexture(textureID)){
+            m_textureStreamer.Request(textureID, uvPerPixel);
         }
+    }
 
-        return nullptr;
+    void UpdateTextureStreaming(const TextureStreamingSettings& settings){
+        m_textureStreamingSettings = settings;
+        m_textureStreamer.Update(settings, m_residencySettings.GetTextureBudget());
     }
 
+    const TextureStreamer& GetTextureStreamer() const { return m_textureStreamer; }
+    TextureStreamer& GetTextureStreamer() { return m_textureStreamer; }
+    const UploadQueue& GetUploadQueue() const { return m_uploadQueue; }
+
     // Force upload all assets for a model (useful for preloading)
     void PreloadModel(ModelAssetID modelID){
         const ModelAsset* model = m_assetManager->GetModel(modelID);
@@ -159,34 +342,223 @@ public:
         }
     }
 
+    // Only affects meshes uploaded afterwards
+    void SetVertexQuantization(bool enabled) { m_quantizeVertices = enabled; }
+    bool GetVertexQuantization() const { return m_quantizeVertices; }
+
     // Statistics
     uint32_t GetMeshesUploaded() const { return m_meshesUploaded; }
+    uint32_t GetMeshesQuantized() const { return m_meshesQuantized; }
     uint32_t GetTexturesUploaded() const { return m_texturesUploaded; }
-    size_t GetGPUMemoryUsed() const { return m_gpuMemoryUsed; }
+    u32 GetPendingMeshes() const { return m_pendingMeshCount; }
+    u32 GetMeshesResident() const { return m_meshesResident; }
+    size_t GetMeshBytesResident() const { return m_meshBytesResident; }
+    u32 GetMeshesEvicted() const { return m_meshesEvicted; }
+    size_t GetGeometryPoolBytes() const { return m_geometryPoolBytes; }
+    size_t GetGPUMemoryUsed() const {
+        return m_meshBytesResident + m_textureStreamer.GetResidentBytes() + GetGeometryPoolBytes();
+    }
 
 private:
-    bool UploadMesh(const MeshData& meshData, GPUMesh& gpuMesh){
-        // Generate OpenGL objects
-        glGenVertexArrays(1, &gpuMesh.VAO);
+    // The streamed texture, registered on first use, whether or not its levels have arrived
+    GPUTexture* GetStreamedTexture(TextureID textureID){
+        if(textureID == INVALID_TEXTURE){
+            return nullptr;
+        }
+
+        auto it = m_gpuTextures.find(textureID);
+        if(it != m_gpuTextures.end()){
+            return it->second.get();
+        }
+
+        const TextureData* textureData = m_assetManager->GetTexture(textureID);
+        if(!textureData || textureData->mips.empty()){
+            return nullptr;
+        }
+
+        auto gpuTexture = std::make_unique<GPUTexture>();
+        if(m_textureStreamer.Create(textureID, *textureData, *gpuTexture, m_textureStreamingSettings)){
+            GPUTexture* result = gpuTexture.get();
+            m_gpuTextures[textureID] = std::move(gpuTexture);
+            m_texturesUploaded++;
+            return result;
+        }
+
+        return nullptr;
+    }
+
+    GPUTexture* GetPlaceholder(bool normal){
+        std::unique_ptr<GPUTexture>& placeholder = m_placeholders[normal ? 1 : 0];
+        if(!placeholder){
+            const u8 white[4] = {255, 255, 255, 255};
+            const u8 flatNormal[4] = {128, 128, 255, 255};
+            placeholder = std::make_unique<GPUTexture>();
+            glGenTextures(1, &placeholder->textureID);
+            glBindTexture(GL_TEXTURE_2D, placeholder->textureID);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, normal ? flatNormal : white);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            placeholder->isUploaded = true;
+        }
+        return placeholder.get();
+    }
+
+    // Bytes one staging allocation of the mesh takes in the format it will get
+    size_t GetMeshUploadBytes(const MeshData& meshData) const {
+        const size_t vertexCount = meshData.vertices.size();
+        bool quantized = m_quantizeVertices && vertexCount > 0;
+        size_t vertexBytes = quantized ? sizeof(QuantizedVertex) + 4 * sizeof(u16) : sizeof(Vertex) + sizeof(glm::vec3);
+        size_t indexBytes = vertexCount < 65536 ? sizeof(u16) : sizeof(u32);
+        return vertexCount * vertexBytes + meshData.indices.size() * indexBytes;
+    }
+
+    // Creates the buffers and fills them with the converted mesh: on the
+    // loader thread through mapped buffers, or staged in one upload queue
+    // allocation, vertices, positions, then indices
+    void UploadMesh(MeshID meshID, const MeshData& meshData, GPUMesh& gpuMesh){
+        const size_t vertexCount = meshData.vertices.size();
+        gpuMesh.format = m_quantizeVertices && vertexCount > 0 ? VertexFormat::Quantized : VertexFormat::Float;
+        gpuMesh.indexType = vertexCount < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        gpuMesh.indexCount = static_cast<u32>(meshData.indices.size());
+        bool quantized = gpuMesh.format == VertexFormat::Quantized;
+
+        size_t vertexBytes = vertexCount * (quantized ? sizeof(QuantizedVertex) : sizeof(Vertex));
+        size_t positionBytes = vertexCount * (quantized ? 4 * sizeof(u16) : sizeof(glm::vec3));
+        size_t indexBytes = meshData.indices.size() * (gpuMesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32));
+
+        // Update statistics
+        m_meshesUploaded++;
+        if(quantized) m_meshesQuantized++;
+        gpuMesh.bytes = vertexBytes + positionBytes + indexBytes;
+        m_meshBytesResident += gpuMesh.bytes;
+
+        if(m_loader){
+            GPUMesh* target = &gpuMesh;
+            gpuMesh.uploadTicket = m_loader->Submit([this, meshID, target, vertexBytes, positionBytes, indexBytes](){
+                const MeshData& meshData = *m_assetManager->GetMesh(meshID);
+                u32 buffers[3];
+                glGenBuffers(3, buffers);
+                u8* vertices = MapNewBuffer(buffers[0], vertexBytes);
+                u8* positions = MapNewBuffer(buffers[1], positionBytes);
+                u8* indices = MapNewBuffer(buffers[2], indexBytes);
+                WriteMesh(meshData, *target, vertices, positions, indices);
+                for(u32 buffer: buffers){
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+                }
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+                target->VBO = buffers[0];
+                target->positionVBO = buffers[1];
+                target->EBO = buffers[2];
+            });
+            return;
+        }
+
+        // Storage only, contents are copied in from staging
         glGenBuffers(1, &gpuMesh.VBO);
+        glGenBuffers(1, &gpuMesh.positionVBO);
         glGenBuffers(1, &gpuMesh.EBO);
+        for(std::pair<u32, size_t> buffer: {std::make_pair(gpuMesh.VBO, vertexBytes), std::make_pair(gpuMesh.positionVBO, positionBytes),
+                                           std::make_pair(gpuMesh.EBO, indexBytes)}){
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer.first);
+            glBufferData(GL_COPY_WRITE_BUFFER, buffer.second, nullptr, GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        gpuMesh.uploadTicket = m_uploadQueue.Upload(vertexBytes + positionBytes + indexBytes, [&](u8* staging){
+            WriteMesh(meshData, gpuMesh, staging, staging + vertexBytes, staging + vertexBytes + positionBytes);
+        }, [&](const UploadSource& source){
+            glBindBuffer(GL_COPY_WRITE_BUFFER, gpuMesh.VBO);
+            source.CopyToBuffer(0, 0, vertexBytes);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, gpuMesh.positionVBO);
+            source.CopyToBuffer(0, vertexBytes, positionBytes);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, gpuMesh.EBO);
+            source.CopyToBuffer(0, vertexBytes + positionBytes, indexBytes);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        });
+
+        CreateVertexArrays(gpuMesh);
+    }
+
+    // Least recently used first, largest first among equals. Meshes asked
+    // for last frame stay, as do ones still uploading.
+    void EvictMeshes(size_t budget){
+        if(m_meshBytesResident <= budget) return;
+
+        m_evictionOrder.clear();
+        for(const auto& [meshID, gpuMesh]: m_gpuMeshes){
+            if(gpuMesh->isUploaded && gpuMesh->lastUsedFrame + 1 < m_frame) m_evictionOrder.push_back(meshID);
+        }
+        std::sort(m_evictionOrder.begin(), m_evictionOrder.end(), [this](MeshID a, MeshID b){
+            const GPUMesh& first = *m_gpuMeshes[a];
+            const GPUMesh& second = *m_gpuMeshes[b];
+            if(first.lastUsedFrame != second.lastUsedFrame) return first.lastUsedFrame < second.lastUsedFrame;
+            return first.bytes > second.bytes;
+        });
+
+        for(MeshID meshID: m_evictionOrder){
+            if(m_meshBytesResident <= budget) break;
+            auto it = m_gpuMeshes.find(meshID);
+            m_meshBytesResident -= it->second->bytes;
+            m_gpuMeshes.erase(it);      // the destructor frees the buffers
+            m_meshesEvicted++;
+        }
+    }
+
+    // Allocates the buffer and maps all of it for writing, null when empty
+    static u8* MapNewBuffer(u32 buffer, size_t bytes){
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+        if(bytes == 0) return nullptr;
+        return static_cast<u8*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    }
+
+    // The three streams in the mesh's format and index type
+    static void WriteMesh(const MeshData& meshData, GPUMesh& gpuMesh, u8* vertices, u8* positions, u8* indices){
+        if(gpuMesh.format == VertexFormat::Quantized){
+            WriteQuantizedVertices(meshData, gpuMesh, vertices, positions);
+        } else {
+            WriteFloatVertices(meshData, vertices, positions);
+        }
+
+        if(gpuMesh.indexType == GL_UNSIGNED_SHORT){
+            for(size_t i = 0; i < meshData.indices.size(); i++){
+                u16 index = static_cast<u16>(meshData.indices[i]);
+                std::memcpy(indices + i * sizeof(u16), &index, sizeof(u16));
+            }
+        } else if(!meshData.indices.empty()){
+            std::memcpy(indices, meshData.indices.data(), meshData.indices.size() * sizeof(u32));
+        }
+    }
 
-        // Bind VAO
+    static void CreateVertexArrays(GPUMesh& gpuMesh){
+        glGenVertexArrays(1, &gpuMesh.VAO);
+        glGenVertexArrays(1, &gpuMesh.depthVAO);
         glBindVertexArray(gpuMesh.VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuMesh.EBO);
+        if(gpuMesh.format == VertexFormat::Quantized){
+            SetQuantizedAttributes(gpuMesh);
+        } else {
+            SetFloatAttributes(gpuMesh);
+        }
+    }
+
+    // Full float attributes plus a tightly packed position stream
+    static void WriteFloatVertices(const MeshData& meshData, u8* vertices, u8* positions){
+        std::memcpy(vertices, meshData.vertices.data(), meshData.vertices.size() * sizeof(Vertex));
 
-        // Upload Vertex data
+        // Position-only stream for depth passes, a third of the fetch bandwidth
+        for(size_t i = 0; i < meshData.vertices.size(); i++){
+            std::memcpy(positions + i * sizeof(glm::vec3), &meshData.vertices[i].Position, sizeof(glm::vec3));
+        }
+    }
+
+    static void SetFloatAttributes(GPUMesh& gpuMesh){
+        glBindVertexArray(gpuMesh.VAO);
         glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.VBO);
-        glBufferData(GL_ARRAY_BUFFER, meshData.vertices.size() * sizeof(Vertex),
-        meshData.vertices.data(), GL_STATIC_DRAW);
 
-        // Upload index data
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuMesh.EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-                     meshData.indices.size() * sizeof(u32), 
-                     meshData.indices.data(), 
-                     GL_STATIC_DRAW);
-        
-        // Set up vertex attributes
         // Position (location 0)
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 
@@ -202,64 +574,85 @@ private:
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), 
                               (void*)offsetof(Vertex, TexCoords));
 
-        // Unbind
-        glBindVertexArray(0);
+        glBindVertexArray(gpuMesh.depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.positionVBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuMesh.EBO);
 
-        // Store info
-        gpuMesh.indexCount = static_cast<u32>(meshData.indices.size());
-        gpuMesh.isUploaded = true;
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
 
-        // Update statistics
-        m_meshesUploaded++;
-        m_gpuMemoryUsed += meshData.vertices.size() * sizeof(Vertex);
-        m_gpuMemoryUsed += meshData.indices.size() * sizeof(uint32_t);
-        
-        return true;
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
-    bool UploadTexture(TextureData& textureData, GPUTexture& gpuTexture){
-        glGenTextures(1, &gpuTexture.textureID);
-        glBindTexture(GL_TEXTURE_2D, gpuTexture.textureID);
-
-        // Determine format
-        GLenum format;
-        if (textureData.channels == 1)
-            format = GL_RED;
-        else if (textureData.channels == 3)
-            format = GL_RGB;
-        else if (textureData.channels == 4)
-            format = GL_RGBA;
-        else {
-            glDeleteTextures(1, &gpuTexture.textureID);
-            return false;
+    // QuantizedVertex attributes and an 8 byte position stream
+    static void WriteQuantizedVertices(const MeshData& meshData, GPUMesh& gpuMesh, u8* vertices, u8* positions){
+        // Bounds of the vertices themselves, LOD meshes may be tighter than the source
+        glm::vec3 boundsMin(std::numeric_limits<f32>::max());
+        glm::vec3 boundsMax(-std::numeric_limits<f32>::max());
+        for(const Vertex& vertex: meshData.vertices){
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
         }
+        glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
 
-        // Upload texture data
-        glTexImage2D(GL_TEXTURE_2D, 0, format, 
-                     textureData.width, textureData.height, 0, 
-                     format, GL_UNSIGNED_BYTE, textureData.data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        for(size_t i = 0; i < meshData.vertices.size(); i++){
+            const Vertex& source = meshData.vertices[i];
+            QuantizedVertex vertex;
 
-        // Set parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glm::vec3 unit = (source.Position - boundsMin) / extent;
+            for(int axis = 0; axis < 3; axis++){
+                vertex.position[axis] = static_cast<u16>(glm::round(glm::clamp(unit[axis], 0.0f, 1.0f) * 65535.0f));
+            }
+            vertex.position[3] = 0;
 
-        glBindTexture(GL_TEXTURE_2D, 0);
+            glm::vec2 octahedral = OctEncode(source.Normal);
+            vertex.normal[0] = static_cast<i16>(glm::round(octahedral.x * 32767.0f));
+            vertex.normal[1] = static_cast<i16>(glm::round(octahedral.y * 32767.0f));
+            vertex.texCoords[0] = glm::packHalf1x16(source.TexCoords.x);
+            vertex.texCoords[1] = glm::packHalf1x16(source.TexCoords.y);
 
-        // Free CPU data after upload
-        if (textureData.data) {
-            stbi_image_free(textureData.data);
-            textureData.data = nullptr;
+            std::memcpy(vertices + i * sizeof(QuantizedVertex), &vertex, sizeof(QuantizedVertex));
+            std::memcpy(positions + i * sizeof(vertex.position), vertex.position, sizeof(vertex.position));
         }
 
-        gpuTexture.isUploaded = true;
+        gpuMesh.positionDecode = glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), extent);
+        gpuMesh.octNormals = true;
+    }
 
-        // Update statistics  
-        m_texturesUploaded++;
-        m_gpuMemoryUsed += textureData.width * textureData.height * textureData.channels;
-        
-        return true;
+    static void SetQuantizedAttributes(GPUMesh& gpuMesh){
+        glBindVertexArray(gpuMesh.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.VBO);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+                              (void*)offsetof(QuantizedVertex, position));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex),
+                              (void*)offsetof(QuantizedVertex, normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex),
+                              (void*)offsetof(QuantizedVertex, texCoords));
+
+        glBindVertexArray(gpuMesh.depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuMesh.positionVBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuMesh.EBO);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(u16), (void*)0);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Octahedral mapping of a unit vector to [-1,1]^2, decoded by OctDecode in the shaders
+    static glm::vec2 OctEncode(glm::vec3 n){
+        n /= glm::max(std::abs(n.x) + std::abs(n.y) + std::abs(n.z), 1e-12f);
+        glm::vec2 e(n.x, n.y);
+        if(n.z < 0.0f){
+            e = (1.0f - glm::abs(glm::vec2(n.y, n.x))) *
+                glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return glm::clamp(e, glm::vec2(-1.0f), glm::vec2(1.0f));
     }
 };
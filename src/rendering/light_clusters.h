@@ -0,0 +1,308 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "rendering/frame_packet.h"
+#include "rendering/texture_buffer.h"
+#include "job_system.h"
+#include "shader.h"
+#include "defines.h"
+
+// Clustered light assignment. The view frustum is split into a grid of
+// screen tiles times exponentially spaced depth slices, every point light is
+// binned into the clusters its sphere touches, and the fragment shader only
+// loops over the light index list of its own cluster. Each sphere is first
+// projected to a tile rectangle and slice range, only the clusters inside
+// them are tested exactly.
+class LightClusterBuilder{
+public:
+    static constexpr u32 TILES_X = 16;
+    static constexpr u32 TILES_Y = 9;
+    static constexpr u32 SLICES_Z = 24;
+    static constexpr u32 CLUSTER_COUNT = TILES_X * TILES_Y * SLICES_Z;
+    static constexpr u32 MAX_LIGHTS_PER_CLUSTER = 256;
+
+private:
+    struct ClusterBounds{
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // View space cluster boxes, rebuilt when the projection changes
+    std::vector<ClusterBounds> m_clusterBounds;
+    glm::mat4 m_boundsProjection{0.0f};
+
+    // Per-slice input and output, merged into the packet after the parallel pass
+    struct SliceLists{
+        std::vector<u32> lights;    // lights whose slice range includes this slice
+        std::vector<std::vector<u32>> tileLights;   // TILES_X * TILES_Y, kept for their capacity
+        std::vector<u32> counts;    // TILES_X * TILES_Y
+        std::vector<u32> indices;   // light indices grouped by tile
+    };
+    std::vector<SliceLists> m_slices;
+
+    // View space spheres and the tiles and slices they may touch
+    struct ViewLight{
+        glm::vec3 center;
+        f32 radius;
+        u32 firstSlice;
+        u32 lastSlice;
+        glm::uvec2 firstTile;
+        glm::uvec2 lastTile;
+    };
+    std::vector<ViewLight> m_viewLights;
+
+public:
+    LightClusterBuilder(){
+        m_slices.resize(SLICES_Z);
+        for(SliceLists& slice: m_slices){
+            slice.tileLights.resize(TILES_X * TILES_Y);
+            slice.counts.resize(TILES_X * TILES_Y);
+        }
+    }
+
+    // Fills packet.lightClusters from packet.pointLights and packet.camera
+    void Build(FramePacket& packet, JobSystem& jobSystem){
+        LightClusterData& clusters = packet.lightClusters;
+        const glm::mat4& projection = packet.camera.projection;
+
+        // Near/far from a standard OpenGL perspective matrix
+        f32 zNear = projection[3][2] / (projection[2][2] - 1.0f);
+        f32 zFar = projection[3][2] / (projection[2][2] + 1.0f);
+
+        clusters.dimensions = glm::uvec3(TILES_X, TILES_Y, SLICES_Z);
+        clusters.zScale = SLICES_Z / std::log(zFar / zNear);
+        clusters.zBias = SLICES_Z * std::log(zNear) / std::log(zFar / zNear);
+
+        if(projection != m_boundsProjection){
+            BuildClusterBounds(projection, zNear, zFar);
+            m_boundsProjection = projection;
+        }
+
+        // View space spheres, culled against the depth range
+        m_viewLights.clear();
+        for(SliceLists& slice: m_slices){
+            slice.lights.clear();
+        }
+        for(const PointLightData& light: packet.pointLights){
+            ViewLight viewLight;
+            viewLight.center = glm::vec3(packet.camera.view * glm::vec4(light.position, 1.0f));
+            viewLight.radius = light.radius;
+
+            f32 depthMin = -viewLight.center.z - light.radius;
+            f32 depthMax = -viewLight.center.z + light.radius;
+            if(depthMax < zNear || depthMin > zFar ||
+               !TileRange(viewLight.center, light.radius, zNear, projection, viewLight.firstTile, viewLight.lastTile)){
+                viewLight.firstSlice = 1;
+                viewLight.lastSlice = 0;
+            } else {
+                viewLight.firstSlice = SliceOfDepth(std::max(depthMin, zNear), clusters);
+                viewLight.lastSlice = SliceOfDepth(std::min(depthMax, zFar), clusters);
+            }
+            for(u32 z = viewLight.firstSlice; z <= viewLight.lastSlice; z++){
+                m_slices[z].lights.push_back(static_cast<u32>(m_viewLights.size()));
+            }
+            m_viewLights.push_back(viewLight);
+        }
+
+        // Bin per depth slice, slices are independent so workers never share output
+        jobSystem.ParallelFor(SLICES_Z, 1, [&](u32 begin, u32 end, u32){
+            for(u32 z = begin; z < end; z++){
+                SliceLists& slice = m_slices[z];
+                std::vector<std::vector<u32>>& tileLights = slice.tileLights;
+                for(auto& lights: tileLights) lights.clear();
+
+                for(u32 lightIndex: slice.lights){
+                    const ViewLight& light = m_viewLights[lightIndex];
+
+                    for(u32 y = light.firstTile.y; y <= light.lastTile.y; y++){
+                        for(u32 x = light.firstTile.x; x <= light.lastTile.x; x++){
+                            u32 tile = y * TILES_X + x;
+                            const ClusterBounds& bounds = m_clusterBounds[z * TILES_X * TILES_Y + tile];
+                            if(tileLights[tile].size() < MAX_LIGHTS_PER_CLUSTER &&
+                               SphereIntersectsBox(light.center, light.radius, bounds)){
+                                tileLights[tile].push_back(lightIndex);
+                            }
+                        }
+                    }
+                }
+
+                slice.indices.clear();
+                for(u32 tile = 0; tile < TILES_X * TILES_Y; tile++){
+                    slice.counts[tile] = static_cast<u32>(tileLights[tile].size());
+                    slice.indices.insert(slice.indices.end(), tileLights[tile].begin(), tileLights[tile].end());
+                }
+            }
+        });
+
+        // Grid of (offset, count) pairs into one compact index list. Slice
+        // lists are already grouped tile by tile, so they are appended whole.
+        clusters.grid.resize(CLUSTER_COUNT * 2);
+        clusters.lightIndices.clear();
+        clusters.maxLightsPerCluster = 0;
+
+        for(u32 z = 0; z < SLICES_Z; z++){
+            const SliceLists& slice = m_slices[z];
+            u32 offset = static_cast<u32>(clusters.lightIndices.size());
+
+            for(u32 tile = 0; tile < TILES_X * TILES_Y; tile++){
+                u32 cluster = z * TILES_X * TILES_Y + tile;
+                clusters.grid[cluster * 2] = offset;
+                clusters.grid[cluster * 2 + 1] = slice.counts[tile];
+                clusters.maxLightsPerCluster = std::max(clusters.maxLightsPerCluster, slice.counts[tile]);
+                offset += slice.counts[tile];
+            }
+
+            clusters.lightIndices.insert(clusters.lightIndices.end(), slice.indices.begin(), slice.indices.end());
+        }
+    }
+
+private:
+    static u32 SliceOfDepth(f32 depth, const LightClusterData& clusters){
+        f32 slice = std::log(depth) * clusters.zScale - clusters.zBias;
+        return static_cast<u32>(glm::clamp(slice, 0.0f, static_cast<f32>(SLICES_Z - 1)));
+    }
+
+    // Tiles covered by the sphere's screen projection, false when it is off
+    // screen. A sphere reaching in front of the near plane covers them all.
+    static bool TileRange(const glm::vec3& center, f32 radius, f32 zNear, const glm::mat4& projection,
+                          glm::uvec2& firstTile, glm::uvec2& lastTile){
+        glm::vec2 ndcMin(-1.0f), ndcMax(1.0f);
+        f32 depth = -center.z;
+
+        if(depth - radius > zNear){
+            // Per axis, the lines through the eye tangent to the circle the
+            // sphere makes in that axis' plane give the extremes of x / depth:
+            // tan(theta -+ alpha) with tan(theta) = c / depth, tan(alpha) = radius / t
+            for(u32 axis = 0; axis < 2; axis++){
+                f32 c = center[axis];
+                f32 t = std::sqrt(c * c + depth * depth - radius * radius);
+                f32 lower = (c * t - radius * depth) / (depth * t + radius * c);
+                f32 upper = (c * t + radius * depth) / (depth * t - radius * c);
+
+                // ndc = P[axis][axis] * x / depth - P[2][axis] for a view space point
+                f32 scale = projection[axis][axis];
+                f32 offset = -projection[2][axis];
+                ndcMin[axis] = std::max(scale * lower + offset, -1.0f);
+                ndcMax[axis] = std::min(scale * upper + offset, 1.0f);
+                if(ndcMin[axis] > ndcMax[axis]) return false;
+            }
+        }
+
+        const glm::vec2 tiles(TILES_X, TILES_Y);
+        glm::vec2 first = glm::floor((ndcMin * 0.5f + 0.5f) * tiles);
+        glm::vec2 last = glm::floor((ndcMax * 0.5f + 0.5f) * tiles);
+        firstTile = glm::uvec2(glm::clamp(first, glm::vec2(0.0f), tiles - 1.0f));
+        lastTile = glm::uvec2(glm::clamp(last, glm::vec2(0.0f), tiles - 1.0f));
+        return true;
+    }
+
+    void BuildClusterBounds(const glm::mat4& projection, f32 zNear, f32 zFar){
+        m_clusterBounds.resize(CLUSTER_COUNT);
+        glm::mat4 inverseProjection = glm::inverse(projection);
+
+        // View space point on the near plane for an NDC xy
+        auto nearPoint = [&](f32 x, f32 y){
+            glm::vec4 p = inverseProjection * glm::vec4(x, y, -1.0f, 1.0f);
+            return glm::vec3(p) / p.w;
+        };
+
+        for(u32 z = 0; z < SLICES_Z; z++){
+            f32 sliceNear = zNear * std::pow(zFar / zNear, static_cast<f32>(z) / SLICES_Z);
+            f32 sliceFar = zNear * std::pow(zFar / zNear, static_cast<f32>(z + 1) / SLICES_Z);
+
+            for(u32 y = 0; y < TILES_Y; y++){
+                for(u32 x = 0; x < TILES_X; x++){
+                    f32 x0 = -1.0f + 2.0f * x / TILES_X;
+                    f32 x1 = -1.0f + 2.0f * (x + 1) / TILES_X;
+                    f32 y0 = -1.0f + 2.0f * y / TILES_Y;
+                    f32 y1 = -1.0f + 2.0f * (y + 1) / TILES_Y;
+
+                    ClusterBounds& bounds = m_clusterBounds[(z * TILES_Y + y) * TILES_X + x];
+                    bounds.min = glm::vec3(std::numeric_limits<f32>::max());
+                    bounds.max = glm::vec3(-std::numeric_limits<f32>::max());
+
+                    // Tile corner rays scaled to the slice depths
+                    for(glm::vec2 corner: {glm::vec2(x0, y0), glm::vec2(x1, y0), glm::vec2(x0, y1), glm::vec2(x1, y1)}){
+                        glm::vec3 ray = nearPoint(corner.x, corner.y);
+                        for(f32 depth: {sliceNear, sliceFar}){
+                            glm::vec3 point = ray * (depth / -ray.z);
+                            bounds.min = glm::min(bounds.min, point);
+                            bounds.max = glm::max(bounds.max, point);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    static bool SphereIntersectsBox(const glm::vec3& center, f32 radius, const ClusterBounds& bounds){
+        glm::vec3 closest = glm::clamp(center, bounds.min, bounds.max);
+        glm::vec3 delta = center - closest;
+        return glm::dot(delta, delta) <= radius * radius;
+    }
+};
+
+// GPU side of the clustered lights, texture buffers so it works on GL 4.1
+class LightClusterBuffers{
+public:
+    // Texture units used by the model shader
+    static constexpr u32 LIGHT_DATA_UNIT = 4;
+    static constexpr u32 CLUSTER_GRID_UNIT = 5;
+    static constexpr u32 LIGHT_INDEX_UNIT = 6;
+
+private:
+    TextureBuffer m_lightData;
+    TextureBuffer m_clusterGrid;
+    TextureBuffer m_lightIndices;
+    std::vector<glm::vec4> m_lightTexels;
+
+public:
+    // Uploads this frame's lights and clusters, once per frame before any pass
+    void Upload(const FramePacket& packet){
+        // Two texels per light: (position, radius), (color, point shadow index + 1)
+        m_lightTexels.clear();
+        for(const PointLightData& light: packet.pointLights){
+            m_lightTexels.emplace_back(light.position, light.radius);
+            m_lightTexels.emplace_back(light.color * light.intensity, static_cast<f32>(light.shadowIndex + 1));
+        }
+        if(m_lightTexels.empty()) m_lightTexels.emplace_back(0.0f);
+
+        const LightClusterData& clusters = packet.lightClusters;
+        static const u32 noIndex = 0;
+
+        m_lightData.Upload(GL_RGBA32F, m_lightTexels.data(), m_lightTexels.size() * sizeof(glm::vec4));
+        m_clusterGrid.Upload(GL_RG32UI, clusters.grid.data(), clusters.grid.size() * sizeof(u32));
+        if(clusters.lightIndices.empty()){
+            m_lightIndices.Upload(GL_R32UI, &noIndex, sizeof(u32));
+        } else {
+            m_lightIndices.Upload(GL_R32UI, clusters.lightIndices.data(), clusters.lightIndices.size() * sizeof(u32));
+        }
+    }
+
+    // Binds the uploaded buffers for a shader, every permutation drawn with needs it
+    void Bind(const FramePacket& packet, Shader& shader){
+        const LightClusterData& clusters = packet.lightClusters;
+
+        m_lightData.Bind(LIGHT_DATA_UNIT);
+        m_clusterGrid.Bind(CLUSTER_GRID_UNIT);
+        m_lightIndices.Bind(LIGHT_INDEX_UNIT);
+
+        shader.setInt("lightData", LIGHT_DATA_UNIT);
+        shader.setInt("clusterGrid", CLUSTER_GRID_UNIT);
+        shader.setInt("clusterLightIndices", LIGHT_INDEX_UNIT);
+
+        glUniform3ui(glGetUniformLocation(shader.ID, "clusterDims"),
+                     clusters.dimensions.x, clusters.dimensions.y, clusters.dimensions.z);
+        shader.setVec2("clusterTileSize",
+                       static_cast<f32>(packet.framebufferSize.x) / clusters.dimensions.x,
+                       static_cast<f32>(packet.framebufferSize.y) / clusters.dimensions.y);
+        shader.setFloat("clusterZScale", clusters.zScale);
+        shader.setFloat("clusterZBias", clusters.zBias);
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include "assets/asset_manager.h"
+#include "defines.h"
+
+struct LODSettings{
+    // Scales the detail demand, lower it under load to drop to coarser LODs sooner
+    f32 bias = 1.0f;
+
+    // Relative band around each threshold that must be crossed before the
+    // selected LOD changes, avoids popping back and forth at the boundary
+    f32 hysteresis = 0.1f;
+
+    // Allowed on-screen error in pixels for LODs that carry a geometric error
+    f32 pixelErrorThreshold = 1.0f;
+};
+
+// Per-entity view data needed to pick a LOD
+struct LODQuery{
+    f32 distanceToCamera = 0.0f;
+    f32 worldRadius = 0.0f;      // bounding sphere radius after scaling
+    f32 worldScale = 1.0f;       // largest axis scale of the world matrix
+    f32 projectionScale = 1.0f;  // projection[1][1]
+    f32 viewportHeight = 1.0f;   // in pixels
+    f32 lodDistance = 0.0f;      // RenderComponent::lodDistance, 0 = use model thresholds
+};
+
+class LODSelector{
+public:
+    // Returns the LOD to draw given the one drawn last frame
+    static u32 Select(const ModelAsset& model, const LODQuery& query, u32 previousLOD, const LODSettings& settings){
+        const u32 lodCount = model.GetLODCount();
+        if(lodCount == 1) return 0;
+
+        f32 distance = glm::max(query.distanceToCamera, 1e-4f);
+
+        // Detail demand and the threshold each LOD switches at, both
+        // decrease as the object gets further away
+        f32 demand;
+        auto threshold = [&](u32 lod) -> f32 {
+            if(query.lodDistance > 0.0f){
+                // Distance bands: LOD i beyond i * lodDistance
+                return 1.0f / static_cast<f32>(lod);
+            }
+
+            const ModelLOD& modelLOD = model.lods[lod - 1];
+            if(modelLOD.error > 0.0f){
+                // Coverage at which the LOD error projects to the allowed pixel error
+                f32 errorPixelsPerCoverage = (modelLOD.error * query.worldScale / query.worldRadius) * query.viewportHeight * 0.5f;
+                return settings.pixelErrorThreshold / errorPixelsPerCoverage;
+            }
+            return modelLOD.screenSize;
+        };
+
+        if(query.lodDistance > 0.0f){
+            demand = query.lodDistance / distance;
+        } else {
+            // Fraction of the screen height covered by the bounding sphere
+            demand = query.worldRadius * query.projectionScale / distance;
+        }
+        demand *= settings.bias;
+
+        // Coarsest LOD whose (scaled) threshold is above the demand
+        auto selectWithScale = [&](f32 scale) -> u32 {
+            u32 lod = 0;
+            for(u32 i = 1; i < lodCount; i++){
+                if(demand < threshold(i) * scale) lod = i;
+            }
+            return lod;
+        };
+
+        u32 coarseLOD = selectWithScale(1.0f - settings.hysteresis);
+        u32 fineLOD = selectWithScale(1.0f + settings.hysteresis);
+
+        u32 lod = glm::min(previousLOD, lodCount - 1);
+        if(lod < coarseLOD) return coarseLOD;
+        if(lod > fineLOD) return fineLOD;
+        return lod;
+    }
+};
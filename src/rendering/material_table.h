@@ -0,0 +1,487 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <cmath>
+#include <iostream>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/gpu_resource_manager.h"
+#include "rendering/gl_extensions.h"
+#include "rendering/shader_permutations.h"
+#include "rendering/texture_buffer.h"
+#include "shader.h"
+#include "defines.h"
+
+struct MaterialTableStats{
+    u32 materials = 0;
+    u32 textures = 0;
+    size_t arrayMemory = 0;     // texture array fallback only, layers in use count in the texture budget
+};
+
+// Every material's parameters and texture references in one buffer indexed
+// by MaterialID, so draws of different materials need no binds in between.
+// Textures are referenced by ARB_bindless_texture handles when the driver
+// has them. Otherwise they are drawn into texture arrays bucketed by the
+// size of their finest resident level, each layer rescaled to a power of
+// two between 512 and 2048 texels, and a reference is (array, layer).
+// Drawn rather than blit since block compressed textures can't be
+// framebuffer attachments, every level of the layer is drawn from the
+// matching level of the texture so the rest of the array is left alone.
+// Two RGBA32UI texels per material:
+//   (diffuse ref, specular ref)   ref = handle low/high or array/layer
+//   (normal ref, unorm8 diffuse color and opacity, unorm16 roughness << 16 | feature bits)
+// The feature bits are the material's ShaderFeatures, one shader serves
+// every material so they pick the paths at run time.
+// Streaming replaces texture objects as levels come and go, the handle or
+// layer of a texture is refreshed when that happens, and a texture whose
+// resident size changes bucket moves to a layer of that array. Evicted
+// textures give their layer back, and an array at a quarter of its layers
+// or less is halved, so the arrays follow what streaming keeps resident.
+// Each streamed texture's layer is counted in the texture budget with it.
+class MaterialTable{
+public:
+    static constexpr u32 TABLE_UNIT = 7;
+    static constexpr u32 FIRST_ARRAY_UNIT = 13;
+    static constexpr u32 ARRAY_COUNT = 3;
+    static constexpr u32 MIN_ARRAY_SIZE = 512;
+    static constexpr TextureID FREE_LAYER = ~0u;
+
+private:
+    struct TextureArray{
+        u32 texture = 0;
+        u32 size = 0;
+        u32 capacity = 0;
+        std::vector<TextureID> owners;      // per layer handed out, FREE_LAYER once given back
+        std::vector<u32> freeLayers;        // reused before new layers are handed out
+    };
+
+    // Streaming replaces texture objects, generation tells when the ref is stale
+    struct TextureRef{
+        glm::uvec2 ref{0};
+        u32 generation = 0;
+        i32 copiedSize = 0;     // texture array layers: largest side copied in so far
+    };
+
+    AssetManager* m_assetManager;
+    GPUResourceManager* m_gpuResourceManager;
+
+    bool m_bindless = false;
+    BindlessTextureAPI m_bindlessAPI;
+    std::vector<GLuint64> m_residentHandles;
+
+    TextureArray m_arrays[ARRAY_COUNT];
+    u32 m_readFramebuffer = 0;
+    u32 m_drawFramebuffer = 0;
+    std::unique_ptr<Shader> m_copyShader;
+    u32 m_emptyVAO = 0;
+
+    // Referenced by empty texture slots, and with the flat normal by
+    // textures whose upload hasn't completed
+    u32 m_whiteTexture = 0;
+    glm::uvec2 m_whiteRef{0};
+    u32 m_flatNormalTexture = 0;
+    glm::uvec2 m_flatNormalRef{0};
+
+    std::unordered_map<TextureID, TextureRef> m_textureRefs;
+    std::vector<glm::uvec4> m_texels;
+    TextureBuffer m_table;
+
+    MaterialTableStats m_stats;
+
+public:
+    MaterialTable(AssetManager* assetManager, GPUResourceManager* gpuResourceManager)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager){
+        m_bindless = m_bindlessAPI.Load();
+
+        glGenFramebuffers(1, &m_readFramebuffer);
+        glGenFramebuffers(1, &m_drawFramebuffer);
+        if(!m_bindless){
+            m_copyShader = std::make_unique<Shader>("fullscreen.vert", "copyTexture.frag");
+            glGenVertexArrays(1, &m_emptyVAO);
+
+            // A streamed texture's layer is paid for out of the texture budget
+            m_gpuResourceManager->GetTextureStreamer().SetCopyBytes([](i32 width, i32 height){
+                return LayerBytes(GetArrayIndex(width, height));
+            });
+        }
+
+        const u8 white[4] = {255, 255, 255, 255};
+        const u8 flatNormal[4] = {128, 128, 255, 255};
+        m_whiteTexture = CreateSolidTexture(white);
+        m_whiteRef = AddTexture(m_whiteTexture, 1, 1);
+        m_flatNormalTexture = CreateSolidTexture(flatNormal);
+        m_flatNormalRef = AddTexture(m_flatNormalTexture, 1, 1);
+    }
+
+    ~MaterialTable(){
+        if(!m_bindless) m_gpuResourceManager->GetTextureStreamer().SetCopyBytes(nullptr);
+        for(GLuint64 handle: m_residentHandles){
+            m_bindlessAPI.MakeTextureHandleNonResident(handle);
+        }
+        for(TextureArray& array: m_arrays){
+            glDeleteTextures(1, &array.texture);
+        }
+        glDeleteTextures(1, &m_whiteTexture);
+        glDeleteTextures(1, &m_flatNormalTexture);
+        glDeleteFramebuffers(1, &m_readFramebuffer);
+        glDeleteFramebuffers(1, &m_drawFramebuffer);
+        glDeleteVertexArrays(1, &m_emptyVAO);
+    }
+
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    bool UsesBindless() const { return m_bindless; }
+
+    // Shader features selecting the matching sampling code
+    u32 GetFeatures() const {
+        return ShaderFeatures::MATERIAL_TABLE | (m_bindless ? ShaderFeatures::BINDLESS_TEXTURES : 0u);
+    }
+
+    // Repacks every material, textures seen for the first time are made
+    // resident or copied into their array. Render thread only.
+    void Update(){
+        // Arrays mostly emptied by last frame's frees shrink before any ref is packed
+        for(u32 i = 0; i < ARRAY_COUNT; i++){
+            TextureArray& array = m_arrays[i];
+            u32 used = static_cast<u32>(array.owners.size() - array.freeLayers.size());
+            if(used == 0 && array.capacity > 0){
+                Resize(i, 0);
+            } else if(array.capacity > 1 && used * 4 <= array.capacity){
+                Resize(i, array.capacity / 2);
+            }
+        }
+
+        u32 materialCount = m_assetManager->GetMaterialCount();
+        m_texels.assign(std::max(materialCount, 1u) * 2, glm::uvec4(0u));
+
+        for(MaterialID id = 1; id < materialCount; id++){
+            const Material* material = m_assetManager->GetMaterial(id);
+            if(!material) continue;
+
+            glm::uvec2 diffuse = GetTextureRef(material->diffuseTexture);
+            glm::uvec2 specular = GetTextureRef(material->specularTexture);
+            glm::uvec2 normal = GetTextureRef(material->normalTexture);
+            u32 color = glm::packUnorm4x8(glm::vec4(material->diffuse, material->opacity));
+            u32 roughness = glm::packUnorm2x16(glm::vec2(0.0f, material->roughness));
+
+            m_texels[id * 2] = glm::uvec4(diffuse, specular);
+            m_texels[id * 2 + 1] = glm::uvec4(normal, color, (roughness & 0xFFFF0000u) | ShaderFeatures::ForMaterial(*material));
+        }
+
+        m_table.Upload(GL_RGBA32UI, m_texels.data(), m_texels.size() * sizeof(glm::uvec4));
+
+        m_stats.materials = materialCount > 0 ? materialCount - 1 : 0;
+        m_stats.textures = static_cast<u32>(m_textureRefs.size());
+    }
+
+    void Bind(Shader& shader){
+        m_table.Bind(TABLE_UNIT);
+        shader.setInt("materialTable", TABLE_UNIT);
+
+        if(!m_bindless){
+            for(u32 i = 0; i < ARRAY_COUNT; i++){
+                glActiveTexture(GL_TEXTURE0 + FIRST_ARRAY_UNIT + i);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, m_arrays[i].texture);
+                shader.setInt("materialArrays[" + std::to_string(i) + "]", FIRST_ARRAY_UNIT + i);
+            }
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    const MaterialTableStats& GetStats() const { return m_stats; }
+
+private:
+    glm::uvec2 GetTextureRef(TextureID textureID){
+        if(textureID == INVALID_TEXTURE) return m_whiteRef;
+
+        const TextureData* textureData = m_assetManager->GetTexture(textureID);
+        if(!textureData) return m_whiteRef;
+        GPUTexture* gpuTexture = m_gpuResourceManager->GetGPUTexture(textureID);
+        if(!gpuTexture) return m_whiteRef;
+
+        // Not cached, the texture gets its own ref once uploaded. An evicted
+        // one gives its ref back.
+        if(m_gpuResourceManager->IsPlaceholder(gpuTexture)){
+            auto it = m_textureRefs.find(textureID);
+            if(it != m_textureRefs.end()){
+                FreeRef(it->second.ref);
+                m_textureRefs.erase(it);
+            }
+            return textureData->type == "normal" ? m_flatNormalRef : m_whiteRef;
+        }
+
+        // Size of the finest resident level
+        i32 width = std::max(textureData->width >> gpuTexture->residentMip, 1);
+        i32 height = std::max(textureData->height >> gpuTexture->residentMip, 1);
+
+        auto it = m_textureRefs.find(textureID);
+        if(it == m_textureRefs.end()){
+            TextureRef& entry = m_textureRefs[textureID];
+            entry.ref = AddTexture(gpuTexture->textureID, width, height, textureID);
+            entry.generation = gpuTexture->generation;
+            entry.copiedSize = std::max(width, height);
+            return entry.ref;
+        }
+
+        TextureRef& entry = it->second;
+        if(entry.generation != gpuTexture->generation){
+            entry.generation = gpuTexture->generation;
+            if(m_bindless){
+                FreeRef(entry.ref);
+                entry.ref = MakeResident(gpuTexture->textureID);
+            } else if(GetArrayIndex(width, height) != entry.ref.x){
+                // Resident size changed bucket, the old layer goes to the next texture needing one
+                FreeRef(entry.ref);
+                entry.ref = AddTexture(gpuTexture->textureID, width, height, textureID);
+                entry.copiedSize = std::max(width, height);
+            } else if(std::max(width, height) > entry.copiedSize){
+                // The layer keeps its best copy when levels are dropped, only finer ones are copied again
+                UpdateLayer(gpuTexture->textureID, width, height, entry.ref);
+                entry.copiedSize = std::max(width, height);
+            }
+        }
+        return entry.ref;
+    }
+
+    static u32 CreateSolidTexture(const u8 color[4]){
+        u32 texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, color);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    glm::uvec2 MakeResident(u32 texture){
+        GLuint64 handle = m_bindlessAPI.GetTextureHandle(texture);
+        m_bindlessAPI.MakeTextureHandleResident(handle);
+        m_residentHandles.push_back(handle);
+        return glm::uvec2(static_cast<u32>(handle), static_cast<u32>(handle >> 32));
+    }
+
+    // Nearest power of two of the larger side, clamped to the bucket sizes
+    static u32 GetArrayIndex(i32 width, i32 height){
+        u32 size = MIN_ARRAY_SIZE;
+        u32 arrayIndex = 0;
+        while(arrayIndex + 1 < ARRAY_COUNT && size < static_cast<u32>(std::max(width, height))){
+            size *= 2;
+            arrayIndex++;
+        }
+        return arrayIndex;
+    }
+
+    static u32 GetLevelCount(u32 size){
+        u32 levels = 1;
+        while((size >> levels) > 0) levels++;
+        return levels;
+    }
+
+    // width and height are the texture's level 0, which picks the array.
+    // owner is the texture the layer's ref is stored for, so it can follow
+    // the layer when the array shrinks.
+    glm::uvec2 AddTexture(u32 texture, i32 width, i32 height, TextureID owner = INVALID_TEXTURE){
+        if(m_bindless){
+            return MakeResident(texture);
+        }
+
+        u32 arrayIndex = GetArrayIndex(width, height);
+        TextureArray& array = m_arrays[arrayIndex];
+        u32 layer;
+        if(!array.freeLayers.empty()){
+            layer = array.freeLayers.back();
+            array.freeLayers.pop_back();
+            array.owners[layer] = owner;
+        } else {
+            if(array.owners.size() == array.capacity){
+                Resize(arrayIndex, std::max(array.capacity * 2, 4u));
+            }
+            layer = static_cast<u32>(array.owners.size());
+            array.owners.push_back(owner);
+        }
+
+        glm::uvec2 ref(arrayIndex, layer);
+        UpdateLayer(texture, width, height, ref);
+        return ref;
+    }
+
+    // The texture object behind a handle is gone with it, a layer goes to
+    // the next texture needing one
+    void FreeRef(glm::uvec2 ref){
+        if(m_bindless){
+            GLuint64 handle = static_cast<GLuint64>(ref.x) | (static_cast<GLuint64>(ref.y) << 32);
+            m_residentHandles.erase(std::remove(m_residentHandles.begin(), m_residentHandles.end(), handle),
+                                    m_residentHandles.end());
+            return;
+        }
+        TextureArray& array = m_arrays[ref.x];
+        array.owners[ref.y] = FREE_LAYER;
+        array.freeLayers.push_back(ref.y);
+    }
+
+    // Copies the texture into its layer again, mips included
+    void UpdateLayer(u32 texture, i32 width, i32 height, glm::uvec2 ref){
+        GLint readFramebuffer = 0;
+        GLint drawFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+
+        CopyLayer(texture, width, height, m_arrays[ref.x], ref.y);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    }
+
+    // New array object of capacity layers holding the layers in use. When
+    // shrinking, layers past its end move into free layers below it and
+    // their refs follow, the refs packed this frame must not be built yet.
+    void Resize(u32 arrayIndex, u32 capacity){
+        TextureArray& array = m_arrays[arrayIndex];
+        u32 size = MIN_ARRAY_SIZE << arrayIndex;
+        u32 levels = GetLevelCount(size);
+
+        u32 texture = 0;
+        if(capacity > 0){
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            for(u32 level = 0; level < levels; level++){
+                u32 levelSize = std::max(size >> level, 1u);
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, levelSize, levelSize, capacity, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+
+        // Free layers that stay, lowest handed out first
+        std::vector<TextureID> owners(std::min(static_cast<u32>(array.owners.size()), capacity), FREE_LAYER);
+        std::vector<u32> freeLayers;
+        for(u32 layer: array.freeLayers){
+            if(layer < owners.size()) freeLayers.push_back(layer);
+        }
+        std::sort(freeLayers.begin(), freeLayers.end(), std::greater<u32>());
+
+        // Resizes happen mid frame, keep the pass's framebuffers bound.
+        // GL 4.1 has no glCopyImageSubData, layers go through a blit per level.
+        GLint readFramebuffer = 0;
+        GLint drawFramebuffer = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_drawFramebuffer);
+        for(u32 layer = 0; layer < array.owners.size(); layer++){
+            TextureID owner = array.owners[layer];
+            if(owner == FREE_LAYER) continue;
+
+            u32 destination = layer;
+            if(layer >= owners.size()){
+                destination = freeLayers.back();
+                freeLayers.pop_back();
+                m_textureRefs[owner].ref.y = destination;
+            }
+            owners[destination] = owner;
+
+            for(u32 level = 0; level < levels; level++){
+                i32 levelSize = static_cast<i32>(std::max(size >> level, 1u));
+                glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, array.texture, level, layer);
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, level, destination);
+                glBlitFramebuffer(0, 0, levelSize, levelSize, 0, 0, levelSize, levelSize, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            }
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+
+        // Free layers at the end are handed out again in order
+        while(!owners.empty() && owners.back() == FREE_LAYER) owners.pop_back();
+        freeLayers.erase(std::remove_if(freeLayers.begin(), freeLayers.end(), [&](u32 layer){
+            return layer >= owners.size();
+        }), freeLayers.end());
+
+        m_stats.arrayMemory -= ArrayBytes(array);
+        glDeleteTextures(1, &array.texture);
+        array.texture = texture;
+        array.size = size;
+        array.capacity = capacity;
+        array.owners = std::move(owners);
+        array.freeLayers = std::move(freeLayers);
+        m_stats.arrayMemory += ArrayBytes(array);
+    }
+
+    // Rescales the texture into every level of the layer with a full screen
+    // triangle each, sampling the level closest to the target's size.
+    // Textures show up mid frame, so the state the draws touch is put back
+    // afterwards.
+    void CopyLayer(u32 texture, i32 width, i32 height, const TextureArray& array, u32 layer){
+        GLint program = 0, vertexArray = 0, activeTexture = 0, boundTexture = 0;
+        GLint viewport[4];
+        GLboolean colorMask[4];
+        glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vertexArray);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        const GLenum capabilities[] = {GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST, GL_STENCIL_TEST};
+        GLboolean enabled[5];
+        for(u32 i = 0; i < 5; i++){
+            enabled[i] = glIsEnabled(capabilities[i]);
+            glDisable(capabilities[i]);
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &boundTexture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        m_copyShader->use();
+        m_copyShader->setInt("source", 0);
+        glBindVertexArray(m_emptyVAO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_drawFramebuffer);
+
+        u32 levels = GetLevelCount(array.size);
+        for(u32 level = 0; level < levels; level++){
+            u32 levelSize = std::max(array.size >> level, 1u);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, array.texture, level, layer);
+            if(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+                std::cout << "ERROR::MATERIAL_TABLE:: Texture " << texture << " can't be copied into its array" << std::endl;
+                break;
+            }
+
+            f32 downscale = static_cast<f32>(std::max(width, height)) / static_cast<f32>(levelSize);
+            m_copyShader->setFloat("targetSize", static_cast<f32>(levelSize));
+            m_copyShader->setFloat("lod", std::max(std::log2(downscale), 0.0f));
+            glViewport(0, 0, levelSize, levelSize);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, boundTexture);
+        glActiveTexture(activeTexture);
+        glBindVertexArray(vertexArray);
+        glUseProgram(program);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+        for(u32 i = 0; i < 5; i++){
+            if(enabled[i]) glEnable(capabilities[i]);
+        }
+    }
+
+    // Full mip chain is a third more than level 0
+    static size_t LayerBytes(u32 arrayIndex){
+        size_t size = MIN_ARRAY_SIZE << arrayIndex;
+        return size * size * 4 * 4 / 3;
+    }
+
+    static size_t ArrayBytes(const TextureArray& array){
+        return static_cast<size_t>(array.size) * array.size * 4 * array.capacity * 4 / 3;
+    }
+};
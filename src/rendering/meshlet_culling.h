@@ -0,0 +1,185 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/frustum.h"
+#include "defines.h"
+
+// SSE is part of every x86-64 target, other targets take the scalar loop
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MESHLET_CULL_SSE 1
+#else
+#define MESHLET_CULL_SSE 0
+#endif
+
+struct MeshletCullStats{
+    u32 meshletsTested = 0;
+    u32 frustumCulled = 0;
+    u32 backfaceCulled = 0;     // inside the frustum, culled by the normal cone
+};
+
+// Frustum and normal cone tests of meshlets, four at a time. The view is
+// moved into each instance's object space instead of moving the meshlets
+// out of it: planes through the transpose of the world matrix, the camera
+// through its inverse. Both tests are exact in object space for any affine
+// transform, only a mirroring one skips the cone test since its front
+// faces wind the other way on screen.
+class MeshletCuller{
+private:
+    // Culling data of one mesh, structure of arrays padded to a multiple of four
+    struct MeshletSoA{
+        std::vector<f32> centerX, centerY, centerZ, radius;
+        std::vector<f32> axisX, axisY, axisZ, cutoff;
+        u32 count = 0;
+    };
+
+    AssetManager* m_assetManager;
+    std::unordered_map<MeshID, MeshletSoA> m_meshes;
+
+    Frustum m_frustum;
+    glm::vec3 m_cameraPosition{0.0f};
+
+    std::vector<u8> m_visible;
+    MeshletCullStats m_stats;
+
+public:
+    explicit MeshletCuller(AssetManager* assetManager) : m_assetManager(assetManager){}
+
+    // Starts a view, stats cover everything culled until the next call
+    void BeginView(const glm::mat4& viewProjection, const glm::vec3& cameraPosition){
+        m_frustum.Extract(viewProjection);
+        m_cameraPosition = cameraPosition;
+        m_stats = {};
+    }
+
+    // One byte per meshlet of the mesh, nonzero if it may be visible. Empty
+    // when the mesh has no meshlets and has to be drawn whole.
+    const std::vector<u8>& Cull(MeshID meshID, const glm::mat4& worldMatrix){
+        m_visible.clear();
+        const MeshletSoA* meshlets = GetMeshlets(meshID);
+        if(!meshlets) return m_visible;
+
+        // Object space view
+        glm::mat4 transposed = glm::transpose(worldMatrix);
+        glm::vec4 planes[Frustum::PLANE_COUNT];
+        for(u32 i = 0; i < Frustum::PLANE_COUNT; i++){
+            planes[i] = transposed * m_frustum.planes[i];
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+        glm::vec3 camera = glm::vec3(glm::inverse(worldMatrix) * glm::vec4(m_cameraPosition, 1.0f));
+        bool coneTest = glm::determinant(glm::mat3(worldMatrix)) > 0.0f;
+
+        m_visible.resize(meshlets->count);
+        CullRange(*meshlets, planes, camera, coneTest);
+        m_stats.meshletsTested += meshlets->count;
+        return m_visible;
+    }
+
+    const MeshletCullStats& GetStats() const { return m_stats; }
+
+private:
+    const MeshletSoA* GetMeshlets(MeshID meshID){
+        auto it = m_meshes.find(meshID);
+        if(it != m_meshes.end()) return it->second.count ? &it->second : nullptr;
+
+        // Meshes are immutable once loaded, converted on first use
+        MeshletSoA& soa = m_meshes[meshID];
+        const MeshData* mesh = m_assetManager->GetMesh(meshID);
+        if(!mesh || mesh->meshlets.empty()) return nullptr;
+
+        soa.count = static_cast<u32>(mesh->meshlets.size());
+        size_t padded = (soa.count + 3) & ~3u;
+        for(std::vector<f32>* lane: {&soa.centerX, &soa.centerY, &soa.centerZ, &soa.radius,
+                                     &soa.axisX, &soa.axisY, &soa.axisZ, &soa.cutoff}){
+            lane->assign(padded, 0.0f);
+        }
+        for(u32 i = 0; i < soa.count; i++){
+            const Meshlet& meshlet = mesh->meshlets[i];
+            soa.centerX[i] = meshlet.center.x;
+            soa.centerY[i] = meshlet.center.y;
+            soa.centerZ[i] = meshlet.center.z;
+            soa.radius[i] = meshlet.radius;
+            soa.axisX[i] = meshlet.coneAxis.x;
+            soa.axisY[i] = meshlet.coneAxis.y;
+            soa.axisZ[i] = meshlet.coneAxis.z;
+            soa.cutoff[i] = meshlet.coneCutoff;
+        }
+        return &soa;
+    }
+
+#if MESHLET_CULL_SSE
+    void CullRange(const MeshletSoA& meshlets, const glm::vec4* planes, const glm::vec3& camera, bool coneTest){
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 coneMask = _mm_castsi128_ps(_mm_set1_epi32(coneTest ? -1 : 0));
+        const __m128 cameraX = _mm_set1_ps(camera.x);
+        const __m128 cameraY = _mm_set1_ps(camera.y);
+        const __m128 cameraZ = _mm_set1_ps(camera.z);
+
+        for(u32 i = 0; i < meshlets.count; i += 4){
+            __m128 centerX = _mm_loadu_ps(&meshlets.centerX[i]);
+            __m128 centerY = _mm_loadu_ps(&meshlets.centerY[i]);
+            __m128 centerZ = _mm_loadu_ps(&meshlets.centerZ[i]);
+            __m128 radius = _mm_loadu_ps(&meshlets.radius[i]);
+            __m128 negativeRadius = _mm_sub_ps(zero, radius);
+
+            // Inside or touching every plane
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+            for(u32 p = 0; p < Frustum::PLANE_COUNT; p++){
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(planes[p].x)),
+                                                        _mm_mul_ps(centerY, _mm_set1_ps(planes[p].y))),
+                                             _mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(planes[p].z)),
+                                                        _mm_set1_ps(planes[p].w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+
+            // dot(center - camera, axis) >= cutoff * length(center - camera) + radius
+            __m128 toX = _mm_sub_ps(centerX, cameraX);
+            __m128 toY = _mm_sub_ps(centerY, cameraY);
+            __m128 toZ = _mm_sub_ps(centerZ, cameraZ);
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(toX, toX), _mm_mul_ps(toY, toY)), _mm_mul_ps(toZ, toZ)));
+            __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toX, _mm_loadu_ps(&meshlets.axisX[i])),
+                                                  _mm_mul_ps(toY, _mm_loadu_ps(&meshlets.axisY[i]))),
+                                       _mm_mul_ps(toZ, _mm_loadu_ps(&meshlets.axisZ[i])));
+            __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&meshlets.cutoff[i]), length), radius);
+            __m128 backface = _mm_and_ps(_mm_cmpge_ps(facing, limit), coneMask);
+
+            u32 insideBits = static_cast<u32>(_mm_movemask_ps(inside));
+            u32 backfaceBits = static_cast<u32>(_mm_movemask_ps(backface));
+            u32 lanes = std::min(4u, meshlets.count - i);
+            for(u32 lane = 0; lane < lanes; lane++){
+                Classify(i + lane, (insideBits >> lane) & 1, (backfaceBits >> lane) & 1);
+            }
+        }
+    }
+#else
+    void CullRange(const MeshletSoA& meshlets, const glm::vec4* planes, const glm::vec3& camera, bool coneTest){
+        for(u32 i = 0; i < meshlets.count; i++){
+            glm::vec3 center(meshlets.centerX[i], meshlets.centerY[i], meshlets.centerZ[i]);
+            f32 radius = meshlets.radius[i];
+
+            bool inside = true;
+            for(u32 p = 0; p < Frustum::PLANE_COUNT; p++){
+                inside = inside && glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -radius;
+            }
+
+            glm::vec3 toCenter = center - camera;
+            glm::vec3 axis(meshlets.axisX[i], meshlets.axisY[i], meshlets.axisZ[i]);
+            bool backface = coneTest && glm::dot(toCenter, axis) >= meshlets.cutoff[i] * glm::length(toCenter) + radius;
+
+            Classify(i, inside, backface);
+        }
+    }
+#endif
+
+    void Classify(u32 meshlet, bool inside, bool backface){
+        if(!inside) m_stats.frustumCulled++;
+        else if(backface) m_stats.backfaceCulled++;
+        m_visible[meshlet] = inside && !backface;
+    }
+};
@@ -0,0 +1,328 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/gpu_resource_manager.h"
+#include "rendering/frame_packet.h"
+#include "rendering/geometry_pool.h"
+#include "rendering/gpu_culling.h"
+#include "rendering/material_table.h"
+#include "rendering/meshlet_culling.h"
+#include "rendering/shader_permutations.h"
+#include "rendering/texture_buffer.h"
+#include "shader.h"
+#include "defines.h"
+
+struct MultiDrawStats{
+    u32 draws = 0;              // meshes covered
+    u32 drawCalls = 0;          // API calls issued
+    u32 materials = 0;
+    u32 trianglesRendered = 0;
+    MeshletCullStats meshlets;
+};
+
+// Forward opaque drawing without per-material state changes. Every mesh is
+// drawn from the geometry pool with its transform, normal matrix and
+// MaterialID fetched by draw ID, and the shader reads its textures through
+// the material table, so one glMultiDrawElementsIndirect covers all opaque
+// batches whatever their material. Without GL 4.3 the same draws are issued
+// one by one with the draw ID as a constant vertex attribute, still without
+// any texture binds.
+//
+// Meshes with meshlets are culled per meshlet against the camera first and
+// each run of visible meshlets becomes one command. The runs of a mesh all
+// carry its draw ID as base instance, so they share one transform.
+//
+// With GPU culling the CPU only lists whole meshes and their bounds, a
+// GPUCuller tests them against the frustum and the depth pyramid and
+// writes the commands the draws consume.
+//
+// DrawDepth lays down the depth pre-pass from the same pool vertices and
+// fetched transforms, so the color pass can test with GL_EQUAL.
+class MultiDrawRenderer{
+public:
+    static constexpr u32 DRAW_TRANSFORM_UNIT = 9;
+    static constexpr u32 DRAW_INFO_UNIT = 10;
+
+private:
+    enum class DrawCulling{
+        None,
+        Meshlets,   // CPU, per meshlet
+        GPU         // whole meshes, commands written by the GPUCuller
+    };
+
+    // Layout fixed by GL_DRAW_INDIRECT_BUFFER
+    struct DrawElementsIndirectCommand{
+        u32 count;
+        u32 instanceCount;
+        u32 firstIndex;
+        u32 baseVertex;
+        u32 baseInstance;       // draw ID
+    };
+
+    AssetManager* m_assetManager;
+    GPUResourceManager* m_gpuResourceManager;
+
+    MaterialTable m_materialTable;
+    MeshletCuller m_meshletCuller;
+    std::unique_ptr<GPUCuller> m_gpuCuller;
+    std::vector<GPUCullInstance> m_cullInstances;
+    ShaderPermutationCache* m_shaders;
+    Shader* m_shader = nullptr;
+
+    bool m_indirect = false;
+    u32 m_indirectBuffer = 0;
+    std::vector<DrawElementsIndirectCommand> m_commands;
+
+    std::vector<glm::vec4> m_drawTransforms;   // model matrix, then normal matrix columns
+    std::vector<glm::uvec4> m_drawInfos;       // MaterialID, receiveShadows
+    TextureBuffer m_drawTransformBuffer;
+    TextureBuffer m_drawInfoBuffer;
+
+    MultiDrawStats m_stats;
+
+public:
+    MultiDrawRenderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager, ShaderPermutationCache* shaders)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager),
+      m_materialTable(assetManager, gpuResourceManager), m_meshletCuller(assetManager), m_shaders(shaders){
+        // Base instance needs GL 4.2, indirect multi-draw 4.3
+        m_indirect = GLAD_GL_VERSION_4_3 != 0;
+        if(m_indirect){
+            glGenBuffers(1, &m_indirectBuffer);
+        }
+        if(GPUCuller::IsSupported()){
+            m_gpuCuller = std::make_unique<GPUCuller>();
+        }
+    }
+
+    ~MultiDrawRenderer(){
+        glDeleteBuffers(1, &m_indirectBuffer);
+    }
+
+    MultiDrawRenderer(const MultiDrawRenderer&) = delete;
+    MultiDrawRenderer& operator=(const MultiDrawRenderer&) = delete;
+
+    // Table permutation for this frame's light tier, lighting uniforms are
+    // set on it by the caller before Draw
+    Shader& GetShader(u32 lightFeatures){
+        m_shader = &m_shaders->Get(m_materialTable.GetFeatures() | lightFeatures);
+        return *m_shader;
+    }
+
+    bool UsesBindless() const { return m_materialTable.UsesBindless(); }
+    u32 GetShaderFeatures() const { return m_materialTable.GetFeatures(); }
+    bool UsesIndirect() const { return m_indirect; }
+    bool UsesGPUCulling() const { return m_gpuCuller != nullptr; }
+    bool UsesDrawCount() const { return m_gpuCuller && m_gpuCuller->UsesDrawCount(); }
+
+    // Draws every opaque batch, the shader from GetShader must be in use.
+    // cullMeshlets drops the meshlets camera can't see.
+    void Draw(const std::vector<RenderBatch>& batches, const CameraData& camera, bool cullMeshlets){
+        m_stats = {};
+        m_meshletCuller.BeginView(camera.projection * camera.view, camera.position);
+        BuildDraws(batches, cullMeshlets ? DrawCulling::Meshlets : DrawCulling::None);
+        m_stats.meshlets = m_meshletCuller.GetStats();
+        if(m_commands.empty()) return;
+
+        m_materialTable.Update();
+        m_materialTable.Bind(*m_shader);
+        UploadDraws(*m_shader);
+        IssueDraws();
+    }
+
+    // Depth pre-pass of every opaque batch with depthShader, depthOnly.vert
+    // built with MERGED_DRAWS, which must be in use. cullMeshlets as Draw
+    // will get it, false ahead of DrawGPUCulled so every mesh is drawn.
+    // Returns the API calls issued.
+    u32 DrawDepth(const std::vector<RenderBatch>& batches, const CameraData& camera, bool cullMeshlets, Shader& depthShader){
+        m_stats = {};
+        m_meshletCuller.BeginView(camera.projection * camera.view, camera.position);
+        BuildDraws(batches, cullMeshlets ? DrawCulling::Meshlets : DrawCulling::None);
+        if(m_commands.empty()) return 0;
+
+        UploadDraws(depthShader);
+        IssueDraws();
+        return m_stats.drawCalls;
+    }
+
+    // Draw with the commands culled on the GPU, needs UsesGPUCulling. depthTexture
+    // is the target being drawn into, it is read back into the depth pyramid
+    // between the phases and once more after them for the next frame.
+    void DrawGPUCulled(const std::vector<RenderBatch>& batches, const CameraData& camera,
+                       u32 depthTexture, glm::ivec2 depthSize){
+        m_stats = {};
+        BuildDraws(batches, DrawCulling::GPU);
+        if(m_cullInstances.empty()) return;
+
+        m_materialTable.Update();
+        m_materialTable.Bind(*m_shader);
+        UploadDraws(*m_shader);
+
+        GeometryPool& pool = m_gpuResourceManager->GetGeometryPool();
+        pool.ReserveDrawIDs(static_cast<u32>(m_drawInfos.size()));
+
+        glm::mat4 viewProjection = camera.projection * camera.view;
+        bool retest = m_gpuCuller->HasHistory();
+        m_gpuCuller->Upload(m_cullInstances);
+
+        m_gpuCuller->Cull(0, viewProjection);
+        m_shader->use();
+        glBindVertexArray(pool.GetVAO());
+        m_gpuCuller->Draw(0);
+        m_stats.drawCalls = 1;
+
+        // Without history phase 0 tested the frustum only and nothing is left over
+        if(retest){
+            m_gpuCuller->BuildHiZ(depthTexture, depthSize, viewProjection);
+            m_gpuCuller->Cull(1, viewProjection);
+            m_shader->use();
+            glBindVertexArray(pool.GetVAO());
+            m_gpuCuller->Draw(1);
+            m_stats.drawCalls++;
+        }
+        glBindVertexArray(0);
+
+        m_gpuCuller->BuildHiZ(depthTexture, depthSize, viewProjection);
+        m_gpuCuller->EndFrame();
+
+        // Counted on the GPU, a few frames old
+        m_stats.trianglesRendered = m_gpuCuller->GetStats().trianglesRendered;
+    }
+
+    const MultiDrawStats& GetStats() const { return m_stats; }
+    const GPUCullStats& GetGPUCullStats() const { return m_gpuCuller->GetStats(); }
+    const MaterialTableStats& GetMaterialTableStats() const { return m_materialTable.GetStats(); }
+
+private:
+    // m_commands from the pool VAO, one multi-draw or one call per command
+    void IssueDraws(){
+        GeometryPool& pool = m_gpuResourceManager->GetGeometryPool();
+        u32 drawCount = static_cast<u32>(m_commands.size());
+
+        if(m_indirect){
+            pool.ReserveDrawIDs(drawCount);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, m_commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, m_commands.size() * sizeof(DrawElementsIndirectCommand), m_commands.data());
+
+            glBindVertexArray(pool.GetVAO());
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, drawCount, 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            m_stats.drawCalls = 1;
+        } else {
+            // Location 3 stays a disabled array, its current value is the draw ID
+            glBindVertexArray(pool.GetVAO());
+            for(const DrawElementsIndirectCommand& command: m_commands){
+                glVertexAttribI4ui(3, command.baseInstance, 0, 0, 0);
+                glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                                         (void*)(static_cast<size_t>(command.firstIndex) * sizeof(u32)), command.baseVertex);
+            }
+            m_stats.drawCalls = drawCount;
+        }
+        glBindVertexArray(0);
+    }
+
+    void BuildDraws(const std::vector<RenderBatch>& batches, DrawCulling culling){
+        m_commands.clear();
+        m_drawTransforms.clear();
+        m_drawInfos.clear();
+        m_cullInstances.clear();
+
+        for(const RenderBatch& batch: batches){
+            if(batch.isTransparent) continue;
+            m_stats.materials++;
+
+            for(const RenderCommand* command: batch.commands){
+                const ModelAsset* model = m_assetManager->GetModel(command->modelID);
+                if(!model) continue;
+
+                for(MeshID meshID: model->GetLODMeshes(command->lodLevel)){
+                    const GeometryAllocation* allocation = m_gpuResourceManager->GetPoolAllocation(meshID);
+                    if(!allocation) continue;
+
+                    u32 drawID = static_cast<u32>(m_drawInfos.size());
+                    u32 indexCount = 0;
+                    if(culling == DrawCulling::Meshlets){
+                        indexCount = AddMeshletDraws(meshID, *allocation, command->worldMatrix, drawID);
+                        if(indexCount == 0) continue;
+                    } else if(culling == DrawCulling::GPU){
+                        indexCount = allocation->indexCount;
+                        AddCullInstance(meshID, *allocation, command->worldMatrix, drawID);
+                    } else {
+                        indexCount = allocation->indexCount;
+                        m_commands.push_back({indexCount, 1, allocation->firstIndex, allocation->baseVertex, drawID});
+                    }
+
+                    const glm::mat4& world = command->worldMatrix;
+                    const glm::mat4& normal = command->normalMatrix;
+                    m_drawTransforms.insert(m_drawTransforms.end(), {world[0], world[1], world[2], world[3], normal[0], normal[1], normal[2]});
+                    m_drawInfos.emplace_back(batch.materialID, command->receiveShadows ? 1u : 0u, 0u, 0u);
+
+                    m_stats.trianglesRendered += indexCount / 3;
+                }
+            }
+        }
+        m_stats.draws = static_cast<u32>(m_drawInfos.size());
+    }
+
+    // World space sphere of the mesh, scaled by the largest axis scale
+    void AddCullInstance(MeshID meshID, const GeometryAllocation& allocation, const glm::mat4& worldMatrix, u32 drawID){
+        const MeshData* mesh = m_assetManager->GetMesh(meshID);
+        glm::vec3 center = mesh ? mesh->boundsCenter : glm::vec3(0.0f);
+        f32 radius = mesh ? mesh->boundsRadius : 0.0f;
+        f32 scale = std::max(glm::length(glm::vec3(worldMatrix[0])),
+                             std::max(glm::length(glm::vec3(worldMatrix[1])), glm::length(glm::vec3(worldMatrix[2]))));
+
+        GPUCullInstance instance;
+        instance.sphere = glm::vec4(glm::vec3(worldMatrix * glm::vec4(center, 1.0f)), radius * scale);
+        instance.range = glm::uvec4(allocation.indexCount, allocation.firstIndex, allocation.baseVertex, drawID);
+        m_cullInstances.push_back(instance);
+    }
+
+    // Commands for the visible meshlet runs of a mesh, or one for all of it
+    // when it has no meshlets. Returns the indices covered, 0 if all culled.
+    u32 AddMeshletDraws(MeshID meshID, const GeometryAllocation& allocation, const glm::mat4& worldMatrix, u32 drawID){
+        const std::vector<u8>& visible = m_meshletCuller.Cull(meshID, worldMatrix);
+        if(visible.empty()){
+            m_commands.push_back({allocation.indexCount, 1, allocation.firstIndex, allocation.baseVertex, drawID});
+            return allocation.indexCount;
+        }
+
+        const std::vector<Meshlet>& meshlets = m_assetManager->GetMesh(meshID)->meshlets;
+        u32 indexCount = 0;
+        bool extendRun = false;
+        for(size_t i = 0; i < meshlets.size(); i++){
+            if(!visible[i]){
+                extendRun = false;
+                continue;
+            }
+
+            // Meshlets are consecutive in the index buffer, neighbours merge
+            if(extendRun){
+                m_commands.back().count += meshlets[i].indexCount;
+            } else {
+                m_commands.push_back({meshlets[i].indexCount, 1, allocation.firstIndex + meshlets[i].firstIndex,
+                                      allocation.baseVertex, drawID});
+            }
+            indexCount += meshlets[i].indexCount;
+            extendRun = true;
+        }
+        return indexCount;
+    }
+
+    void UploadDraws(Shader& shader){
+        m_drawTransformBuffer.Upload(GL_RGBA32F, m_drawTransforms.data(), m_drawTransforms.size() * sizeof(glm::vec4));
+        m_drawInfoBuffer.Upload(GL_RGBA32UI, m_drawInfos.data(), m_drawInfos.size() * sizeof(glm::uvec4));
+
+        m_drawTransformBuffer.Bind(DRAW_TRANSFORM_UNIT);
+        m_drawInfoBuffer.Bind(DRAW_INFO_UNIT);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("drawTransforms", DRAW_TRANSFORM_UNIT);
+        shader.setInt("drawInfos", DRAW_INFO_UNIT);
+    }
+};
@@ -0,0 +1,368 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/gpu_resource_manager.h"
+#include "rendering/frame_packet.h"
+#include "rendering/frustum.h"
+#include "rendering/render_graph.h"
+#include "rendering/texture_buffer.h"
+#include "shader.h"
+#include "defines.h"
+
+struct PointShadowSettings{
+    bool enabled = true;
+    u32 atlasSize = 4096;
+    u32 maxFaceSize = 512;
+    u32 minFaceSize = 64;
+    u32 maxShadowedLights = 16;
+
+    // Face texels per pixel of the light sphere's projected diameter
+    f32 resolutionScale = 0.5f;
+    f32 nearPlane = 0.05f;
+};
+
+struct PointShadowStats{
+    u32 shadowedLights = 0;
+    u32 drawCalls = 0;
+    u32 facesRendered = 0;      // caster faces that passed the per-face test
+    u32 facesCulled = 0;
+    f32 atlasUsage = 0.0f;      // fraction of the atlas allocated
+};
+
+// Cube face orientation shared with the lighting shaders: view direction
+// and up vector of face i, in GL cube map order
+namespace PointShadowFaces{
+    const glm::vec3 FORWARD[6] = {
+        { 1.0f,  0.0f,  0.0f}, {-1.0f,  0.0f,  0.0f},
+        { 0.0f,  1.0f,  0.0f}, { 0.0f, -1.0f,  0.0f},
+        { 0.0f,  0.0f,  1.0f}, { 0.0f,  0.0f, -1.0f}
+    };
+    const glm::vec3 UP[6] = {
+        { 0.0f, -1.0f,  0.0f}, { 0.0f, -1.0f,  0.0f},
+        { 0.0f,  0.0f,  1.0f}, { 0.0f,  0.0f, -1.0f},
+        { 0.0f, -1.0f,  0.0f}, { 0.0f, -1.0f,  0.0f}
+    };
+
+    inline glm::mat4 ViewProjection(const PointShadowData& shadow, u32 face){
+        glm::mat4 view = glm::lookAt(shadow.position, shadow.position + FORWARD[face], UP[face]);
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, shadow.nearPlane, shadow.radius);
+        return projection * view;
+    }
+
+    // Faces whose 90 degree pyramid the sphere touches. Each face is bounded
+    // by four planes through the light, e.g. dot(d, forward - right) >= 0.
+    inline u32 FaceMask(const glm::vec3& lightPosition, const glm::vec3& center, f32 radius){
+        glm::vec3 d = center - lightPosition;
+        f32 slack = radius * 1.41421356f;   // planes are unnormalized by sqrt(2)
+        u32 mask = 0;
+        for(u32 face = 0; face < 6; face++){
+            glm::vec3 forward = FORWARD[face];
+            glm::vec3 up = UP[face];
+            glm::vec3 right = glm::cross(forward, up);
+            f32 along = glm::dot(d, forward);
+            f32 x = glm::dot(d, right);
+            f32 y = glm::dot(d, up);
+            if(along - x >= -slack && along + x >= -slack && along - y >= -slack && along + y >= -slack){
+                mask |= 1u << face;
+            }
+        }
+        return mask;
+    }
+}
+
+// Picks the point lights that get a shadow this frame and packs their cube
+// faces into the atlas, simulation side. Lights are ranked by the projected
+// size of their sphere; the face resolution follows that size and is halved
+// until the block fits, so the atlas bounds the total shadow cost.
+class PointShadowAllocator{
+public:
+    // Bits in ShadowCaster::pointShadowMask
+    static constexpr u32 MAX_SHADOWED_LIGHTS = 32;
+
+private:
+    struct Candidate{
+        u32 lightIndex;
+        f32 importance;     // projected diameter in pixels
+    };
+    std::vector<Candidate> m_candidates;
+
+    struct Shelf{
+        u32 y;
+        u32 height;
+        u32 x;              // first free column
+    };
+    std::vector<Shelf> m_shelves;
+
+public:
+    void Allocate(std::vector<PointLightData>& lights, const CameraData& camera, const Frustum& frustum,
+                  glm::ivec2 viewportSize, const PointShadowSettings& settings, std::vector<PointShadowData>& shadows){
+        shadows.clear();
+        for(PointLightData& light: lights){
+            light.shadowIndex = -1;
+        }
+        if(!settings.enabled) return;
+
+        // Lights whose sphere is off screen cannot shadow anything visible
+        m_candidates.clear();
+        for(u32 i = 0; i < lights.size(); i++){
+            const PointLightData& light = lights[i];
+            if(!light.castShadows || !frustum.IntersectsSphere(light.position, light.radius)) continue;
+
+            f32 distance = std::max(glm::distance(camera.position, light.position), light.radius);
+            f32 importance = light.radius * camera.projection[1][1] * viewportSize.y / distance;
+            m_candidates.push_back({i, importance});
+        }
+        std::sort(m_candidates.begin(), m_candidates.end(), [](const Candidate& a, const Candidate& b){
+            return a.importance > b.importance;
+        });
+
+        m_shelves.clear();
+        u32 maxLights = std::min(settings.maxShadowedLights, MAX_SHADOWED_LIGHTS);
+
+        for(const Candidate& candidate: m_candidates){
+            if(shadows.size() >= maxLights) break;
+
+            f32 wanted = glm::clamp(candidate.importance * settings.resolutionScale,
+                                    static_cast<f32>(settings.minFaceSize), static_cast<f32>(settings.maxFaceSize));
+            u32 faceSize = settings.minFaceSize;
+            while(faceSize * 2 <= wanted) faceSize *= 2;
+
+            glm::uvec2 offset;
+            while(faceSize >= settings.minFaceSize && !Pack(faceSize * 3, faceSize * 2, settings.atlasSize, offset)){
+                faceSize /= 2;
+            }
+            if(faceSize < settings.minFaceSize) continue;
+
+            const PointLightData& light = lights[candidate.lightIndex];
+            PointShadowData shadow;
+            shadow.lightIndex = candidate.lightIndex;
+            shadow.position = light.position;
+            shadow.radius = light.radius;
+            shadow.nearPlane = settings.nearPlane;
+            shadow.atlasOffset = offset;
+            shadow.faceSize = faceSize;
+
+            lights[candidate.lightIndex].shadowIndex = static_cast<i32>(shadows.size());
+            shadows.push_back(shadow);
+        }
+    }
+
+    // Shadows whose light radius the sphere reaches
+    static u32 LightMask(const std::vector<PointShadowData>& shadows, const glm::vec3& center, f32 radius){
+        u32 mask = 0;
+        for(u32 i = 0; i < shadows.size(); i++){
+            f32 reach = shadows[i].radius + radius;
+            glm::vec3 delta = center - shadows[i].position;
+            if(glm::dot(delta, delta) <= reach * reach){
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+
+private:
+    // Shelf packing, blocks arrive in roughly decreasing size
+    bool Pack(u32 width, u32 height, u32 atlasSize, glm::uvec2& offset){
+        for(Shelf& shelf: m_shelves){
+            if(height <= shelf.height && shelf.x + width <= atlasSize){
+                offset = glm::uvec2(shelf.x, shelf.y);
+                shelf.x += width;
+                return true;
+            }
+        }
+
+        u32 top = m_shelves.empty() ? 0 : m_shelves.back().y + m_shelves.back().height;
+        if(width > atlasSize || top + height > atlasSize) return false;
+
+        m_shelves.push_back({top, height, width});
+        offset = glm::uvec2(0, top);
+        return true;
+    }
+};
+
+// Renders every allocated point shadow into the atlas. A geometry shader
+// with one invocation per face routes each triangle to the faces it touches
+// through gl_ViewportIndex, so a caster is drawn once per light instead of
+// once per face. Casters are culled per light by their sphere on the
+// simulation side and per face here; the faces they miss are skipped by the
+// geometry shader before any primitive is emitted.
+class PointShadowRenderer{
+public:
+    // Texture units in the lighting shaders
+    static constexpr u32 ATLAS_UNIT = 11;
+    static constexpr u32 TILE_UNIT = 12;
+
+private:
+    AssetManager* m_assetManager;
+    GPUResourceManager* m_gpuResourceManager;
+
+    u32 m_atlas = 0;
+    u32 m_framebuffer = 0;
+    u32 m_atlasSize = 0;
+
+    std::unique_ptr<Shader> m_shader;
+
+    // One texel per shadow: atlas offset, face size, near plane
+    TextureBuffer m_tiles;
+    std::vector<glm::vec4> m_tileTexels;
+
+    PointShadowStats m_stats;
+
+public:
+    PointShadowRenderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager){
+        m_shader = std::make_unique<Shader>("pointShadow.vert", "depthOnly.frag", "pointShadow.geom");
+        glGenFramebuffers(1, &m_framebuffer);
+    }
+
+    ~PointShadowRenderer(){
+        glDeleteFramebuffers(1, &m_framebuffer);
+        glDeleteTextures(1, &m_atlas);
+    }
+
+    PointShadowRenderer(const PointShadowRenderer&) = delete;
+    PointShadowRenderer& operator=(const PointShadowRenderer&) = delete;
+
+    // Adds the pass rendering this frame's point shadows, returns the atlas
+    // handle lighting passes read, or RG_INVALID_HANDLE if no light got one
+    RGHandle AddPass(RenderGraph& graph, const FramePacket& packet){
+        m_stats = {};
+        if(packet.pointShadows.empty()) return RG_INVALID_HANDLE;
+
+        Resize(packet.pointShadowAtlasSize);
+        RGHandle atlas = graph.ImportTexture("PointShadowAtlas", m_atlas,
+                                             {glm::ivec2(static_cast<i32>(m_atlasSize)), GL_DEPTH_COMPONENT24});
+
+        // Tiles are bound as viewports by the pass itself
+        graph.AddPass("PointShadows",
+            [&](RenderGraphBuilder& builder){
+                builder.Write(atlas);
+            },
+            [this, &packet](const RenderPassContext&){
+                RenderShadows(packet);
+            });
+
+        return atlas;
+    }
+
+    void Bind(Shader& shader){
+        glActiveTexture(GL_TEXTURE0 + ATLAS_UNIT);
+        glBindTexture(GL_TEXTURE_2D, m_atlas);
+        m_tiles.Bind(TILE_UNIT);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.setInt("pointShadowAtlas", ATLAS_UNIT);
+        shader.setInt("pointShadowTiles", TILE_UNIT);
+    }
+
+    const PointShadowStats& GetStats() const { return m_stats; }
+
+private:
+    void Resize(u32 atlasSize){
+        if(atlasSize == m_atlasSize) return;
+        m_atlasSize = atlasSize;
+
+        glDeleteTextures(1, &m_atlas);
+        glGenTextures(1, &m_atlas);
+        glBindTexture(GL_TEXTURE_2D, m_atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, atlasSize, atlasSize, 0,
+                     GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_atlas, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Point shadow atlas is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void RenderShadows(const FramePacket& packet){
+        m_tileTexels.clear();
+        u64 texelsUsed = 0;
+        for(const PointShadowData& shadow: packet.pointShadows){
+            m_tileTexels.emplace_back(shadow.atlasOffset.x, shadow.atlasOffset.y, shadow.faceSize, shadow.nearPlane);
+            texelsUsed += static_cast<u64>(shadow.faceSize) * shadow.faceSize * 6;
+        }
+        m_tiles.Upload(GL_RGBA32F, m_tileTexels.data(), m_tileTexels.size() * sizeof(glm::vec4));
+
+        m_stats.shadowedLights = static_cast<u32>(packet.pointShadows.size());
+        m_stats.atlasUsage = static_cast<f32>(texelsUsed) / (static_cast<f32>(m_atlasSize) * m_atlasSize);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glEnable(GL_SCISSOR_TEST);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 2.0f);
+
+        m_shader->use();
+        GLint faceMaskLocation = glGetUniformLocation(m_shader->ID, "faceMask");
+
+        for(u32 shadowIndex = 0; shadowIndex < packet.pointShadows.size(); shadowIndex++){
+            const PointShadowData& shadow = packet.pointShadows[shadowIndex];
+
+            // Clear only this light's block
+            glScissor(shadow.atlasOffset.x, shadow.atlasOffset.y, shadow.faceSize * 3, shadow.faceSize * 2);
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            for(u32 face = 0; face < 6; face++){
+                glViewportIndexedf(face, static_cast<f32>(shadow.atlasOffset.x + (face % 3) * shadow.faceSize),
+                                   static_cast<f32>(shadow.atlasOffset.y + (face / 3) * shadow.faceSize),
+                                   static_cast<f32>(shadow.faceSize), static_cast<f32>(shadow.faceSize));
+                m_shader->setMat4("faceViewProjection[" + std::to_string(face) + "]",
+                                  PointShadowFaces::ViewProjection(shadow, face));
+            }
+
+            for(const ShadowCaster& caster: packet.shadowCasters){
+                if(!(caster.pointShadowMask & (1u << shadowIndex))) continue;
+
+                u32 faceMask = PointShadowFaces::FaceMask(shadow.position, caster.boundsCenter, caster.boundsRadius);
+                u32 faces = 0;
+                for(u32 bits = faceMask; bits; bits &= bits - 1) faces++;
+                m_stats.facesRendered += faces;
+                m_stats.facesCulled += 6 - faces;
+                if(faceMask == 0) continue;
+
+                const ModelAsset* model = m_assetManager->GetModel(caster.modelID);
+                if(!model) continue;
+
+                glUniform1i(faceMaskLocation, static_cast<GLint>(faceMask));
+
+                for(MeshID meshID: model->GetLODMeshes(caster.lodLevel)){
+                    GPUMesh* gpuMesh = m_gpuResourceManager->GetGPUMesh(meshID);
+                    if(!gpuMesh) continue;
+
+                    m_shader->setMat4("model", caster.worldMatrix * gpuMesh->positionDecode);
+                    glBindVertexArray(gpuMesh->depthVAO);
+                    glDrawElements(GL_TRIANGLES, gpuMesh->indexCount, gpuMesh->indexType, 0);
+                    m_stats.drawCalls++;
+                }
+            }
+        }
+
+        glBindVertexArray(0);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_SCISSOR_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <vector>
+#include <array>
+
+#include "defines.h"
+#include "job_system.h"
+
+// Stable LSD radix sort of 64-bit keys with a 32-bit payload, 8 bits per pass.
+// Each pass histograms per worker range, prefix sums the counts and scatters
+// the ranges in parallel. Passes where every key shares the same digit are
+// skipped, so keys with mostly constant high bits only pay for the low ones.
+class RadixSorter{
+private:
+    static constexpr u32 RADIX_BITS = 8;
+    static constexpr u32 RADIX_SIZE = 1 << RADIX_BITS;
+    static constexpr u32 PASS_COUNT = 64 / RADIX_BITS;
+    static constexpr u32 MIN_BATCH_SIZE = 4096;
+
+    using Histogram = std::array<u32, RADIX_SIZE>;
+
+    std::vector<u64> m_tempKeys;
+    std::vector<u32> m_tempValues;
+    std::vector<Histogram> m_histograms;
+
+public:
+    void Sort(JobSystem& jobSystem, std::vector<u64>& keys, std::vector<u32>& values){
+        const u32 count = static_cast<u32>(keys.size());
+        if(count < 2) return;
+
+        m_tempKeys.resize(count);
+        m_tempValues.resize(count);
+
+        // Fixed range split so every pass sees the same ranges
+        const u32 batchCount = std::max(1u, std::min(jobSystem.GetThreadCount(), count / MIN_BATCH_SIZE));
+        const u32 batchSize = (count + batchCount - 1) / batchCount;
+        m_histograms.resize(batchCount);
+
+        u64* srcKeys = keys.data();
+        u32* srcValues = values.data();
+        u64* dstKeys = m_tempKeys.data();
+        u32* dstValues = m_tempValues.data();
+
+        for(u32 pass = 0; pass < PASS_COUNT; pass++){
+            const u32 shift = pass * RADIX_BITS;
+
+            // Per range digit counts
+            jobSystem.ParallelFor(batchCount, 1, [&](u32 begin, u32 end, u32){
+                for(u32 batch = begin; batch < end; batch++){
+                    Histogram& histogram = m_histograms[batch];
+                    histogram.fill(0);
+
+                    u32 first = batch * batchSize;
+                    u32 last = std::min(first + batchSize, count);
+                    for(u32 i = first; i < last; i++){
+                        histogram[(srcKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+                    }
+                }
+            });
+
+            // Skip the pass if all keys land in one bucket
+            bool trivialPass = false;
+            for(u32 digit = 0; digit < RADIX_SIZE && !trivialPass; digit++){
+                u32 total = 0;
+                for(const Histogram& histogram: m_histograms){
+                    total += histogram[digit];
+                }
+                trivialPass = total == count;
+            }
+            if(trivialPass) continue;
+
+            // Exclusive prefix sum in (digit, range) order keeps the sort stable
+            u32 offset = 0;
+            for(u32 digit = 0; digit < RADIX_SIZE; digit++){
+                for(Histogram& histogram: m_histograms){
+                    u32 digitCount = histogram[digit];
+                    histogram[digit] = offset;
+                    offset += digitCount;
+                }
+            }
+
+            jobSystem.ParallelFor(batchCount, 1, [&](u32 begin, u32 end, u32){
+                for(u32 batch = begin; batch < end; batch++){
+                    Histogram& histogram = m_histograms[batch];
+
+                    u32 first = batch * batchSize;
+                    u32 last = std::min(first + batchSize, count);
+                    for(u32 i = first; i < last; i++){
+                        u32 destination = histogram[(srcKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+                        dstKeys[destination] = srcKeys[i];
+                        dstValues[destination] = srcValues[i];
+                    }
+                }
+            });
+
+            std::swap(srcKeys, dstKeys);
+            std::swap(srcValues, dstValues);
+        }
+
+        // Odd number of executed passes leaves the result in the temp buffers
+        if(srcKeys != keys.data()){
+            keys.swap(m_tempKeys);
+            values.swap(m_tempValues);
+        }
+    }
+};
@@ -0,0 +1,623 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "defines.h"
+
+using RGHandle = u32;
+constexpr RGHandle RG_INVALID_HANDLE = ~0u;
+
+enum class RGLoadOp{
+    Load,
+    Clear
+};
+
+struct RGTextureDesc{
+    glm::ivec2 size{0};
+    GLenum format = GL_RGBA8;
+
+    bool operator==(const RGTextureDesc& other) const {
+        return size == other.size && format == other.format;
+    }
+};
+
+struct RenderGraphStats{
+    u32 passes = 0;
+    u32 passesCulled = 0;
+    u32 transientTextures = 0;
+    u32 physicalTextures = 0;
+    size_t transientBytes = 0;   // if every transient texture had its own memory
+    size_t physicalBytes = 0;    // actually allocated after aliasing
+};
+
+// Resources shared by every render path: the targets the scene is drawn
+// into before presenting, and inputs of the lighting passes
+struct SceneTargets{
+    RGHandle color = RG_INVALID_HANDLE;
+    RGHandle depth = RG_INVALID_HANDLE;
+    RGHandle shadowMap = RG_INVALID_HANDLE;     // invalid with shadows off
+    RGHandle pointShadowAtlas = RG_INVALID_HANDLE;  // invalid without shadowed point lights
+};
+
+inline const glm::vec4 SCENE_CLEAR_COLOR(0.1f, 0.1f, 0.1f, 1.0f);
+
+class RenderGraph;
+
+// Handed to a pass while it runs, resolves handles to GL textures
+class RenderPassContext{
+private:
+    const RenderGraph* m_graph;
+public:
+    RenderPassContext(const RenderGraph* graph): m_graph(graph){}
+    u32 GetTexture(RGHandle handle) const;
+    glm::ivec2 GetSize(RGHandle handle) const;
+};
+
+// Records what one pass reads and writes during setup
+class RenderGraphBuilder{
+private:
+    RenderGraph* m_graph;
+    u32 m_pass;
+public:
+    RenderGraphBuilder(RenderGraph* graph, u32 pass): m_graph(graph), m_pass(pass){}
+
+    // Sampled in shaders
+    void Read(RGHandle handle);
+    // Bound as render targets, in attachment order
+    void WriteColor(RGHandle handle, RGLoadOp loadOp = RGLoadOp::Load, const glm::vec4& clearColor = glm::vec4(0.0f));
+    void WriteDepth(RGHandle handle, RGLoadOp loadOp = RGLoadOp::Load, f32 clearDepth = 1.0f);
+    // Written through the pass's own framebuffer, e.g. layers of an imported array
+    void Write(RGHandle handle);
+    // Never culled, for passes with effects the graph cannot see
+    void SideEffect();
+};
+
+// Per-frame graph of render passes. Passes declare the textures they read and
+// write; Compile() orders them so every reader runs after all writers of a
+// texture, culls passes whose outputs never reach an imported resource, and
+// assigns transient textures to pooled GL textures so that textures with
+// disjoint lifetimes share memory. Pooled textures and framebuffers persist
+// across frames, a pool entry is released once a frame no longer needs it.
+class RenderGraph{
+public:
+    using SetupFn = std::function<void(RenderGraphBuilder&)>;
+    using ExecuteFn = std::function<void(const RenderPassContext&)>;
+
+private:
+    friend class RenderGraphBuilder;
+    friend class RenderPassContext;
+
+    struct Attachment{
+        RGHandle handle;
+        RGLoadOp loadOp;
+        glm::vec4 clearValue;
+    };
+
+    struct Pass{
+        std::string name;
+        ExecuteFn execute;
+        std::vector<RGHandle> reads;
+        std::vector<Attachment> colorWrites;
+        Attachment depthWrite{RG_INVALID_HANDLE, RGLoadOp::Load, glm::vec4(1.0f)};
+        std::vector<RGHandle> externalWrites;   // not bound by the graph, treated as loads
+        bool sideEffect = false;
+
+        // Compile results
+        bool culled = false;
+
+        RGLoadOp GetLoadOp(RGHandle handle) const {
+            if(depthWrite.handle == handle) return depthWrite.loadOp;
+            for(const Attachment& attachment: colorWrites){
+                if(attachment.handle == handle) return attachment.loadOp;
+            }
+            return RGLoadOp::Load;
+        }
+
+        bool Writes(RGHandle handle) const {
+            if(depthWrite.handle == handle) return true;
+            for(const Attachment& attachment: colorWrites){
+                if(attachment.handle == handle) return true;
+            }
+            return std::find(externalWrites.begin(), externalWrites.end(), handle) != externalWrites.end();
+        }
+    };
+
+    struct Resource{
+        std::string name;
+        RGTextureDesc desc;
+        bool imported = false;
+        bool backbuffer = false;
+        u32 importedTexture = 0;
+
+        // Compile results
+        std::vector<u32> writers;
+        std::vector<u32> readers;   // passes that read without writing
+        i32 firstUse = -1;
+        i32 lastUse = -1;
+        i32 physical = -1;
+    };
+
+    struct PhysicalTexture{
+        u32 texture = 0;
+        RGTextureDesc desc;
+        i32 busyUntil = -1;     // last execution index using it this frame
+        bool usedThisFrame = false;
+    };
+
+    std::vector<Pass> m_passes;
+    std::vector<Resource> m_resources;
+    std::vector<u32> m_executionOrder;
+
+    std::vector<PhysicalTexture> m_pool;
+    std::map<std::vector<u32>, u32> m_framebuffers;
+
+    RenderGraphStats m_stats;
+
+public:
+    RenderGraph() = default;
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    ~RenderGraph(){
+        ReleaseFramebuffers();
+        for(PhysicalTexture& physical: m_pool){
+            glDeleteTextures(1, &physical.texture);
+        }
+    }
+
+    // Drops the previous frame's passes and resources, keeps the pool
+    void Reset(){
+        m_passes.clear();
+        m_resources.clear();
+        m_executionOrder.clear();
+    }
+
+    // Transient texture, memory is only assigned if a live pass uses it
+    RGHandle CreateTexture(const char* name, const RGTextureDesc& desc){
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        m_resources.push_back(resource);
+        return static_cast<RGHandle>(m_resources.size() - 1);
+    }
+
+    // Externally owned texture, writes to it keep passes alive
+    RGHandle ImportTexture(const char* name, u32 texture, const RGTextureDesc& desc){
+        RGHandle handle = CreateTexture(name, desc);
+        m_resources[handle].imported = true;
+        m_resources[handle].importedTexture = texture;
+        return handle;
+    }
+
+    // The default framebuffer, only usable as a pass's sole color target
+    RGHandle ImportBackbuffer(const char* name, glm::ivec2 size){
+        RGHandle handle = ImportTexture(name, 0, {size, GL_RGBA8});
+        m_resources[handle].backbuffer = true;
+        return handle;
+    }
+
+    void AddPass(const char* name, const SetupFn& setup, const ExecuteFn& execute){
+        Pass pass;
+        pass.name = name;
+        pass.execute = execute;
+        m_passes.push_back(std::move(pass));
+
+        RenderGraphBuilder builder(this, static_cast<u32>(m_passes.size() - 1));
+        setup(builder);
+    }
+
+    void Compile(){
+        BuildDependencies();
+        CullPasses();
+        SortPasses();
+        AssignPhysicalTextures();
+    }
+
+    void Execute(){
+        RenderPassContext context(this);
+        for(u32 passIndex: m_executionOrder){
+            Pass& pass = m_passes[passIndex];
+            BindTargets(pass);
+            pass.execute(context);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    const RGTextureDesc& GetDesc(RGHandle handle) const { return m_resources[handle].desc; }
+    const RenderGraphStats& GetStats() const { return m_stats; }
+
+private:
+    void BuildDependencies(){
+        for(u32 passIndex = 0; passIndex < m_passes.size(); passIndex++){
+            Pass& pass = m_passes[passIndex];
+            for(const Attachment& attachment: pass.colorWrites){
+                m_resources[attachment.handle].writers.push_back(passIndex);
+            }
+            if(pass.depthWrite.handle != RG_INVALID_HANDLE){
+                m_resources[pass.depthWrite.handle].writers.push_back(passIndex);
+            }
+            for(RGHandle handle: pass.externalWrites){
+                m_resources[handle].writers.push_back(passIndex);
+            }
+            for(RGHandle handle: pass.reads){
+                if(!pass.Writes(handle)){
+                    m_resources[handle].readers.push_back(passIndex);
+                }
+            }
+        }
+    }
+
+    // Walks back from the passes with visible effects (imported outputs or
+    // SideEffect()) through the passes whose output they consume. A reader
+    // consumes every writer since the last one that cleared the texture, a
+    // writer that loads consumes the writer before it.
+    void CullPasses(){
+        const u32 passCount = static_cast<u32>(m_passes.size());
+        std::vector<std::vector<u32>> producers(passCount);
+
+        for(RGHandle handle = 0; handle < m_resources.size(); handle++){
+            const Resource& resource = m_resources[handle];
+
+            u32 firstContributing = 0;
+            for(u32 i = 0; i < resource.writers.size(); i++){
+                const Pass& writer = m_passes[resource.writers[i]];
+                if(writer.GetLoadOp(handle) == RGLoadOp::Clear){
+                    firstContributing = i;
+                } else if(i > 0){
+                    producers[resource.writers[i]].push_back(resource.writers[i - 1]);
+                }
+            }
+
+            for(u32 reader: resource.readers){
+                for(u32 i = firstContributing; i < resource.writers.size(); i++){
+                    producers[reader].push_back(resource.writers[i]);
+                }
+            }
+        }
+
+        std::vector<u32> stack;
+        for(u32 passIndex = 0; passIndex < passCount; passIndex++){
+            Pass& pass = m_passes[passIndex];
+            pass.culled = true;
+
+            bool visible = pass.sideEffect;
+            for(const Attachment& attachment: pass.colorWrites){
+                visible |= m_resources[attachment.handle].imported;
+            }
+            if(pass.depthWrite.handle != RG_INVALID_HANDLE){
+                visible |= m_resources[pass.depthWrite.handle].imported;
+            }
+            for(RGHandle handle: pass.externalWrites){
+                visible |= m_resources[handle].imported;
+            }
+            if(visible) stack.push_back(passIndex);
+        }
+
+        while(!stack.empty()){
+            u32 passIndex = stack.back();
+            stack.pop_back();
+            if(!m_passes[passIndex].culled) continue;
+
+            m_passes[passIndex].culled = false;
+            for(u32 producer: producers[passIndex]){
+                if(m_passes[producer].culled) stack.push_back(producer);
+            }
+        }
+    }
+
+    // Topological order: writers of a texture in declaration order, readers
+    // after all of its writers. Ties keep declaration order.
+    void SortPasses(){
+        const u32 passCount = static_cast<u32>(m_passes.size());
+        std::vector<std::vector<u32>> successors(passCount);
+        std::vector<u32> inDegree(passCount, 0);
+
+        auto addEdge = [&](u32 from, u32 to){
+            if(from == to || m_passes[from].culled || m_passes[to].culled) return;
+            successors[from].push_back(to);
+            inDegree[to]++;
+        };
+
+        for(const Resource& resource: m_resources){
+            for(size_t i = 1; i < resource.writers.size(); i++){
+                addEdge(resource.writers[i - 1], resource.writers[i]);
+            }
+            for(u32 reader: resource.readers){
+                for(u32 writer: resource.writers){
+                    addEdge(writer, reader);
+                }
+            }
+        }
+
+        std::priority_queue<u32, std::vector<u32>, std::greater<u32>> ready;
+        for(u32 passIndex = 0; passIndex < passCount; passIndex++){
+            if(!m_passes[passIndex].culled && inDegree[passIndex] == 0) ready.push(passIndex);
+        }
+
+        m_executionOrder.clear();
+        while(!ready.empty()){
+            u32 passIndex = ready.top();
+            ready.pop();
+            m_executionOrder.push_back(passIndex);
+            for(u32 successor: successors[passIndex]){
+                if(--inDegree[successor] == 0) ready.push(successor);
+            }
+        }
+
+        m_stats.passes = passCount;
+        m_stats.passesCulled = 0;
+        for(const Pass& pass: m_passes){
+            if(pass.culled) m_stats.passesCulled++;
+        }
+
+        u32 livePasses = passCount - m_stats.passesCulled;
+        if(m_executionOrder.size() != livePasses){
+            std::cout << "ERROR::RENDER_GRAPH:: Dependency cycle, "
+                      << livePasses - m_executionOrder.size() << " passes skipped" << std::endl;
+        }
+    }
+
+    void AssignPhysicalTextures(){
+        // Lifetimes in execution order
+        for(u32 order = 0; order < m_executionOrder.size(); order++){
+            const Pass& pass = m_passes[m_executionOrder[order]];
+            auto touch = [&](RGHandle handle){
+                Resource& resource = m_resources[handle];
+                if(resource.firstUse < 0) resource.firstUse = static_cast<i32>(order);
+                resource.lastUse = static_cast<i32>(order);
+            };
+            for(RGHandle handle: pass.reads) touch(handle);
+            for(const Attachment& attachment: pass.colorWrites) touch(attachment.handle);
+            if(pass.depthWrite.handle != RG_INVALID_HANDLE) touch(pass.depthWrite.handle);
+            for(RGHandle handle: pass.externalWrites) touch(handle);
+        }
+
+        for(PhysicalTexture& physical: m_pool){
+            physical.busyUntil = -1;
+            physical.usedThisFrame = false;
+        }
+
+        m_stats.transientTextures = 0;
+        m_stats.transientBytes = 0;
+
+        // Greedy interval assignment, resources sorted by first use
+        std::vector<RGHandle> transients;
+        for(RGHandle handle = 0; handle < m_resources.size(); handle++){
+            const Resource& resource = m_resources[handle];
+            if(!resource.imported && resource.firstUse >= 0) transients.push_back(handle);
+        }
+        std::sort(transients.begin(), transients.end(), [&](RGHandle a, RGHandle b){
+            return m_resources[a].firstUse < m_resources[b].firstUse;
+        });
+
+        for(RGHandle handle: transients){
+            Resource& resource = m_resources[handle];
+            m_stats.transientTextures++;
+            m_stats.transientBytes += TextureBytes(resource.desc);
+
+            i32 match = -1;
+            for(i32 i = 0; i < static_cast<i32>(m_pool.size()); i++){
+                const PhysicalTexture& physical = m_pool[i];
+                if(physical.desc == resource.desc && physical.busyUntil < resource.firstUse){
+                    match = i;
+                    break;
+                }
+            }
+            if(match < 0){
+                PhysicalTexture physical;
+                physical.desc = resource.desc;
+                physical.texture = CreateTexture(resource.desc);
+                m_pool.push_back(physical);
+                match = static_cast<i32>(m_pool.size() - 1);
+            }
+
+            m_pool[match].busyUntil = resource.lastUse;
+            m_pool[match].usedThisFrame = true;
+            resource.physical = match;
+        }
+
+        // Release textures this frame did not need, e.g. after a resize
+        bool released = false;
+        for(size_t i = 0; i < m_pool.size();){
+            if(m_pool[i].usedThisFrame){
+                i++;
+                continue;
+            }
+            glDeleteTextures(1, &m_pool[i].texture);
+            m_pool.erase(m_pool.begin() + i);
+            released = true;
+
+            for(Resource& resource: m_resources){
+                if(resource.physical > static_cast<i32>(i)) resource.physical--;
+            }
+        }
+        if(released) ReleaseFramebuffers();
+
+        m_stats.physicalTextures = static_cast<u32>(m_pool.size());
+        m_stats.physicalBytes = 0;
+        for(const PhysicalTexture& physical: m_pool){
+            m_stats.physicalBytes += TextureBytes(physical.desc);
+        }
+    }
+
+    u32 GetTexture(RGHandle handle) const {
+        const Resource& resource = m_resources[handle];
+        if(resource.imported) return resource.importedTexture;
+        return resource.physical >= 0 ? m_pool[resource.physical].texture : 0;
+    }
+
+    void BindTargets(const Pass& pass){
+        glm::ivec2 size(0);
+        bool backbuffer = false;
+        std::vector<u32> key;
+
+        for(const Attachment& attachment: pass.colorWrites){
+            const Resource& resource = m_resources[attachment.handle];
+            backbuffer |= resource.backbuffer;
+            size = resource.desc.size;
+            key.push_back(GetTexture(attachment.handle));
+        }
+        key.push_back(0);   // separates color from depth
+        if(pass.depthWrite.handle != RG_INVALID_HANDLE){
+            size = m_resources[pass.depthWrite.handle].desc.size;
+            key.push_back(GetTexture(pass.depthWrite.handle));
+        }
+
+        if(backbuffer){
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        } else if(pass.colorWrites.empty() && pass.depthWrite.handle == RG_INVALID_HANDLE){
+            return;
+        } else {
+            glBindFramebuffer(GL_FRAMEBUFFER, GetFramebuffer(pass, key));
+        }
+        glViewport(0, 0, size.x, size.y);
+
+        // Clears respect the write masks
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        for(u32 i = 0; i < pass.colorWrites.size(); i++){
+            const Attachment& attachment = pass.colorWrites[i];
+            if(attachment.loadOp != RGLoadOp::Clear) continue;
+
+            if(backbuffer){
+                glClearColor(attachment.clearValue.r, attachment.clearValue.g, attachment.clearValue.b, attachment.clearValue.a);
+                glClear(GL_COLOR_BUFFER_BIT);
+            } else if(IsIntegerFormat(m_resources[attachment.handle].desc.format)){
+                GLuint value[4] = {static_cast<GLuint>(attachment.clearValue.r), static_cast<GLuint>(attachment.clearValue.g),
+                                   static_cast<GLuint>(attachment.clearValue.b), static_cast<GLuint>(attachment.clearValue.a)};
+                glClearBufferuiv(GL_COLOR, i, value);
+            } else {
+                glClearBufferfv(GL_COLOR, i, &attachment.clearValue.r);
+            }
+        }
+        if(pass.depthWrite.handle != RG_INVALID_HANDLE && pass.depthWrite.loadOp == RGLoadOp::Clear){
+            glClearBufferfv(GL_DEPTH, 0, &pass.depthWrite.clearValue.r);
+        }
+    }
+
+    u32 GetFramebuffer(const Pass& pass, const std::vector<u32>& key){
+        auto it = m_framebuffers.find(key);
+        if(it != m_framebuffers.end()) return it->second;
+
+        u32 framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+        std::vector<GLenum> drawBuffers;
+        for(u32 i = 0; i < pass.colorWrites.size(); i++){
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, GetTexture(pass.colorWrites[i].handle), 0);
+            drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+        }
+        if(drawBuffers.empty()){
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        } else {
+            glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+        }
+
+        if(pass.depthWrite.handle != RG_INVALID_HANDLE){
+            GLenum format = m_resources[pass.depthWrite.handle].desc.format;
+            GLenum attachmentPoint = format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8
+                                   ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachmentPoint, GL_TEXTURE_2D, GetTexture(pass.depthWrite.handle), 0);
+        }
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Render graph pass '" << pass.name << "' targets are not complete!" << std::endl;
+
+        m_framebuffers[key] = framebuffer;
+        return framebuffer;
+    }
+
+    void ReleaseFramebuffers(){
+        for(auto& pair: m_framebuffers){
+            glDeleteFramebuffers(1, &pair.second);
+        }
+        m_framebuffers.clear();
+    }
+
+    static u32 CreateTexture(const RGTextureDesc& desc){
+        GLenum format = GL_RGBA;
+        GLenum type = GL_UNSIGNED_BYTE;
+        switch(desc.format){
+        case GL_R32UI:                  format = GL_RED_INTEGER;        type = GL_UNSIGNED_INT; break;
+        case GL_RG32UI:                 format = GL_RG_INTEGER;         type = GL_UNSIGNED_INT; break;
+        case GL_RGBA16:                 format = GL_RGBA;               type = GL_UNSIGNED_SHORT; break;
+        case GL_RGBA16F:                format = GL_RGBA;               type = GL_HALF_FLOAT; break;
+        case GL_R16F:                   format = GL_RED;                type = GL_HALF_FLOAT; break;
+        case GL_R8:                     format = GL_RED;                type = GL_UNSIGNED_BYTE; break;
+        case GL_DEPTH24_STENCIL8:       format = GL_DEPTH_STENCIL;      type = GL_UNSIGNED_INT_24_8; break;
+        case GL_DEPTH_COMPONENT24:      format = GL_DEPTH_COMPONENT;    type = GL_UNSIGNED_INT; break;
+        case GL_DEPTH_COMPONENT32F:     format = GL_DEPTH_COMPONENT;    type = GL_FLOAT; break;
+        default: break;
+        }
+
+        u32 texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.size.x, desc.size.y, 0, format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    static bool IsIntegerFormat(GLenum format){
+        return format == GL_R32UI || format == GL_RG32UI;
+    }
+
+    static size_t TextureBytes(const RGTextureDesc& desc){
+        size_t texelBytes = 4;
+        switch(desc.format){
+        case GL_RGBA16:
+        case GL_RGBA16F:
+        case GL_RG32UI:
+        case GL_DEPTH32F_STENCIL8:
+            texelBytes = 8; break;
+        case GL_R16F:
+            texelBytes = 2; break;
+        case GL_R8:
+            texelBytes = 1; break;
+        default: break;
+        }
+        return static_cast<size_t>(desc.size.x) * desc.size.y * texelBytes;
+    }
+};
+
+inline u32 RenderPassContext::GetTexture(RGHandle handle) const {
+    return m_graph->GetTexture(handle);
+}
+
+inline glm::ivec2 RenderPassContext::GetSize(RGHandle handle) const {
+    return m_graph->m_resources[handle].desc.size;
+}
+
+inline void RenderGraphBuilder::Read(RGHandle handle){
+    m_graph->m_passes[m_pass].reads.push_back(handle);
+}
+
+inline void RenderGraphBuilder::WriteColor(RGHandle handle, RGLoadOp loadOp, const glm::vec4& clearColor){
+    m_graph->m_passes[m_pass].colorWrites.push_back({handle, loadOp, clearColor});
+}
+
+inline void RenderGraphBuilder::WriteDepth(RGHandle handle, RGLoadOp loadOp, f32 clearDepth){
+    m_graph->m_passes[m_pass].depthWrite = {handle, loadOp, glm::vec4(clearDepth)};
+}
+
+inline void RenderGraphBuilder::Write(RGHandle handle){
+    m_graph->m_passes[m_pass].externalWrites.push_back(handle);
+}
+
+inline void RenderGraphBuilder::SideEffect(){
+    m_graph->m_passes[m_pass].sideEffect = true;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <glad/gl.h>
+#include <glfw/glfw3.h>
+#include <imgui_impl_opengl3.h>
+
+#include "rendering/frame_packet.h"
+#include "rendering/renderer.h"
+#include "defines.h"
+
+// Owns the GL context and draws frame packets produced by the simulation
+// thread. With a frame latency of N the simulation may run up to N packets
+// ahead of the frame being drawn, so CPU simulation of frame N+1 overlaps
+// GL submission of frame N.
+class RenderThread{
+public:
+    static constexpr u32 MAX_FRAME_LATENCY = 3;
+
+private:
+    GLFWwindow* m_window;
+    Renderer* m_renderer;
+
+    // One packet per queued frame, plus the one being built and the one being drawn
+    std::vector<std::unique_ptr<FramePacket>> m_packets;
+    std::deque<FramePacket*> m_freePackets;
+    std::deque<FramePacket*> m_pendingPackets;
+
+    std::mutex m_mutex;
+    std::condition_variable m_packetFreed;
+    std::condition_variable m_packetReady;
+    bool m_shutdown = false;
+
+    std::atomic<u32> m_frameLatency;
+    std::thread m_thread;
+
+    // Statistics
+    std::atomic<f32> m_renderTimeMs{0.0f};
+    std::atomic<f32> m_waitTimeMs{0.0f};
+    std::atomic<f64> m_firstFrameTime{-1.0};    // glfwGetTime at the first present
+
+public:
+    RenderThread(GLFWwindow* window, Renderer* renderer, u32 frameLatency = 1)
+    : m_window(window), m_renderer(renderer), m_frameLatency(glm::clamp(frameLatency, 1u, MAX_FRAME_LATENCY)){
+        for(u32 i = 0; i < MAX_FRAME_LATENCY + 2; i++){
+            m_packets.push_back(std::make_unique<FramePacket>());
+            m_freePackets.push_back(m_packets.back().get());
+        }
+    }
+
+    ~RenderThread(){
+        Stop();
+    }
+
+    // Hands the GL context over to the render thread. Must be called from
+    // the thread that currently has the context bound.
+    void Start(){
+        glfwMakeContextCurrent(NULL);
+        m_thread = std::thread([this](){ ThreadLoop(); });
+    }
+
+    // Drains the queue, joins and binds the context back to the caller
+    void Stop(){
+        if(!m_thread.joinable()) return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shutdown = true;
+        }
+        m_packetReady.notify_all();
+        m_thread.join();
+
+        glfwMakeContextCurrent(m_window);
+    }
+
+    // Simulation side: get a packet to fill. Blocks while the render thread
+    // is already frameLatency packets behind.
+    FramePacket* AcquirePacket(){
+        double waitStart = glfwGetTime();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_packetFreed.wait(lock, [this](){
+            return !m_freePackets.empty() && m_pendingPackets.size() < m_frameLatency.load();
+        });
+
+        FramePacket* packet = m_freePackets.front();
+        m_freePackets.pop_front();
+
+        m_waitTimeMs.store(static_cast<f32>((glfwGetTime() - waitStart) * 1000.0));
+        return packet;
+    }
+
+    // Simulation side: the packet must not be touched after this
+    void SubmitPacket(FramePacket* packet){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pendingPackets.push_back(packet);
+        }
+        m_packetReady.notify_one();
+    }
+
+    void SetFrameLatency(u32 frameLatency){
+        m_frameLatency.store(glm::clamp(frameLatency, 1u, MAX_FRAME_LATENCY));
+        m_packetFreed.notify_all();
+    }
+
+    u32 GetFrameLatency() const { return m_frameLatency.load(); }
+    f32 GetRenderTimeMs() const { return m_renderTimeMs.load(); }
+    f32 GetWaitTimeMs() const { return m_waitTimeMs.load(); }
+    f64 GetFirstFrameTime() const { return m_firstFrameTime.load(); }
+
+private:
+    void ThreadLoop(){
+        glfwMakeContextCurrent(m_window);
+
+        while(true){
+            FramePacket* packet = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_packetReady.wait(lock, [this](){ return m_shutdown || !m_pendingPackets.empty(); });
+
+                if(m_pendingPackets.empty()) break;
+
+                packet = m_pendingPackets.front();
+                m_pendingPackets.pop_front();
+            }
+
+            double renderStart = glfwGetTime();
+
+            m_renderer->RenderFrame(*packet);
+            ImGui_ImplOpenGL3_RenderDrawData(&packet->imgui.drawData);
+            glfwSwapBuffers(m_window);
+            if(m_firstFrameTime.load() < 0.0) m_firstFrameTime.store(glfwGetTime());
+
+            m_renderTimeMs.store(static_cast<f32>((glfwGetTime() - renderStart) * 1000.0));
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_freePackets.push_back(packet);
+            }
+            m_packetFreed.notify_one();
+        }
+
+        glfwMakeContextCurrent(NULL);
+    }
+};
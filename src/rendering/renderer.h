@@ -3,6 +3,8 @@
 #include <unordered_map>
 #include <algorithm>
 #include <memory>
+#include <cstring>
+#include <limits>
 
 #include <glad/gl.h>
 #include <glm/glm.hpp>
@@ -13,143 +15,765 @@
 #include "ecs/component_manager.h"
 #include "assets/asset_manager.h"  
 #include "rendering/gpu_resource_manager.h"  
+#include "rendering/frustum.h"
+#include "rendering/radix_sort.h"
+#include "rendering/frame_packet.h"
+#include "rendering/lod.h"
+#include "rendering/light_clusters.h"
+#include "rendering/gpu_queries.h"
+#include "rendering/deferred_renderer.h"
+#include "rendering/visibility_renderer.h"
+#include "rendering/render_graph.h"
+#include "rendering/shadows.h"
+#include "rendering/point_shadows.h"
+#include "rendering/multi_draw.h"
+#include "rendering/shader_permutations.h"
+#include "job_system.h"
 #include "shader.h"
 #include "defines.h"
 
+// Commands recorded by one thread, merged by the renderer at frame start
+struct RenderCommandList{
+    std::vector<RenderCommand> commands;
+    std::vector<u64> sortKeys;
+    std::vector<ShadowCaster> shadowCasters;
+
+    void Clear(){
+        commands.clear();
+        sortKeys.clear();
+        shadowCasters.clear();
+    }
+};
+
 class Renderer{
 private:
     AssetManager* m_assetManager;
     GPUResourceManager* m_gpuResourceManager;
+    JobSystem* m_jobSystem;
 
-    // Render commands for current frame
-    std::vector<RenderCommand> m_renderCommands;
-    std::vector<RenderBatch> m_renderBatches;
+    // --- Simulation side: command recording and frame packet building ---
+
+    // Per-thread command lists, indexed by JobSystem::GetThreadIndex()
+    std::vector<RenderCommandList> m_commandLists;
+    std::vector<RenderCommand> m_unsortedCommands;
+    std::vector<u32> m_sortIndices;
+    RadixSorter m_radixSorter;
 
     // Camera data
-    glm::mat4 m_viewMatrix{1.0f};
-    glm::mat4 m_projectionMatrix{1.0f};
-    glm::vec3 m_cameraPosition{0.0f};
+    CameraData m_camera;
+    ViewSettings m_viewSettings;
+    TextureStreamingSettings m_textureStreamingSettings;
+    UploadSettings m_uploadSettings;
+    ResidencySettings m_residencySettings;
+    Frustum m_frustum;
+    glm::ivec2 m_viewportSize{1};
 
-    // Shaders
-    std::unique_ptr<Shader> m_defaultShader;
-    Shader* m_currentShader;
+    LODSettings m_lodSettings;
 
-    // Statistics
-    u32 m_drawCalls = 0;
-    u32 m_trianglesRendered = 0;
+    // Directional light cascades, fitted when the camera is set so casters
+    // can be culled against them while commands are recorded
+    ShadowSettings m_shadowSettings;
+    ShadowCascadeData m_shadowCascades;
+
+    // Point lights submitted this frame and their cluster assignment
+    std::vector<PointLightData> m_pointLights;
+    PointShadowSettings m_pointShadowSettings;
+    PointShadowAllocator m_pointShadowAllocator;
+    std::vector<PointShadowData> m_pointShadows;
+    LightClusterBuilder m_lightClusterBuilder;
+    u32 m_pointLightCount = 0;
+    u32 m_maxLightsPerCluster = 0;
+
+    // --- Render side: only touched by the thread owning the GL context ---
+
+    std::vector<RenderBatch> m_renderBatches;
+
+    // Model shader permutations, picked per batch from the material's
+    // features and the frame's light tier
+    ShaderPermutationCache m_modelShaders{"modelShader.vert", "modelShader.frag"};
+    Shader* m_currentShader = nullptr;
+    u32 m_lightFeatures = 0;
+    bool m_weightedBlended = false;
+
+    std::unique_ptr<LightClusterBuffers> m_lightClusterBuffers;
+
+    // Depth pre-pass
+    std::unique_ptr<Shader> m_depthShader;
+    std::unique_ptr<Shader> m_mergedDepthShader;    // pool vertices, transforms fetched by draw ID
+    std::vector<const RenderCommand*> m_depthPrePassCommands;
+    std::unique_ptr<FragmentStatsQuery> m_fragmentQuery;
+
+    // Forward opaque draws merged across materials
+    std::unique_ptr<MultiDrawRenderer> m_multiDrawRenderer;
+
+    // Alternative backends for opaque geometry
+    std::unique_ptr<DeferredRenderer> m_deferredRenderer;
+    std::unique_ptr<VisibilityRenderer> m_visibilityRenderer;
+
+    std::unique_ptr<ShadowRenderer> m_shadowRenderer;
+    std::unique_ptr<PointShadowRenderer> m_pointShadowRenderer;
+
+    // Passes of the current frame and the transient targets they share
+    RenderGraph m_renderGraph;
+    std::unique_ptr<Shader> m_presentShader;
+    std::unique_ptr<Shader> m_oitCompositeShader;
+    u32 m_emptyVAO = 0;
+
+    // Statistics, written by the render side and read by the UI
+    std::atomic<u32> m_drawCalls{0};
+    std::atomic<u32> m_trianglesRendered{0};
+    std::atomic<u32> m_commandsSubmitted{0};
+    std::atomic<u32> m_depthPrePassDrawCalls{0};
+    std::atomic<u32> m_materialsResolved{0};
+    std::atomic<size_t> m_materialArrayMemory{0};
+    std::atomic<u32> m_meshletsTested{0};
+    std::atomic<u32> m_meshletsFrustumCulled{0};
+    std::atomic<u32> m_meshletsBackfaceCulled{0};
+    std::atomic<bool> m_gpuCulled{false};
+    // GPU culling counters, read back a few frames late
+    std::atomic<u32> m_gpuCullInstances{0};
+    std::atomic<u32> m_gpuCullDrawnFirstPhase{0};
+    std::atomic<u32> m_gpuCullDrawnSecondPhase{0};
+    std::atomic<u32> m_gpuCullFrustumCulled{0};
+    std::atomic<u32> m_gpuCullOcclusionCulled{0};
+    std::atomic<u32> m_renderPasses{0};
+    std::atomic<u32> m_renderPassesCulled{0};
+    // Render target memory before and after aliasing transients
+    std::atomic<size_t> m_transientTargetMemory{0};
+    std::atomic<size_t> m_physicalTargetMemory{0};
+    std::atomic<u32> m_shadowCascadesRendered{0};
+    std::atomic<u32> m_shadowCascadesCached{0};
+    std::atomic<u32> m_shadowDrawCalls{0};
+    std::atomic<u32> m_shadowCasters{0};
+    std::atomic<u32> m_pointShadowLights{0};
+    std::atomic<u32> m_pointShadowDrawCalls{0};
+    std::atomic<u32> m_pointShadowFacesRendered{0};
+    std::atomic<u32> m_pointShadowFacesCulled{0};
+    std::atomic<f32> m_pointShadowAtlasUsage{0.0f};
+    // Fragments shaded by the color pass, last result without [0] and with [1] the pre-pass
+    std::atomic<u64> m_shadedFragments[2] = {{0}, {0}};
 
 public:
-    Renderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager)
-    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager){
-        // Load default shader
-        m_defaultShader = std::make_unique<Shader>("modelShader.vert", "modelShader.frag");
+    Renderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager, JobSystem* jobSystem)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager), m_jobSystem(jobSystem){
+        m_commandLists.resize(jobSystem->GetThreadCount());
+
+        m_depthShader = std::make_unique<Shader>("depthOnly.vert", "depthOnly.frag");
+        m_mergedDepthShader = std::make_unique<Shader>("depthOnly.vert", "depthOnly.frag", nullptr, "#define MERGED_DRAWS\n");
+
+        m_lightClusterBuffers = std::make_unique<LightClusterBuffers>();
+        m_fragmentQuery = std::make_unique<FragmentStatsQuery>();
+        m_multiDrawRenderer = std::make_unique<MultiDrawRenderer>(m_assetManager, m_gpuResourceManager, &m_modelShaders);
+        m_deferredRenderer = std::make_unique<DeferredRenderer>(m_assetManager, m_gpuResourceManager);
+        m_visibilityRenderer = std::make_unique<VisibilityRenderer>(m_assetManager, m_gpuResourceManager);
+        m_shadowRenderer = std::make_unique<ShadowRenderer>(m_assetManager, m_gpuResourceManager);
+        m_pointShadowRenderer = std::make_unique<PointShadowRenderer>(m_assetManager, m_gpuResourceManager);
+
+        m_presentShader = std::make_unique<Shader>("fullscreen.vert", "present.frag");
+        m_oitCompositeShader = std::make_unique<Shader>("fullscreen.vert", "oitComposite.frag");
+        glGenVertexArrays(1, &m_emptyVAO);
+
+        // Common model permutations, compiled alongside the shaders above
+        std::vector<u32> permutations;
+        for(u32 tier = 0; tier < 4; tier++){
+            u32 lights = tier << ShaderFeatures::LIGHT_TIER_SHIFT;
+            permutations.push_back(lights);
+            permutations.push_back(lights | ShaderFeatures::DIFFUSE_MAP);
+            permutations.push_back(lights | ShaderFeatures::DIFFUSE_MAP | ShaderFeatures::SPECULAR_MAP);
+            permutations.push_back(lights | m_multiDrawRenderer->GetShaderFeatures());
+        }
+        m_modelShaders.Prewarm(permutations);
+    }
+
+    ~Renderer(){
+        glDeleteVertexArrays(1, &m_emptyVAO);
     }
 
     // Camera setup
     void SetCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position) {
-        m_viewMatrix = view;
-        m_projectionMatrix = projection;
-        m_cameraPosition = position;
+        m_camera.view = view;
+        m_camera.projection = projection;
+        m_camera.position = position;
+        m_camera.front = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+        m_frustum.Extract(projection * view);
+
+        ShadowCascadeBuilder::Build(m_camera, dirLightDirection, m_shadowSettings, m_shadowCascades);
     }
 
-    // Add render command for this frame
+    void SetViewportSize(int width, int height) {
+        m_viewportSize = glm::max(glm::ivec2(width, height), glm::ivec2(1));
+    }
+
+    // Add render command for this frame. Safe to call from job system workers,
+    // each thread records into its own list. distanceToCamera must already be
+    // filled in by the caller (it is computed during culling).
     void SubmitRenderCommand(const RenderCommand& command) {
-        m_renderCommands.push_back(command);
+        RenderCommandList& list = m_commandLists[JobSystem::GetThreadIndex()];
+
+        RenderCommand& recorded = list.commands.emplace_back(command);
+
+        const Material* material = m_assetManager->GetMaterial(recorded.materialID);
+        bool isTransparent = material && IsTransparent(*material);
+        list.sortKeys.push_back(BuildSortKey(recorded, isTransparent));
+    }
+
+    // Add a shadow caster for this frame, same threading rules as commands
+    void SubmitShadowCaster(const ShadowCaster& caster) {
+        m_commandLists[JobSystem::GetThreadIndex()].shadowCasters.push_back(caster);
+    }
+
+    // Add a point light for this frame, simulation thread only
+    void SubmitPointLight(const PointLightData& light) {
+        m_pointLights.push_back(light);
+    }
+
+    // Picks the submitted lights that get a cube shadow this frame and places
+    // them in the atlas, simulation thread only, after all lights are in
+    void AllocatePointShadows() {
+        m_pointShadowAllocator.Allocate(m_pointLights, m_camera, m_frustum, m_viewportSize,
+                                        m_pointShadowSettings, m_pointShadows);
+    }
+
+    // Simulation side: snapshot camera, lights and the sorted commands
+    // submitted this frame into a packet the render side can consume
+    void BuildFramePacket(FramePacket& packet){
+        packet.camera = m_camera;
+        packet.viewSettings = m_viewSettings;
+        packet.textureStreaming = m_textureStreamingSettings;
+        packet.uploads = m_uploadSettings;
+        packet.residency = m_residencySettings;
+
+        packet.dirLight.direction = dirLightDirection;
+        packet.dirLight.ambient = dirLightAmbient;
+        packet.dirLight.diffuse = dirLightDiffuse;
+        packet.dirLight.specular = dirLightSpecular;
+
+        packet.pointLights.swap(m_pointLights);
+        m_pointLights.clear();
+        packet.pointShadows.swap(m_pointShadows);
+        m_pointShadows.clear();
+        packet.pointShadowAtlasSize = m_pointShadowSettings.atlasSize;
+
+        // Bin point lights into view space clusters
+        m_lightClusterBuilder.Build(packet, *m_jobSystem);
+        m_pointLightCount = static_cast<u32>(packet.pointLights.size());
+        m_maxLightsPerCluster = packet.lightClusters.maxLightsPerCluster;
+
+        // Flashlight attached to the camera
+        packet.spotLight.position = m_camera.position;
+        packet.spotLight.direction = m_camera.front;
+        packet.spotLight.diffuse = glm::vec3(1.0f);
+        packet.spotLight.specular = glm::vec3(1.0f);
+        packet.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+        packet.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+
+        // Shadow casters in any order, before the merge clears the lists
+        packet.shadowCascades = m_shadowCascades;
+        packet.shadowCasters.clear();
+        for(const RenderCommandList& list: m_commandLists){
+            packet.shadowCasters.insert(packet.shadowCasters.end(), list.shadowCasters.begin(), list.shadowCasters.end());
+        }
+
+        // Merge per-thread lists and sort by key
+        MergeCommandLists(packet);
     }
 
-    // Render all submitted commands
-    void RenderFrame(){
+    // Render side: draw a packet, must run on the thread owning the GL context
+    void RenderFrame(const FramePacket& packet){
         // Clear statistics
         m_drawCalls = 0;
         m_trianglesRendered = 0;
+        m_depthPrePassDrawCalls = 0;
+        m_meshletsTested = 0;
+        m_meshletsFrustumCulled = 0;
+        m_meshletsBackfaceCulled = 0;
 
-        if(m_renderCommands.empty()) return;
+        // Retire finished uploads, free meshes over the budget and stage the
+        // meshes waiting for their buffers
+        m_gpuResourceManager->ProcessUploads(packet.uploads, packet.residency);
 
-        // Calculate distance to camera for sorting
-        CalculateDistances();
-        
-        // Build render batches
-        BuildRenderBatches();
-        
-        // Sort batches
-        SortRenderBatches();
-        
-        // Set up global rendering state
-        SetupGlobalState();
+        if(packet.commands.empty()){
+            glViewport(0, 0, packet.framebufferSize.x, packet.framebufferSize.y);
+            glClearColor(SCENE_CLEAR_COLOR.r, SCENE_CLEAR_COLOR.g, SCENE_CLEAR_COLOR.b, SCENE_CLEAR_COLOR.a);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            return;
+        }
 
-        // Render all batches
-        for (const auto& batch : m_renderBatches) {
-            DrawBatch(batch);
+        // Build render batches from the sorted command stream
+        BuildRenderBatches(packet);
+        StreamTextures(packet);
+
+        // Lights are shared by every pass and permutation that shades
+        m_modelShaders.Update();
+        m_lightClusterBuffers->Upload(packet);
+        m_lightFeatures = ShaderFeatures::ForLights(packet.lightClusters.maxLightsPerCluster);
+
+        // Declare this frame's passes, the graph orders them, culls the unused
+        // ones and places the transient targets in shared memory
+        m_renderGraph.Reset();
+        glm::ivec2 size = glm::max(packet.framebufferSize, glm::ivec2(1));
+        RGHandle backbuffer = m_renderGraph.ImportBackbuffer("Backbuffer", size);
+
+        SceneTargets targets;
+        targets.color = m_renderGraph.CreateTexture("SceneColor", {size, GL_RGBA16F});
+        targets.depth = m_renderGraph.CreateTexture("SceneDepth", {size, GL_DEPTH24_STENCIL8});
+        targets.shadowMap = m_shadowRenderer->AddPass(m_renderGraph, packet);
+        targets.pointShadowAtlas = m_pointShadowRenderer->AddPass(m_renderGraph, packet);
+
+        RenderPath renderPath = packet.viewSettings.renderPath;
+        if(renderPath == RenderPath::VisibilityBuffer &&
+           !m_visibilityRenderer->AddPasses(m_renderGraph, packet, m_renderBatches, *m_lightClusterBuffers,
+                                            *m_shadowRenderer, *m_pointShadowRenderer, targets)){
+            // More draws than the ID packing can address
+            renderPath = RenderPath::Forward;
+        }
+        if(renderPath == RenderPath::Deferred){
+            m_deferredRenderer->AddPasses(m_renderGraph, packet, m_renderBatches, *m_shadowRenderer, *m_pointShadowRenderer, targets);
+        } else if(renderPath == RenderPath::Forward){
+            AddForwardPasses(packet, targets);
+        }
+        AddTransparentPass(packet, targets);
+        AddPresentPass(targets.color, backbuffer);
+
+        m_renderGraph.Compile();
+        m_renderGraph.Execute();
+
+        if(renderPath == RenderPath::Deferred){
+            const DeferredStats& stats = m_deferredRenderer->GetStats();
+            m_drawCalls += stats.drawCalls;
+            m_trianglesRendered += stats.trianglesRendered;
+        } else if(renderPath == RenderPath::VisibilityBuffer){
+            const VisibilityStats& stats = m_visibilityRenderer->GetStats();
+            m_drawCalls += stats.drawCalls;
+            m_trianglesRendered += stats.trianglesRendered;
+            m_materialsResolved = stats.materialsResolved;
         }
+        const ShadowStats& shadowStats = m_shadowRenderer->GetStats();
+        m_shadowCascadesRendered = shadowStats.cascadesRendered;
+        m_shadowCascadesCached = shadowStats.cascadesCached;
+        m_shadowDrawCalls = shadowStats.drawCalls;
+        m_shadowCasters = shadowStats.casters;
+        const PointShadowStats& pointShadowStats = m_pointShadowRenderer->GetStats();
+        m_pointShadowLights = pointShadowStats.shadowedLights;
+        m_pointShadowDrawCalls = pointShadowStats.drawCalls;
+        m_pointShadowFacesRendered = pointShadowStats.facesRendered;
+        m_pointShadowFacesCulled = pointShadowStats.facesCulled;
+        m_pointShadowAtlasUsage = pointShadowStats.atlasUsage;
+
+        const RenderGraphStats& graphStats = m_renderGraph.GetStats();
+        m_renderPasses = graphStats.passes;
+        m_renderPassesCulled = graphStats.passesCulled;
+        m_transientTargetMemory = graphStats.transientBytes;
+        m_physicalTargetMemory = graphStats.physicalBytes;
 
         // Cleanup for next frame
-        m_renderCommands.clear();
         m_renderBatches.clear();
     }
 
+    // Culling data for command generation
+    const Frustum& GetFrustum() const { return m_frustum; }
+    const glm::vec3& GetCameraPosition() const { return m_camera.position; }
+    const CameraData& GetCamera() const { return m_camera; }
+    const glm::ivec2& GetViewportSize() const { return m_viewportSize; }
+
+    // Render options of the main view, copied into each frame packet
+    ViewSettings& GetViewSettings() { return m_viewSettings; }
+    TextureStreamingSettings& GetTextureStreamingSettings() { return m_textureStreamingSettings; }
+    UploadSettings& GetUploadSettings() { return m_uploadSettings; }
+    ResidencySettings& GetResidencySettings() { return m_residencySettings; }
+
+    // LOD selection parameters, read by the render system during culling
+    LODSettings& GetLODSettings() { return m_lodSettings; }
+
+    // Cascades of the current frame, read by the render system to cull casters
+    ShadowSettings& GetShadowSettings() { return m_shadowSettings; }
+    const ShadowCascadeData& GetShadowCascades() const { return m_shadowCascades; }
+    PointShadowSettings& GetPointShadowSettings() { return m_pointShadowSettings; }
+    const std::vector<PointShadowData>& GetPointShadows() const { return m_pointShadows; }
+    const AssetManager* GetAssetManager() const { return m_assetManager; }
+
     // Statistics
     u32 GetDrawCalls() const { return m_drawCalls; }
     u32 GetTrianglesRendered() const { return m_trianglesRendered; }
+    u32 GetCommandsSubmitted() const { return m_commandsSubmitted; }
+    u32 GetDepthPrePassDrawCalls() const { return m_depthPrePassDrawCalls; }
+    u32 GetRenderPasses() const { return m_renderPasses; }
+    u32 GetRenderPassesCulled() const { return m_renderPassesCulled; }
+    size_t GetTransientTargetMemory() const { return m_transientTargetMemory; }
+    size_t GetPhysicalTargetMemory() const { return m_physicalTargetMemory; }
+    u32 GetShadowCascadesRendered() const { return m_shadowCascadesRendered; }
+    u32 GetShadowCascadesCached() const { return m_shadowCascadesCached; }
+    u32 GetShadowDrawCalls() const { return m_shadowDrawCalls; }
+    u32 GetShadowCasters() const { return m_shadowCasters; }
+    u32 GetPointShadowLights() const { return m_pointShadowLights; }
+    u32 GetPointShadowDrawCalls() const { return m_pointShadowDrawCalls; }
+    u32 GetPointShadowFacesRendered() const { return m_pointShadowFacesRendered; }
+    u32 GetPointShadowFacesCulled() const { return m_pointShadowFacesCulled; }
+    f32 GetPointShadowAtlasUsage() const { return m_pointShadowAtlasUsage; }
+    u32 GetMaterialsResolved() const { return m_materialsResolved; }
+    size_t GetMaterialArrayMemory() const { return m_materialArrayMemory; }
+    u32 GetMeshletsTested() const { return m_meshletsTested; }
+    u32 GetMeshletsFrustumCulled() const { return m_meshletsFrustumCulled; }
+    u32 GetMeshletsBackfaceCulled() const { return m_meshletsBackfaceCulled; }
+    u64 GetShadedFragments(bool depthPrePass) const { return m_shadedFragments[depthPrePass ? 1 : 0]; }
+    bool UsesPipelineStatistics() const { return m_fragmentQuery->UsesPipelineStatistics(); }
+    bool UsesBindlessTextures() const { return m_multiDrawRenderer->UsesBindless(); }
+    bool UsesMultiDrawIndirect() const { return m_multiDrawRenderer->UsesIndirect(); }
+    bool SupportsGPUCulling() const { return m_multiDrawRenderer->UsesGPUCulling(); }
+    bool UsesIndirectDrawCount() const { return m_multiDrawRenderer->UsesDrawCount(); }
+    bool IsGPUCulled() const { return m_gpuCulled; }
+    u32 GetGPUCullInstances() const { return m_gpuCullInstances; }
+    u32 GetGPUCullDrawnFirstPhase() const { return m_gpuCullDrawnFirstPhase; }
+    u32 GetGPUCullDrawnSecondPhase() const { return m_gpuCullDrawnSecondPhase; }
+    u32 GetGPUCullFrustumCulled() const { return m_gpuCullFrustumCulled; }
+    u32 GetGPUCullOcclusionCulled() const { return m_gpuCullOcclusionCulled; }
+    u32 GetPointLightCount() const { return m_pointLightCount; }
+    u32 GetMaxLightsPerCluster() const { return m_maxLightsPerCluster; }
+    u32 GetShaderPermutations() const { return m_modelShaders.GetPermutationCount(); }
+    u32 GetShaderPermutationsPending() const { return m_modelShaders.GetPendingCount(); }
+    u32 GetShaderFallbackBatches() const { return m_modelShaders.GetFallbackBatches(); }
 
 private:
-    void CalculateDistances(){
-        for(auto& command: m_renderCommands){
-            glm::vec3 objectPosition = glm::vec3(command.worldMatrix[3]);
-            command.distanceToCamera = glm::distance(m_cameraPosition, objectPosition);
+    // Key layout, sorted ascending:
+    //   [63]    transparent flag (opaque first)
+    //   [62:60] material shader features (group by permutation)
+    //   [59:32] material ID (group by material)
+    //   [31:0]  distance bits front to back for opaque, zero for transparent,
+    //           weighted blended OIT is order independent
+    u64 BuildSortKey(const RenderCommand& command, bool isTransparent) const {
+        // Non-negative floats compare like their bit patterns
+        u32 depthBits = 0;
+        if(!isTransparent) std::memcpy(&depthBits, &command.distanceToCamera, sizeof(depthBits));
+
+        const Material* material = m_assetManager->GetMaterial(command.materialID);
+        u32 features = material ? ShaderFeatures::ForMaterial(*material) : 0;
+
+        return (static_cast<u64>(isTransparent) << 63) |
+               (static_cast<u64>(features & ShaderFeatures::MATERIAL_MASK) << 60) |
+               (static_cast<u64>(command.materialID & 0x0FFFFFFF) << 32) |
+               static_cast<u64>(depthBits);
+    }
+
+    void MergeCommandLists(FramePacket& packet){
+        // Offsets of each thread list in the merged array
+        u32 totalCommands = 0;
+        std::vector<u32> listOffsets(m_commandLists.size());
+        for(size_t i = 0; i < m_commandLists.size(); i++){
+            listOffsets[i] = totalCommands;
+            totalCommands += static_cast<u32>(m_commandLists[i].commands.size());
         }
+        m_commandsSubmitted = totalCommands;
+
+        m_unsortedCommands.resize(totalCommands);
+        packet.sortKeys.resize(totalCommands);
+        m_sortIndices.resize(totalCommands);
+
+        m_jobSystem->ParallelFor(static_cast<u32>(m_commandLists.size()), 1, [&](u32 begin, u32 end, u32){
+            for(u32 listIndex = begin; listIndex < end; listIndex++){
+                RenderCommandList& list = m_commandLists[listIndex];
+                u32 offset = listOffsets[listIndex];
+
+                std::copy(list.commands.begin(), list.commands.end(), m_unsortedCommands.begin() + offset);
+                std::copy(list.sortKeys.begin(), list.sortKeys.end(), packet.sortKeys.begin() + offset);
+                for(u32 i = 0; i < list.commands.size(); i++){
+                    m_sortIndices[offset + i] = offset + i;
+                }
+
+                list.Clear();
+            }
+        });
+
+        m_radixSorter.Sort(*m_jobSystem, packet.sortKeys, m_sortIndices);
+
+        // Gather commands into sorted order
+        packet.commands.resize(totalCommands);
+        m_jobSystem->ParallelFor(totalCommands, 4096, [&](u32 begin, u32 end, u32){
+            for(u32 i = begin; i < end; i++){
+                packet.commands[i] = m_unsortedCommands[m_sortIndices[i]];
+            }
+        });
     }
 
-    void BuildRenderBatches(){
-        // Group commands by material
-        std::unordered_map<MaterialID, std::vector<RenderCommand*>> materialGroups;
-        
-        for (auto& command : m_renderCommands) {
-            materialGroups[command.materialID].push_back(&command);
+    // Requests the levels each drawn texture needs and streams before any pass samples them
+    void StreamTextures(const FramePacket& packet){
+        for (const RenderBatch& batch : m_renderBatches) {
+            const Material* material = m_assetManager->GetMaterial(batch.materialID);
+            if (!material) continue;
+
+            // Finest density the batch's textures are seen at
+            f32 uvPerPixel = std::numeric_limits<f32>::max();
+            for (const RenderCommand* command : batch.commands) uvPerPixel = std::min(uvPerPixel, command->uvPerPixel);
+
+            for (TextureID textureID : {material->diffuseTexture, material->specularTexture, material->normalTexture}) {
+                if (textureID != INVALID_TEXTURE) m_gpuResourceManager->RequestTextureMips(textureID, uvPerPixel);
+            }
         }
+        m_gpuResourceManager->UpdateTextureStreaming(packet.textureStreaming);
+    }
 
-        // Create batches
+    void BuildRenderBatches(const FramePacket& packet){
+        // Commands are already in key order, a batch is a run of equal material
         m_renderBatches.clear();
-        m_renderBatches.reserve(materialGroups.size());
 
-        for (auto& [materialID, commands] : materialGroups) {
-            RenderBatch batch;
-            batch.materialID = materialID;
-            batch.commands = std::move(commands);
-            
-            // Check if material is transparent
-            const Material* material = m_assetManager->GetMaterial(materialID);
-            batch.isTransparent = material && IsTransparent(*material);
-            
-            m_renderBatches.push_back(std::move(batch));
+        for (size_t i = 0; i < packet.commands.size(); i++) {
+            const RenderCommand& command = packet.commands[i];
+            bool isTransparent = (packet.sortKeys[i] >> 63) != 0;
+
+            if (m_renderBatches.empty() ||
+                m_renderBatches.back().materialID != command.materialID ||
+                m_renderBatches.back().isTransparent != isTransparent) {
+                RenderBatch batch;
+                batch.materialID = command.materialID;
+                batch.isTransparent = isTransparent;
+                m_renderBatches.push_back(std::move(batch));
+            }
+
+            m_renderBatches.back().commands.push_back(&command);
         }
     }
 
-    void SortRenderBatches() {
-        // Sort batches: opaque first, then transparent
-        std::sort(m_renderBatches.begin(), m_renderBatches.end(),
-                  [](const RenderBatch& a, const RenderBatch& b) {
-                      if (a.isTransparent != b.isTransparent) {
-                          return !a.isTransparent;  // Opaque first
-                      }
-                      return a.materialID < b.materialID;  // Group by material
-                  });
-        
-        // Sort commands within each batch
-        for (auto& batch : m_renderBatches) {
-            if (batch.isTransparent) {
-                // Transparent: back to front
-                std::sort(batch.commands.begin(), batch.commands.end(),
-                          [](const RenderCommand* a, const RenderCommand* b) {
-                              return a->distanceToCamera > b->distanceToCamera;
-                          });
-            } else {
-                // Opaque: front to back (early Z rejection)
-                std::sort(batch.commands.begin(), batch.commands.end(),
-                          [](const RenderCommand* a, const RenderCommand* b) {
-                              return a->distanceToCamera < b->distanceToCamera;
-                          });
+    void AddForwardPasses(const FramePacket& packet, const SceneTargets& targets) {
+        const bool depthPrePass = packet.viewSettings.depthPrePass;
+        if (depthPrePass) {
+            m_renderGraph.AddPass("DepthPrePass",
+                [&](RenderGraphBuilder& builder) {
+                    builder.WriteDepth(targets.depth, RGLoadOp::Clear);
+                },
+                [this, &packet](const RenderPassContext&) {
+                    RenderDepthPrePass(packet);
+                });
+        }
+
+        m_renderGraph.AddPass("ForwardOpaque",
+            [&](RenderGraphBuilder& builder) {
+                if (targets.shadowMap != RG_INVALID_HANDLE) builder.Read(targets.shadowMap);
+                if (targets.pointShadowAtlas != RG_INVALID_HANDLE) builder.Read(targets.pointShadowAtlas);
+                builder.WriteColor(targets.color, RGLoadOp::Clear, SCENE_CLEAR_COLOR);
+                builder.WriteDepth(targets.depth, depthPrePass ? RGLoadOp::Load : RGLoadOp::Clear);
+            },
+            [this, &packet, &targets, depthPrePass](const RenderPassContext& context) {
+                RenderForwardOpaque(packet, depthPrePass, context.GetTexture(targets.depth), context.GetSize(targets.depth));
+            });
+    }
+
+    // depthTexture is the bound depth target, GPU culling builds its pyramid from it
+    void RenderForwardOpaque(const FramePacket& packet, bool depthPrePass, u32 depthTexture, glm::ivec2 depthSize) {
+        const bool merged = packet.viewSettings.mergeMaterials;
+        SetupGlobalState();
+        if (merged) UseShader(packet, m_multiDrawRenderer->GetShader(m_lightFeatures));
+
+        // Opaque depth is final after the pre-pass, only the visible surface shades
+        glDepthFunc(depthPrePass ? GL_EQUAL : GL_LESS);
+        glDepthMask(depthPrePass ? GL_FALSE : GL_TRUE);
+
+        m_fragmentQuery->Begin(depthPrePass ? 1 : 0);
+        const bool gpuCulled = merged && packet.viewSettings.gpuCulling && m_multiDrawRenderer->UsesGPUCulling();
+        m_gpuCulled = gpuCulled;
+        if (gpuCulled) {
+            m_multiDrawRenderer->DrawGPUCulled(m_renderBatches, packet.camera, depthTexture, depthSize);
+            const MultiDrawStats& stats = m_multiDrawRenderer->GetStats();
+            m_drawCalls += stats.drawCalls;
+            m_trianglesRendered += stats.trianglesRendered;
+            const GPUCullStats& cullStats = m_multiDrawRenderer->GetGPUCullStats();
+            m_gpuCullInstances = cullStats.instances;
+            m_gpuCullDrawnFirstPhase = cullStats.drawnFirstPhase;
+            m_gpuCullDrawnSecondPhase = cullStats.drawnSecondPhase;
+            m_gpuCullFrustumCulled = cullStats.frustumCulled;
+            m_gpuCullOcclusionCulled = cullStats.occlusionCulled;
+        } else if (merged) {
+            m_multiDrawRenderer->Draw(m_renderBatches, packet.camera, packet.viewSettings.meshletCulling);
+            const MultiDrawStats& stats = m_multiDrawRenderer->GetStats();
+            m_drawCalls += stats.drawCalls;
+            m_trianglesRendered += stats.trianglesRendered;
+            m_meshletsTested = stats.meshlets.meshletsTested;
+            m_meshletsFrustumCulled = stats.meshlets.frustumCulled;
+            m_meshletsBackfaceCulled = stats.meshlets.backfaceCulled;
+        } else {
+            for (const auto& batch : m_renderBatches) {
+                if (!batch.isTransparent) DrawBatch(packet, batch);
+            }
+        }
+        m_fragmentQuery->End();
+        if (merged) m_materialArrayMemory = m_multiDrawRenderer->GetMaterialTableStats().arrayMemory;
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+
+        ReadFragmentStats();
+    }
+
+    // Transparent surfaces are shaded forward on top of any path's opaque result
+    void AddTransparentPass(const FramePacket& packet, const SceneTargets& targets) {
+        bool hasTransparent = std::any_of(m_renderBatches.begin(), m_renderBatches.end(),
+            [](const RenderBatch& batch) { return batch.isTransparent; });
+        if (!hasTransparent) return;
+
+        // Weighted blended OIT: premultiplied color times a depth weight is
+        // summed in accumulation, revealage keeps the product of (1 - alpha)
+        glm::ivec2 size = m_renderGraph.GetDesc(targets.color).size;
+        RGHandle accumulation = m_renderGraph.CreateTexture("OITAccumulation", {size, GL_RGBA16F});
+        RGHandle revealage = m_renderGraph.CreateTexture("OITRevealage", {size, GL_R8});
+
+        // Tested against the opaque depth, never written
+        m_renderGraph.AddPass("TransparentAccumulate",
+            [&](RenderGraphBuilder& builder) {
+                if (targets.shadowMap != RG_INVALID_HANDLE) builder.Read(targets.shadowMap);
+                if (targets.pointShadowAtlas != RG_INVALID_HANDLE) builder.Read(targets.pointShadowAtlas);
+                builder.WriteColor(accumulation, RGLoadOp::Clear, glm::vec4(0.0f));
+                builder.WriteColor(revealage, RGLoadOp::Clear, glm::vec4(1.0f));
+                builder.WriteDepth(targets.depth);
+            },
+            [this, &packet](const RenderPassContext&) {
+                RenderTransparent(packet);
+            });
+
+        m_renderGraph.AddPass("TransparentComposite",
+            [&](RenderGraphBuilder& builder) {
+                builder.Read(accumulation);
+                builder.Read(revealage);
+                builder.WriteColor(targets.color);
+            },
+            [this, accumulation, revealage](const RenderPassContext& context) {
+                CompositeTransparent(context.GetTexture(accumulation), context.GetTexture(revealage));
+            });
+    }
+
+    void RenderTransparent(const FramePacket& packet) {
+        SetupGlobalState();
+        m_weightedBlended = true;
+
+        // Foliage and glass are seen from both sides
+        glDisable(GL_CULL_FACE);
+        glDepthMask(GL_FALSE);
+        glEnable(GL_BLEND);
+        glBlendFunci(0, GL_ONE, GL_ONE);
+        glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+
+        for (const auto& batch : m_renderBatches) {
+            if (batch.isTransparent) DrawBatch(packet, batch);
+        }
+
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        m_weightedBlended = false;
+    }
+
+    // Resolves the weighted average over the opaque scene, dst * revealage + average * (1 - revealage)
+    void CompositeTransparent(u32 accumulation, u32 revealage) {
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+
+        m_oitCompositeShader->use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, accumulation);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, revealage);
+        m_oitCompositeShader->setInt("accumulation", 0);
+        m_oitCompositeShader->setInt("revealage", 1);
+
+        glBindVertexArray(m_emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+
+        glActiveTexture(GL_TEXTURE0);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+    }
+
+    // Copies the HDR scene color to the default framebuffer
+    void AddPresentPass(RGHandle sceneColor, RGHandle backbuffer) {
+        m_renderGraph.AddPass("Present",
+            [&](RenderGraphBuilder& builder) {
+                builder.Read(sceneColor);
+                builder.WriteColor(backbuffer);
+            },
+            [this, sceneColor](const RenderPassContext& context) {
+                glDisable(GL_DEPTH_TEST);
+                glDisable(GL_CULL_FACE);
+
+                m_presentShader->use();
+                m_presentShader->setInt("sceneColor", 0);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, context.GetTexture(sceneColor));
+
+                glBindVertexArray(m_emptyVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+                glBindVertexArray(0);
+
+                glEnable(GL_DEPTH_TEST);
+                glEnable(GL_CULL_FACE);
+            });
+    }
+
+    // Opaque geometry only, position-only stream and no color writes. Draws are
+    // ordered strictly front to back since no material state is needed. With
+    // merged draws the depth comes from the same pool vertices and fetched
+    // transforms as the color pass, its GL_EQUAL test needs identical positions.
+    void RenderDepthPrePass(const FramePacket& packet) {
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+        if (packet.viewSettings.mergeMaterials) {
+            const bool gpuCulled = packet.viewSettings.gpuCulling && m_multiDrawRenderer->UsesGPUCulling();
+            m_mergedDepthShader->use();
+            m_mergedDepthShader->setMat4("view", packet.camera.view);
+            m_mergedDepthShader->setMat4("projection", packet.camera.projection);
+            m_depthPrePassDrawCalls += m_multiDrawRenderer->DrawDepth(m_renderBatches, packet.camera,
+                packet.viewSettings.meshletCulling && !gpuCulled, *m_mergedDepthShader);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            return;
+        }
+
+        m_depthPrePassCommands.clear();
+        for (const auto& batch : m_renderBatches) {
+            if (batch.isTransparent) continue;
+            m_depthPrePassCommands.insert(m_depthPrePassCommands.end(), batch.commands.begin(), batch.commands.end());
+        }
+
+        std::sort(m_depthPrePassCommands.begin(), m_depthPrePassCommands.end(),
+            [](const RenderCommand* a, const RenderCommand* b) {
+                return a->distanceToCamera < b->distanceToCamera;
+            });
+
+        m_depthShader->use();
+        m_depthShader->setMat4("view", packet.camera.view);
+        m_depthShader->setMat4("projection", packet.camera.projection);
+
+        for (const RenderCommand* command : m_depthPrePassCommands) {
+            const ModelAsset* model = m_assetManager->GetModel(command->modelID);
+            if (!model) continue;
+
+            for (MeshID meshID : model->GetLODMeshes(command->lodLevel)) {
+                GPUMesh* gpuMesh = m_gpuResourceManager->GetGPUMesh(meshID);
+                if (!gpuMesh) continue;
+
+                // Same product as the color pass, GL_EQUAL needs identical positions
+                m_depthShader->setMat4("model", command->worldMatrix * gpuMesh->positionDecode);
+                glBindVertexArray(gpuMesh->depthVAO);
+                glDrawElements(GL_TRIANGLES, gpuMesh->indexCount, gpuMesh->indexType, 0);
+                m_depthPrePassDrawCalls++;
             }
         }
+
+        glBindVertexArray(0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    void ReadFragmentStats() {
+        u64 fragments = 0;
+        u32 depthPrePass = 0;
+        if (m_fragmentQuery->Poll(fragments, depthPrePass)) {
+            m_shadedFragments[depthPrePass ? 1 : 0] = fragments;
+        }
     }
 
     void SetupGlobalState() {
@@ -161,50 +785,59 @@ private:
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
         glFrontFace(GL_CCW);
-        
-        // Set default shader
-        m_currentShader = m_defaultShader.get();
+
+        // Units were rebound by earlier passes, the first batch sets everything up again
+        m_currentShader = nullptr;
+    }
+
+    // Makes a permutation current with the frame's camera and lights
+    void UseShader(const FramePacket& packet, Shader& shader) {
+        m_currentShader = &shader;
         m_currentShader->use();
         
         // Set camera matrices
-        m_currentShader->setMat4("view", m_viewMatrix);
-        m_currentShader->setMat4("projection", m_projectionMatrix);
-        m_currentShader->setVec3("viewPos", m_cameraPosition);
+        m_currentShader->setMat4("view", packet.camera.view);
+        m_currentShader->setMat4("projection", packet.camera.projection);
+        m_currentShader->setVec3("viewPos", packet.camera.position);
 
         // Set up basic directional light (simple setup)
-        m_currentShader->setVec3("dirLight.direction", dirLightDirection);
-        m_currentShader->setVec3("dirLight.ambient", dirLightAmbient);
-        m_currentShader->setVec3("dirLight.diffuse", dirLightDiffuse);
-        m_currentShader->setVec3("dirLight.specular", dirLightSpecular);
-
-        // point lights
-        for (int i = 0; i < 4; i++) {
-            std::string base = "pointLights[" + std::to_string(i) + "]";
-            m_currentShader->setVec3(base + ".position", pointLightPositions[i]);
-            m_currentShader->setVec3(base + ".ambient", pointLightColors[i].x * 0.1f, pointLightColors[i].y * 0.1f, pointLightColors[i].z * 0.1f);
-            m_currentShader->setVec3(base + ".diffuse", pointLightColors[i]);
-            m_currentShader->setVec3(base + ".specular", pointLightColors[i]);
-            m_currentShader->setFloat(base + ".constant", 1.0f);
-            m_currentShader->setFloat(base + ".linear", 0.09f);
-            m_currentShader->setFloat(base + ".quadratic", 0.032f);
-        }
+        m_currentShader->setVec3("dirLight.direction", packet.dirLight.direction);
+        m_currentShader->setVec3("dirLight.ambient", packet.dirLight.ambient);
+        m_currentShader->setVec3("dirLight.diffuse", packet.dirLight.diffuse);
+        m_currentShader->setVec3("dirLight.specular", packet.dirLight.specular);
+
+        // point lights, fetched per cluster in the fragment shader
+        m_lightClusterBuffers->Bind(packet, *m_currentShader);
+        m_currentShader->setBool("weightedBlended", m_weightedBlended);
+
+        // directional light shadow cascades
+        m_shadowRenderer->Bind(*m_currentShader, packet);
+        m_pointShadowRenderer->Bind(*m_currentShader);
 
         // spotLight
-        m_currentShader->setVec3("spotLight.position", camera.Position);
-        m_currentShader->setVec3("spotLight.direction", camera.Front);
-        m_currentShader->setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-        m_currentShader->setVec3("spotLight.diffuse", 1.0f, 1.0f, 1.0f);
-        m_currentShader->setVec3("spotLight.specular", 1.0f, 1.0f, 1.0f);
-        m_currentShader->setFloat("spotLight.constant", 1.0f);
-        m_currentShader->setFloat("spotLight.linear", 0.09f);
-        m_currentShader->setFloat("spotLight.quadratic", 0.032f);
-        m_currentShader->setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-        m_currentShader->setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
+        const SpotLightData& spotLight = packet.spotLight;
+        m_currentShader->setVec3("spotLight.position", spotLight.position);
+        m_currentShader->setVec3("spotLight.direction", spotLight.direction);
+        m_currentShader->setVec3("spotLight.ambient", spotLight.ambient);
+        m_currentShader->setVec3("spotLight.diffuse", spotLight.diffuse);
+        m_currentShader->setVec3("spotLight.specular", spotLight.specular);
+        m_currentShader->setFloat("spotLight.constant", spotLight.constant);
+        m_currentShader->setFloat("spotLight.linear", spotLight.linear);
+        m_currentShader->setFloat("spotLight.quadratic", spotLight.quadratic);
+        m_currentShader->setFloat("spotLight.cutOff", spotLight.cutOff);
+        m_currentShader->setFloat("spotLight.outerCutOff", spotLight.outerCutOff);
     }
 
-    void DrawBatch(const RenderBatch& batch) {
+    void DrawBatch(const FramePacket& packet, const RenderBatch& batch) {
+        const Material* material = m_assetManager->GetMaterial(batch.materialID);
+        if (!material) return;
+
+        // Batches are sorted by features, so this switches once per permutation
+        Shader& shader = m_modelShaders.Get(ShaderFeatures::ForMaterial(*material) | m_lightFeatures);
+        if (&shader != m_currentShader) UseShader(packet, shader);
+
         // Bind material
-        BindMaterial(batch.materialID);
+        BindMaterial(*material);
         
         // Render all commands in this batch
         for (const RenderCommand* command : batch.commands) {
@@ -212,21 +845,16 @@ private:
         }
     }
 
-    void BindMaterial(MaterialID materialID) {
-        const Material* material = m_assetManager->GetMaterial(materialID);
-        if (!material) return;
-        
+    void BindMaterial(const Material& material) {
         // Set material properties
-        //m_currentShader->setVec3("material.diffuse", material->diffuse);
-        //m_currentShader->setFloat("material.metallic", material->metallic);
-        //m_currentShader->setFloat("material.roughness", material->roughness);
-        //m_currentShader->setFloat("material.ao", material->ao);
-        m_currentShader->setFloat("material.shininess", 32.0f);
+        m_currentShader->setVec3("material.diffuse", material.diffuse);
+        m_currentShader->setFloat("material.roughness", material.roughness);
+        m_currentShader->setFloat("material.opacity", material.opacity);
         
         // Bind textures
         // Bind diffuse texture to texture unit 0
-        if (material->diffuseTexture != INVALID_TEXTURE) {
-            GPUTexture* gpuTexture = m_gpuResourceManager->GetGPUTexture(material->diffuseTexture);
+        if (material.diffuseTexture != INVALID_TEXTURE) {
+            GPUTexture* gpuTexture = m_gpuResourceManager->GetGPUTexture(material.diffuseTexture);
             if (gpuTexture) {
                 glActiveTexture(GL_TEXTURE0);
                 glBindTexture(GL_TEXTURE_2D, gpuTexture->textureID);
@@ -235,14 +863,25 @@ private:
         }
         
         // Bind specular texture to texture unit 1
-        if (material->specularTexture != INVALID_TEXTURE) {
-            GPUTexture* gpuTexture = m_gpuResourceManager->GetGPUTexture(material->specularTexture);
+        if (material.specularTexture != INVALID_TEXTURE) {
+            GPUTexture* gpuTexture = m_gpuResourceManager->GetGPUTexture(material.specularTexture);
             if (gpuTexture) {
                 glActiveTexture(GL_TEXTURE1);
                 glBindTexture(GL_TEXTURE_2D, gpuTexture->textureID);
                 m_currentShader->setInt("material.texture_specular1", 1);
             }
         }
+
+        // Bind normal map to texture unit 2
+        if (material.normalTexture != INVALID_TEXTURE) {
+            GPUTexture* gpuTexture = m_gpuResourceManager->GetGPUTexture(material.normalTexture);
+            if (gpuTexture) {
+                glActiveTexture(GL_TEXTURE2);
+                glBindTexture(GL_TEXTURE_2D, gpuTexture->textureID);
+                m_currentShader->setInt("material.texture_normal1", 2);
+                glActiveTexture(GL_TEXTURE0);
+            }
+        }
     }
 
     void DrawCommand(const RenderCommand& command) {
@@ -251,17 +890,21 @@ private:
         if (!model) return;
         
         // Set per-object uniforms
-        m_currentShader->setMat4("model", command.worldMatrix);
         m_currentShader->setMat4("normalMatrix", command.normalMatrix);
+        m_currentShader->setBool("receiveShadows", command.receiveShadows);
         
-        // Render all meshes in the model
-        for (MeshID meshID : model->meshes) {
+        // Render all meshes of the selected LOD
+        for (MeshID meshID : model->GetLODMeshes(command.lodLevel)) {
             GPUMesh* gpuMesh = m_gpuResourceManager->GetGPUMesh(meshID);
             if (!gpuMesh) continue;
+
+            // Quantized positions are decoded by the model matrix
+            m_currentShader->setMat4("model", command.worldMatrix * gpuMesh->positionDecode);
+            m_currentShader->setBool("octNormals", gpuMesh->octNormals);
             
             // Bind and draw
             glBindVertexArray(gpuMesh->VAO);
-            glDrawElements(GL_TRIANGLES, gpuMesh->indexCount, GL_UNSIGNED_INT, 0);
+            glDrawElements(GL_TRIANGLES, gpuMesh->indexCount, gpuMesh->indexType, 0);
             
             // Update statistics
             m_drawCalls++;
@@ -271,10 +914,7 @@ private:
         glBindVertexArray(0);
     }
 
-    bool IsTransparent(const Material& material) {
-        // Check if material has transparency
-        // This is a simple check - could be more sophisticated
-        //return material.diffuse.a < 1.0f;  // Assuming alpha in albedo
-        return false;
+    bool IsTransparent(const Material& material) const {
+        return material.alphaBlend;
     }
 };
\ No newline at end of file
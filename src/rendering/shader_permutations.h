@@ -0,0 +1,139 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+
+#include "assets/asset_manager.h"
+#include "shader.h"
+#include "defines.h"
+
+// Compile time features of a shader, one bit each. A permutation only
+// contains the code paths its bits enable, so a material without a normal
+// map never pays for the tangent frame and a frame without point lights
+// skips the cluster loop entirely.
+namespace ShaderFeatures{
+    constexpr u32 DIFFUSE_MAP       = 1u << 0;
+    constexpr u32 SPECULAR_MAP      = 1u << 1;
+    constexpr u32 NORMAL_MAP        = 1u << 2;
+    constexpr u32 MATERIAL_TABLE    = 1u << 3;
+    constexpr u32 BINDLESS_TEXTURES = 1u << 4;
+
+    // Bits 8-9: bound on the point lights of one cluster, tier 0 has none
+    constexpr u32 LIGHT_TIER_SHIFT = 8;
+    constexpr u32 LIGHT_TIER_MASK = 3u << LIGHT_TIER_SHIFT;
+    constexpr u32 LIGHT_TIER_LIMITS[4] = {0, 4, 16, 0xFFFFFFFFu};
+
+    // Material bits, also stored in the sort key so batches sharing a
+    // permutation are adjacent
+    constexpr u32 MATERIAL_MASK = DIFFUSE_MAP | SPECULAR_MAP | NORMAL_MAP;
+
+    inline u32 ForMaterial(const Material& material){
+        u32 features = 0;
+        if(material.diffuseTexture != INVALID_TEXTURE) features |= DIFFUSE_MAP;
+        if(material.specularTexture != INVALID_TEXTURE) features |= SPECULAR_MAP;
+        if(material.normalTexture != INVALID_TEXTURE) features |= NORMAL_MAP;
+        return features;
+    }
+
+    // Smallest tier covering the busiest cluster of the frame
+    inline u32 ForLights(u32 maxLightsPerCluster){
+        u32 tier = 0;
+        while(tier < 3 && LIGHT_TIER_LIMITS[tier] < maxLightsPerCluster) tier++;
+        return tier << LIGHT_TIER_SHIFT;
+    }
+
+    // The #define block the shader is compiled with
+    inline std::string BuildDefines(u32 features){
+        std::string defines;
+        if(features & DIFFUSE_MAP) defines += "#define HAS_DIFFUSE_MAP\n";
+        if(features & SPECULAR_MAP) defines += "#define HAS_SPECULAR_MAP\n";
+        if(features & NORMAL_MAP) defines += "#define HAS_NORMAL_MAP\n";
+        if(features & MATERIAL_TABLE) defines += "#define MATERIAL_TABLE\n";
+        if(features & BINDLESS_TEXTURES) defines += "#define BINDLESS_TEXTURES\n";
+
+        u32 tier = (features & LIGHT_TIER_MASK) >> LIGHT_TIER_SHIFT;
+        if(tier > 0) defines += "#define POINT_LIGHT_LIMIT " + std::to_string(LIGHT_TIER_LIMITS[tier]) + "u\n";
+        return defines;
+    }
+}
+
+// Programs of one vertex/fragment pair keyed by feature bits. A missing
+// combination is submitted for compilation the first time it is asked for
+// and, while the driver works on it, draws use a fallback: the same
+// material table mode with no optional maps and the unbounded light tier,
+// which is submitted up front with the rest of the startup set. Render
+// thread only.
+class ShaderPermutationCache{
+private:
+    std::string m_vertexPath;
+    std::string m_fragmentPath;
+    std::unordered_map<u32, std::unique_ptr<Shader>> m_permutations;
+    std::vector<Shader*> m_pending;
+
+    u32 m_frameFallbacks = 0;
+
+    // Read by the UI
+    std::atomic<u32> m_permutationCount{0};
+    std::atomic<u32> m_pendingCount{0};
+    std::atomic<u32> m_fallbackBatches{0};     // previous frame
+
+public:
+    ShaderPermutationCache(const char* vertexPath, const char* fragmentPath)
+    : m_vertexPath(vertexPath), m_fragmentPath(fragmentPath){}
+
+    ShaderPermutationCache(const ShaderPermutationCache&) = delete;
+    ShaderPermutationCache& operator=(const ShaderPermutationCache&) = delete;
+
+    // Submits every combination without waiting for any of them
+    void Prewarm(const std::vector<u32>& featureSets){
+        for(u32 features: featureSets){
+            Request(features);
+            Request(GetFallbackFeatures(features));
+        }
+    }
+
+    // The permutation if it's compiled, its fallback otherwise
+    Shader& Get(u32 features){
+        Shader& shader = Request(features);
+        if(shader.IsReady()) return shader;
+
+        m_frameFallbacks++;
+        // The fallback blocks on first use if it isn't done either
+        return Request(GetFallbackFeatures(features));
+    }
+
+    // Once per frame, retires compiles the driver has finished
+    void Update(){
+        m_pending.erase(std::remove_if(m_pending.begin(), m_pending.end(),
+                                       [](Shader* shader){ return shader->IsReady(); }),
+                        m_pending.end());
+        m_pendingCount = static_cast<u32>(m_pending.size());
+        m_fallbackBatches = m_frameFallbacks;
+        m_frameFallbacks = 0;
+    }
+
+    u32 GetPermutationCount() const { return m_permutationCount; }
+    u32 GetPendingCount() const { return m_pendingCount; }
+    u32 GetFallbackBatches() const { return m_fallbackBatches; }
+
+    static u32 GetFallbackFeatures(u32 features){
+        return (features & (ShaderFeatures::MATERIAL_TABLE | ShaderFeatures::BINDLESS_TEXTURES)) |
+               ShaderFeatures::LIGHT_TIER_MASK;
+    }
+
+private:
+    Shader& Request(u32 features){
+        std::unique_ptr<Shader>& shader = m_permutations[features];
+        if(!shader){
+            shader = std::make_unique<Shader>(m_vertexPath.c_str(), m_fragmentPath.c_str(), nullptr,
+                                              ShaderFeatures::BuildDefines(features));
+            m_pending.push_back(shader.get());
+            m_permutationCount = static_cast<u32>(m_permutations.size());
+            m_pendingCount = static_cast<u32>(m_pending.size());
+        }
+        return *shader;
+    }
+};
@@ -0,0 +1,351 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/gpu_resource_manager.h"
+#include "rendering/frame_packet.h"
+#include "rendering/render_graph.h"
+#include "shader.h"
+#include "defines.h"
+
+struct ShadowSettings{
+    bool enabled = true;
+    u32 cascadeCount = 4;
+    u32 resolution = 2048;
+
+    // Shadows end here or at the far plane, whichever is closer
+    f32 shadowDistance = 60.0f;
+
+    // 0 splits the range uniformly, 1 logarithmically
+    f32 splitLambda = 0.75f;
+
+    // Cascades from this index on are cached. Their center snaps to a coarse
+    // grid so the matrix stays put while the camera moves inside a cell, the
+    // box grows by cachedMargin to keep the slice covered.
+    u32 firstCachedCascade = 2;
+    f32 cachedMargin = 0.25f;
+};
+
+struct ShadowStats{
+    u32 cascadesRendered = 0;
+    u32 cascadesCached = 0;
+    u32 drawCalls = 0;
+    u32 casters = 0;
+};
+
+// Fits the directional light cascades to the camera, simulation side
+class ShadowCascadeBuilder{
+public:
+    static void Build(const CameraData& camera, const glm::vec3& lightDirection,
+                      const ShadowSettings& settings, ShadowCascadeData& data){
+        data.cascadeCount = settings.enabled ? std::min(settings.cascadeCount, ShadowCascadeData::MAX_CASCADES) : 0;
+        data.resolution = settings.resolution;
+        if(data.cascadeCount == 0) return;
+
+        // Near/far from a standard OpenGL perspective matrix
+        const glm::mat4& projection = camera.projection;
+        f32 zNear = projection[3][2] / (projection[2][2] - 1.0f);
+        f32 zFar = projection[3][2] / (projection[2][2] + 1.0f);
+        f32 shadowFar = std::min(zFar, settings.shadowDistance);
+
+        // Squared slope of the frustum corners off the view axis
+        f32 tanHalfX = 1.0f / projection[0][0];
+        f32 tanHalfY = 1.0f / projection[1][1];
+        f32 cornerSlope2 = tanHalfX * tanHalfX + tanHalfY * tanHalfY;
+
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+        glm::mat4 inverseLightRotation = glm::transpose(lightRotation);
+
+        const f32 resolution = static_cast<f32>(settings.resolution);
+        f32 splitNear = zNear;
+
+        for(u32 i = 0; i < data.cascadeCount; i++){
+            f32 t = static_cast<f32>(i + 1) / data.cascadeCount;
+            f32 logSplit = zNear * std::pow(shadowFar / zNear, t);
+            f32 uniformSplit = zNear + (shadowFar - zNear) * t;
+            f32 splitFar = glm::mix(uniformSplit, logSplit, settings.splitLambda);
+
+            // Bounding sphere of the slice. It only depends on the split
+            // distances, so rotating the camera never changes the cascade size.
+            f32 centerDistance = 0.5f * (splitNear + splitFar) * (1.0f + cornerSlope2);
+            f32 radius;
+            if(centerDistance >= splitFar){
+                centerDistance = splitFar;
+                radius = splitFar * std::sqrt(cornerSlope2);
+            } else {
+                f32 alongAxis = splitFar - centerDistance;
+                radius = std::sqrt(alongAxis * alongAxis + splitFar * splitFar * cornerSlope2);
+            }
+
+            ShadowCascade& cascade = data.cascades[i];
+            cascade.cached = i >= settings.firstCachedCascade;
+
+            // Snapping the center moves it by up to grid * sqrt(3) / 2, the
+            // margin is sized so the slice stays inside the box regardless
+            f32 margin = cascade.cached ? settings.cachedMargin : 2.0f / resolution;
+            cascade.extent = radius * (1.0f + margin);
+            cascade.texelSize = 2.0f * cascade.extent / resolution;
+            f32 maxGrid = 2.0f * margin * radius / std::sqrt(3.0f);
+            f32 grid = std::max(cascade.texelSize, std::floor(maxGrid / cascade.texelSize) * cascade.texelSize);
+
+            glm::vec3 center = camera.position + camera.front * centerDistance;
+            glm::vec3 lightSpaceCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+            lightSpaceCenter = glm::floor(lightSpaceCenter / grid + 0.5f) * grid;
+            center = glm::vec3(inverseLightRotation * glm::vec4(lightSpaceCenter, 1.0f));
+
+            // Casters in front of the near plane are clamped onto it with
+            // GL_DEPTH_CLAMP, so the box only has to contain the receivers
+            cascade.view = glm::lookAt(center, center + direction, up);
+            cascade.projection = glm::ortho(-cascade.extent, cascade.extent, -cascade.extent, cascade.extent,
+                                            -cascade.extent, cascade.extent);
+            cascade.viewProjection = cascade.projection * cascade.view;
+            cascade.splitFar = splitFar;
+
+            splitNear = splitFar;
+        }
+    }
+
+    // Cascades a caster sphere can throw shadows into
+    static u32 CascadeMask(const ShadowCascadeData& data, const glm::vec3& center, f32 radius){
+        u32 mask = 0;
+        for(u32 i = 0; i < data.cascadeCount; i++){
+            const ShadowCascade& cascade = data.cascades[i];
+            glm::vec3 lightSpace = glm::vec3(cascade.view * glm::vec4(center, 1.0f));
+
+            // Unbounded towards the light, behind the box nothing is shadowed
+            f32 reach = cascade.extent + radius;
+            if(std::abs(lightSpace.x) <= reach && std::abs(lightSpace.y) <= reach && lightSpace.z >= -reach){
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+};
+
+// Renders the cascades into the layers of a depth texture array. Cached
+// cascades keep last frame's layer while their matrix and the set of casters
+// touching them, with transforms and LODs, hash to the same signature.
+class ShadowRenderer{
+public:
+    // Texture unit of the shadow map in the lighting shaders
+    static constexpr u32 SHADOW_MAP_UNIT = 3;
+
+private:
+    struct CascadeCache{
+        glm::mat4 viewProjection{0.0f};
+        u64 signature = 0;
+        bool valid = false;
+    };
+
+    AssetManager* m_assetManager;
+    GPUResourceManager* m_gpuResourceManager;
+
+    u32 m_shadowMap = 0;
+    u32 m_framebuffer = 0;
+    u32 m_resolution = 0;
+    u32 m_layers = 0;
+
+    std::unique_ptr<Shader> m_depthShader;
+    CascadeCache m_cache[ShadowCascadeData::MAX_CASCADES];
+
+    ShadowStats m_stats;
+
+public:
+    ShadowRenderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager){
+        m_depthShader = std::make_unique<Shader>("depthOnly.vert", "depthOnly.frag");
+        glGenFramebuffers(1, &m_framebuffer);
+    }
+
+    ~ShadowRenderer(){
+        glDeleteFramebuffers(1, &m_framebuffer);
+        glDeleteTextures(1, &m_shadowMap);
+    }
+
+    ShadowRenderer(const ShadowRenderer&) = delete;
+    ShadowRenderer& operator=(const ShadowRenderer&) = delete;
+
+    // Adds the pass refreshing the shadow map, returns the handle lighting
+    // passes read, or RG_INVALID_HANDLE with shadows off
+    RGHandle AddPass(RenderGraph& graph, const FramePacket& packet){
+        m_stats = {};
+        const ShadowCascadeData& cascades = packet.shadowCascades;
+        if(cascades.cascadeCount == 0) return RG_INVALID_HANDLE;
+
+        Resize(cascades.resolution, cascades.cascadeCount);
+        RGHandle shadowMap = graph.ImportTexture("ShadowMap", m_shadowMap,
+                                                 {glm::ivec2(static_cast<i32>(m_resolution)), GL_DEPTH_COMPONENT24});
+
+        // Layers are bound by the pass itself
+        graph.AddPass("ShadowCascades",
+            [&](RenderGraphBuilder& builder){
+                builder.Write(shadowMap);
+            },
+            [this, &packet](const RenderPassContext&){
+                RenderCascades(packet);
+            });
+
+        return shadowMap;
+    }
+
+    // Cascade uniforms and the shadow map, cascadeCount 0 disables shadowing
+    void Bind(Shader& shader, const FramePacket& packet){
+        const ShadowCascadeData& cascades = packet.shadowCascades;
+
+        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_shadowMap);
+        glActiveTexture(GL_TEXTURE0);
+        shader.setInt("shadowMap", SHADOW_MAP_UNIT);
+        shader.setInt("cascadeCount", static_cast<i32>(cascades.cascadeCount));
+
+        glm::vec4 splits(0.0f);
+        glm::vec4 texelSizes(0.0f);
+        for(u32 i = 0; i < cascades.cascadeCount; i++){
+            splits[i] = cascades.cascades[i].splitFar;
+            texelSizes[i] = cascades.cascades[i].texelSize;
+            shader.setMat4("cascadeViewProjection[" + std::to_string(i) + "]", cascades.cascades[i].viewProjection);
+        }
+        shader.setVec4("cascadeSplits", splits);
+        shader.setVec4("cascadeTexelSizes", texelSizes);
+    }
+
+    const ShadowStats& GetStats() const { return m_stats; }
+
+private:
+    void Resize(u32 resolution, u32 layers){
+        if(resolution == m_resolution && layers == m_layers) return;
+        m_resolution = resolution;
+        m_layers = layers;
+
+        glDeleteTextures(1, &m_shadowMap);
+        glGenTextures(1, &m_shadowMap);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_shadowMap);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, layers, 0,
+                     GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        // Hardware 2x2 comparison filtering
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        for(CascadeCache& cache: m_cache){
+            cache.valid = false;
+        }
+    }
+
+    void RenderCascades(const FramePacket& packet){
+        const ShadowCascadeData& cascades = packet.shadowCascades;
+        m_stats.casters = static_cast<u32>(packet.shadowCasters.size());
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glViewport(0, 0, m_resolution, m_resolution);
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 2.0f);
+
+        m_depthShader->use();
+
+        for(u32 i = 0; i < cascades.cascadeCount; i++){
+            const ShadowCascade& cascade = cascades.cascades[i];
+            CascadeCache& cache = m_cache[i];
+
+            if(cascade.cached){
+                u64 signature = CasterSignature(packet.shadowCasters, 1u << i);
+                if(cache.valid && cache.viewProjection == cascade.viewProjection && cache.signature == signature){
+                    m_stats.cascadesCached++;
+                    continue;
+                }
+                cache.signature = signature;
+            }
+            cache.viewProjection = cascade.viewProjection;
+
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_shadowMap, 0, i);
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            m_depthShader->setMat4("view", cascade.view);
+            m_depthShader->setMat4("projection", cascade.projection);
+            u32 missing = DrawCasters(packet.shadowCasters, 1u << i);
+
+            // Casters whose meshes are still uploading aren't in it, so it is
+            // rendered again until they all are
+            cache.valid = cascade.cached && missing == 0;
+
+            m_stats.cascadesRendered++;
+        }
+
+        glBindVertexArray(0);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Returns the number of meshes skipped because they aren't resident yet
+    u32 DrawCasters(const std::vector<ShadowCaster>& casters, u32 cascadeBit){
+        u32 missing = 0;
+        for(const ShadowCaster& caster: casters){
+            if(!(caster.cascadeMask & cascadeBit)) continue;
+
+            const ModelAsset* model = m_assetManager->GetModel(caster.modelID);
+            if(!model) continue;
+
+            for(MeshID meshID: model->GetLODMeshes(caster.lodLevel)){
+                GPUMesh* gpuMesh = m_gpuResourceManager->GetGPUMesh(meshID);
+                if(!gpuMesh){
+                    missing++;
+                    continue;
+                }
+
+                m_depthShader->setMat4("model", caster.worldMatrix * gpuMesh->positionDecode);
+                glBindVertexArray(gpuMesh->depthVAO);
+                glDrawElements(GL_TRIANGLES, gpuMesh->indexCount, gpuMesh->indexType, 0);
+                m_stats.drawCalls++;
+            }
+        }
+        return missing;
+    }
+
+    // Order independent, casters arrive in whatever order the workers recorded them
+    static u64 CasterSignature(const std::vector<ShadowCaster>& casters, u32 cascadeBit){
+        u64 signature = 0;
+        for(const ShadowCaster& caster: casters){
+            if(!(caster.cascadeMask & cascadeBit)) continue;
+
+            u64 hash = 14695981039346656037ull;
+            auto mix = [&hash](const void* data, size_t size){
+                const u8* bytes = static_cast<const u8*>(data);
+                for(size_t i = 0; i < size; i++){
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+                }
+            };
+            mix(&caster.entityID, sizeof(caster.entityID));
+            mix(&caster.modelID, sizeof(caster.modelID));
+            mix(&caster.lodLevel, sizeof(caster.lodLevel));
+            mix(&caster.worldMatrix, sizeof(caster.worldMatrix));
+            signature += hash;
+        }
+        return signature;
+    }
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include <glad/gl.h>
+
+#include "defines.h"
+
+// Buffer texture streamed from the CPU every frame, the GL 4.1 stand-in for
+// a read-only storage buffer
+class TextureBuffer{
+private:
+    u32 m_buffer = 0;
+    u32 m_texture = 0;
+
+public:
+    TextureBuffer(){
+        glGenBuffers(1, &m_buffer);
+        glGenTextures(1, &m_texture);
+    }
+
+    ~TextureBuffer(){
+        glDeleteTextures(1, &m_texture);
+        glDeleteBuffers(1, &m_buffer);
+    }
+
+    TextureBuffer(const TextureBuffer&) = delete;
+    TextureBuffer& operator=(const TextureBuffer&) = delete;
+
+    void Upload(GLenum format, const void* data, size_t size){
+        // Orphan and refill, the driver renames the storage if the GPU still uses it
+        glBindBuffer(GL_TEXTURE_BUFFER, m_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+
+        glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, m_buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void Bind(u32 unit) const {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, m_texture);
+    }
+};
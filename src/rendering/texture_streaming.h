@@ -0,0 +1,567 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <cmath>
+#include <cstring>
+
+#include <glad/gl.h>
+
+#include "assets/asset_manager.h"
+#include "rendering/gl_extensions.h"
+#include "rendering/upload_queue.h"
+#include "rendering/gl_loader_thread.h"
+#include "defines.h"
+
+struct GPUTexture{
+    u32 textureID = 0;
+    GLenum target = GL_TEXTURE_2D;
+
+    // Set once the upload of the first levels has completed, until then
+    // draws use a placeholder
+    bool isUploaded = false;
+    u64 uploadTicket = 0;
+
+    // The texture object holds levels residentMip to mipCount - 1 of the
+    // source only. It is replaced whenever that range changes, generation
+    // counts the replacements so cached handles and copies can be refreshed.
+    u32 residentMip = 0;
+    u32 mipCount = 1;
+    u32 generation = 0;
+    size_t residentBytes = 0;
+
+    ~GPUTexture(){
+        if(textureID){
+            glDeleteTextures(1, &textureID);
+        }
+    }
+};
+
+struct TextureStreamingSettings{
+    // Off keeps every level of every texture resident, budget ignored. The
+    // budget is the texture share of ResidencySettings.
+    bool enabled = true;
+    u32 uploadKBPerFrame = 4096;    // level data uploaded per frame, the rest waits
+
+    // Levels no larger than this load with the texture and are never evicted
+    u32 residentSize = 64;
+
+    // Added to the estimated level, positive trades sharpness for memory
+    f32 mipBias = 0.0f;
+};
+
+// Mip level residency of every GPU texture under one VRAM budget. Each frame
+// the renderer reports how many UV units a screen pixel spans wherever a
+// texture is drawn, which gives the finest level that can be seen. Levels
+// above it are dropped right away, missing ones are uploaded finest-need
+// first within the per-frame upload budget while draws keep sampling what
+// is resident. When the levels wanted exceed the budget, textures not drawn
+// recently go down to their up-front levels first, least recently used
+// first, then drop out of VRAM entirely in the same order until drawn
+// again, then visible textures give up their largest level one at a time.
+// Level data goes through the upload queue's staging ring, or is uploaded
+// on the loader thread when there is one. A new texture gets its up-front
+// levels ahead of everything else.
+// Render thread only, stats may be read from any thread.
+class TextureStreamer{
+private:
+    static constexpr f32 NOT_REQUESTED = 1e9f;
+
+    struct StreamedTexture{
+        TextureID id = INVALID_TEXTURE;
+        GPUTexture* texture = nullptr;
+        u32 floorMip = 0;           // coarsest level ever streamed, always resident
+        u32 targetMip = 0;
+        f32 requestedMip = NOT_REQUESTED;   // finest level asked for this frame
+        u64 lastUsedFrame = 0;
+        bool loading = false;       // replacement being built on the loader thread
+        GLsync copied = nullptr;    // render thread copies into the current object, loader jobs wait on it
+    };
+
+    // Texture object the loader thread builds, swapped in once its job is done
+    struct PendingLoad{
+        u64 ticket = 0;
+        u32 index = 0;
+        u32 mip = 0;
+        u32 textureID = 0;      // written by the job
+        GLsync copied = nullptr;    // waited on by the job, deleted once it's done
+    };
+
+    AssetManager* m_assetManager;
+    UploadQueue* m_uploadQueue;
+    GLLoaderThread* m_loader = nullptr;
+    std::deque<std::unique_ptr<PendingLoad>> m_loads;
+    std::vector<StreamedTexture> m_textures;
+    std::unordered_map<TextureID, u32> m_indices;
+    u64 m_frame = 0;
+
+    std::vector<u32> m_order;
+    std::function<size_t(i32, i32)> m_copyBytes;
+
+    // Read by the UI
+    std::atomic<u32> m_textureCount{0};
+    std::atomic<size_t> m_residentBytes{0};
+    std::atomic<size_t> m_wantedBytes{0};       // before the budget is applied, copies included
+    std::atomic<size_t> m_uploadedBytes{0};     // last frame
+    std::atomic<u32> m_pendingLevels{0};
+    std::atomic<u32> m_levelsStreamed{0};
+    std::atomic<u32> m_levelsEvicted{0};
+    std::atomic<u32> m_texturesEvicted{0};     // whole textures
+
+public:
+    TextureStreamer(AssetManager* assetManager, UploadQueue* uploadQueue)
+    : m_assetManager(assetManager), m_uploadQueue(uploadQueue){}
+
+    // The loader thread is stopped first, textures of loads never swapped in are freed here
+    ~TextureStreamer(){
+        for(std::unique_ptr<PendingLoad>& load: m_loads){
+            if(load->textureID) glDeleteTextures(1, &load->textureID);
+            if(load->copied) glDeleteSync(load->copied);
+        }
+        for(StreamedTexture& streamed: m_textures){
+            if(streamed.copied) glDeleteSync(streamed.copied);
+        }
+    }
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Uploads from now on go to the loader thread, null for the upload queue
+    void SetLoader(GLLoaderThread* loader) { m_loader = loader; }
+
+    // Bytes of a copy kept elsewhere of a texture whose finest resident
+    // level is width x height, counted in the budget along with the texture
+    void SetCopyBytes(std::function<size_t(i32 width, i32 height)> copyBytes) { m_copyBytes = std::move(copyBytes); }
+
+    // Registers the texture, its up-front levels are uploaded by the next Update
+    bool Create(TextureID textureID, const TextureData& data, GPUTexture& texture, const TextureStreamingSettings& settings){
+        if(data.mips.empty() || GetFormats(data.format).first == 0) return false;
+
+        StreamedTexture streamed;
+        streamed.id = textureID;
+        streamed.texture = &texture;
+        streamed.floorMip = GetFloorMip(data, settings.residentSize);
+        streamed.targetMip = streamed.floorMip;
+        streamed.lastUsedFrame = m_frame;
+
+        texture.mipCount = static_cast<u32>(data.mips.size());
+        texture.residentMip = texture.mipCount;     // no texture object yet
+
+        m_indices[textureID] = static_cast<u32>(m_textures.size());
+        m_textures.push_back(streamed);
+        m_textureCount = static_cast<u32>(m_textures.size());
+        return true;
+    }
+
+    // uvPerPixel is the UV distance one pixel spans where the texture is
+    // drawn, 0 when unknown, which asks for the full resolution
+    void Request(TextureID textureID, f32 uvPerPixel){
+        auto it = m_indices.find(textureID);
+        if(it == m_indices.end()) return;
+
+        StreamedTexture& streamed = m_textures[it->second];
+        const TextureData& data = GetData(streamed);
+        f32 mip = 0.0f;
+        if(uvPerPixel > 0.0f){
+            f32 texelsPerPixel = uvPerPixel * static_cast<f32>(std::max(data.width, data.height));
+            mip = std::max(std::log2(texelsPerPixel), 0.0f);
+        }
+        streamed.requestedMip = std::min(streamed.requestedMip, mip);
+    }
+
+    // Once per frame after the requests, before anything is drawn
+    void Update(const TextureStreamingSettings& settings, size_t budget){
+        m_frame++;
+
+        for(StreamedTexture& streamed: m_textures){
+            GPUTexture& texture = *streamed.texture;
+            if(!texture.isUploaded && m_uploadQueue->IsComplete(texture.uploadTicket)) texture.isUploaded = true;
+        }
+        while(!m_loads.empty() && m_loader && m_loader->IsComplete(m_loads.front()->ticket)){
+            PendingLoad& load = *m_loads.front();
+            StreamedTexture& streamed = m_textures[load.index];
+            Replace(streamed, load.textureID, load.mip);
+            streamed.texture->isUploaded = true;
+            streamed.loading = false;
+            if(load.copied) glDeleteSync(load.copied);
+            m_loads.pop_front();
+        }
+
+        size_t wantedBytes = 0;
+        for(StreamedTexture& streamed: m_textures){
+            const TextureData& data = GetData(streamed);
+            streamed.floorMip = GetFloorMip(data, settings.residentSize);
+            if(streamed.requestedMip != NOT_REQUESTED){
+                streamed.lastUsedFrame = m_frame;
+                streamed.targetMip = std::min(SelectMip(streamed, settings.mipBias), streamed.floorMip);
+            } else if(streamed.targetMip < streamed.texture->mipCount){
+                // Not drawn this frame: stays as it is until the budget needs it, evicted ones stay out
+                streamed.targetMip = std::min(streamed.targetMip, streamed.floorMip);
+            }
+            if(!settings.enabled) streamed.targetMip = 0;
+            streamed.requestedMip = NOT_REQUESTED;
+            wantedBytes += BudgetBytes(data, streamed.targetMip);
+        }
+        m_wantedBytes = wantedBytes;
+
+        if(settings.enabled && wantedBytes > budget){
+            FitBudget(wantedBytes, budget);
+        }
+
+        // Drops are cheap and make room, apply them all
+        for(StreamedTexture& streamed: m_textures){
+            if(!streamed.loading && streamed.targetMip > streamed.texture->residentMip){
+                m_levelsEvicted += streamed.targetMip - streamed.texture->residentMip;
+                if(streamed.targetMip == streamed.texture->mipCount){
+                    Evict(streamed);
+                } else {
+                    Reallocate(streamed, streamed.targetMip);
+                }
+            }
+        }
+
+        StreamIn(static_cast<size_t>(settings.uploadKBPerFrame) << 10);
+
+        size_t residentBytes = 0;
+        u32 pendingLevels = 0;
+        for(const StreamedTexture& streamed: m_textures){
+            residentBytes += streamed.texture->residentBytes;
+            if(streamed.targetMip < streamed.texture->residentMip){
+                pendingLevels += streamed.texture->residentMip - streamed.targetMip;
+            }
+        }
+        m_residentBytes = residentBytes;
+        m_pendingLevels = pendingLevels;
+    }
+
+    u32 GetTextureCount() const { return m_textureCount; }
+    size_t GetResidentBytes() const { return m_residentBytes; }
+    size_t GetWantedBytes() const { return m_wantedBytes; }
+    size_t GetUploadedBytes() const { return m_uploadedBytes; }
+    u32 GetPendingLevels() const { return m_pendingLevels; }
+    u32 GetLevelsStreamed() const { return m_levelsStreamed; }
+    u32 GetLevelsEvicted() const { return m_levelsEvicted; }
+    u32 GetTexturesEvicted() const { return m_texturesEvicted; }
+
+private:
+    // A resident level is only dropped once the request is half a level
+    // past it, so a camera hovering at a boundary doesn't reallocate every frame
+    static u32 SelectMip(const StreamedTexture& streamed, f32 bias){
+        f32 mip = std::max(streamed.requestedMip + bias, 0.0f);
+        u32 target = static_cast<u32>(mip);
+        u32 resident = streamed.texture->residentMip;
+        if(target == resident + 1 && mip < static_cast<f32>(resident) + 1.5f) target = resident;
+        return target;
+    }
+
+    void FitBudget(size_t& wantedBytes, size_t budget){
+        // Least recently drawn first, largest first among equals
+        m_order.resize(m_textures.size());
+        for(u32 i = 0; i < m_order.size(); i++) m_order[i] = i;
+        std::sort(m_order.begin(), m_order.end(), [this](u32 a, u32 b){
+            const StreamedTexture& first = m_textures[a];
+            const StreamedTexture& second = m_textures[b];
+            if(first.lastUsedFrame != second.lastUsedFrame) return first.lastUsedFrame < second.lastUsedFrame;
+            return TopLevelBytes(first) > TopLevelBytes(second);
+        });
+
+        for(u32 index: m_order){
+            StreamedTexture& streamed = m_textures[index];
+            if(streamed.lastUsedFrame == m_frame) break;
+            while(wantedBytes > budget && streamed.targetMip < streamed.floorMip) DropLevel(streamed, wantedBytes);
+            if(wantedBytes <= budget) return;
+        }
+
+        // Still over, the same textures give up their up-front levels too
+        for(u32 index: m_order){
+            StreamedTexture& streamed = m_textures[index];
+            if(streamed.lastUsedFrame == m_frame) break;
+            wantedBytes -= BudgetBytes(GetData(streamed), streamed.targetMip);
+            streamed.targetMip = streamed.texture->mipCount;
+            if(wantedBytes <= budget) return;
+        }
+
+        // Everything left is on screen, trim the largest top level each step
+        auto smaller = [this](u32 a, u32 b){ return TopLevelBytes(m_textures[a]) < TopLevelBytes(m_textures[b]); };
+        m_order.erase(std::remove_if(m_order.begin(), m_order.end(), [this](u32 index){
+            return m_textures[index].targetMip >= m_textures[index].floorMip;
+        }), m_order.end());
+        std::make_heap(m_order.begin(), m_order.end(), smaller);
+        while(wantedBytes > budget && !m_order.empty()){
+            std::pop_heap(m_order.begin(), m_order.end(), smaller);
+            StreamedTexture& streamed = m_textures[m_order.back()];
+            DropLevel(streamed, wantedBytes);
+            if(streamed.targetMip < streamed.floorMip){
+                std::push_heap(m_order.begin(), m_order.end(), smaller);
+            } else {
+                m_order.pop_back();
+            }
+        }
+    }
+
+    void DropLevel(StreamedTexture& streamed, size_t& wantedBytes){
+        wantedBytes -= TopLevelBytes(streamed);
+        streamed.targetMip++;
+    }
+
+    // One level per texture per round, the textures missing the most first.
+    // Textures without an object come before all others and start at their
+    // up-front levels.
+    void StreamIn(size_t uploadBudget){
+        size_t uploaded = 0;
+        bool progress = true;
+        while(progress){
+            m_order.clear();
+            for(u32 i = 0; i < m_textures.size(); i++){
+                if(!m_textures[i].loading && m_textures[i].targetMip < m_textures[i].texture->residentMip) m_order.push_back(i);
+            }
+            std::sort(m_order.begin(), m_order.end(), [this](u32 a, u32 b){
+                const StreamedTexture& first = m_textures[a];
+                const StreamedTexture& second = m_textures[b];
+                bool firstNew = first.texture->textureID == 0;
+                bool secondNew = second.texture->textureID == 0;
+                if(firstNew != secondNew) return firstNew;
+                u32 firstMissing = first.texture->residentMip - first.targetMip;
+                u32 secondMissing = second.texture->residentMip - second.targetMip;
+                if(firstMissing != secondMissing) return firstMissing > secondMissing;
+                return first.lastUsedFrame > second.lastUsedFrame;
+            });
+
+            progress = false;
+            for(u32 index: m_order){
+                StreamedTexture& streamed = m_textures[index];
+                u32 mip = streamed.texture->textureID ? streamed.texture->residentMip - 1 : streamed.floorMip;
+
+                // A level larger than the whole budget still goes alone
+                size_t bytes = UploadBytes(GetData(streamed), mip, streamed.texture->residentMip);
+                if(uploaded > 0 && uploaded + bytes > uploadBudget) break;
+
+                Reallocate(streamed, mip);
+                uploaded += bytes;
+                m_levelsStreamed++;
+                progress = true;
+            }
+            if(uploaded >= uploadBudget) break;
+        }
+        m_uploadedBytes = uploaded;
+    }
+
+    // New texture object holding levels mip and below. Levels the old one
+    // already has are copied on the GPU with GL 4.3, the rest is staged in
+    // one upload. With a loader thread the object is built there instead
+    // and the old one stays in use until it's done; drops with nothing to
+    // upload are still made here, fenced so a later job copying from the
+    // object waits for them.
+    void Reallocate(StreamedTexture& streamed, u32 mip){
+        GPUTexture& texture = *streamed.texture;
+        const TextureData& data = GetData(streamed);
+        bool copy = GLAD_GL_VERSION_4_3 && texture.textureID != 0;
+        u32 uploadEnd = copy ? std::max(mip, texture.residentMip) : texture.mipCount;
+
+        if(m_loader && uploadEnd > mip){
+            auto load = std::make_unique<PendingLoad>();
+            PendingLoad* pending = load.get();
+            pending->index = static_cast<u32>(&streamed - m_textures.data());
+            pending->mip = mip;
+
+            TextureID id = streamed.id;
+            u32 source = copy ? texture.textureID : 0;
+            u32 sourceMip = texture.residentMip;
+            pending->copied = streamed.copied;
+            streamed.copied = nullptr;
+            GLsync copied = pending->copied;
+            pending->ticket = m_loader->Submit([this, pending, id, source, sourceMip, mip, uploadEnd, copied](){
+                if(copied) glWaitSync(copied, 0, GL_TIMEOUT_IGNORED);
+                const TextureData& data = *m_assetManager->GetTexture(id);
+                u32 textureID = CreateTexture(data, mip);
+                UploadLevels(textureID, data, mip, uploadEnd, [&](u32 level, size_t){ return data.mips[level].data(); });
+                if(source) CopyLevels(data, source, sourceMip, textureID, mip);
+                pending->textureID = textureID;
+            });
+            streamed.loading = true;
+            m_loads.push_back(std::move(load));
+            return;
+        }
+
+        u32 textureID = CreateTexture(data, mip);
+        size_t uploadBytes = 0;
+        for(u32 level = mip; level < uploadEnd; level++) uploadBytes += data.mips[level].size();
+
+        u64 ticket = m_uploadQueue->Upload(uploadBytes, [&](u8* staging){
+            for(u32 level = mip; level < uploadEnd; level++){
+                std::memcpy(staging, data.mips[level].data(), data.mips[level].size());
+                staging += data.mips[level].size();
+            }
+        }, [&](const UploadSource& source){
+            UploadLevels(textureID, data, mip, uploadEnd, [&](u32, size_t at){ return source.Pixels(at); });
+        });
+        if(copy) CopyLevels(data, texture.textureID, texture.residentMip, textureID, mip);
+
+        if(!texture.textureID) texture.uploadTicket = ticket;
+        Replace(streamed, textureID, mip);
+
+        if(m_loader){
+            if(streamed.copied) glDeleteSync(streamed.copied);
+            streamed.copied = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+    }
+
+    // Back to no texture object, uploaded again from its up-front levels once requested
+    void Evict(StreamedTexture& streamed){
+        GPUTexture& texture = *streamed.texture;
+        glDeleteTextures(1, &texture.textureID);
+        texture.textureID = 0;
+        texture.residentMip = texture.mipCount;
+        texture.residentBytes = 0;
+        texture.isUploaded = false;
+        texture.uploadTicket = 0;
+        texture.generation++;
+        if(streamed.copied){
+            glDeleteSync(streamed.copied);
+            streamed.copied = nullptr;
+        }
+        m_texturesEvicted++;
+    }
+
+    void Replace(StreamedTexture& streamed, u32 textureID, u32 mip){
+        GPUTexture& texture = *streamed.texture;
+        if(texture.textureID) glDeleteTextures(1, &texture.textureID);
+        texture.textureID = textureID;
+        texture.residentMip = mip;
+        texture.residentBytes = LevelBytes(GetData(streamed), mip);
+        texture.generation++;
+    }
+
+    // Storage for levels mip and below, contents undefined. With GL 4.2 the
+    // storage is immutable and allocated in one call.
+    static u32 CreateTexture(const TextureData& data, u32 mip){
+        std::pair<GLenum, GLenum> formats = GetFormats(data.format);
+        u32 mipCount = static_cast<u32>(data.mips.size());
+
+        u32 textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        if(GLAD_GL_VERSION_4_2){
+            glTexStorage2D(GL_TEXTURE_2D, mipCount - mip, formats.first, MipWidth(data, mip), MipHeight(data, mip));
+        } else {
+            for(u32 level = mip; level < mipCount; level++){
+                i32 width = MipWidth(data, level);
+                i32 height = MipHeight(data, level);
+                if(BlockCompressor::IsCompressed(data.format)){
+                    glCompressedTexImage2D(GL_TEXTURE_2D, level - mip, formats.first, width, height, 0,
+                                           static_cast<GLsizei>(data.mips[level].size()), nullptr);
+                } else {
+                    glTexImage2D(GL_TEXTURE_2D, level - mip, formats.first, width, height, 0,
+                                 formats.second, GL_UNSIGNED_BYTE, nullptr);
+                }
+            }
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipCount - mip - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return textureID;
+    }
+
+    // Source levels mip to end - 1 into the texture holding mip and below.
+    // pixels(level, offset) gives the data pointer argument, offset being
+    // the bytes of the levels before it.
+    template<typename Pixels>
+    static void UploadLevels(u32 textureID, const TextureData& data, u32 mip, u32 end, Pixels&& pixels){
+        std::pair<GLenum, GLenum> formats = GetFormats(data.format);
+        bool compressed = BlockCompressor::IsCompressed(data.format);
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t offset = 0;
+        for(u32 level = mip; level < end; level++){
+            GLsizei bytes = static_cast<GLsizei>(data.mips[level].size());
+            i32 width = MipWidth(data, level);
+            i32 height = MipHeight(data, level);
+            if(compressed){
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, level - mip, 0, 0, width, height, formats.first,
+                                          bytes, pixels(level, offset));
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D, level - mip, 0, 0, width, height, formats.second,
+                                GL_UNSIGNED_BYTE, pixels(level, offset));
+            }
+            offset += data.mips[level].size();
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Levels both textures hold, GL 4.3
+    static void CopyLevels(const TextureData& data, u32 source, u32 sourceMip, u32 destination, u32 mip){
+        for(u32 level = std::max(mip, sourceMip); level < data.mips.size(); level++){
+            glCopyImageSubData(source, GL_TEXTURE_2D, level - sourceMip, 0, 0, 0,
+                               destination, GL_TEXTURE_2D, level - mip, 0, 0, 0,
+                               MipWidth(data, level), MipHeight(data, level), 1);
+        }
+    }
+
+    // Bytes sent from the CPU to go from resident to mip
+    static size_t UploadBytes(const TextureData& data, u32 mip, u32 resident){
+        if(GLAD_GL_VERSION_4_3) return LevelBytes(data, mip) - LevelBytes(data, resident);
+        return LevelBytes(data, mip);
+    }
+
+    // Levels mip to the last one together
+    static size_t LevelBytes(const TextureData& data, u32 mip){
+        size_t bytes = 0;
+        for(u32 level = mip; level < data.mips.size(); level++) bytes += data.mips[level].size();
+        return bytes;
+    }
+
+    // Levels mip to the last one and their copy, what the budget counts
+    size_t BudgetBytes(const TextureData& data, u32 mip) const {
+        if(mip >= data.mips.size()) return 0;
+        size_t bytes = LevelBytes(data, mip);
+        if(m_copyBytes) bytes += m_copyBytes(MipWidth(data, mip), MipHeight(data, mip));
+        return bytes;
+    }
+
+    // What dropping the target's largest level frees
+    size_t TopLevelBytes(const StreamedTexture& streamed) const {
+        const TextureData& data = GetData(streamed);
+        return BudgetBytes(data, streamed.targetMip) - BudgetBytes(data, streamed.targetMip + 1);
+    }
+
+    // Looked up every time, the asset manager's storage may move as textures load
+    const TextureData& GetData(const StreamedTexture& streamed) const {
+        return *m_assetManager->GetTexture(streamed.id);
+    }
+
+    static u32 GetFloorMip(const TextureData& data, u32 residentSize){
+        u32 mip = 0;
+        while(mip + 1 < data.mips.size() &&
+              static_cast<u32>(std::max(MipWidth(data, mip), MipHeight(data, mip))) > residentSize) mip++;
+        return mip;
+    }
+
+    static i32 MipWidth(const TextureData& data, u32 level) { return std::max(data.width >> level, 1); }
+    static i32 MipHeight(const TextureData& data, u32 level) { return std::max(data.height >> level, 1); }
+
+    // Internal format and pixel format, the latter 0 for block compressed ones
+    static std::pair<GLenum, GLenum> GetFormats(TextureFormat format){
+        switch(format){
+        case TextureFormat::R8: return {GL_R8, GL_RED};
+        case TextureFormat::RGB8: return {GL_RGB8, GL_RGB};
+        case TextureFormat::RGBA8: return {GL_RGBA8, GL_RGBA};
+        case TextureFormat::BC1: return {S3TCFormats::RGB_DXT1, 0};
+        case TextureFormat::BC3: return {S3TCFormats::RGBA_DXT5, 0};
+        case TextureFormat::BC4: return {GL_COMPRESSED_RED_RGTC1, 0};
+        case TextureFormat::BC5: return {GL_COMPRESSED_RG_RGTC2, 0};
+        case TextureFormat::BC7: return {GL_COMPRESSED_RGBA_BPTC_UNORM, 0};
+        default: return {0, 0};
+        }
+    }
+};
@@ -0,0 +1,213 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <cstring>
+
+#include <glad/gl.h>
+
+#include "defines.h"
+
+struct UploadSettings{
+    // Mesh data staged per frame, meshes past it wait for the next frame
+    u32 meshKBPerFrame = 8192;
+};
+
+// Where an upload's bytes sit while its copy commands are recorded: an
+// offset into the staging buffer, bound as the pixel unpack and copy read
+// source, or client memory when the ring had no room
+struct UploadSource{
+    u32 buffer = 0;
+    size_t offset = 0;
+    const u8* data = nullptr;
+
+    // Pointer argument of glTexSubImage2D and friends for byte at
+    const void* Pixels(size_t at) const {
+        return buffer ? reinterpret_cast<const void*>(offset + at) : data + at;
+    }
+
+    // Copies size bytes from at into the buffer bound to GL_COPY_WRITE_BUFFER
+    void CopyToBuffer(size_t destinationOffset, size_t at, size_t size) const {
+        if(buffer){
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset + at, destinationOffset, size);
+        } else {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, destinationOffset, size, data + at);
+        }
+    }
+};
+
+// Staging ring for buffer and texture uploads. Callers write their data
+// straight into mapped staging memory and record GPU copies out of it, so
+// the driver never holds a second CPU copy and the calls return without
+// waiting for the transfer. Uploads of one frame share a fence; a ticket
+// names that frame's segment and completes once the fence has passed,
+// which is also when its part of the ring is written again. With GL 4.4
+// the ring is mapped once, persistent and coherent, otherwise each upload
+// maps its range unsynchronized, safe since the fences keep it unused.
+// Render thread only, stats may be read from any thread.
+class UploadQueue{
+private:
+    static constexpr size_t ALIGNMENT = 64;
+
+    struct Segment{
+        GLsync fence = nullptr;
+        u64 ticket = 0;
+        size_t bytes = 0;       // ring space, wrap padding included
+    };
+
+    size_t m_capacity;
+    u32 m_buffer = 0;
+    u8* m_mapped = nullptr;     // persistent mapping, null without GL 4.4
+
+    size_t m_head = 0;
+    size_t m_used = 0;          // written and not yet retired, wrap padding included
+    std::deque<Segment> m_segments;
+
+    // The open segment, fenced at the start of the next frame
+    u64 m_ticket = 1;
+    size_t m_segmentBytes = 0;
+    bool m_segmentUsed = false;
+    u64 m_completedTicket = 0;
+
+    std::vector<u8> m_fallback;     // uploads that don't fit the ring
+
+    // Read by the UI
+    std::atomic<size_t> m_stagedBytes{0};     // last frame
+    std::atomic<u32> m_directUploads{0};
+    std::atomic<u32> m_segmentsInFlight{0};
+    size_t m_frameBytes = 0;
+
+public:
+    explicit UploadQueue(size_t capacity = 32 << 20) : m_capacity(capacity){}
+
+    ~UploadQueue(){
+        for(Segment& segment: m_segments){
+            glDeleteSync(segment.fence);
+        }
+        // Deleting the buffer also ends the persistent mapping
+        glDeleteBuffers(1, &m_buffer);
+    }
+
+    UploadQueue(const UploadQueue&) = delete;
+    UploadQueue& operator=(const UploadQueue&) = delete;
+
+    // Start of every frame: fences last frame's uploads and retires the
+    // segments the GPU has finished with
+    void BeginFrame(){
+        if(m_segmentUsed){
+            m_segments.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), m_ticket, m_segmentBytes});
+            m_ticket++;
+            m_segmentBytes = 0;
+            m_segmentUsed = false;
+        }
+
+        // Oldest first, stop at the first one still in flight
+        while(!m_segments.empty()){
+            Segment& segment = m_segments.front();
+            GLenum status = glClientWaitSync(segment.fence, 0, 0);
+            if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+            glDeleteSync(segment.fence);
+            m_used -= segment.bytes;
+            m_completedTicket = segment.ticket;
+            m_segments.pop_front();
+        }
+
+        m_segmentsInFlight = static_cast<u32>(m_segments.size());
+        m_stagedBytes = m_frameBytes;
+        m_frameBytes = 0;
+    }
+
+    // write fills size bytes of staging memory, copy then records the GPU
+    // copies out of it through the UploadSource. Returns the upload's
+    // ticket, copies are issued in order so the destination may be used
+    // right away; the ticket only says when the transfer has finished.
+    template<typename Write, typename Copy>
+    u64 Upload(size_t size, Write&& write, Copy&& copy){
+        m_segmentUsed = true;
+
+        if(size == 0){
+            copy(UploadSource{});
+            return m_ticket;
+        }
+
+        size_t offset = 0;
+        if(!Allocate(size, offset)){
+            // Larger than the ring or the ring is full, the driver copies it instead
+            m_fallback.resize(size);
+            write(m_fallback.data());
+            UploadSource source;
+            source.data = m_fallback.data();
+            copy(source);
+            m_directUploads++;
+            return m_ticket;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+        if(m_mapped){
+            write(m_mapped + offset);
+        } else {
+            void* mapped = glMapBufferRange(GL_COPY_READ_BUFFER, offset, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            write(static_cast<u8*>(mapped));
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+        UploadSource source;
+        source.buffer = m_buffer;
+        source.offset = offset;
+        copy(source);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        m_frameBytes += size;
+        return m_ticket;
+    }
+
+    bool IsComplete(u64 ticket) const { return ticket != 0 && ticket <= m_completedTicket; }
+
+    size_t GetCapacity() const { return m_capacity; }
+    size_t GetStagedBytes() const { return m_stagedBytes; }
+    u32 GetDirectUploads() const { return m_directUploads; }
+    u32 GetSegmentsInFlight() const { return m_segmentsInFlight; }
+
+private:
+    // Space at the head of the ring, wrapping to the start when the end is too short
+    bool Allocate(size_t size, size_t& offset){
+        if(!m_buffer) CreateBuffer();
+
+        size_t aligned = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if(aligned > m_capacity) return false;
+
+        // Nothing in flight, start over at the front
+        if(m_used == 0) m_head = 0;
+
+        size_t position = m_head;
+        size_t padding = 0;
+        if(position + aligned > m_capacity){
+            padding = m_capacity - position;
+            position = 0;
+        }
+        if(m_used + padding + aligned > m_capacity) return false;
+
+        m_head = position + aligned;
+        m_used += padding + aligned;
+        m_segmentBytes += padding + aligned;
+        offset = position;
+        return true;
+    }
+
+    void CreateBuffer(){
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+        if(GLAD_GL_VERSION_4_4){
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_READ_BUFFER, m_capacity, nullptr, flags);
+            m_mapped = static_cast<u8*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, m_capacity, flags));
+        } else {
+            glBufferData(GL_COPY_READ_BUFFER, m_capacity, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+};
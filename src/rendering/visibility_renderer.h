@@ -0,0 +1,327 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <iostream>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "assets/asset_manager.h"
+#include "rendering/gpu_resource_manager.h"
+#include "rendering/geometry_pool.h"
+#include "rendering/frame_packet.h"
+#include "rendering/render_graph.h"
+#include "rendering/shadows.h"
+#include "rendering/point_shadows.h"
+#include "rendering/texture_buffer.h"
+#include "rendering/light_clusters.h"
+#include "shader.h"
+#include "defines.h"
+
+struct VisibilityStats{
+    u32 drawCalls = 0;
+    u32 trianglesRendered = 0;
+    u32 materialsResolved = 0;
+    bool overflowed = false;    // too many draws to pack, frame fell back to forward
+};
+
+// Visibility buffer backend for opaque geometry. The geometry pass writes a
+// single packed 32-bit ID per pixel, (drawID + 1) << 19 | primitiveID, so its
+// cost is independent of material and vertex attribute count. Shading is
+// resolved in screen space: the resolve shader fetches the three vertices of
+// the pixel's triangle from the geometry pool, transforms them and rebuilds
+// perspective correct barycentrics and their screen derivatives analytically,
+// which gives interpolated attributes and texture gradients without any
+// per-vertex outputs.
+//
+// GL 4.1 has no bindless textures, so the resolve runs one full screen pass
+// per material. A classify pass first writes each pixel's material slot into a
+// depth buffer; the material passes then draw at their slot's depth with
+// GL_EQUAL so early depth testing rejects every other pixel. The material
+// depth is float so slot / MAX_MATERIAL_SLOTS round trips exactly.
+class VisibilityRenderer{
+public:
+    static constexpr u32 TRIANGLE_ID_BITS = 19;
+    static constexpr u32 DRAW_ID_BITS = 32 - TRIANGLE_ID_BITS;
+    static constexpr u32 MAX_DRAWS = (1u << DRAW_ID_BITS) - 1;        // 0 marks empty pixels
+    static constexpr u32 MAX_TRIANGLES_PER_DRAW = 1u << TRIANGLE_ID_BITS;
+    static constexpr u32 MAX_MATERIAL_SLOTS = 1u << 16;
+
+    // Texture units, the shadow map uses 3 and clustered lights 4-6
+    static constexpr u32 VISIBILITY_UNIT = 2;
+    static constexpr u32 VERTEX_UNIT = 7;
+    static constexpr u32 INDEX_UNIT = 8;
+    static constexpr u32 DRAW_TRANSFORM_UNIT = 9;
+    static constexpr u32 DRAW_INFO_UNIT = 10;
+
+private:
+    // A pool range drawn with one ID, large meshes are split into several
+    struct VisibilityDraw{
+        const RenderCommand* command;
+        u32 firstIndex;
+        u32 indexCount;
+        u32 baseVertex;
+        u32 materialSlot;
+    };
+
+    AssetManager* m_assetManager;
+    GPUResourceManager* m_gpuResourceManager;
+
+    std::unique_ptr<Shader> m_visibilityShader;
+    std::unique_ptr<Shader> m_classifyShader;
+    std::unique_ptr<Shader> m_resolveShader;
+    u32 m_emptyVAO = 0;
+
+    std::vector<VisibilityDraw> m_draws;
+    std::vector<MaterialID> m_materialSlots;
+    std::vector<glm::vec4> m_drawTransforms;   // model matrix, then normal matrix columns
+    std::vector<glm::uvec4> m_drawInfos;       // firstIndex, baseVertex, materialSlot, receiveShadows
+    TextureBuffer m_drawTransformBuffer;
+    TextureBuffer m_drawInfoBuffer;
+
+    VisibilityStats m_stats;
+
+public:
+    VisibilityRenderer(AssetManager* assetManager, GPUResourceManager* gpuResourceManager)
+    : m_assetManager(assetManager), m_gpuResourceManager(gpuResourceManager){
+        m_visibilityShader = std::make_unique<Shader>("visibility.vert", "visibility.frag");
+        m_classifyShader = std::make_unique<Shader>("fullscreen.vert", "visibilityClassify.frag");
+        m_resolveShader = std::make_unique<Shader>("visibilityResolve.vert", "visibilityResolve.frag");
+        glGenVertexArrays(1, &m_emptyVAO);
+    }
+
+    ~VisibilityRenderer(){
+        glDeleteVertexArrays(1, &m_emptyVAO);
+    }
+
+    VisibilityRenderer(const VisibilityRenderer&) = delete;
+    VisibilityRenderer& operator=(const VisibilityRenderer&) = delete;
+
+    // Adds the passes drawing the opaque batches into the scene targets.
+    // Returns false without adding any if the frame does not fit the ID packing.
+    bool AddPasses(RenderGraph& graph, const FramePacket& packet, const std::vector<RenderBatch>& batches,
+                   LightClusterBuffers& lightClusters, ShadowRenderer& shadows, PointShadowRenderer& pointShadows,
+                   const SceneTargets& targets){
+        m_stats = {};
+        if(!BuildDraws(batches)){
+            m_stats.overflowed = true;
+            return false;
+        }
+
+        glm::ivec2 size = graph.GetDesc(targets.color).size;
+        RGHandle visibility = graph.CreateTexture("VisibilityIDs", {size, GL_R32UI});
+        RGHandle materialDepth = graph.CreateTexture("MaterialDepth", {size, GL_DEPTH_COMPONENT32F});
+
+        graph.AddPass("Visibility",
+            [&](RenderGraphBuilder& builder){
+                builder.WriteColor(visibility, RGLoadOp::Clear);
+                builder.WriteDepth(targets.depth, RGLoadOp::Clear);
+            },
+            [this, &packet](const RenderPassContext&){
+                UploadDraws();
+                VisibilityPass(packet);
+            });
+
+        // Material slot to depth, empty pixels keep the cleared far depth
+        graph.AddPass("MaterialClassify",
+            [&](RenderGraphBuilder& builder){
+                builder.Read(visibility);
+                builder.WriteDepth(materialDepth, RGLoadOp::Clear);
+            },
+            [this, visibility](const RenderPassContext& context){
+                ClassifyPass(context.GetTexture(visibility));
+            });
+
+        graph.AddPass("MaterialResolve",
+            [&](RenderGraphBuilder& builder){
+                builder.Read(visibility);
+                if(targets.shadowMap != RG_INVALID_HANDLE) builder.Read(targets.shadowMap);
+                if(targets.pointShadowAtlas != RG_INVALID_HANDLE) builder.Read(targets.pointShadowAtlas);
+                builder.WriteColor(targets.color, RGLoadOp::Clear, SCENE_CLEAR_COLOR);
+                builder.WriteDepth(materialDepth);
+            },
+            [this, &packet, &lightClusters, &shadows, &pointShadows, visibility](const RenderPassContext& context){
+                ResolvePass(packet, lightClusters, shadows, pointShadows, context.GetTexture(visibility), context.GetSize(visibility));
+            });
+
+        return true;
+    }
+
+    const VisibilityStats& GetStats() const { return m_stats; }
+
+private:
+    bool BuildDraws(const std::vector<RenderBatch>& batches){
+        m_draws.clear();
+        m_materialSlots.clear();
+
+        for(const RenderBatch& batch: batches){
+            if(batch.isTransparent) continue;
+
+            u32 materialSlot = static_cast<u32>(m_materialSlots.size());
+            m_materialSlots.push_back(batch.materialID);
+
+            for(const RenderCommand* command: batch.commands){
+                const ModelAsset* model = m_assetManager->GetModel(command->modelID);
+                if(!model) continue;
+
+                for(MeshID meshID: model->GetLODMeshes(command->lodLevel)){
+                    const GeometryAllocation* allocation = m_gpuResourceManager->GetPoolAllocation(meshID);
+                    if(!allocation) continue;
+
+                    for(u32 first = 0; first < allocation->indexCount; first += MAX_TRIANGLES_PER_DRAW * 3){
+                        VisibilityDraw draw;
+                        draw.command = command;
+                        draw.firstIndex = allocation->firstIndex + first;
+                        draw.indexCount = std::min(allocation->indexCount - first, MAX_TRIANGLES_PER_DRAW * 3);
+                        draw.baseVertex = allocation->baseVertex;
+                        draw.materialSlot = materialSlot;
+                        m_draws.push_back(draw);
+                    }
+                }
+            }
+        }
+
+        return m_draws.size() <= MAX_DRAWS && m_materialSlots.size() <= MAX_MATERIAL_SLOTS;
+    }
+
+    void UploadDraws(){
+        m_drawTransforms.clear();
+        m_drawInfos.clear();
+        for(const VisibilityDraw& draw: m_draws){
+            const glm::mat4& model = draw.command->worldMatrix;
+            const glm::mat4& normal = draw.command->normalMatrix;
+            m_drawTransforms.insert(m_drawTransforms.end(), {model[0], model[1], model[2], model[3], normal[0], normal[1], normal[2]});
+            m_drawInfos.emplace_back(draw.firstIndex, draw.baseVertex, draw.materialSlot, draw.command->receiveShadows ? 1u : 0u);
+        }
+        if(m_draws.empty()){
+            m_drawTransforms.emplace_back(0.0f);
+            m_drawInfos.emplace_back(0u);
+        }
+
+        m_drawTransformBuffer.Upload(GL_RGBA32F, m_drawTransforms.data(), m_drawTransforms.size() * sizeof(glm::vec4));
+        m_drawInfoBuffer.Upload(GL_RGBA32UI, m_drawInfos.data(), m_drawInfos.size() * sizeof(glm::uvec4));
+    }
+
+    void VisibilityPass(const FramePacket& packet){
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+
+        m_visibilityShader->use();
+        m_visibilityShader->setMat4("viewProjection", packet.camera.projection * packet.camera.view);
+        m_visibilityShader->setInt("drawTransforms", DRAW_TRANSFORM_UNIT);
+        m_drawTransformBuffer.Bind(DRAW_TRANSFORM_UNIT);
+
+        GLint drawIDLocation = glGetUniformLocation(m_visibilityShader->ID, "drawID");
+
+        // Every draw comes from the one pool VAO
+        glBindVertexArray(m_gpuResourceManager->GetGeometryPool().GetVAO());
+        for(u32 drawID = 0; drawID < m_draws.size(); drawID++){
+            const VisibilityDraw& draw = m_draws[drawID];
+            glUniform1ui(drawIDLocation, drawID);
+            glDrawElementsBaseVertex(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_INT,
+                                     (void*)(static_cast<size_t>(draw.firstIndex) * sizeof(u32)), draw.baseVertex);
+
+            m_stats.drawCalls++;
+            m_stats.trianglesRendered += draw.indexCount / 3;
+        }
+        glBindVertexArray(0);
+    }
+
+    void ClassifyPass(u32 visibilityTexture){
+        glDepthFunc(GL_ALWAYS);
+        glDisable(GL_CULL_FACE);
+
+        m_classifyShader->use();
+        BindVisibility(*m_classifyShader, visibilityTexture);
+        m_classifyShader->setFloat("materialSlotScale", 1.0f / MAX_MATERIAL_SLOTS);
+
+        glBindVertexArray(m_emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        m_stats.drawCalls++;
+    }
+
+    void ResolvePass(const FramePacket& packet, LightClusterBuffers& lightClusters, ShadowRenderer& shadows,
+                     PointShadowRenderer& pointShadows, u32 visibilityTexture, glm::ivec2 size){
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+
+        m_resolveShader->use();
+        BindVisibility(*m_resolveShader, visibilityTexture);
+        m_resolveShader->setFloat("materialSlotScale", 1.0f / MAX_MATERIAL_SLOTS);
+        m_resolveShader->setMat4("view", packet.camera.view);
+        m_resolveShader->setMat4("viewProjection", packet.camera.projection * packet.camera.view);
+        m_resolveShader->setVec2("screenSize", glm::vec2(size));
+        m_resolveShader->setVec3("viewPos", packet.camera.position);
+
+        m_resolveShader->setVec3("dirLight.direction", packet.dirLight.direction);
+        m_resolveShader->setVec3("dirLight.ambient", packet.dirLight.ambient);
+        m_resolveShader->setVec3("dirLight.diffuse", packet.dirLight.diffuse);
+        m_resolveShader->setVec3("dirLight.specular", packet.dirLight.specular);
+        lightClusters.Bind(packet, *m_resolveShader);
+        shadows.Bind(*m_resolveShader, packet);
+        pointShadows.Bind(*m_resolveShader);
+
+        m_resolveShader->setInt("material.texture_diffuse1", 0);
+        m_resolveShader->setInt("material.texture_specular1", 1);
+
+        GLint slotLocation = glGetUniformLocation(m_resolveShader->ID, "materialSlot");
+
+        glBindVertexArray(m_emptyVAO);
+        for(u32 slot = 0; slot < m_materialSlots.size(); slot++){
+            const Material* material = m_assetManager->GetMaterial(m_materialSlots[slot]);
+            if(!material) continue;
+
+            m_resolveShader->setVec3("material.diffuse", material->diffuse);
+            m_resolveShader->setBool("material.hasDiffuseMap", material->diffuseTexture != INVALID_TEXTURE);
+            m_resolveShader->setFloat("material.roughness", material->roughness);
+
+            // White when the material has no such texture
+            GPUTexture* diffuse = m_gpuResourceManager->GetGPUTexture(material->diffuseTexture);
+            if(!diffuse) diffuse = m_gpuResourceManager->GetFallbackTexture();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, diffuse->textureID);
+
+            GPUTexture* specular = m_gpuResourceManager->GetGPUTexture(material->specularTexture);
+            if(!specular) specular = m_gpuResourceManager->GetFallbackTexture();
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, specular->textureID);
+            glActiveTexture(GL_TEXTURE0);
+
+            glUniform1ui(slotLocation, slot);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+
+            m_stats.drawCalls++;
+            m_stats.materialsResolved++;
+        }
+        glBindVertexArray(0);
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_CULL_FACE);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void BindVisibility(Shader& shader, u32 visibilityTexture){
+        glActiveTexture(GL_TEXTURE0 + VISIBILITY_UNIT);
+        glBindTexture(GL_TEXTURE_2D, visibilityTexture);
+
+        GeometryPool& pool = m_gpuResourceManager->GetGeometryPool();
+        glActiveTexture(GL_TEXTURE0 + VERTEX_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, pool.GetVertexTexture());
+        glActiveTexture(GL_TEXTURE0 + INDEX_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, pool.GetIndexTexture());
+        m_drawTransformBuffer.Bind(DRAW_TRANSFORM_UNIT);
+        m_drawInfoBuffer.Bind(DRAW_INFO_UNIT);
+
+        shader.setInt("visibilityBuffer", VISIBILITY_UNIT);
+        shader.setInt("vertexData", VERTEX_UNIT);
+        shader.setInt("indexData", INDEX_UNIT);
+        shader.setInt("drawTransforms", DRAW_TRANSFORM_UNIT);
+        shader.setInt("drawInfos", DRAW_INFO_UNIT);
+    }
+};
@@ -8,25 +8,42 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
+
+#include "program_cache.h"
+#include "rendering/gl_extensions.h"
 
 constexpr char* shaderPath = "../assets/shaders/";
 
+// Names a compute stage file, keeps its constructor apart from (vertex, fragment)
+struct ComputeSource
+{
+    const char* path;
+};
+
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly, defines ("#define X\n"
+    // lines) are inserted after the #version line of every stage. Compiles
+    // are only submitted, errors are reported by IsReady or the first use,
+    // so constructing many shaders back to back lets the driver overlap them.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const std::string& defines = "")
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
+        std::string geometryCode;
         std::ifstream vShaderFile;
         std::ifstream fShaderFile;
+        std::ifstream gShaderFile;
         // ensure ifstream objects can throw exceptions:
         vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
         fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
         try 
         {
             // open files
@@ -47,39 +64,138 @@ public:
             // convert stream into string
             vertexCode   = vShaderStream.str();
             fragmentCode = fShaderStream.str();
+            // if geometry shader path is present, also load a geometry shader
+            if(geometryPath != nullptr)
+            {
+                std::string gsPath(shaderPath);
+                gsPath.append(geometryPath);
+                gShaderFile.open(gsPath.c_str());
+                std::stringstream gShaderStream;
+                gShaderStream << gShaderFile.rdbuf();
+                gShaderFile.close();
+                geometryCode = gShaderStream.str();
+            }
         }
         catch (std::ifstream::failure& e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
+        if(!defines.empty())
+        {
+            vertexCode = InsertDefines(vertexCode, defines);
+            fragmentCode = InsertDefines(fragmentCode, defines);
+            if(geometryPath != nullptr)
+                geometryCode = InsertDefines(geometryCode, defines);
+        }
+        // 2. link from the program binary cache when this exact source was built before
+        const std::string sources[3] = {vertexCode, fragmentCode, geometryCode};
+        m_cacheKey = ProgramBinaryCache::Key(sources, 3);
+        ProgramCacheStats& cacheStats = ProgramBinaryCache::GetStats();
+        auto start = std::chrono::steady_clock::now();
+        ID = glCreateProgram();
+        if(ProgramBinaryCache::Load(ID, m_cacheKey))
+        {
+            cacheStats.loadMs = cacheStats.loadMs + ElapsedMs(start);
+            return;
+        }
+        // 3. submit compiles and the link, nothing here waits for the driver
+        HasParallelCompile();
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
         // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
+        m_stages[0] = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(m_stages[0], 1, &vShaderCode, NULL);
+        glCompileShader(m_stages[0]);
         // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        m_stages[1] = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(m_stages[1], 1, &fShaderCode, NULL);
+        glCompileShader(m_stages[1]);
+        // if geometry shader is given, compile geometry shader
+        if(geometryPath != nullptr)
+        {
+            const char * gShaderCode = geometryCode.c_str();
+            m_stages[2] = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(m_stages[2], 1, &gShaderCode, NULL);
+            glCompileShader(m_stages[2]);
+        }
         // shader Program
+        for(unsigned int stage : m_stages)
+            if(stage != 0)
+                glAttachShader(ID, stage);
+        ProgramBinaryCache::PrepareForStore(ID);
+        glLinkProgram(ID);
+        m_pending = true;
+        m_submitMs = ElapsedMs(start);
+    }
+    // compute program, needs GL 4.3. Cached and submitted like the above.
+    // ------------------------------------------------------------------------
+    explicit Shader(ComputeSource compute, const std::string& defines = "")
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            std::string csPath(shaderPath);
+            csPath.append(compute.path);
+            cShaderFile.open(csPath.c_str());
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+        }
+        if(!defines.empty())
+            computeCode = InsertDefines(computeCode, defines);
+
+        const std::string sources[1] = {computeCode};
+        m_cacheKey = ProgramBinaryCache::Key(sources, 1);
+        ProgramCacheStats& cacheStats = ProgramBinaryCache::GetStats();
+        auto start = std::chrono::steady_clock::now();
         ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
+        if(ProgramBinaryCache::Load(ID, m_cacheKey))
+        {
+            cacheStats.loadMs = cacheStats.loadMs + ElapsedMs(start);
+            return;
+        }
+        HasParallelCompile();
+        const char* cShaderCode = computeCode.c_str();
+        m_stages[3] = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(m_stages[3], 1, &cShaderCode, NULL);
+        glCompileShader(m_stages[3]);
+        glAttachShader(ID, m_stages[3]);
+        ProgramBinaryCache::PrepareForStore(ID);
         glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        m_pending = true;
+        m_submitMs = ElapsedMs(start);
+    }
+    // true once the program can be used without stalling. Never blocks with
+    // parallel shader compile, without it the status query waits for the
+    // driver like a synchronous compile.
+    // ------------------------------------------------------------------------
+    bool IsReady()
+    {
+        if(!m_pending)
+            return true;
+        if(HasParallelCompile())
+        {
+            int complete = 0;
+            glGetProgramiv(ID, ParallelShaderCompileAPI::COMPLETION_STATUS, &complete);
+            if(!complete)
+                return false;
+        }
+        Finish();
+        return true;
     }
-    // activate the shader
+    // activate the shader, waits for the link if it is still running
     // ------------------------------------------------------------------------
     void use() 
     { 
+        if(m_pending)
+            Finish();
         glUseProgram(ID); 
     }
     // utility uniform functions
@@ -93,6 +209,10 @@ public:
     { 
         glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
     }
+    void setUInt(const std::string &name, unsigned int value) const
+    {
+        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+    }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
@@ -141,9 +261,64 @@ public:
     }
 
 private:
+    u64 m_cacheKey = 0;
+    unsigned int m_stages[4] = {0, 0, 0, 0};  // vertex, fragment, geometry, compute until linked
+    bool m_pending = false;
+    float m_submitMs = 0.0f;
+
+    // Checks the finished compile and link, stores the binary and drops the stages
+    void Finish()
+    {
+        auto start = std::chrono::steady_clock::now();
+        const char* stageNames[4] = {"VERTEX", "FRAGMENT", "GEOMETRY", "COMPUTE"};
+        for(int i = 0; i < 4; i++)
+            if(m_stages[i] != 0)
+                checkCompileErrors(m_stages[i], stageNames[i]);
+        if(checkCompileErrors(ID, "PROGRAM"))
+            ProgramBinaryCache::Store(ID, m_cacheKey);
+        // delete the shaders as they're linked into our program now and no longer necessary
+        for(unsigned int& stage : m_stages)
+        {
+            if(stage != 0)
+                glDeleteShader(stage);
+            stage = 0;
+        }
+        m_pending = false;
+
+        ProgramCacheStats& cacheStats = ProgramBinaryCache::GetStats();
+        cacheStats.programsCompiled++;
+        cacheStats.compileMs = cacheStats.compileMs + m_submitMs + ElapsedMs(start);
+    }
+    // asks the driver for as many compiler threads as it likes, once per process
+    static bool HasParallelCompile()
+    {
+        static std::once_flag once;
+        static bool available = false;
+        std::call_once(once, []()
+        {
+            ParallelShaderCompileAPI api;
+            available = api.Load();
+            if(available)
+                api.MaxShaderCompilerThreads(0xFFFFFFFF);
+        });
+        return available;
+    }
+    // defines must follow #version, which has to be the first line
+    // ------------------------------------------------------------------------
+    static std::string InsertDefines(const std::string& code, const std::string& defines)
+    {
+        size_t versionEnd = code.find('\n');
+        if(code.compare(0, 8, "#version") != 0 || versionEnd == std::string::npos)
+            return defines + code;
+        return code.substr(0, versionEnd + 1) + defines + code.substr(versionEnd + 1);
+    }
+    static float ElapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(unsigned int shader, std::string type)
+    bool checkCompileErrors(unsigned int shader, std::string type)
     {
         int success;
         char infoLog[1024];
@@ -165,6 +340,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success != 0;
     }
 };
 #endif
\ No newline at end of file